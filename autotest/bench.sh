@@ -0,0 +1,136 @@
+#!/bin/bash
+
+# Performance benchmark of the Remhos solvers, based on the -perf timers.
+# execute with
+# ./bench.sh                -- cpu, with 1, 2 and 4 tasks
+# ./bench.sh "1 4 16"       -- cpu, with the given task counts
+# ./bench.sh "1 4 16" cuda  -- cuda
+#
+# Every run writes its JSON report to autotest/bench/. The table of all runs
+# and phases goes to autotest/bench/results.csv, with the throughput of each
+# phase in dofs/s (global dofs * steps / average phase time). Strong scaling
+# runs each case with all task counts, weak scaling refines the mesh in
+# parallel, so that the dofs per task stay the same.
+
+tasks=${1:-"1 2 4"}
+
+outdir="autotest/bench"
+csv=$outdir"/results.csv"
+table=$outdir"/scaling.txt"
+
+if [ "$2" = "cuda" ]; then
+  launcher="lrun -n"
+  device="-d cuda"
+else
+  launcher="mpirun -np"
+  device=""
+fi
+options="-no-vis -perf "$device
+
+methods=( "-ho 1 -lo 2 -fct 2"
+          "-ho 3 -lo 4 -fct 2"
+          "-ho 3 -lo 1 -fct 1"
+          "-ho 3 -lo 1 -fct 3"
+          "-mono 1" )
+
+# Cases: name, dimension, mesh and problem options. The number of time steps
+# is fixed by -dt and -tf.
+cases=( "transport-2D:2:-m ./data/periodic-square.mesh -p 5 -dt 0.001 -tf 0.02"
+        "remap-2D:2:-m ./data/inline-quad.mesh -p 14 -dt 0.001 -tf 0.02"
+        "transport-3D:3:-m ./data/periodic-cube.mesh -p 0 -dt 0.002 -tf 0.02"
+        "remap-3D:3:-m ./data/cube01_hex.mesh -p 10 -dt 0.002 -tf 0.02" )
+orders=( 1 2 3 )
+
+cd ..
+mkdir -p $outdir
+rm -f $outdir/*.json $csv $table
+echo "case,method,order,rs,rp,tasks,global_dofs,steps,phase,calls,"\
+"time_avg,time_max,dofs_per_s" > $csv
+
+# Value of a top-level entry of a JSON report.
+json_value() {
+  grep '"'$2'"' $1 | head -n 1 | sed -e 's/.*: *//' -e 's/,$//'
+}
+
+# Appends the phases of a JSON report to the csv table.
+add_results() {
+  local json=$1 prefix=$2
+  local dofs=$(json_value $json global_dofs)
+  local steps=$(json_value $json steps)
+  grep '"calls"' $json | sed -e 's/[{}":,]/ /g' |
+  awk -v p="$prefix" -v n="$dofs" -v s="$steps" \
+      '{ r = ($7 > 0) ? n * s / $7 : 0;
+         printf "%s,%s,%s,%s,%s,%s,%s,%.6e\n",
+                p, n, s, $1, $3, $7, $9, r }' >> $csv
+}
+
+# Runs one case and records its report.
+run_case() {
+  local name=$1 run_opts=$2 method=$3 order=$4 rs=$5 rp=$6 np=$7
+  local tag=$(echo $name"_"$method"_o"$order"_rs"$rs"_rp"$rp"_np"$np |
+              tr -d ' -' )
+  local json=$outdir"/"$tag".json"
+  local run_line=$launcher" "$np" ./remhos "$options" "$run_opts" -o "$order\
+" -rs "$rs" -rp "$rp" "$method" -pj "$json
+  echo $run_line
+  $run_line > $outdir"/"$tag".log" 2>&1
+  if [ -f $json ]; then
+    add_results $json "$name,\"$method\",$order,$rs,$rp,$np"
+  else
+    echo "  failed, see "$outdir"/"$tag".log"
+  fi
+}
+
+# Time per dof and step of a report, or - if the run failed.
+time_per_dof() {
+  local json=$outdir"/"$1".json"
+  if [ -f $json ]; then json_value $json time_per_dof_step; else echo "-"; fi
+}
+
+for case in "${cases[@]}"; do
+  name=$(echo $case | cut -d ':' -f 1)
+  dim=$(echo $case | cut -d ':' -f 2)
+  run_opts=$(echo $case | cut -d ':' -f 3)
+  if [ $dim = 2 ]; then base_rs=3; else base_rs=1; fi
+
+  for method in "${methods[@]}"; do
+    for order in "${orders[@]}"; do
+
+      # The subcell schemes (-lo 4, -mono 2) need order 2 or higher.
+      if [ $order = 1 ] && [[ " $method " =~ " -lo 4 "|" -mono 2 " ]]; then
+        continue
+      fi
+
+      # Strong scaling: the same mesh on all task counts.
+      echo -e "\n"$name" "$method" -o "$order" strong scaling" >> $table
+      printf "%8s %16s\n" "tasks" "time/dof/step" >> $table
+      for np in $tasks; do
+        run_case $name "$run_opts" "$method" $order $base_rs 0 $np
+        tag=$(echo $name"_"$method"_o"$order"_rs"$base_rs"_rp0_np"$np |
+              tr -d ' -' )
+        printf "%8s %16s\n" $np $(time_per_dof $tag) >> $table
+      done
+
+      # Weak scaling: one parallel refinement per 2^dim times more tasks.
+      echo -e "\n"$name" "$method" -o "$order" weak scaling" >> $table
+      printf "%8s %4s %16s\n" "tasks" "rp" "time/dof/step" >> $table
+      for np in $tasks; do
+        rp=0; n=1
+        while [ $n -lt $np ]; do n=$((n * (1 << dim))); rp=$((rp + 1)); done
+        if [ $n -ne $np ]; then continue; fi
+        if [ $rp -eq 0 ]; then
+          tag=$(echo $name"_"$method"_o"$order"_rs"$base_rs"_rp0_np"$np |
+                tr -d ' -' )
+        else
+          run_case $name "$run_opts" "$method" $order $base_rs $rp $np
+          tag=$(echo $name"_"$method"_o"$order"_rs"$base_rs"_rp"$rp"_np"$np |
+                tr -d ' -' )
+        fi
+        printf "%8s %4s %16s\n" $np $rp $(time_per_dof $tag) >> $table
+      done
+
+    done
+  done
+done
+
+echo -e "\nResults: "$csv", scaling tables: "$table
@@ -78,6 +78,89 @@ run_line=$command" -m ./data/inline-quad.mesh -p 6 -rs 2 -o 1 -dt 0.01 -tf 20 -m
 echo -e $run_line >> $file
 $run_line | grep -e 'mass u' -e 'value u'>> $file
 
+# Runs of the checkpoint, multi-field, load balancing, adaptivity and low
+# storage modes. Their values are checked against a reference run, or against
+# mass conservation, so each check writes one line to the file.
+
+# Final mass and max value of u of a run.
+final_values() {
+  $1 | grep -e 'Final mass u' -e 'Max value u' | awk '{ print $NF }'
+}
+
+# Writes "<msg>: yes" if the values of two runs agree to 1e-9, relative, as
+# the sums of the masses depend on the partitioning.
+check_same() {
+  local ok=$(paste <(echo "$2") <(echo "$3") |
+             awk '{ n++; d = $1 - $2; if (d < 0) d = -d;
+                    s = ($1 < 0) ? -$1 : $1;
+                    if (NF != 2 || d > 1e-9 * s + 1e-14) bad = 1 }
+                  END { print (n == 2 && bad == 0) ? "yes" : "no" }')
+  echo $1": "$ok >> $file
+}
+
+# Writes "<msg>: yes" if the mass loss of u of the run is below 1e-9.
+check_mass() {
+  local ok=$($2 | grep -e 'Mass loss u' |
+             awk '{ ok = ($NF < 1e-9) ? "yes" : "no" }
+                  END { print (NR == 1) ? ok : "no" }')
+  echo $1": "$ok >> $file
+}
+
+# The step is a power of 2, so that the times of the split runs are exact.
+base=" -m ./data/periodic-square.mesh -p 5 -rs 3 -dt 0.00390625 -ho 3 -lo 1 -fct 1"
+chk="autotest/test.chk"
+full=$(final_values "$command$base -tf 0.5")
+
+echo -e '\n'"--- Checkpoint restart 2D" >> $file
+run_line=$command$base" -tf 0.25 -chk 1000 -chkf "$chk
+echo -e $run_line >> $file
+$run_line > /dev/null
+run_line=$command$base" -tf 0.5 -rst -chkf "$chk
+echo -e $run_line >> $file
+check_same "restart matches the full run" "$full" "$(final_values "$run_line")"
+
+echo -e '\n'"--- Element checkpoint restart 2D" >> $file
+run_line=$command$base" -tf 0.25 -chk 1000 -chkf "$chk" -lb 1000"
+echo -e $run_line >> $file
+$run_line > /dev/null
+run_line=$command$base" -tf 0.5 -rst -chkf "$chk" -lb 1000"
+echo -e $run_line >> $file
+check_same "restart matches the full run" "$full" "$(final_values "$run_line")"
+rm -f $chk
+
+echo -e '\n'"--- Multiple fields 2D" >> $file
+run_line=$command$base" -tf 0.5 -nf 3"
+echo -e $run_line >> $file
+check_same "field 0 matches the single field" "$full" \
+           "$(final_values "$run_line")"
+
+echo -e '\n'"--- Load balancing 2D" >> $file
+# -lbt below 1 rebalances at every check.
+run_line=$command$base" -tf 0.5 -lb 16 -lbt 0.5"
+echo -e $run_line >> $file
+check_same "balanced run matches the full run" "$full" \
+           "$(final_values "$run_line")"
+
+echo -e '\n'"--- Low storage RK 2D" >> $file
+for ode in 7 8; do
+  run_line=$command$base" -tf 0.5 -s "$ode
+  echo -e $run_line >> $file
+  check_mass "conserves mass" "$run_line"
+done
+
+echo -e '\n'"--- Polynomial remap matrices 2D" >> $file
+run_line=$command" -m ./data/inline-quad.mesh -p 14 -rs 1 -dt 0.0015 -tf 0.75 -ho 3 -lo 1 -fct 1 -rpm"
+echo -e $run_line >> $file
+check_mass "conserves mass" "$run_line"
+
+echo -e '\n'"--- Adaptive mesh 2D" >> $file
+run_line=$command" -m ./data/periodic-square.mesh -p 5 -rs 3 -o 2 -dt 0.001 -tf 0.8 -ho 3 -lo 2 -fct 2 -amr 3 -amrs 20 -amrr 0.1 -amrd 0.01"
+echo -e $run_line >> $file
+check_mass "conserves mass" "$run_line"
+run_line=$run_line" -lb 50"
+echo -e $run_line >> $file
+check_mass "conserves mass" "$run_line"
+
 cd autotest
 
 exit 0
@@ -0,0 +1,150 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+// Example of an application that remaps with the Remhos library, see
+// remhos_remapper.hpp. The nodes of the mesh are moved back and forth by a
+// smooth displacement that keeps the boundary fixed, and a field is remapped
+// in every cycle. The mass and the bounds of the field are checked.
+//
+// Sample run: mpirun -np 4 remap_example -m data/inline-quad.mesh -rs 2 -c 4
+
+#include "mfem.hpp"
+#include <iostream>
+#include "remhos_remapper.hpp"
+
+using namespace std;
+using namespace mfem;
+
+// Displacement of the nodes in the unit square.
+void displacement(const Vector &x, Vector &d)
+{
+   d = 0.1 * sin(M_PI * x(0)) * sin(M_PI * x(1));
+}
+
+// Indicator of a disc in the unit square.
+double u0_function(const Vector &x)
+{
+   const double dx = x(0) - 0.5, dy = x(1) - 0.5;
+   return (dx*dx + dy*dy < 0.09) ? 1.0 : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+   MPI_Session mpi(argc, argv);
+   const int myid = mpi.WorldRank();
+
+   const char *mesh_file = "data/inline-quad.mesh";
+   int rs_levels = 2;
+   int cycles = 4;
+   bool visualization = true;
+   RemhosRemapOptions opt;
+
+   OptionsParser args(argc, argv);
+   args.AddOption(&mesh_file, "-m", "--mesh",
+                  "Mesh file to use, within the unit square.");
+   args.AddOption(&rs_levels, "-rs", "--refine-serial",
+                  "Number of times to refine the mesh uniformly in serial.");
+   args.AddOption(&cycles, "-c", "--cycles",
+                  "Number of remap calls.");
+   args.AddOption(&opt.order, "-o", "--order",
+                  "Order (degree) of the finite element solution.");
+   args.AddOption(&opt.ho_type, "-ho", "--ho-type",
+                  "High-Order Solver, see remhos -h.");
+   args.AddOption(&opt.lo_type, "-lo", "--lo-type",
+                  "Low-Order Solver, see remhos -h.");
+   args.AddOption(&opt.fct_type, "-fct", "--fct-type",
+                  "Correction type, see remhos -h.");
+   args.AddOption(&opt.mono_type, "-mono", "--mono-type",
+                  "Monolithic solver, see remhos -h.");
+   args.AddOption(&opt.dt, "-dt", "--time-step",
+                  "Pseudo-time step of the remap.");
+   args.AddOption(&visualization, "-vis", "--visualization", "-no-vis",
+                  "--no-visualization",
+                  "Enable or disable GLVis visualization.");
+   args.Parse();
+   if (!args.Good())
+   {
+      if (myid == 0) { args.PrintUsage(cout); }
+      return 1;
+   }
+   if (myid == 0) { args.PrintOptions(cout); }
+
+   Mesh *mesh = new Mesh(mesh_file, 1, 1);
+   const int dim = mesh->Dimension();
+   MFEM_VERIFY(dim == 2, "The example is two-dimensional.");
+   for (int lev = 0; lev < rs_levels; lev++) { mesh->UniformRefinement(); }
+   ParMesh pmesh(MPI_COMM_WORLD, *mesh);
+   delete mesh;
+   pmesh.SetCurvature(1);
+
+   RemhosRemapper remapper(pmesh, opt);
+
+   // The node positions of the two ends of the motion.
+   const GridFunction &nodes = *pmesh.GetNodes();
+   Vector x_a(nodes), x_b(nodes.Size());
+   GridFunction disp(nodes.FESpace());
+   VectorFunctionCoefficient d_coef(dim, displacement);
+   disp.ProjectCoefficient(d_coef);
+   add(x_a, disp, x_b);
+
+   ParGridFunction u(&remapper.GetFESpace());
+   FunctionCoefficient u0(u0_function);
+   u.ProjectCoefficient(u0);
+   Array<ParGridFunction *> fields(1);
+   fields[0] = &u;
+
+   ConstantCoefficient one(1.0);
+   ParLinearForm mass_lf(&remapper.GetFESpace());
+   mass_lf.AddDomainIntegrator(new DomainLFIntegrator(one));
+   mass_lf.Assemble();
+   const double mass0 = mass_lf(u);
+   double umin, umax;
+
+   for (int c = 0; c < cycles; c++)
+   {
+      if (c % 2 == 0) { remapper.Remap(x_a, x_b, fields); }
+      else            { remapper.Remap(x_b, x_a, fields); }
+
+      mass_lf.Assemble();
+      const double mass = mass_lf(u);
+      GetMinMax(u, umin, umax);
+      if (myid == 0)
+      {
+         cout << "cycle: " << c + 1 << ", mass loss: " << fabs(mass - mass0)
+              << ", min: " << umin << ", max: " << umax << endl;
+      }
+   }
+
+   if (visualization)
+   {
+      socketstream sout;
+      char vishost[] = "localhost";
+      const int visport = 19916;
+      VisualizeField(sout, vishost, visport, u, "Remapped u", 0, 0, 400, 400);
+   }
+
+   // Checks of the conservative and bound-preserving remap.
+   const bool forced_bounds = opt.lo_type != 0 || opt.mono_type != 0;
+   const double mass = mass_lf(u);
+   int status = 0;
+   if (fabs(mass - mass0) > 1e-10 * fabs(mass0)) { status = 1; }
+   if (forced_bounds && (umin < -1e-12 || umax > 1.0 + 1e-12)) { status = 1; }
+   if (myid == 0)
+   {
+      cout << (status ? "Remap check failed." : "Remap check passed.") << endl;
+   }
+   return status;
+}
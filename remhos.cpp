@@ -32,12 +32,20 @@
 #include "mfem.hpp"
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include "remhos_ho.hpp"
 #include "remhos_lo.hpp"
 #include "remhos_fct.hpp"
 #include "remhos_mono.hpp"
 #include "remhos_tools.hpp"
 #include "remhos_sync.hpp"
+#include "remhos_perf.hpp"
+#include "remhos_remap.hpp"
+#include "remhos_ode.hpp"
+#include "remhos_io.hpp"
+#include "remhos_balance.hpp"
+#include "remhos_steady.hpp"
+#include "remhos_advection.hpp"
 
 using namespace std;
 using namespace mfem;
@@ -68,53 +76,74 @@ double inflow_function(const Vector &x);
 // Mesh bounding box
 Vector bb_min, bb_max;
 
-class AdvectionOperator : public TimeDependentOperator
+// Curves the mesh with nodes of the given order, and returns the collection of
+// the nodes, which are discontinuous on a periodic mesh.
+static FiniteElementCollection *CurveMesh(ParMesh &pmesh, int mesh_order)
 {
-private:
-   BilinearForm &Mbf, &ml;
-   ParBilinearForm &Kbf;
-   ParBilinearForm &M_HO, &K_HO;
-   Vector &lumpedM;
-
-   Vector start_mesh_pos, start_submesh_pos;
-   GridFunction &mesh_pos, *submesh_pos, &mesh_vel, &submesh_vel;
-
-   mutable ParGridFunction x_gf;
-
-   double dt;
-   Assembly &asmbl;
-
-   LowOrderMethod &lom;
-   DofInfo &dofs;
-
-   HOSolver *ho_solver;
-   LOSolver *lo_solver;
-   FCTSolver *fct_solver;
-   MonolithicSolver *mono_solver;
-
-public:
-   AdvectionOperator(int size, BilinearForm &Mbf_, BilinearForm &_ml,
-                     Vector &_lumpedM,
-                     ParBilinearForm &Kbf_,
-                     ParBilinearForm &M_HO_, ParBilinearForm &K_HO_,
-                     GridFunction &pos, GridFunction *sub_pos,
-                     GridFunction &vel, GridFunction &sub_vel,
-                     Assembly &_asmbl, LowOrderMethod &_lom, DofInfo &_dofs,
-                     HOSolver *hos, LOSolver *los, FCTSolver *fct,
-                     MonolithicSolver *mos);
-
-   virtual void Mult(const Vector &x, Vector &y) const;
-
-   virtual void SetDt(double _dt) { dt = _dt; }
-   void SetRemapStartPos(const Vector &m_pos, const Vector &sm_pos)
+   // Check if the input mesh is periodic.
+   const int dim = pmesh.Dimension();
+   const bool periodic = pmesh.GetNodes() != NULL &&
+                         dynamic_cast<const L2_FECollection *>
+                         (pmesh.GetNodes()->FESpace()->FEColl()) != NULL;
+   pmesh.SetCurvature(mesh_order, periodic);
+
+   if (periodic)
    {
-      start_mesh_pos    = m_pos;
-      start_submesh_pos = sm_pos;
+      return new L2_FECollection(mesh_order, dim, BasisType::GaussLobatto);
    }
+   return new H1_FECollection(mesh_order, dim, BasisType::GaussLobatto);
+}
 
-   virtual ~AdvectionOperator() { }
+// Current and initial mesh positions, and the mesh velocity. They're updated
+// together with the mesh when it's rebalanced or adapted.
+struct MeshMotion
+{
+   FiniteElementCollection *fec;
+   ParFiniteElementSpace pfes;
+   ParGridFunction x;
+   GridFunction x0, v;
+
+   MeshMotion(ParMesh &pmesh, int mesh_order, double dt, double t_final);
+   ~MeshMotion() { delete fec; }
 };
 
+MeshMotion::MeshMotion(ParMesh &pmesh, int mesh_order, double dt,
+                       double t_final)
+   : fec(CurveMesh(pmesh, mesh_order)),
+     pfes(&pmesh, fec, pmesh.Dimension()), x(&pfes), x0(&pfes), v(&pfes)
+{
+   pmesh.SetNodalGridFunction(&x);
+   x0 = x;
+   v = 0.0;
+
+   // If remap is on, obtain the mesh velocity by moving the mesh to the final
+   // mesh positions, and taking the displacement vector.
+   // The mesh motion resembles a time-dependent deformation, e.g., similar to
+   // a deformation that is obtained by a Lagrangian simulation.
+   if (exec_mode == 1)
+   {
+      ParGridFunction v_nodes(&pfes);
+      VectorFunctionCoefficient vcoeff(pmesh.Dimension(), velocity_function);
+      v_nodes.ProjectCoefficient(vcoeff);
+
+      double t = 0.0;
+      while (t < t_final)
+      {
+         t += dt;
+         // Move the mesh nodes.
+         x.Add(std::min(dt, t_final-t), v_nodes);
+         // Update the node velocities.
+         v_nodes.ProjectCoefficient(vcoeff);
+      }
+
+      // Pseudotime velocity.
+      add(x, -1.0, x0, v);
+
+      // Return the mesh to the initial configuration.
+      x = x0;
+   }
+}
+
 int main(int argc, char *argv[])
 {
    // Initialize MPI.
@@ -135,12 +164,33 @@ int main(int argc, char *argv[])
    int smth_ind_type = 0;
    double t_final = 4.0;
    double dt = 0.005;
+   double cfl = 0.0;
+   int max_step_retries = 5;
    bool visualization = true;
    bool visit = false;
    bool verify_bounds = false;
    bool product_sync = false;
+   int num_fields = 1;
+   int field_layout = 0;
    int vis_steps = 100;
    const char *device_config = "cpu";
+   bool perf = false;
+   const char *perf_json = "";
+   bool remap_poly = false;
+   bool par_output = false;
+   int chk_steps = 0;
+   const char *chk_file = "remhos.chk";
+   bool restart = false;
+   bool async_output = false;
+   const char *async_fields = "u";
+   bool async_single = false;
+   int lb_steps = 0;
+   double lb_tol = 1.2;
+   int amr_cycles = 0, amr_steps = 0;
+   double amr_ref_tol = 0.1, amr_deref_tol = 0.01;
+   bool local_dt = false;
+   int anderson_depth = 0;
+   int res_steps = 1;
 
    int precision = 8;
    cout.precision(precision);
@@ -160,7 +210,9 @@ int main(int argc, char *argv[])
                   "Order (degree) of the mesh.");
    args.AddOption(&ode_solver_type, "-s", "--ode-solver",
                   "ODE solver: 1 - Forward Euler,\n\t"
-                  "            2 - RK2 SSP, 3 - RK3 SSP, 4 - RK4, 6 - RK6.");
+                  "            2 - RK2 SSP, 3 - RK3 SSP, 4 - RK4, 6 - RK6,\n\t"
+                  "            7 - low-storage SSP-RK(10,4),\n\t"
+                  "            8 - low-storage SSP-RK(5,2).");
    args.AddOption((int*)(&ho_type), "-ho", "--ho-type",
                   "High-Order Solver: 0 - No HO solver,\n\t"
                   "                   1 - Neumann iteration,\n\t"
@@ -194,6 +246,21 @@ int main(int argc, char *argv[])
                   "Final time; start time is 0.");
    args.AddOption(&dt, "-dt", "--time-step",
                   "Time step.");
+   args.AddOption(&cfl, "-cfl", "--cfl-number",
+                  "CFL factor of the adaptive time step, 0 - fixed -dt.");
+   args.AddOption(&max_step_retries, "-sr", "--step-retries",
+                  "With -cfl and -vb, number of times a step that violates\n\t"
+                  "the bounds is retried with half the time step.");
+   args.AddOption(&local_dt, "-lts", "--local-time-steps", "-no-lts",
+                  "--no-local-time-steps",
+                  "Steady problems: every element advances with its own\n\t"
+                  "time step, given by -cfl.");
+   args.AddOption(&anderson_depth, "-aa", "--anderson",
+                  "Steady problems: number of previous steps in the\n\t"
+                  "Anderson acceleration, 0 - none.");
+   args.AddOption(&res_steps, "-rck", "--residual-steps",
+                  "Steady problems: check the residual every n-th step,\n\t"
+                  "1 with -aa.");
    args.AddOption(&visualization, "-vis", "--visualization", "-no-vis",
                   "--no-visualization",
                   "Enable or disable GLVis visualization.");
@@ -206,8 +273,59 @@ int main(int argc, char *argv[])
    args.AddOption(&product_sync, "-ps", "--product-sync", "-no-ps",
                   "--no-product-sync",
                   "Enable remap of synchronized product fields.");
+   args.AddOption(&num_fields, "-nf", "--num-fields",
+                  "Number of independent fields that are solved together.\n\t"
+                  "Field f starts from the initial condition times 1/(f+1).");
+   args.AddOption(&field_layout, "-fl", "--field-layout",
+                  "Storage of the fields: 0 - SoA (one field after the other),"
+                  "\n\t"
+                  "                      1 - AoS (the fields of each dof\n\t"
+                  "                          next to each other).");
    args.AddOption(&vis_steps, "-vs", "--visualization-steps",
                   "Visualize every n-th timestep.");
+   args.AddOption(&perf, "-perf", "--performance", "-no-perf",
+                  "--no-performance",
+                  "Time the phases of the time steps and print a report.");
+   args.AddOption(&perf_json, "-pj", "--perf-json",
+                  "File for the performance report in JSON format.");
+   args.AddOption(&remap_poly, "-rpm", "--remap-poly-matrices", "-no-rpm",
+                  "--no-remap-poly-matrices",
+                  "Precompute the remap matrices as polynomials in time.");
+   args.AddOption(&par_output, "-pbo", "--par-binary-output", "-no-pbo",
+                  "--no-par-binary-output",
+                  "Write the initial and final meshes per task and the\n\t"
+                  "solutions as binary files, without gathering them.");
+   args.AddOption(&chk_steps, "-chk", "--checkpoint-steps",
+                  "Write a checkpoint every n-th timestep, 0 - never.");
+   args.AddOption(&chk_file, "-chkf", "--checkpoint-file",
+                  "File name of the checkpoint.");
+   args.AddOption(&restart, "-rst", "--restart", "-no-rst", "--no-restart",
+                  "Resume the run from the checkpoint file.");
+   args.AddOption(&async_output, "-aso", "--async-output", "-no-aso",
+                  "--no-async-output",
+                  "Write snapshots every -vs steps from a background thread.");
+   args.AddOption(&async_fields, "-asf", "--async-fields",
+                  "Comma-separated fields of the snapshots: u, s, us.");
+   args.AddOption(&async_single, "-ass", "--async-single", "-no-ass",
+                  "--no-async-single",
+                  "Write the snapshots in single precision.");
+   args.AddOption(&lb_steps, "-lb", "--balance-steps",
+                  "Check the load balance every n-th timestep, 0 - never.\n\t"
+                  "An unbalanced mesh is repartitioned by the element\n\t"
+                  "costs, and the run continues on the new partitioning.");
+   args.AddOption(&lb_tol, "-lbt", "--balance-tolerance",
+                  "Ratio of the maximum and the average cost of the tasks\n\t"
+                  "above which the mesh is repartitioned.");
+   args.AddOption(&amr_cycles, "-amr", "--amr-cycles",
+                  "Cycles of refinement and derefinement of the initial\n\t"
+                  "nonconforming mesh to the face jumps of u0, 0 - none.");
+   args.AddOption(&amr_ref_tol, "-amrr", "--amr-refine",
+                  "Face jump above which an element is refined.");
+   args.AddOption(&amr_deref_tol, "-amrd", "--amr-derefine",
+                  "Face jump below which refined elements are derefined.");
+   args.AddOption(&amr_steps, "-amrs", "--amr-steps",
+                  "Adapt the mesh to the face jumps of u every n-th\n\t"
+                  "timestep, 0 - never.");
    args.Parse();
    if (!args.Good())
    {
@@ -215,6 +333,25 @@ int main(int argc, char *argv[])
       return 1;
    }
    if (myid == 0) { args.PrintOptions(cout); }
+   MFEM_VERIFY(num_fields >= 1, "The number of fields must be positive.");
+   MFEM_VERIFY(product_sync == false || num_fields == 1,
+               "Product remap works with a single field u.");
+   MFEM_VERIFY(field_layout == 0 || field_layout == 1,
+               "Unknown field layout " << field_layout);
+   const FieldLayout layout = (field_layout == 0) ? FieldLayout::SoA
+                              : FieldLayout::AoS;
+   if (product_sync) { num_fields = 2; }
+   const bool steady = (problem_num == 6 || problem_num == 7 ||
+                        problem_num == 8);
+   MFEM_VERIFY(steady || (local_dt == false && anderson_depth == 0),
+               "Local time steps and acceleration need a steady problem.");
+   MFEM_VERIFY(local_dt == false || cfl > 0.0,
+               "Local time steps are set by -cfl.");
+   MFEM_VERIFY(anderson_depth == 0 || num_fields == 1,
+               "Anderson acceleration works with a single field.");
+   MFEM_VERIFY(res_steps >= 1, "The residual steps must be positive.");
+   MFEM_VERIFY(anderson_depth == 0 || res_steps == 1,
+               "Anderson acceleration checks the residual every step.");
 
    // Enable hardware devices such as GPUs, and programming models such as
    // CUDA, OCCA, RAJA and OpenMP based on command line options.
@@ -230,14 +367,62 @@ int main(int argc, char *argv[])
    // Refine the mesh in serial to increase the resolution.
    Mesh *mesh = new Mesh(mesh_file, 1, 1);
    const int dim = mesh->Dimension();
+   // The refinements of an adapted mesh are recorded, so that they can be
+   // derefined where the solution is smooth.
+   const bool adapt = amr_cycles > 0 || amr_steps > 0;
+   if (adapt) { mesh->EnsureNCMesh(); }
    for (int lev = 0; lev < rs_levels; lev++) { mesh->UniformRefinement(); }
    mesh->GetBoundingBox(bb_min, bb_max, max(order, 1));
 
-   // Parallel partitioning of the mesh.
+   // Parallel partitioning of the mesh. A conforming mesh is load balanced by
+   // building the parallel mesh again from the serial one, so the serial mesh
+   // and the partitioning are kept, as the local elements are identified by
+   // their serial indices. Its parallel refinements are done in serial then,
+   // and a restart uses the partitioning of the checkpoint. A nonconforming
+   // mesh is rebalanced in parallel.
    // Refine the mesh further in parallel to increase the resolution.
-   ParMesh pmesh(MPI_COMM_WORLD, *mesh);
-   delete mesh;
-   for (int lev = 0; lev < rp_levels; lev++) { pmesh.UniformRefinement(); }
+   const bool serial_lb = lb_steps > 0 && mesh->Nonconforming() == false;
+   MFEM_VERIFY(lb_steps == 0 || serial_lb ||
+               (chk_steps == 0 && restart == false),
+               "Checkpoints are not supported when a nonconforming mesh is "
+               "rebalanced.");
+   MFEM_VERIFY(amr_steps == 0 || (chk_steps == 0 && restart == false),
+               "Checkpoints are not supported when the mesh is adapted.");
+   Array<int> partitioning, sfc_order;
+   if (serial_lb)
+   {
+      for (int lev = 0; lev < rp_levels; lev++) { mesh->UniformRefinement(); }
+      if (restart)
+      {
+         LoadCheckpointPartitioning(MPI_COMM_WORLD, chk_file, mesh->GetNE(),
+                                    partitioning);
+      }
+      else
+      {
+         int *part = mesh->GeneratePartitioning(mpi.WorldSize());
+         partitioning.SetSize(mesh->GetNE());
+         partitioning.Assign(part);
+         delete [] part;
+      }
+      GetCurveOrder(*mesh, sfc_order);
+   }
+   ParMesh *pmesh_ptr = new ParMesh(MPI_COMM_WORLD, *mesh, serial_lb ?
+                                    partitioning.GetData() : NULL);
+   if (serial_lb == false)
+   {
+      delete mesh;
+      mesh = NULL;
+      for (int lev = 0; lev < rp_levels; lev++)
+      {
+         pmesh_ptr->UniformRefinement();
+      }
+   }
+   if (amr_cycles > 0)
+   {
+      FunctionCoefficient u0_amr(u0_function);
+      AdaptMeshToFaceJumps(*pmesh_ptr, u0_amr, order, BasisType::Positive,
+                           amr_cycles, amr_ref_tol, amr_deref_tol);
+   }
 
    // Define the ODE solver used for time integration. Several explicit
    // Runge-Kutta methods are available.
@@ -253,947 +438,1196 @@ int main(int argc, char *argv[])
       case 6:
          if (myid == 0) { MFEM_WARNING("RK6 may violate the bounds."); }
          ode_solver = new RK6Solver; break;
+      case 7: ode_solver = new LowStorageSSPRK104Solver; break;
+      case 8: ode_solver = new LowStorageSSPRK2Solver(5); break;
       default:
          cout << "Unknown ODE solver type: " << ode_solver_type << '\n';
          return 3;
    }
 
-   // Check if the input mesh is periodic.
-   const bool periodic = pmesh.GetNodes() != NULL &&
-                         dynamic_cast<const L2_FECollection *>
-                         (pmesh.GetNodes()->FESpace()->FEColl()) != NULL;
-   pmesh.SetCurvature(mesh_order, periodic);
-
-   FiniteElementCollection *mesh_fec;
-   if (periodic)
-   {
-      mesh_fec = new L2_FECollection(mesh_order, dim, BasisType::GaussLobatto);
-   }
-   else
-   {
-      mesh_fec = new H1_FECollection(mesh_order, dim, BasisType::GaussLobatto);
-   }
-   // Current mesh positions.
-   ParFiniteElementSpace mesh_pfes(&pmesh, mesh_fec, dim);
-   ParGridFunction x(&mesh_pfes);
-   pmesh.SetNodalGridFunction(&x);
-
-   // Store initial mesh positions.
-   Vector x0(x.Size());
-   x0 = x;
-
    // Velocity for the problem. Depending on the execution mode, this is the
    // advective velocity (transport) or mesh velocity (remap).
    VectorFunctionCoefficient velocity(dim, velocity_function);
 
-   // Mesh velocity.
-   GridFunction v_gf(x.FESpace());
-   VectorGridFunctionCoefficient v_coef(&v_gf);
+   // The mesh positions and velocity. The mesh motion uses the time step and
+   // the final time of the options.
+   const double motion_dt = dt, motion_t_final = t_final;
+   MeshMotion *motion = new MeshMotion(*pmesh_ptr, mesh_order, motion_dt,
+                                       motion_t_final);
+
+   // The state of the run that is kept when the mesh is rebalanced or
+   // adapted: the values of the elements of the serial mesh for a conforming
+   // mesh, or the fields on the changed nonconforming mesh.
+   Vector el_state, S_carry;
+   Array<int> nc_partition;
+   double t_start = 0.0;
+   int ti_start = 0;
+   const int num_ind_fields = product_sync ? 1 : num_fields;
+   // The initial masses of u, us and the independent fields, in one vector
+   // that is stored in the checkpoints.
+   Vector mass0(2 + num_ind_fields);
+   mass0 = 0.0;
+   double &mass0_u = mass0(0), &mass0_us = mass0(1);
+   Vector mass0_f(mass0.GetData() + 2, num_ind_fields);
+   socketstream sout, vis_s, vis_us;
 
-   // If remap is on, obtain the mesh velocity by moving the mesh to the final
-   // mesh positions, and taking the displacement vector.
-   // The mesh motion resembles a time-dependent deformation, e.g., similar to
-   // a deformation that is obtained by a Lagrangian simulation.
-   if (exec_mode == 1)
+   // The solvers are set up for the current mesh. When the mesh is
+   // rebalanced or adapted, the run continues in the next pass with the
+   // solvers set up again for the new mesh.
+   for (int pass = 0; ; pass++)
    {
-      ParGridFunction v(&mesh_pfes);
-      VectorFunctionCoefficient vcoeff(dim, velocity_function);
-      v.ProjectCoefficient(vcoeff);
-
-      double t = 0.0;
-      while (t < t_final)
+      if (pass > 0 && serial_lb)
       {
-         t += dt;
-         // Move the mesh nodes.
-         x.Add(std::min(dt, t_final-t), v);
-         // Update the node velocities.
-         v.ProjectCoefficient(vcoeff);
+         delete motion;
+         delete pmesh_ptr;
+         pmesh_ptr = new ParMesh(MPI_COMM_WORLD, *mesh,
+                                 partitioning.GetData());
+         motion = new MeshMotion(*pmesh_ptr, mesh_order, motion_dt,
+                                 motion_t_final);
       }
+      ParMesh &pmesh = *pmesh_ptr;
+      ParFiniteElementSpace &mesh_pfes = motion->pfes;
+      ParGridFunction &x = motion->x;
+      GridFunction &x0 = motion->x0, &v_gf = motion->v;
+      VectorGridFunctionCoefficient v_coef(&v_gf);
+
+      // The velocity of the execution mode at the quadrature points, used by
+      // the convection integrators and the face flux terms.
+      VectorCoefficient &exec_velocity = (exec_mode == 1) ?
+                                         (VectorCoefficient &) v_coef :
+                                         velocity;
+      QuadratureVelocity velocity_q(exec_velocity, pmesh);
+
+      // Define the discontinuous DG finite element space of the given
+      // polynomial order on the refined mesh.
+      const int btype = BasisType::Positive;
+      DG_FECollection fec(order, dim, btype);
+      ParFiniteElementSpace pfes(&pmesh, &fec);
+
+      // Check for meaningful combinations of parameters.
+      const bool forced_bounds = lo_type   != LOSolverType::None ||
+                                 mono_type != MonolithicSolverType::None;
+      if (forced_bounds)
+      {
+         MFEM_VERIFY(btype == 2,
+                     "Monotonicity treatment requires Bernstein basis.");
 
-      // Pseudotime velocity.
-      add(x, -1.0, x0, v_gf);
+         if (order == 0)
+         {
+            // Disable monotonicity treatment for piecewise constants.
+            if (myid == 0)
+            { mfem_warning("For -o 0, monotonicity treatment is disabled."); }
+            lo_type = LOSolverType::None;
+            fct_type = FCTSolverType::None;
+            mono_type = MonolithicSolverType::None;
+         }
+      }
 
-      // Return the mesh to the initial configuration.
-      x = x0;
-   }
+      const bool use_subcell_RD =
+         ( lo_type   == LOSolverType::ResDistSubcell ||
+           mono_type == MonolithicSolverType::ResDistMonoSubcell );
+
+      if (use_subcell_RD && order==1)
+      { MFEM_ABORT("Subcell schemes are not applicable to linear FE."); }
+
+      // The subcell mesh is built by refining the elements of a conforming
+      // mesh.
+      const bool nc_mesh = pmesh.Nonconforming();
+      MFEM_VERIFY(nc_mesh == false || (use_subcell_RD == false &&
+                                       smth_ind_type == 0),
+                  "Subcell schemes and the smoothness indicator require a "
+                  "conforming mesh.");
+      // The FCT bounds assume one time step for all dofs.
+      MFEM_VERIFY(local_dt == false || fct_type == FCTSolverType::None,
+                  "Local time steps can't be used with FCT.");
+
+      const int prob_size = pfes.GlobalTrueVSize();
+      if (myid == 0) { cout << "Number of unknowns: " << prob_size << endl; }
+
+      // Fields related to inflow BC.
+      FunctionCoefficient inflow(inflow_function);
+      ParGridFunction inflow_gf(&pfes);
+      if (problem_num == 7) // Convergence test: use high order projection.
+      {
+         L2_FECollection l2_fec(order, dim);
+         ParFiniteElementSpace l2_fes(&pmesh, &l2_fec);
+         ParGridFunction l2_inflow(&l2_fes);
+         l2_inflow.ProjectCoefficient(inflow);
+         inflow_gf.ProjectGridFunction(l2_inflow);
+      }
+      else { inflow_gf.ProjectCoefficient(inflow); }
 
-   // Define the discontinuous DG finite element space of the given
-   // polynomial order on the refined mesh.
-   const int btype = BasisType::Positive;
-   DG_FECollection fec(order, dim, btype);
-   ParFiniteElementSpace pfes(&pmesh, &fec);
+      // Set up the bilinear and linear forms corresponding to the DG
+      // discretization.
+      ParBilinearForm m(&pfes);
+      m.AddDomainIntegrator(new MassIntegrator);
 
-   // Check for meaningful combinations of parameters.
-   const bool forced_bounds = lo_type   != LOSolverType::None ||
-                              mono_type != MonolithicSolverType::None;
-   if (forced_bounds)
-   {
-      MFEM_VERIFY(btype == 2,
-                  "Monotonicity treatment requires Bernstein basis.");
+      ParBilinearForm M_HO(&pfes);
+      M_HO.AddDomainIntegrator(new MassIntegrator);
 
-      if (order == 0)
+      ParBilinearForm k(&pfes);
+      ParBilinearForm K_HO(&pfes);
+      if (exec_mode == 0)
       {
-         // Disable monotonicity treatment for piecewise constants.
-         if (myid == 0)
-         { mfem_warning("For -o 0, monotonicity treatment is disabled."); }
-         lo_type = LOSolverType::None;
-         fct_type = FCTSolverType::None;
-         mono_type = MonolithicSolverType::None;
+         k.AddDomainIntegrator(new ConvectionIntegrator(velocity_q, -1.0));
+         K_HO.AddDomainIntegrator(new ConvectionIntegrator(velocity_q, -1.0));
+      }
+      else if (exec_mode == 1)
+      {
+         k.AddDomainIntegrator(new ConvectionIntegrator(velocity_q));
+         K_HO.AddDomainIntegrator(new ConvectionIntegrator(velocity_q));
       }
-   }
 
-   const bool use_subcell_RD =
-      ( lo_type   == LOSolverType::ResDistSubcell ||
-        mono_type == MonolithicSolverType::ResDistMonoSubcell );
+      if (ho_type == HOSolverType::CG ||
+          ho_type == HOSolverType::LocalInverse ||
+          fct_type == FCTSolverType::FluxBased)
+      {
+         if (exec_mode == 0)
+         {
+            DGTraceIntegrator *dgt_i =
+               new DGTraceIntegrator(velocity, 1.0, -0.5);
+            DGTraceIntegrator *dgt_b =
+               new DGTraceIntegrator(velocity, 1.0, -0.5);
+            K_HO.AddInteriorFaceIntegrator(new TransposeIntegrator(dgt_i));
+            K_HO.AddBdrFaceIntegrator(new TransposeIntegrator(dgt_b));
+         }
+         else if (exec_mode == 1)
+         {
+            DGTraceIntegrator *dgt_i =
+               new DGTraceIntegrator(v_coef, -1.0, -0.5);
+            DGTraceIntegrator *dgt_b =
+               new DGTraceIntegrator(v_coef, -1.0, -0.5);
+            K_HO.AddInteriorFaceIntegrator(new TransposeIntegrator(dgt_i));
+            K_HO.AddBdrFaceIntegrator(new TransposeIntegrator(dgt_b));
+         }
 
-   if (use_subcell_RD && order==1)
-   { MFEM_ABORT("Subcell schemes are not applicable to linear FE."); }
+         K_HO.KeepNbrBlock(true);
+      }
 
-   const int prob_size = pfes.GlobalTrueVSize();
-   if (myid == 0) { cout << "Number of unknowns: " << prob_size << endl; }
+      if (pa)
+      {
+         M_HO.SetAssemblyLevel(AssemblyLevel::PARTIAL);
+         K_HO.SetAssemblyLevel(AssemblyLevel::PARTIAL);
+      }
 
-   // Fields related to inflow BC.
-   FunctionCoefficient inflow(inflow_function);
-   ParGridFunction inflow_gf(&pfes);
-   if (problem_num == 7) // Convergence test: use high order projection.
-   {
-      L2_FECollection l2_fec(order, dim);
-      ParFiniteElementSpace l2_fes(&pmesh, &l2_fec);
-      ParGridFunction l2_inflow(&l2_fes);
-      l2_inflow.ProjectCoefficient(inflow);
-      inflow_gf.ProjectGridFunction(l2_inflow);
-   }
-   else { inflow_gf.ProjectCoefficient(inflow); }
+      M_HO.Assemble();
+      K_HO.Assemble(0);
 
-   // Set up the bilinear and linear forms corresponding to the DG
-   // discretization.
-   ParBilinearForm m(&pfes);
-   m.AddDomainIntegrator(new MassIntegrator);
+      if (pa == false)
+      {
+         M_HO.Finalize();
+         K_HO.Finalize(0);
+      }
 
-   ParBilinearForm M_HO(&pfes);
-   M_HO.AddDomainIntegrator(new MassIntegrator);
+      // Compute the lumped mass matrix.
+      Vector lumpedM;
+      ParBilinearForm ml(&pfes);
+      ml.AddDomainIntegrator(new LumpedIntegrator(new MassIntegrator));
+      ml.Assemble();
+      ml.Finalize();
+      ml.SpMat().GetDiag(lumpedM);
 
-   ParBilinearForm k(&pfes);
-   ParBilinearForm K_HO(&pfes);
-   if (exec_mode == 0)
-   {
-      k.AddDomainIntegrator(new ConvectionIntegrator(velocity, -1.0));
-      K_HO.AddDomainIntegrator(new ConvectionIntegrator(velocity, -1.0));
-   }
-   else if (exec_mode == 1)
-   {
-      k.AddDomainIntegrator(new ConvectionIntegrator(v_coef));
-      K_HO.AddDomainIntegrator(new ConvectionIntegrator(v_coef));
-   }
+      m.Assemble();
+      m.Finalize();
+      int skip_zeros = 0;
+      k.Assemble(skip_zeros);
+      k.Finalize(skip_zeros);
 
-   if (ho_type == HOSolverType::CG ||
-       ho_type == HOSolverType::LocalInverse ||
-       fct_type == FCTSolverType::FluxBased)
-   {
-      if (exec_mode == 0)
+      // Store topological dof data.
+      DofInfo dofs(pfes);
+
+      // Precompute data required for high and low order schemes. This could be
+      // put into a separate routine. I am using a struct now because the
+      // various schemes require quite different information.
+      LowOrderMethod lom;
+      lom.subcell_scheme = use_subcell_RD;
+
+      lom.pk = NULL;
+      if (lo_type == LOSolverType::DiscrUpwind)
       {
-         DGTraceIntegrator *dgt_i = new DGTraceIntegrator(velocity, 1.0, -0.5);
-         DGTraceIntegrator *dgt_b = new DGTraceIntegrator(velocity, 1.0, -0.5);
-         K_HO.AddInteriorFaceIntegrator(new TransposeIntegrator(dgt_i));
-         K_HO.AddBdrFaceIntegrator(new TransposeIntegrator(dgt_b));
+         lom.smap = SparseMatrix_Build_smap(k.SpMat());
+         lom.D = k.SpMat();
+
+         if (exec_mode == 0)
+         {
+            ComputeDiscreteUpwindingMatrix(k.SpMat(), lom.smap, lom.D);
+         }
       }
-      else if (exec_mode == 1)
+      else if (lo_type == LOSolverType::DiscrUpwindPrec)
       {
-         DGTraceIntegrator *dgt_i = new DGTraceIntegrator(v_coef, -1.0, -0.5);
-         DGTraceIntegrator *dgt_b = new DGTraceIntegrator(v_coef, -1.0, -0.5);
-         K_HO.AddInteriorFaceIntegrator(new TransposeIntegrator(dgt_i));
-         K_HO.AddBdrFaceIntegrator(new TransposeIntegrator(dgt_b));
+         lom.pk = new ParBilinearForm(&pfes);
+         if (exec_mode == 0)
+         {
+            lom.pk->AddDomainIntegrator(
+               new PrecondConvectionIntegrator(velocity_q, -1.0) );
+         }
+         else if (exec_mode == 1)
+         {
+            lom.pk->AddDomainIntegrator(
+               new PrecondConvectionIntegrator(velocity_q) );
+         }
+         lom.pk->Assemble(skip_zeros);
+         lom.pk->Finalize(skip_zeros);
+
+         lom.smap = SparseMatrix_Build_smap(lom.pk->SpMat());
+         lom.D = lom.pk->SpMat();
+
+         if (exec_mode == 0)
+         {
+            ComputeDiscreteUpwindingMatrix(lom.pk->SpMat(), lom.smap, lom.D);
+         }
       }
+      lom.coef = &velocity_q;
+
+      // Face integration rule.
+      const FaceElementTransformations *ft =
+         pmesh.GetFaceElementTransformations(0);
+      const int el_order = pfes.GetFE(0)->GetOrder();
+      int ft_order = ft->Elem1->OrderW() + 2 * el_order;
+      if (pfes.GetFE(0)->Space() == FunctionSpace::Pk) { ft_order++; }
+      lom.irF = &IntRules.Get(ft->FaceGeom, ft_order);
+      velocity_q.SetFaceRule(*lom.irF);
+
+      DG_FECollection fec0(0, dim, btype);
+      DG_FECollection fec1(1, dim, btype);
+
+      ParMesh *subcell_mesh = NULL;
+      lom.SubFes0 = NULL;
+      lom.SubFes1 = NULL;
+      FiniteElementCollection *fec_sub = NULL;
+      ParFiniteElementSpace *pfes_sub = NULL;;
+      ParGridFunction *xsub = NULL;
+      ParGridFunction v_sub_gf;
+      VectorGridFunctionCoefficient v_sub_coef;
+      QuadratureVelocity *velocity_sub_q = NULL;
+      Vector x0_sub;
+
+      if (order > 1 && nc_mesh == false)
+      {
+         // The mesh corresponding to Bezier subcells of order p is constructed.
+         // NOTE: The mesh is assumed to consist of quads or hexes.
+         MFEM_VERIFY(order > 1,
+                     "This code should not be entered for order = 1.");
+
+         // Get a uniformly refined mesh.
+         subcell_mesh = new ParMesh(&pmesh, order, BasisType::ClosedUniform);
+
+         // Check if the mesh is periodic.
+         const L2_FECollection *L2_coll =
+            dynamic_cast<const L2_FECollection *>
+            (pmesh.GetNodes()->FESpace()->FEColl());
+         if (L2_coll == NULL)
+         {
+            // Standard non-periodic mesh.
+            // Note that the fine mesh is always linear.
+            fec_sub = new H1_FECollection(1, dim, BasisType::ClosedUniform);
+            pfes_sub = new ParFiniteElementSpace(subcell_mesh, fec_sub, dim);
+            xsub = new ParGridFunction(pfes_sub);
+            subcell_mesh->SetCurvature(1);
+            subcell_mesh->SetNodalGridFunction(xsub);
+         }
+         else
+         {
+            // Periodic mesh - the node positions must be corrected after the
+            // call to the above Mesh constructor. Note that the fine mesh is
+            // always linear.
+            const bool disc_nodes = true;
+            subcell_mesh->SetCurvature(1, disc_nodes);
+
+            fec_sub = new L2_FECollection(1, dim, BasisType::ClosedUniform);
+            pfes_sub = new ParFiniteElementSpace(subcell_mesh, fec_sub, dim);
+            xsub = new ParGridFunction(pfes_sub);
+            subcell_mesh->SetNodalGridFunction(xsub);
+
+            GridFunction *coarse = pmesh.GetNodes();
+            InterpolationGridTransfer transf(*coarse->FESpace(), *pfes_sub);
+            transf.ForwardOperator().Mult(*coarse, *xsub);
+         }
 
-      K_HO.KeepNbrBlock(true);
-   }
+         lom.SubFes0 = new FiniteElementSpace(subcell_mesh, &fec0);
+         lom.SubFes1 = new FiniteElementSpace(subcell_mesh, &fec1);
 
-   if (pa)
-   {
-      M_HO.SetAssemblyLevel(AssemblyLevel::PARTIAL);
-      K_HO.SetAssemblyLevel(AssemblyLevel::PARTIAL);
-   }
+         // Submesh velocity.
+         v_sub_gf.SetSpace(pfes_sub);
+         v_sub_gf.ProjectCoefficient(velocity);
 
-   M_HO.Assemble();
-   K_HO.Assemble(0);
+         // Zero it out on boundaries (not moving boundaries).
+         Array<int> ess_bdr, ess_vdofs;
+         if (subcell_mesh->bdr_attributes.Size() > 0)
+         {
+            ess_bdr.SetSize(subcell_mesh->bdr_attributes.Max());
+         }
+         ess_bdr = 1;
+         xsub->ParFESpace()->GetEssentialVDofs(ess_bdr, ess_vdofs);
+         for (int i = 0; i < ess_vdofs.Size(); i++)
+         {
+            if (ess_vdofs[i] == -1) { v_sub_gf(i) = 0.0; }
+         }
+         v_sub_coef.SetGridFunction(&v_sub_gf);
 
-   if (pa == false)
-   {
-      M_HO.Finalize();
-      K_HO.Finalize(0);
-   }
+         // Store initial submesh positions.
+         x0_sub = *xsub;
 
-   // Compute the lumped mass matrix.
-   Vector lumpedM;
-   ParBilinearForm ml(&pfes);
-   ml.AddDomainIntegrator(new LumpedIntegrator(new MassIntegrator));
-   ml.Assemble();
-   ml.Finalize();
-   ml.SpMat().GetDiag(lumpedM);
-
-   m.Assemble();
-   m.Finalize();
-   int skip_zeros = 0;
-   k.Assemble(skip_zeros);
-   k.Finalize(skip_zeros);
-
-   // Store topological dof data.
-   DofInfo dofs(pfes);
-
-   // Precompute data required for high and low order schemes. This could be put
-   // into a separate routine. I am using a struct now because the various
-   // schemes require quite different information.
-   LowOrderMethod lom;
-   lom.subcell_scheme = use_subcell_RD;
-
-   lom.pk = NULL;
-   if (lo_type == LOSolverType::DiscrUpwind)
-   {
-      lom.smap = SparseMatrix_Build_smap(k.SpMat());
-      lom.D = k.SpMat();
+         // Integrator on the submesh.
+         if (exec_mode == 0)
+         {
+            velocity_sub_q = new QuadratureVelocity(velocity, *subcell_mesh);
+            lom.VolumeTerms =
+               new MixedConvectionIntegrator(*velocity_sub_q, -1.0);
+         }
+         else if (exec_mode == 1)
+         {
+            velocity_sub_q = new QuadratureVelocity(v_sub_coef, *subcell_mesh);
+            lom.VolumeTerms = new MixedConvectionIntegrator(*velocity_sub_q);
+         }
+      }
+      else { subcell_mesh = &pmesh; }
 
-      if (exec_mode == 0)
+      Assembly asmbl(dofs, lom, inflow_gf, pfes, subcell_mesh, exec_mode);
+
+      LOSolver *lo_solver = NULL;
+      Array<int> lo_smap;
+      const bool time_dep = (exec_mode == 0) ? false : true;
+      if (lo_type == LOSolverType::DiscrUpwind)
       {
-         ComputeDiscreteUpwindingMatrix(k.SpMat(), lom.smap, lom.D);
+         lo_smap = SparseMatrix_Build_smap(k.SpMat());
+         lo_solver = new DiscreteUpwind(pfes, k.SpMat(), lo_smap,
+                                        lumpedM, asmbl, time_dep);
       }
-   }
-   else if (lo_type == LOSolverType::DiscrUpwindPrec)
-   {
-      lom.pk = new ParBilinearForm(&pfes);
-      if (exec_mode == 0)
+      else if (lo_type == LOSolverType::DiscrUpwindPrec)
       {
-         lom.pk->AddDomainIntegrator(
-            new PrecondConvectionIntegrator(velocity, -1.0) );
+         lo_smap = SparseMatrix_Build_smap(lom.pk->SpMat());
+         lo_solver = new DiscreteUpwind(pfes, lom.pk->SpMat(), lo_smap,
+                                        lumpedM, asmbl, time_dep);
       }
-      else if (exec_mode == 1)
+      else if (lo_type == LOSolverType::ResDist)
       {
-         lom.pk->AddDomainIntegrator(
-            new PrecondConvectionIntegrator(v_coef) );
+         const bool subcell_scheme = false;
+         lo_solver = new ResidualDistribution(pfes, k, asmbl, lumpedM,
+                                              subcell_scheme, time_dep);
+      }
+      else if (lo_type == LOSolverType::ResDistSubcell)
+      {
+         const bool subcell_scheme = true;
+         lo_solver = new ResidualDistribution(pfes, k, asmbl, lumpedM,
+                                              subcell_scheme, time_dep);
       }
-      lom.pk->Assemble(skip_zeros);
-      lom.pk->Finalize(skip_zeros);
-
-      lom.smap = SparseMatrix_Build_smap(lom.pk->SpMat());
-      lom.D = lom.pk->SpMat();
 
-      if (exec_mode == 0)
+      // Setup the initial conditions.
+      const int vsize = pfes.GetVSize();
+      Array<int> offset(num_fields + 1);
+      for (int i = 0; i < offset.Size(); i++) { offset[i] = i*vsize; }
+      BlockVector S(offset, Device::GetMemoryType());
+      // Primary scalar field is u.
+      ParGridFunction u(&pfes);
+      u.MakeRef(&pfes, S, offset[0]);
+      FunctionCoefficient u0(u0_function);
+      u.ProjectCoefficient(u0);
+      u.SyncAliasMemory(S);
+      // For the case of product remap, we also solve for s and u_s.
+      ParGridFunction s, us;
+      Array<bool> u_bool_el, u_bool_dofs;
+      if (product_sync)
       {
-         ComputeDiscreteUpwindingMatrix(lom.pk->SpMat(), lom.smap, lom.D);
+         s.SetSpace(&pfes);
+         ComputeBoolIndicators(pmesh.GetNE(), u, u_bool_el, u_bool_dofs);
+         BoolFunctionCoefficient sc(s0_function, u_bool_el);
+         s.ProjectCoefficient(sc);
+
+         us.MakeRef(&pfes, S, offset[1]);
+         us.HostWrite();
+         u.HostRead();
+         s.HostRead();
+         // Simple - we don't target conservation at initialization.
+         for (int i = 0; i < s.Size(); i++) { us(i) = u(i) * s(i); }
+         us.SyncAliasMemory(S);
       }
-   }
-   if (exec_mode == 1) { lom.coef = &v_coef; }
-   else                { lom.coef = &velocity; }
-
-   // Face integration rule.
-   const FaceElementTransformations *ft =
-      pmesh.GetFaceElementTransformations(0);
-   const int el_order = pfes.GetFE(0)->GetOrder();
-   int ft_order = ft->Elem1->OrderW() + 2 * el_order;
-   if (pfes.GetFE(0)->Space() == FunctionSpace::Pk) { ft_order++; }
-   lom.irF = &IntRules.Get(ft->FaceGeom, ft_order);
-
-   DG_FECollection fec0(0, dim, btype);
-   DG_FECollection fec1(1, dim, btype);
-
-   ParMesh *subcell_mesh = NULL;
-   lom.SubFes0 = NULL;
-   lom.SubFes1 = NULL;
-   FiniteElementCollection *fec_sub = NULL;
-   ParFiniteElementSpace *pfes_sub = NULL;;
-   ParGridFunction *xsub = NULL;
-   ParGridFunction v_sub_gf;
-   VectorGridFunctionCoefficient v_sub_coef;
-   Vector x0_sub;
-
-   if (order > 1)
-   {
-      // The mesh corresponding to Bezier subcells of order p is constructed.
-      // NOTE: The mesh is assumed to consist of quads or hexes.
-      MFEM_VERIFY(order > 1, "This code should not be entered for order = 1.");
-
-      // Get a uniformly refined mesh.
-      subcell_mesh = new ParMesh(&pmesh, order, BasisType::ClosedUniform);
-
-      // Check if the mesh is periodic.
-      const L2_FECollection *L2_coll = dynamic_cast<const L2_FECollection *>
-                                       (pmesh.GetNodes()->FESpace()->FEColl());
-      if (L2_coll == NULL)
-      {
-         // Standard non-periodic mesh.
-         // Note that the fine mesh is always linear.
-         fec_sub = new H1_FECollection(1, dim, BasisType::ClosedUniform);
-         pfes_sub = new ParFiniteElementSpace(subcell_mesh, fec_sub, dim);
-         xsub = new ParGridFunction(pfes_sub);
-         subcell_mesh->SetCurvature(1);
-         subcell_mesh->SetNodalGridFunction(xsub);
+      // Independent fields are scaled copies of u.
+      Vector S_f;
+      for (int f = 1; f < num_fields && product_sync == false; f++)
+      {
+         S_f.MakeRef(S, offset[f], vsize);
+         S_f.Set(1.0 / (f + 1), u);
+         S_f.SyncAliasMemory(S);
       }
-      else
+      // With load balancing, the checkpoints are stored per element.
+      Array<int> glob_el;
+      Vector el_vals;
+      const int sub_per_el = (subcell_mesh != &pmesh) ?
+                             subcell_mesh->GetNE() / pmesh.GetNE() : 0;
+      if (serial_lb) { GetGlobalElements(partitioning, myid, glob_el); }
+
+      // Resume from a checkpoint, or continue the run after the mesh was
+      // rebalanced. The setup above is repeated, and the state of the run is
+      // overwritten.
+      if (pass == 0 && restart && serial_lb)
       {
-         // Periodic mesh - the node positions must be corrected after the call
-         // to the above Mesh constructor. Note that the fine mesh is always
-         // linear.
-         const bool disc_nodes = true;
-         subcell_mesh->SetCurvature(1, disc_nodes);
-
-         fec_sub = new L2_FECollection(1, dim, BasisType::ClosedUniform);
-         pfes_sub = new ParFiniteElementSpace(subcell_mesh, fec_sub, dim);
-         xsub = new ParGridFunction(pfes_sub);
-         subcell_mesh->SetNodalGridFunction(xsub);
-
-         GridFunction *coarse = pmesh.GetNodes();
-         InterpolationGridTransfer transf(*coarse->FESpace(), *pfes_sub);
-         transf.ForwardOperator().Mult(*coarse, *xsub);
+         el_vals.SetSize(glob_el.Size() *
+                         ElementStateSize(pfes, num_fields, mesh_pfes, pfes_sub,
+                                          sub_per_el));
+         LoadElementCheckpoint(pmesh.GetComm(), chk_file, glob_el, el_vals,
+                               t_start, ti_start, dt, mass0);
+         UnpackElementState(pfes, num_fields, el_vals, S, mesh_pfes, x0,
+                            pfes_sub, x0_sub, sub_per_el);
+      }
+      else if (pass == 0 && restart)
+      {
+         LoadCheckpoint(pmesh.GetComm(), chk_file, S, t_start, ti_start, dt,
+                        mass0, x0, x0_sub);
+      }
+      else if (pass > 0 && serial_lb)
+      {
+         UnpackElementState(pfes, num_fields, el_state, S, mesh_pfes, x0,
+                            pfes_sub, x0_sub, sub_per_el);
+      }
+      else if (pass > 0) { S.Set(1.0, S_carry); }
+      if (restart || pass > 0)
+      {
+         u.SyncAliasMemory(S);
+         if (product_sync) { us.SyncAliasMemory(S); }
+         if (exec_mode == 1)
+         {
+            add(x0, t_start, v_gf, x);
+            if (xsub) { add(x0_sub, t_start, v_sub_gf, *xsub); }
+         }
+         if (pass == 0 && myid == 0)
+         {
+            cout << "Restarting from " << chk_file << " at time step "
+                 << ti_start << ", time " << t_start << endl;
+         }
       }
 
-      lom.SubFes0 = new FiniteElementSpace(subcell_mesh, &fec0);
-      lom.SubFes1 = new FiniteElementSpace(subcell_mesh, &fec1);
+      // With AoS, the time integration works on an interleaved copy of S, from
+      // which S is updated after each step.
+      Vector S_aos;
+      if (layout == FieldLayout::AoS)
+      {
+         S_aos.SetSize(S.Size(), Device::GetMemoryType());
+         S_aos.UseDevice(true);
+         ConvertFieldLayout(S, FieldLayout::SoA, S_aos, layout, num_fields);
+      }
+      Vector &state = (layout == FieldLayout::AoS) ? S_aos : S;
 
-      // Submesh velocity.
-      v_sub_gf.SetSpace(pfes_sub);
-      v_sub_gf.ProjectCoefficient(velocity);
+      // Smoothness indicator.
+      SmoothnessIndicator *smth_indicator = NULL;
+      if (smth_ind_type)
+      {
+         smth_indicator = new SmoothnessIndicator(smth_ind_type, *subcell_mesh,
+                                                  pfes, u, dofs);
+      }
 
-      // Zero it out on boundaries (not moving boundaries).
-      Array<int> ess_bdr, ess_vdofs;
-      if (subcell_mesh->bdr_attributes.Size() > 0)
+      // Setup of the high-order solver (if any).
+      HOSolver *ho_solver = NULL;
+      if (ho_type == HOSolverType::Neumann)
       {
-         ess_bdr.SetSize(subcell_mesh->bdr_attributes.Max());
+         ho_solver = new NeumannHOSolver(pfes, m, k, lumpedM, asmbl);
       }
-      ess_bdr = 1;
-      xsub->ParFESpace()->GetEssentialVDofs(ess_bdr, ess_vdofs);
-      for (int i = 0; i < ess_vdofs.Size(); i++)
+      else if (ho_type == HOSolverType::CG)
       {
-         if (ess_vdofs[i] == -1) { v_sub_gf(i) = 0.0; }
+         ho_solver = new CGHOSolver(pfes, M_HO, K_HO);
+      }
+      else if (ho_type == HOSolverType::LocalInverse)
+      {
+         ho_solver = new LocalInverseHOSolver(pfes, M_HO, K_HO);
       }
-      v_sub_coef.SetGridFunction(&v_sub_gf);
-
-      // Store initial submesh positions.
-      x0_sub = *xsub;
 
-      // Integrator on the submesh.
-      if (exec_mode == 0)
+      // Setup of the monolithic solver (if any).
+      MonolithicSolver *mono_solver = NULL;
+      bool mass_lim = (problem_num != 6 && problem_num != 7) ? true : false;
+      // The smoothness scaling uses the advective velocity in both modes.
+      VectorCoefficient &mono_velocity = (exec_mode == 0) ?
+                                         (VectorCoefficient &) velocity_q :
+                                         velocity;
+      if (mono_type == MonolithicSolverType::ResDistMono)
       {
-         lom.VolumeTerms = new MixedConvectionIntegrator(velocity, -1.0);
+         const bool subcell_scheme = false;
+         mono_solver = new MonoRDSolver(pfes, k.SpMat(), m.SpMat(), lumpedM,
+                                        asmbl, smth_indicator, mono_velocity,
+                                        subcell_scheme, time_dep, mass_lim);
       }
-      else if (exec_mode == 1)
+      else if (mono_type == MonolithicSolverType::ResDistMonoSubcell)
       {
-         lom.VolumeTerms = new MixedConvectionIntegrator(v_sub_coef);
+         const bool subcell_scheme = true;
+         mono_solver = new MonoRDSolver(pfes, k.SpMat(), m.SpMat(), lumpedM,
+                                        asmbl, smth_indicator, mono_velocity,
+                                        subcell_scheme, time_dep, mass_lim);
       }
-   }
-   else { subcell_mesh = &pmesh; }
-
-   Assembly asmbl(dofs, lom, inflow_gf, pfes, subcell_mesh, exec_mode);
 
-   LOSolver *lo_solver = NULL;
-   Array<int> lo_smap;
-   const bool time_dep = (exec_mode == 0) ? false : true;
-   if (lo_type == LOSolverType::DiscrUpwind)
-   {
-      lo_smap = SparseMatrix_Build_smap(k.SpMat());
-      lo_solver = new DiscreteUpwind(pfes, k.SpMat(), lo_smap,
-                                     lumpedM, asmbl, time_dep);
-   }
-   else if (lo_type == LOSolverType::DiscrUpwindPrec)
-   {
-      lo_smap = SparseMatrix_Build_smap(lom.pk->SpMat());
-      lo_solver = new DiscreteUpwind(pfes, lom.pk->SpMat(), lo_smap,
-                                     lumpedM, asmbl, time_dep);
-   }
-   else if (lo_type == LOSolverType::ResDist)
-   {
-      const bool subcell_scheme = false;
-      lo_solver = new ResidualDistribution(pfes, k, asmbl, lumpedM,
-                                           subcell_scheme, time_dep);
-   }
-   else if (lo_type == LOSolverType::ResDistSubcell)
-   {
-      const bool subcell_scheme = true;
-      lo_solver = new ResidualDistribution(pfes, k, asmbl, lumpedM,
-                                           subcell_scheme, time_dep);
-   }
-
-   // Setup the initial conditions.
-   const int vsize = pfes.GetVSize();
-   Array<int> offset((product_sync) ? 3 : 2);
-   for (int i = 0; i < offset.Size(); i++) { offset[i] = i*vsize; }
-   BlockVector S(offset, Device::GetMemoryType());
-   // Primary scalar field is u.
-   ParGridFunction u(&pfes);
-   u.MakeRef(&pfes, S, offset[0]);
-   FunctionCoefficient u0(u0_function);
-   u.ProjectCoefficient(u0);
-   u.SyncAliasMemory(S);
-   // For the case of product remap, we also solve for s and u_s.
-   ParGridFunction s, us;
-   Array<bool> u_bool_el, u_bool_dofs;
-   if (product_sync)
-   {
-      s.SetSpace(&pfes);
-      ComputeBoolIndicators(pmesh.GetNE(), u, u_bool_el, u_bool_dofs);
-      BoolFunctionCoefficient sc(s0_function, u_bool_el);
-      s.ProjectCoefficient(sc);
-
-      us.MakeRef(&pfes, S, offset[1]);
-      us.HostWrite();
-      u.HostRead();
-      s.HostRead();
-      // Simple - we don't target conservation at initialization.
-      for (int i = 0; i < s.Size(); i++) { us(i) = u(i) * s(i); }
-      us.SyncAliasMemory(S);
-   }
-
-   // Smoothness indicator.
-   SmoothnessIndicator *smth_indicator = NULL;
-   if (smth_ind_type)
-   {
-      smth_indicator = new SmoothnessIndicator(smth_ind_type, *subcell_mesh,
-                                               pfes, u, dofs);
-   }
+      // Print the starting meshes and initial condition.
+      if (pass == 0 && par_output)
+      {
+         SaveParallelOutput(pmesh, "meshHO_init.mesh", &u, "sltn_init.bin",
+                            precision);
+         if (subcell_mesh)
+         {
+            SaveParallelOutput(*subcell_mesh, "meshLO_init.mesh", NULL, NULL,
+                               precision);
+         }
+      }
+      else if (pass == 0)
+      {
+         ofstream meshHO("meshHO_init.mesh");
+         meshHO.precision(precision);
+         pmesh.PrintAsOne(meshHO);
+         if (subcell_mesh)
+         {
+            ofstream meshLO("meshLO_init.mesh");
+            meshLO.precision(precision);
+            subcell_mesh->PrintAsOne(meshLO);
+         }
+         ofstream sltn("sltn_init.gf");
+         sltn.precision(precision);
+         u.SaveAsOne(sltn);
+      }
 
-   // Setup of the high-order solver (if any).
-   HOSolver *ho_solver = NULL;
-   if (ho_type == HOSolverType::Neumann)
-   {
-      ho_solver = new NeumannHOSolver(pfes, m, k, lumpedM, asmbl);
-   }
-   else if (ho_type == HOSolverType::CG)
-   {
-      ho_solver = new CGHOSolver(pfes, M_HO, K_HO);
-   }
-   else if (ho_type == HOSolverType::LocalInverse)
-   {
-      ho_solver = new LocalInverseHOSolver(pfes, M_HO, K_HO);
-   }
+      // Create data collection for solution output: either VisItDataCollection
+      // for ASCII data files, or SidreDataCollection for binary data files.
+      DataCollection *dc = NULL;
+      if (visit)
+      {
+         dc = new VisItDataCollection("Remhos", &pmesh);
+         dc->SetPrecision(precision);
+         dc->RegisterField("solution", &u);
+         dc->SetCycle(ti_start);
+         dc->SetTime(t_start);
+         dc->Save();
+      }
 
-   // Setup of the monolithic solver (if any).
-   MonolithicSolver *mono_solver = NULL;
-   bool mass_lim = (problem_num != 6 && problem_num != 7) ? true : false;
-   if (mono_type == MonolithicSolverType::ResDistMono)
-   {
-      const bool subcell_scheme = false;
-      mono_solver = new MonoRDSolver(pfes, k.SpMat(), m.SpMat(), lumpedM,
-                                     asmbl, smth_indicator, velocity,
-                                     subcell_scheme, time_dep, mass_lim);
-   }
-   else if (mono_type == MonolithicSolverType::ResDistMonoSubcell)
-   {
-      const bool subcell_scheme = true;
-      mono_solver = new MonoRDSolver(pfes, k.SpMat(), m.SpMat(), lumpedM,
-                                     asmbl, smth_indicator, velocity,
-                                     subcell_scheme, time_dep, mass_lim);
-   }
+      // Asynchronous snapshots of the selected fields. s is computed by the
+      // writer thread, only when it's selected.
+      AsyncFieldWriter *async_writer = NULL;
+      Array<const Vector *> snap_fields;
+      Array<const char *> snap_names;
+      const Vector *snap_us = NULL, *snap_u = NULL;
+      const int snap_nd = pfes.GetFE(0)->GetDof();
+      if (async_output)
+      {
+         async_writer = new AsyncFieldWriter("remhos_snap", myid, async_single);
+         stringstream fields(async_fields);
+         string name;
+         while (getline(fields, name, ','))
+         {
+            if (name == "u") { snap_fields.Append(&u); snap_names.Append("u"); }
+            else if (name == "s" && product_sync)
+            {
+               snap_us = &us;
+               snap_u = &u;
+            }
+            else if (name == "us" && product_sync)
+            {
+               snap_fields.Append(&us);
+               snap_names.Append("us");
+            }
+            else if (myid == 0)
+            {
+               MFEM_WARNING("Unknown snapshot field " << name);
+            }
+         }
+         if (pass == 0)
+         {
+            async_writer->Write(ti_start, t_start, snap_fields, snap_names,
+                                snap_us, snap_u, snap_nd);
+         }
+      }
 
-   // Print the starting meshes and initial condition.
-   ofstream meshHO("meshHO_init.mesh");
-   meshHO.precision(precision);
-   pmesh.PrintAsOne(meshHO);
-   if (subcell_mesh)
-   {
-      ofstream meshLO("meshLO_init.mesh");
-      meshLO.precision(precision);
-      subcell_mesh->PrintAsOne(meshLO);
-   }
-   ofstream sltn("sltn_init.gf");
-   sltn.precision(precision);
-   u.SaveAsOne(sltn);
-
-   // Create data collection for solution output: either VisItDataCollection for
-   // ASCII data files, or SidreDataCollection for binary data files.
-   DataCollection *dc = NULL;
-   if (visit)
-   {
-      dc = new VisItDataCollection("Remhos", &pmesh);
-      dc->SetPrecision(precision);
-      dc->RegisterField("solution", &u);
-      dc->SetCycle(0);
-      dc->SetTime(0.0);
-      dc->Save();
-   }
+      char vishost[] = "localhost";
+      int  visport   = 19916;
+      if (visualization)
+      {
+         // Make sure all MPI ranks have sent their 'v' solution before
+         // initiating another set of GLVis connections (one from each rank):
+         MPI_Barrier(pmesh.GetComm());
+
+         sout.precision(8);
+         vis_s.precision(8);
+         vis_us.precision(8);
+
+         int Wx = 0, Wy = 0; // window position
+         const int Ww = 400, Wh = 400; // window size
+         u.HostRead();
+         s.HostRead();
+         VisualizeField(sout, vishost, visport, u, "Solution u",
+                        Wx, Wy, Ww, Wh);
+         if (product_sync)
+         {
+            VisualizeField(vis_s, vishost, visport, s, "Solution s",
+                           Wx + Ww, Wy, Ww, Wh);
+            VisualizeField(vis_us, vishost, visport, us, "Solution u_s",
+                           Wx + 2*Ww, Wy, Ww, Wh);
+         }
+      }
 
-   socketstream sout, vis_s, vis_us;
-   char vishost[] = "localhost";
-   int  visport   = 19916;
-   if (visualization)
-   {
-      // Make sure all MPI ranks have sent their 'v' solution before initiating
-      // another set of GLVis connections (one from each rank):
-      MPI_Barrier(pmesh.GetComm());
-
-      sout.precision(8);
-      vis_s.precision(8);
-      vis_us.precision(8);
-
-      int Wx = 0, Wy = 0; // window position
-      const int Ww = 400, Wh = 400; // window size
-      u.HostRead();
-      s.HostRead();
-      VisualizeField(sout, vishost, visport, u, "Solution u", Wx, Wy, Ww, Wh);
-      if (product_sync)
+      // Record the initial mass. On a restart, it's taken from the
+      // checkpoint.
+      MPI_Comm comm = pmesh.GetComm();
+      Vector masses(lumpedM);
+      Vector mass_f_loc(num_ind_fields), mass_f(num_ind_fields);
+      mass_f_loc = 0.0;
+      if (pass == 0 && restart == false)
       {
-         VisualizeField(vis_s, vishost, visport, s, "Solution s",
-                        Wx + Ww, Wy, Ww, Wh);
-         VisualizeField(vis_us, vishost, visport, us, "Solution u_s",
-                        Wx + 2*Ww, Wy, Ww, Wh);
+         const double mass0_u_loc = lumpedM * u;
+         MPI_Allreduce(&mass0_u_loc, &mass0_u, 1, MPI_DOUBLE, MPI_SUM, comm);
+         if (product_sync)
+         {
+            const double mass0_us_loc = lumpedM * us;
+            MPI_Allreduce(&mass0_us_loc, &mass0_us, 1, MPI_DOUBLE, MPI_SUM,
+                          comm);
+         }
+         for (int f = 1; f < num_ind_fields; f++)
+         {
+            S_f.MakeRef(S, offset[f], vsize);
+            mass_f_loc(f) = lumpedM * S_f;
+         }
+         MPI_Allreduce(mass_f_loc.HostReadWrite(), mass0_f.HostWrite(),
+                       num_ind_fields, MPI_DOUBLE, MPI_SUM, comm);
       }
-   }
 
-   // Record the initial mass.
-   MPI_Comm comm = pmesh.GetComm();
-   Vector masses(lumpedM);
-   const double mass0_u_loc = lumpedM * u;
-   double mass0_u, mass0_us;
-   MPI_Allreduce(&mass0_u_loc, &mass0_u, 1, MPI_DOUBLE, MPI_SUM, comm);
-   if (product_sync)
-   {
-      const double mass0_us_loc = lumpedM * us;
-      MPI_Allreduce(&mass0_us_loc, &mass0_us, 1, MPI_DOUBLE, MPI_SUM, comm);
-   }
+      // Setup of the FCT solver (if any).
+      FCTSolver *fct_solver = NULL;
+      if (fct_type == FCTSolverType::FluxBased)
+      {
+         const int fct_iterations = 1;
+         fct_solver = new FluxBasedFCT(pfes, smth_indicator, dt, K_HO, M_HO,
+                                       dofs, fct_iterations);
+      }
+      else if (fct_type == FCTSolverType::ClipScale)
+      {
+         fct_solver = new ClipScaleSolver(pfes, smth_indicator, dt);
+      }
+      else if (fct_type == FCTSolverType::NonlinearPenalty)
+      {
+         fct_solver = new NonlinearPenaltySolver(pfes, smth_indicator, dt);
+      }
 
-   // Setup of the FCT solver (if any).
-   Array<int> K_HO_smap;
-   FCTSolver *fct_solver = NULL;
-   if (fct_type == FCTSolverType::FluxBased)
-   {
-      MFEM_VERIFY(pa == false, "Flux-based FCT and PA are incompatible.");
+      RemapAssembler *remap_asmbl = NULL;
+      if (exec_mode == 1)
+      {
+         remap_asmbl = new RemapAssembler(pfes, m, ml, k, M_HO, K_HO, lumpedM,
+                                          asmbl, lom, dofs);
+         if (remap_poly) { remap_asmbl->ComputePolynomials(x, x0, v_gf); }
+      }
 
-      K_HO_smap = SparseMatrix_Build_smap(K_HO.SpMat());
-      const int fct_iterations = 1;
-      fct_solver = new FluxBasedFCT(pfes, smth_indicator, dt, K_HO.SpMat(),
-                                    K_HO_smap, M_HO.SpMat(), fct_iterations);
-   }
-   else if (fct_type == FCTSolverType::ClipScale)
-   {
-      fct_solver = new ClipScaleSolver(pfes, smth_indicator, dt);
-   }
-   else if (fct_type == FCTSolverType::NonlinearPenalty)
-   {
-      fct_solver = new NonlinearPenaltySolver(pfes, smth_indicator, dt);
-   }
+      AdvectionOperator adv(S.Size(), m, ml, lumpedM, k, M_HO, K_HO,
+                            x, xsub, v_gf, v_sub_gf, asmbl, lom, dofs,
+                            ho_solver, lo_solver, fct_solver, mono_solver,
+                            remap_asmbl, exec_mode);
+      adv.SetFields(product_sync, layout);
 
-   AdvectionOperator adv(S.Size(), m, ml, lumpedM, k, M_HO, K_HO,
-                         x, xsub, v_gf, v_sub_gf, asmbl, lom, dofs,
-                         ho_solver, lo_solver, fct_solver, mono_solver);
+      perf_timers.Enable(perf);
 
-   double t = 0.0;
-   adv.SetTime(t);
-   ode_solver->Init(adv);
+      double t = t_start;
+      adv.SetTime(t);
+      ode_solver->Init(adv);
 
-   double umin, umax;
-   GetMinMax(u, umin, umax);
+      double umin, umax;
+      GetMinMax(u, umin, umax);
 
-   if (exec_mode == 1)
-   {
-      adv.SetRemapStartPos(x0, x0_sub);
+      if (exec_mode == 1)
+      {
+         adv.SetRemapStartPos(x0, x0_sub);
 
-      // For remap, the pseudo-time always evolves from 0 to 1.
-      t_final = 1.0;
-   }
+         // For remap, the pseudo-time always evolves from 0 to 1.
+         t_final = 1.0;
+      }
 
-   ParGridFunction res = u;
-   double residual;
+      ParGridFunction res = u;
+      Vector res_diff, res_blocks;
+      res_diff.UseDevice(true);
+      double residual = 0.0;
 
-   // Time-integration (loop over the time iterations, ti, with a time-step dt).
-   bool done = false;
-   for (int ti = 0; !done;)
-   {
-      double dt_real = min(dt, t_final - t);
+#ifdef REMHOS_WORKSPACE_DEBUG
+      // Workspace allocations done during the first time step. This counts
+      // only the workspace vectors, not the other Vector allocations.
+      int first_step_allocs = 0;
+#endif
 
-      adv.SetDt(dt_real);
+      // The adaptive time step is based on the matrix of the LO solution.
+      const SparseMatrix &K_cfl = lom.pk ? lom.pk->SpMat() : k.SpMat();
+      Array<int> K_cfl_smap;
+      if (cfl > 0.0) { K_cfl_smap = SparseMatrix_Build_smap(K_cfl); }
+      const bool check_bounds = verify_bounds && forced_bounds &&
+                                smth_indicator == NULL;
+      const bool retry_steps = cfl > 0.0 && check_bounds;
+      Vector S_old;
+
+      if (lb_steps > 0) { element_costs.Enable(pmesh.GetNE()); }
+      bool rebalance = false, remesh = false;
+
+      // Steady problems: the elements can advance with their own time steps,
+      // the steps can be accelerated, and the residual is checked every
+      // res_steps steps against the solution res of the last check.
+      // el_dt and cfl_diag are the scratch of the CFL time steps.
+      Vector el_dt_scale, res_scale, el_dt, cfl_diag;
+      if (local_dt)
+      {
+         ComputeElementTimeSteps(K_cfl, K_cfl_smap, asmbl, lumpedM, cfl, el_dt,
+                                 cfl_diag);
+         dt = ComputeLocalTimeStepScales(el_dt, comm, el_dt_scale);
+         adv.SetLocalTimeSteps(&el_dt_scale);
+      }
+      AndersonAcceleration *anderson = NULL;
+      if (anderson_depth > 0)
+      {
+         anderson = new AndersonAcceleration(anderson_depth, comm);
+      }
+      const double inf = numeric_limits<double>::infinity();
+      int ti_res = ti_start;
 
-      ode_solver->Step(S, t, dt_real);
-      ti++;
+      // Time-integration (loop over the time iterations, ti, with a time-step
+      // dt).
+      bool done = false;
+      for (int ti = ti_start; !done;)
+      {
+         if (cfl > 0.0 && local_dt == false)
+         {
+            dt = ComputeCFLTimeStep(K_cfl, K_cfl_smap, asmbl, lumpedM, cfl,
+                                    comm, el_dt, cfl_diag);
+         }
+         double dt_real = min(dt, t_final - t);
 
-      u.SyncAliasMemory(S);
-      if (product_sync) { us.SyncAliasMemory(S); }
+         // Bounds that the solution must satisfy after the step.
+         double u_lo = umin, u_hi = umax;
+         if (problem_num % 10 == 6 || problem_num % 10 == 7)
+         {
+            u_lo = 0.0;
+            u_hi = 1.0;
+         }
 
-      // Monotonicity check for debug purposes mainly.
-      if (verify_bounds && forced_bounds && smth_indicator == NULL)
-      {
+         const double t_old = t;
+         if (retry_steps) { S_old = state; }
          double umin_new, umax_new;
-         GetMinMax(u, umin_new, umax_new);
-         if (problem_num % 10 != 6 && problem_num % 10 != 7)
+         for (int retry = 0; ; retry++)
          {
+            adv.SetDt(dt_real);
+
+            perf_timers.Start(PerfPhase::Step);
+            ode_solver->Step(state, t, dt_real);
+            perf_timers.Stop(PerfPhase::Step);
+
+            if (layout == FieldLayout::AoS)
+            {
+               ConvertFieldLayout(S_aos, layout, S, FieldLayout::SoA,
+                                  num_fields);
+            }
+            u.SyncAliasMemory(S);
+            if (product_sync) { us.SyncAliasMemory(S); }
+
+            if (check_bounds == false) { break; }
+            GetMinMax(u, umin_new, umax_new);
+            if (retry_steps == false || retry == max_step_retries ||
+                (umin_new > u_lo - 1e-12 && umax_new < u_hi + 1e-12)) { break; }
+
+            // Retry the step with half the time step.
+            state = S_old;
+            t = t_old;
+            dt_real *= 0.5;
             if (myid == 0)
             {
-               MFEM_VERIFY(umin_new > umin - 1e-12,
-                           "Undershoot of " << umin - umin_new);
-               MFEM_VERIFY(umax_new < umax + 1e-12,
-                           "Overshoot of " << umax_new - umax);
+               cout << "Bounds violation at time " << t
+                    << ", retrying with dt = " << dt_real << endl;
             }
-            umin = umin_new;
-            umax = umax_new;
          }
-         else
+         ti++;
+         element_costs.AddAll(1.0);
+#ifdef REMHOS_WORKSPACE_DEBUG
+         if (ti == 1) { first_step_allocs = Workspace::NumAllocations(); }
+#endif
+
+         // Monotonicity check for debug purposes mainly.
+         if (check_bounds)
          {
             if (myid == 0)
             {
-               MFEM_VERIFY(umin_new > 0.0 - 1e-12,
-                           "Undershoot of " << 0.0 - umin_new);
-               MFEM_VERIFY(umax_new < 1.0 + 1e-12,
-                           "Overshoot of " << umax_new - 1.0);
+               MFEM_VERIFY(umin_new > u_lo - 1e-12,
+                           "Undershoot of " << u_lo - umin_new);
+               MFEM_VERIFY(umax_new < u_hi + 1e-12,
+                           "Overshoot of " << umax_new - u_hi);
+            }
+            if (problem_num % 10 != 6 && problem_num % 10 != 7)
+            {
+               umin = umin_new;
+               umax = umax_new;
             }
          }
-      }
 
-      if (exec_mode == 1)
-      {
-         add(x0, t, v_gf, x);
-         add(x0_sub, t, v_sub_gf, *xsub);
-      }
+         if (exec_mode == 1)
+         {
+            add(x0, t, v_gf, x);
+            if (xsub) { add(x0_sub, t, v_sub_gf, *xsub); }
+         }
 
-      if (problem_num != 6 && problem_num != 7 && problem_num != 8)
-      {
-         done = (t >= t_final - 1.e-8*dt);
-      }
-      else
-      {
-         // Steady state problems - stop at convergence.
-         double res_loc = 0.;
-         lumpedM.HostReadWrite(); u.HostReadWrite(); res.HostReadWrite();
-         for (int i = 0; i < res.Size(); i++)
+         if (problem_num != 6 && problem_num != 7 && problem_num != 8)
          {
-            res_loc += pow( (lumpedM(i) * u(i) / dt) - (lumpedM(i) * res(i) / dt), 2. );
+            done = (t >= t_final - 1.e-8*dt);
          }
-         MPI_Allreduce(&res_loc, &residual, 1, MPI_DOUBLE, MPI_SUM, comm);
+         else if (anderson || ti - ti_res >= res_steps)
+         {
+            // Steady state problems - stop at convergence. The residual is the
+            // average over the steps since the last check. It is reproducible
+            // for any number of threads.
+            ComputeResidualScales(lumpedM, dt * (ti - ti_res),
+                                  local_dt ? &el_dt_scale : NULL, res_scale);
+            if (anderson)
+            {
+               // The residual is summed together with the acceleration.
+               residual = anderson->Apply(res, state, res_scale,
+                                          forced_bounds ? u_lo : -inf,
+                                          forced_bounds ? u_hi : inf);
+               if (layout == FieldLayout::AoS)
+               {
+                  ConvertFieldLayout(S_aos, layout, S, FieldLayout::SoA, 1);
+               }
+               u.SyncAliasMemory(S);
+            }
+            else
+            {
+               res_diff.SetSize(res.Size());
+               const double *d_s = res_scale.Read(), *d_u = u.Read(),
+                            *d_res = res.Read();
+               double *d_diff = res_diff.Write();
+               MFEM_FORALL(i, res.Size(),
+                           d_diff[i] = d_s[i] * (d_u[i] - d_res[i]); );
+               double res_loc = DeterministicSquaredNorm(res_diff,
+                                                        res_blocks);
+               MPI_Allreduce(&res_loc, &residual, 1, MPI_DOUBLE, MPI_SUM, comm);
+               residual = sqrt(residual);
+            }
+            ti_res = ti;
 
-         residual = sqrt(residual);
-         if (residual < 1.e-12 && t >= 1.) { done = true; u = res; }
-         else { res = u; }
-      }
+            if (residual < 1.e-12 && t >= 1.) { done = true; u = res; }
+            else { res = u; }
+         }
 
-      if (done || ti % vis_steps == 0)
-      {
-         if (myid == 0)
+         if (done || ti % vis_steps == 0)
          {
-            cout << "time step: " << ti << ", time: " << t << ", residual: "
-                 << residual << endl;
+            if (myid == 0)
+            {
+               cout << "time step: " << ti << ", time: " << t << ", residual: "
+                    << residual << endl;
+            }
+
+            if (visualization)
+            {
+               int Wx = 0, Wy = 0; // window position
+               int Ww = 400, Wh = 400; // window size
+               VisualizeField(sout, vishost, visport, u, "Solution",
+                              Wx, Wy, Ww, Wh);
+               if (product_sync)
+               {
+                  // Recompute s = u_s / u.
+                  ComputeRatio(pmesh.GetNE(), us, u, s, u_bool_el, u_bool_dofs);
+                  VisualizeField(vis_s, vishost, visport, s, "Solution s",
+                                 Wx + Ww, Wy, Ww, Wh);
+                  VisualizeField(vis_us, vishost, visport, us, "Solution u_s",
+                                 Wx + 2*Ww, Wy, Ww, Wh);
+               }
+            }
+
+            if (visit)
+            {
+               dc->SetCycle(ti);
+               dc->SetTime(t);
+               dc->Save();
+            }
+
+            if (async_writer)
+            {
+               async_writer->Write(ti, t, snap_fields, snap_names,
+                                   snap_us, snap_u, snap_nd);
+            }
          }
 
-         if (visualization)
+         if (chk_steps > 0 && (ti % chk_steps == 0 || done) && serial_lb)
          {
-            int Wx = 0, Wy = 0; // window position
-            int Ww = 400, Wh = 400; // window size
-            VisualizeField(sout, vishost, visport, u, "Solution",
-                           Wx, Wy, Ww, Wh);
-            if (product_sync)
+            PackElementState(pfes, num_fields, S, mesh_pfes, x0, pfes_sub,
+                             x0_sub, sub_per_el, el_vals);
+            SaveElementCheckpoint(comm, chk_file, glob_el, el_vals,
+                                  partitioning, t, ti, dt, mass0);
+         }
+         else if (chk_steps > 0 && (ti % chk_steps == 0 || done))
+         {
+            SaveCheckpoint(comm, chk_file, S, t, ti, dt, mass0, x0, x0_sub);
+         }
+
+         // Repartition when the work of the tasks has become uneven, e.g., when
+         // the material regions or the limited elements have moved. The run
+         // continues in the next pass on the cost-weighted partitioning.
+         if (lb_steps > 0 && ti % lb_steps == 0 && done == false)
+         {
+            const double imbalance = element_costs.Imbalance(comm);
+            if (myid == 0)
+            {
+               cout << "time step: " << ti << ", load imbalance: " << imbalance
+                    << endl;
+            }
+            if (imbalance > lb_tol && serial_lb)
+            {
+               Vector cost;
+               Array<int> new_partitioning;
+               GatherElementCosts(comm, partitioning, element_costs.Costs(),
+                                  cost);
+               PartitionByCost(sfc_order, cost, mpi.WorldSize(),
+                               new_partitioning);
+               PackElementState(pfes, num_fields, S, mesh_pfes, x0, pfes_sub,
+                                x0_sub, sub_per_el, el_vals);
+               const int el_size = ElementStateSize(pfes, num_fields, mesh_pfes,
+                                                    pfes_sub, sub_per_el);
+               RedistributeElementState(comm, glob_el, el_vals, el_size,
+                                        new_partitioning, el_state);
+               partitioning = new_partitioning;
+            }
+            else if (imbalance > lb_tol)
+            {
+               PartitionLocalByCost(comm, element_costs.Costs(), nc_partition);
+            }
+            if (imbalance > lb_tol)
             {
-               // Recompute s = u_s / u.
-               ComputeRatio(pmesh.GetNE(), us, u, s, u_bool_el, u_bool_dofs);
-               VisualizeField(vis_s, vishost, visport, s, "Solution s",
-                              Wx + Ww, Wy, Ww, Wh);
-               VisualizeField(vis_us, vishost, visport, us, "Solution u_s",
-                              Wx + 2*Ww, Wy, Ww, Wh);
+               t_start = t;
+               ti_start = ti;
+               rebalance = true;
+               break;
             }
+            element_costs.Reset();
          }
 
-         if (visit)
+         // Adapt the mesh to the moved features of the solution. The run
+         // continues in the next pass on the adapted mesh.
+         if (amr_steps > 0 && ti % amr_steps == 0 && done == false)
          {
-            dc->SetCycle(ti);
-            dc->SetTime(t);
-            dc->Save();
+            t_start = t;
+            ti_start = ti;
+            remesh = true;
+            break;
          }
       }
-   }
 
-   // Print the final meshes and solution.
-   {
-      ofstream meshHO("meshHO_final.mesh");
-      meshHO.precision(precision);
-      pmesh.PrintAsOne(meshHO);
-      if (subcell_mesh)
-      {
-         ofstream meshLO("meshLO_final.mesh");
-         meshLO.precision(precision);
-         subcell_mesh->PrintAsOne(meshLO);
-      }
-      ofstream sltn("sltn_final.gf");
-      sltn.precision(precision);
-      u.SaveAsOne(sltn);
-   }
-
-   // Check for mass conservation.
-   double mass_u_loc = 0.0, mass_us_loc = 0.0;
-   if (exec_mode == 1)
-   {
-      ml.BilinearForm::operator=(0.0);
-      ml.Assemble();
-      lumpedM.HostRead();
-      ml.SpMat().GetDiag(lumpedM);
-      mass_u_loc = lumpedM * u;
-      if (product_sync) { mass_us_loc = lumpedM * us; }
-   }
-   else
-   {
-      mass_u_loc = masses * u;
-      if (product_sync) { mass_us_loc = masses * us; }
-   }
-   double mass_u, mass_us, s_max;
-   MPI_Allreduce(&mass_u_loc, &mass_u, 1, MPI_DOUBLE, MPI_SUM, comm);
-   const double umax_loc = u.Max();
-   MPI_Allreduce(&umax_loc, &umax, 1, MPI_DOUBLE, MPI_MAX, comm);
-   if (product_sync)
-   {
-      ComputeRatio(pmesh.GetNE(), us, u, s, u_bool_el, u_bool_dofs);
-      const double s_max_loc = s.Max();
-      MPI_Allreduce(&mass_us_loc, &mass_us, 1, MPI_DOUBLE, MPI_SUM, comm);
-      MPI_Allreduce(&s_max_loc, &s_max, 1, MPI_DOUBLE, MPI_MAX, comm);
-   }
-   if (myid == 0)
-   {
-      cout << setprecision(10)
-           << "Final mass u:  " << mass_u << endl
-           << "Max value u:   " << umax << endl << setprecision(6)
-           << "Mass loss u:   " << abs(mass0_u - mass_u) << endl;
-      if (product_sync)
+      if (rebalance || remesh)
       {
-         cout << setprecision(10)
-              << "Final mass us: " << mass_us << endl
-              << "Max value s:   " << s_max << endl << setprecision(6)
-              << "Mass loss us:  " << abs(mass0_us - mass_us) << endl;
+         if (serial_lb == false)
+         {
+            // The fields are moved together with the mesh, and the state of the
+            // next pass is set up from them.
+            Array<FiniteElementSpace *> spaces;
+            Array<GridFunction *> gfs;
+            Array<ParGridFunction *> fields(num_fields);
+            spaces.Append(&pfes);
+            spaces.Append(&mesh_pfes);
+            for (int f = 0; f < num_fields; f++)
+            {
+               S_f.MakeRef(S, offset[f], vsize);
+               fields[f] = new ParGridFunction(&pfes);
+               *fields[f] = S_f;
+               gfs.Append(fields[f]);
+            }
+            gfs.Append(&x0);
+            gfs.Append(&v_gf);
+            if (rebalance)
+            {
+               pmesh.Rebalance(nc_partition);
+               UpdateFESpaces(spaces, gfs);
+            }
+            else
+            {
+               AdaptMeshToSolution(pmesh, *fields[0], spaces, gfs,
+                                   amr_ref_tol, amr_deref_tol);
+            }
+            const int new_vsize = pfes.GetVSize();
+            S_carry.SetSize(num_fields * new_vsize);
+            for (int f = 0; f < num_fields; f++)
+            {
+               fields[f]->Update();
+               S_f.MakeRef(S_carry, f * new_vsize, new_vsize);
+               S_f = *fields[f];
+               delete fields[f];
+            }
+         }
+         if (myid == 0)
+         {
+            cout << (rebalance ? "Repartitioned" : "Adapted")
+                 << " the mesh at time step " << ti_start << ", time "
+                 << t_start << ", elements: " << pmesh.GetGlobalNE() << endl;
+         }
       }
-   }
-
-   // Compute errors, if the initial condition is equal to the final solution
-   if (problem_num == 4) // solid body rotation
-   {
-      double err = u.ComputeLpError(1., u0);
-      if (myid == 0) { cout << "L1-error: " << err << "." << endl; }
-   }
-   else if (problem_num == 7)
-   {
-      FunctionCoefficient u_ex(inflow_function);
-      double e1 = u.ComputeLpError(1., u_ex);
-      double e2 = u.ComputeLpError(2., u_ex);
-      double eInf = u.ComputeLpError(numeric_limits<double>::infinity(), u_ex);
-      if (myid == 0)
+      else
       {
-         cout << "L1-error: " << e1 << "." << endl;
-
-         // write output
-         ofstream file("errors.txt", ios_base::app);
-
-         if (!file)
+         // Print the final meshes and solution.
+         if (par_output)
          {
-            MFEM_ABORT("Error opening file.");
+            SaveParallelOutput(pmesh, "meshHO_final.mesh", &u, "sltn_final.bin",
+                               precision);
+            if (subcell_mesh)
+            {
+               SaveParallelOutput(*subcell_mesh, "meshLO_final.mesh", NULL,
+                                  NULL, precision);
+            }
          }
          else
          {
-            ostringstream strs;
-            strs << e1 << " " << e2 << " " << eInf << "\n";
-            string str = strs.str();
-            file << str;
-            file.close();
+            ofstream meshHO("meshHO_final.mesh");
+            meshHO.precision(precision);
+            pmesh.PrintAsOne(meshHO);
+            if (subcell_mesh)
+            {
+               ofstream meshLO("meshLO_final.mesh");
+               meshLO.precision(precision);
+               subcell_mesh->PrintAsOne(meshLO);
+            }
+            ofstream sltn("sltn_final.gf");
+            sltn.precision(precision);
+            u.SaveAsOne(sltn);
          }
-      }
-   }
 
-   if (smth_indicator)
-   {
-      // Print the values of the smoothness indicator.
-      ParGridFunction si_val;
-      smth_indicator->ComputeSmoothnessIndicator(u, si_val);
-      {
-         ofstream smth("si_final.gf");
-         smth.precision(precision);
-         si_val.SaveAsOne(smth);
-      }
-   }
-
-   // Free the used memory.
-   delete mono_solver;
-   delete fct_solver;
-   delete smth_indicator;
-   delete ho_solver;
-
-   delete ode_solver;
-   delete mesh_fec;
-   delete lom.pk;
-   delete dc;
-
-   if (order > 1)
-   {
-      delete subcell_mesh;
-      delete fec_sub;
-      delete pfes_sub;
-      delete xsub;
-      delete lom.SubFes0;
-      delete lom.SubFes1;
-      delete lom.VolumeTerms;
-   }
-
-   return 0;
-}
+         // Check for mass conservation.
+         double mass_u_loc = 0.0, mass_us_loc = 0.0;
+         if (exec_mode == 1)
+         {
+            ml.BilinearForm::operator=(0.0);
+            ml.Assemble();
+            lumpedM.HostRead();
+            ml.SpMat().GetDiag(lumpedM);
+            mass_u_loc = lumpedM * u;
+            if (product_sync) { mass_us_loc = lumpedM * us; }
+         }
+         else
+         {
+            mass_u_loc = masses * u;
+            if (product_sync) { mass_us_loc = masses * us; }
+         }
+         for (int f = 1; f < num_ind_fields; f++)
+         {
+            S_f.MakeRef(S, offset[f], vsize);
+            mass_f_loc(f) = ((exec_mode == 1) ? lumpedM : masses) * S_f;
+         }
+         MPI_Allreduce(mass_f_loc.HostReadWrite(), mass_f.HostWrite(),
+                       num_ind_fields, MPI_DOUBLE, MPI_SUM, comm);
+         double mass_u, mass_us, s_max;
+         MPI_Allreduce(&mass_u_loc, &mass_u, 1, MPI_DOUBLE, MPI_SUM, comm);
+         const double umax_loc = u.Max();
+         MPI_Allreduce(&umax_loc, &umax, 1, MPI_DOUBLE, MPI_MAX, comm);
+         if (product_sync)
+         {
+            ComputeRatio(pmesh.GetNE(), us, u, s, u_bool_el, u_bool_dofs);
+            const double s_max_loc = s.Max();
+            MPI_Allreduce(&mass_us_loc, &mass_us, 1, MPI_DOUBLE, MPI_SUM, comm);
+            MPI_Allreduce(&s_max_loc, &s_max, 1, MPI_DOUBLE, MPI_MAX, comm);
+         }
+         if (myid == 0)
+         {
+            cout << setprecision(10)
+                 << "Final mass u:  " << mass_u << endl
+                 << "Max value u:   " << umax << endl << setprecision(6)
+                 << "Mass loss u:   " << abs(mass0_u - mass_u) << endl;
+            if (product_sync)
+            {
+               cout << setprecision(10)
+                    << "Final mass us: " << mass_us << endl
+                    << "Max value s:   " << s_max << endl << setprecision(6)
+                    << "Mass loss us:  " << abs(mass0_us - mass_us) << endl;
+            }
+            for (int f = 1; f < num_ind_fields; f++)
+            {
+               cout << setprecision(10)
+                    << "Final mass field " << f << ": " << mass_f(f) << endl
+                    << setprecision(6) << "Mass loss field " << f << ": "
+                    << abs(mass0_f(f) - mass_f(f)) << endl;
+            }
+         }
 
-AdvectionOperator::AdvectionOperator(int size, BilinearForm &Mbf_,
-                                     BilinearForm &_ml, Vector &_lumpedM,
-                                     ParBilinearForm &Kbf_,
-                                     ParBilinearForm &M_HO_, ParBilinearForm &K_HO_,
-                                     GridFunction &pos, GridFunction *sub_pos,
-                                     GridFunction &vel, GridFunction &sub_vel,
-                                     Assembly &_asmbl,
-                                     LowOrderMethod &_lom, DofInfo &_dofs,
-                                     HOSolver *hos, LOSolver *los, FCTSolver *fct,
-                                     MonolithicSolver *mos) :
-   TimeDependentOperator(size), Mbf(Mbf_), ml(_ml), Kbf(Kbf_),
-   M_HO(M_HO_), K_HO(K_HO_),
-   lumpedM(_lumpedM),
-   start_mesh_pos(pos.Size()), start_submesh_pos(sub_vel.Size()),
-   mesh_pos(pos), submesh_pos(sub_pos),
-   mesh_vel(vel), submesh_vel(sub_vel),
-   x_gf(Kbf.ParFESpace()),
-   asmbl(_asmbl), lom(_lom), dofs(_dofs),
-   ho_solver(hos), lo_solver(los), fct_solver(fct), mono_solver(mos) { }
-
-void AdvectionOperator::Mult(const Vector &X, Vector &Y) const
-{
-   if (exec_mode == 1)
-   {
-      // Move the mesh positions.
-      const double t = GetTime();
-      add(start_mesh_pos, t, mesh_vel, mesh_pos);
-      if (submesh_pos)
-      {
-         add(start_submesh_pos, t, submesh_vel, *submesh_pos);
-      }
-      // Reset precomputed geometric data.
-      Mbf.FESpace()->GetMesh()->DeleteGeometricFactors();
-
-      // Reassemble on the new mesh. Element contributions.
-      // Currently needed to have the sparse matrices used by the LO methods.
-      Mbf.BilinearForm::operator=(0.0);
-      Mbf.Assemble();
-      Kbf.BilinearForm::operator=(0.0);
-      Kbf.Assemble(0);
-      ml.BilinearForm::operator=(0.0);
-      ml.Assemble();
-      lumpedM.HostReadWrite();
-      ml.SpMat().GetDiag(lumpedM);
+         perf_timers.Print(comm, num_fields * pfes.GlobalTrueVSize(),
+                           perf_json);
 
-      M_HO.BilinearForm::operator=(0.0);
-      M_HO.Assemble();
-      K_HO.BilinearForm::operator=(0.0);
-      K_HO.Assemble(0);
+#ifdef REMHOS_WORKSPACE_DEBUG
+         if (myid == 0)
+         {
+            cout << "Workspace vector allocations: "
+                 << Workspace::NumAllocations()
+                 << " (" << Workspace::NumAllocations() - first_step_allocs
+                 << " after the first step)" << endl;
+         }
+#endif
 
-      if (lom.pk)
-      {
-         lom.pk->BilinearForm::operator=(0.0);
-         lom.pk->Assemble();
-      }
+         // Compute errors, if the initial condition is equal to the final
+         // solution
+         if (problem_num == 4) // solid body rotation
+         {
+            double err = u.ComputeLpError(1., u0);
+            if (myid == 0) { cout << "L1-error: " << err << "." << endl; }
+         }
+         else if (problem_num == 7)
+         {
+            FunctionCoefficient u_ex(inflow_function);
+            double e1 = u.ComputeLpError(1., u_ex);
+            double e2 = u.ComputeLpError(2., u_ex);
+            double eInf = u.ComputeLpError(numeric_limits<double>::infinity(),
+                                           u_ex);
+            if (myid == 0)
+            {
+               cout << "L1-error: " << e1 << "." << endl;
 
-      // Face contributions.
-      asmbl.bdrInt = 0.;
-      Mesh *mesh = M_HO.FESpace()->GetMesh();
-      const int dim = mesh->Dimension(), ne = mesh->GetNE();
-      Array<int> bdrs, orientation;
-      FaceElementTransformations *Trans;
+               // write output
+               ofstream file("errors.txt", ios_base::app);
 
-      for (int k = 0; k < ne; k++)
-      {
-         if (dim == 1)      { mesh->GetElementVertices(k, bdrs); }
-         else if (dim == 2) { mesh->GetElementEdges(k, bdrs, orientation); }
-         else if (dim == 3) { mesh->GetElementFaces(k, bdrs, orientation); }
+               if (!file)
+               {
+                  MFEM_ABORT("Error opening file.");
+               }
+               else
+               {
+                  ostringstream strs;
+                  strs << e1 << " " << e2 << " " << eInf << "\n";
+                  string str = strs.str();
+                  file << str;
+                  file.close();
+               }
+            }
+         }
 
-         for (int i = 0; i < dofs.numBdrs; i++)
+         if (smth_indicator)
          {
-            Trans = mesh->GetFaceElementTransformations(bdrs[i]);
-            asmbl.ComputeFluxTerms(k, i, Trans, lom);
+            // Print the values of the smoothness indicator.
+            ParGridFunction si_val;
+            smth_indicator->ComputeSmoothnessIndicator(u, si_val);
+            {
+               ofstream smth("si_final.gf");
+               smth.precision(precision);
+               si_val.SaveAsOne(smth);
+            }
          }
       }
-   }
 
-   const int size = Kbf.ParFESpace()->GetVSize();
-   const int NE   = Kbf.ParFESpace()->GetNE();
+      // Free the used memory.
+      delete mono_solver;
+      delete fct_solver;
+      delete smth_indicator;
+      delete ho_solver;
 
-   // Needed because X and Y are allocated on the host by the ODESolver.
-   X.Read(); Y.Read();
-
-   Vector u, d_u;
-   Vector* xptr = const_cast<Vector*>(&X);
-   u.MakeRef(*xptr, 0, size);
-   d_u.MakeRef(Y, 0, size);
-   Vector du_HO(u.Size()), du_LO(u.Size());
-
-   x_gf = u;
-   x_gf.ExchangeFaceNbrData();
-
-   if (mono_solver) { mono_solver->CalcSolution(u, d_u); }
-   else if (fct_solver)
-   {
-      MFEM_VERIFY(ho_solver && lo_solver, "FCT requires HO and LO solvers.");
-
-      lo_solver->CalcLOSolution(u, du_LO);
-      ho_solver->CalcHOSolution(u, du_HO);
-
-      dofs.ComputeElementsMinMax(u, dofs.xe_min, dofs.xe_max, NULL, NULL);
-      dofs.ComputeBounds(dofs.xe_min, dofs.xe_max, dofs.xi_min, dofs.xi_max);
-      fct_solver->CalcFCTSolution(x_gf, lumpedM, du_HO, du_LO,
-                                  dofs.xi_min, dofs.xi_max, d_u);
-   }
-   else if (lo_solver) { lo_solver->CalcLOSolution(u, d_u); }
-   else if (ho_solver) { ho_solver->CalcHOSolution(u, d_u); }
-   else { MFEM_ABORT("No solver was chosen."); }
+      delete anderson;
+      delete remap_asmbl;
+      delete lom.pk;
+      delete dc;
+      delete async_writer;
 
-   d_u.SyncAliasMemory(Y);
-
-   // Remap the product field, if there is a product field.
-   if (X.Size() > size)
-   {
-      Vector us, d_us;
-      us.MakeRef(*xptr, size, size);
-      d_us.MakeRef(Y, size, size);
-
-      x_gf = us;
-      x_gf.ExchangeFaceNbrData();
-
-      if (mono_solver) { mono_solver->CalcSolution(us, d_us); }
-      else if (fct_solver)
+      if (subcell_mesh != &pmesh)
       {
-         MFEM_VERIFY(ho_solver && lo_solver, "FCT requires HO and LO solvers.");
-
-         Vector d_us_HO(us.Size()), d_us_LO(us.Size());
-         lo_solver->CalcLOSolution(us, d_us_LO);
-         ho_solver->CalcHOSolution(us, d_us_HO);
-
-         // Compute the ratio s = us_old / u_old, and old active dofs.
-         Vector s(size);
-         Array<bool> s_bool_el, s_bool_dofs;
-         ComputeRatio(NE, us, u, s, s_bool_el, s_bool_dofs);
-#ifdef REMHOS_FCT_DEBUG
-         ComputeMinMaxS(s, s_bool_dofs, x_gf.ParFESpace()->GetMyRank());
-#endif
-
-         // Bounds for s, based on the old values (and old active dofs).
-         // This doesn't consider s values from the old inactive dofs, because
-         // there were no bounds restriction on them at the previous time step.
-         dofs.ComputeElementsMinMax(s, dofs.xe_min, dofs.xe_max,
-                                    &s_bool_el, &s_bool_dofs);
-         dofs.ComputeBounds(dofs.xe_min, dofs.xe_max,
-                            dofs.xi_min, dofs.xi_max, &s_bool_el);
-
-         // Evolve u and get the new active dofs.
-         Vector u_new(size);
-         add(1.0, u, dt, d_u, u_new);
-         Array<bool> s_bool_el_new, s_bool_dofs_new;
-         ComputeBoolIndicators(NE, u_new, s_bool_el_new, s_bool_dofs_new);
-
-         fct_solver->CalcFCTProduct(x_gf, lumpedM, d_us_HO, d_us_LO,
-                                    dofs.xi_min, dofs.xi_max,
-                                    u_new,
-                                    s_bool_el_new, s_bool_dofs_new, d_us);
-
-#ifdef REMHOS_FCT_DEBUG
-         Vector us_new(size);
-         add(1.0, us, dt, d_us, us_new);
-         int myid = x_gf.ParFESpace()->GetMyRank();
-         ComputeMinMaxS(NE, us_new, u_new, myid);
-         if (myid == 0) { std::cout << " --- " << std::endl; }
-#endif
+         delete subcell_mesh;
+         delete fec_sub;
+         delete pfes_sub;
+         delete xsub;
+         delete lom.SubFes0;
+         delete lom.SubFes1;
+         delete lom.VolumeTerms;
+         delete velocity_sub_q;
       }
-      else if (lo_solver) { lo_solver->CalcLOSolution(us, d_us); }
-      else if (ho_solver) { ho_solver->CalcHOSolution(us, d_us); }
-      else { MFEM_ABORT("No solver was chosen."); }
 
-      d_us.SyncAliasMemory(Y);
+      if (rebalance == false && remesh == false) { break; }
    }
+
+   delete ode_solver;
+   delete motion;
+   delete pmesh_ptr;
+   delete mesh;
+
+   return 0;
 }
 
 // Velocity coefficient
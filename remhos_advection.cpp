@@ -0,0 +1,376 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#include "remhos_advection.hpp"
+#include "remhos_sync.hpp"
+#include "remhos_balance.hpp"
+
+using namespace std;
+
+namespace mfem
+{
+
+AdvectionOperator::AdvectionOperator(int size, BilinearForm &Mbf_,
+                                     BilinearForm &_ml, Vector &_lumpedM,
+                                     ParBilinearForm &Kbf_,
+                                     ParBilinearForm &M_HO_, ParBilinearForm &K_HO_,
+                                     GridFunction &pos, GridFunction *sub_pos,
+                                     GridFunction &vel, GridFunction &sub_vel,
+                                     Assembly &_asmbl,
+                                     LowOrderMethod &_lom, DofInfo &_dofs,
+                                     HOSolver *hos, LOSolver *los, FCTSolver *fct,
+                                     MonolithicSolver *mos,
+                                     RemapAssembler *remap, int mode) :
+   StageOperator(size), Mbf(Mbf_), ml(_ml), Kbf(Kbf_),
+   M_HO(M_HO_), K_HO(K_HO_),
+   lumpedM(_lumpedM),
+   start_mesh_pos(pos.Size()), start_submesh_pos(sub_vel.Size()),
+   mesh_pos(pos), submesh_pos(sub_pos),
+   mesh_vel(vel), submesh_vel(sub_vel),
+   x_gf(Kbf.ParFESpace()), xs_gf(Kbf.ParFESpace()),
+   asmbl(_asmbl), lom(_lom), dofs(_dofs),
+   ho_solver(hos), lo_solver(los), fct_solver(fct), mono_solver(mos),
+   remap_asmbl(remap), exec_mode(mode), el_dt_scale(NULL),
+   product_fields(false), layout(FieldLayout::SoA)
+{
+   if (ho_solver)   { ho_solver->SetWorkspace(work); }
+   if (lo_solver)   { lo_solver->SetWorkspace(work); }
+   if (fct_solver)  { fct_solver->SetWorkspace(work); }
+   if (mono_solver) { mono_solver->SetWorkspace(work); }
+}
+
+void AdvectionOperator::Mult(const Vector &X, Vector &Y) const
+{
+   MultRate(X, Y);
+
+   if (el_dt_scale)
+   {
+      const int size = Kbf.ParFESpace()->GetVSize(),
+                nd = Kbf.ParFESpace()->GetFE(0)->GetDof(),
+                nfields = X.Size() / size, n = Y.Size();
+      const bool soa = (layout == FieldLayout::SoA);
+      const double *d_sc = el_dt_scale->Read();
+      double *d_y = Y.ReadWrite();
+      MFEM_FORALL(j, n,
+      {
+         const int i = soa ? j % size : j / nfields;
+         d_y[j] *= d_sc[i / nd];
+      });
+   }
+}
+
+void AdvectionOperator::MultRate(const Vector &X, Vector &Y) const
+{
+   const int size = Kbf.ParFESpace()->GetVSize(), nfields = X.Size() / size;
+
+   // Needed because X and Y are allocated on the host by the ODESolver.
+   X.Read(); Y.Read();
+
+   // FCT and the monolithic solvers work on SoA fields.
+   if (layout == FieldLayout::AoS && nfields > 1 &&
+       (fct_solver || mono_solver))
+   {
+      WorkVector X_soa(work, X.Size()), Y_soa(work, Y.Size());
+      ConvertFieldLayout(X, layout, X_soa, FieldLayout::SoA, nfields);
+      MultFields(X_soa, Y_soa, FieldLayout::SoA);
+      ConvertFieldLayout(Y_soa, FieldLayout::SoA, Y, layout, nfields);
+   }
+   else { MultFields(X, Y, layout); }
+}
+
+void AdvectionOperator::MultFields(const Vector &X, Vector &Y,
+                                   FieldLayout l) const
+{
+   const int size = Kbf.ParFESpace()->GetVSize();
+
+   Vector u, d_u;
+   Vector* xptr = const_cast<Vector*>(&X);
+   u.MakeRef(*xptr, 0, size);
+   d_u.MakeRef(Y, 0, size);
+
+   // The face-neighbor values of all fields are exchanged once for all
+   // solvers, in one message. They are in transit during the reassembly and
+   // the interior work.
+   const int nfields = X.Size() / size;
+   asmbl.halo.ExchangeBegin(X, nfields, l);
+
+   if (exec_mode == 1)
+   {
+      // Move the mesh positions.
+      const double t = GetTime();
+      add(start_mesh_pos, t, mesh_vel, mesh_pos);
+      if (submesh_pos)
+      {
+         add(start_submesh_pos, t, submesh_vel, *submesh_pos);
+      }
+      // Reset precomputed geometric data.
+      Mbf.FESpace()->GetMesh()->DeleteGeometricFactors();
+
+      // Reassemble on the new mesh, including the face flux terms.
+      MFEM_VERIFY(remap_asmbl, "Remap requires a RemapAssembler.");
+      remap_asmbl->Reassemble(t);
+      if (ho_solver)   { ho_solver->UpdateOperators(); }
+      if (fct_solver)  { fct_solver->UpdateOperators(); }
+      if (mono_solver) { mono_solver->UpdateOperators(); }
+   }
+
+   if (nfields > 1 && fct_solver && mono_solver == NULL)
+   {
+      // FCT of several fields, which are processed together.
+      if (product_fields) { CalcProductFCT(X, Y); }
+      else                { CalcFieldsFCT(X, Y); }
+      return;
+   }
+
+   if (mono_solver)
+   {
+      Vector u_f, d_u_f;
+      for (int f = 0; f < nfields; f++)
+      {
+         u_f.MakeRef(*xptr, f*size, size);
+         d_u_f.MakeRef(Y, f*size, size);
+         CalcMono(u_f, d_u_f);
+         d_u_f.SyncAliasMemory(Y);
+      }
+   }
+   else if (fct_solver)
+   {
+      MFEM_VERIFY(ho_solver && lo_solver, "FCT requires HO and LO solvers.");
+
+      WorkVector du_HO(work, size), du_LO(work, size);
+      CalcLO(u, du_LO, 1);
+      CalcHO(u, du_HO, 1);
+
+      x_gf.MakeRef(Kbf.ParFESpace(), *xptr, 0);
+      x_gf.FaceNbrData() = asmbl.halo.FaceNbrData(u);
+
+      perf_timers.Start(PerfPhase::Bounds);
+      dofs.ComputeElementsMinMax(u, dofs.xe_min, dofs.xe_max, NULL, NULL);
+      dofs.ComputeBounds(dofs.xe_min, dofs.xe_max, dofs.xi_min, dofs.xi_max);
+      perf_timers.Stop(PerfPhase::Bounds);
+
+      PerfRegion perf_fct(PerfPhase::FCT);
+      fct_solver->CalcFCTSolution(x_gf, lumpedM, du_HO, du_LO,
+                                  dofs.xi_min, dofs.xi_max, d_u);
+      d_u.SyncAliasMemory(Y);
+   }
+   else if (lo_solver) { CalcLO(X, Y, nfields, l); }
+   else if (ho_solver) { CalcHO(X, Y, nfields, l); }
+   else { MFEM_ABORT("No solver was chosen."); }
+}
+
+void AdvectionOperator::CalcProductFCT(const Vector &X, Vector &Y) const
+{
+   MFEM_VERIFY(ho_solver && lo_solver, "FCT requires HO and LO solvers.");
+
+   ParFiniteElementSpace *pfes = Kbf.ParFESpace();
+   const int size = pfes->GetVSize(), NE = pfes->GetNE();
+   Vector* xptr = const_cast<Vector*>(&X);
+   Vector u, us, d_u, d_us;
+   u.MakeRef(*xptr, 0, size);
+   us.MakeRef(*xptr, size, size);
+   d_u.MakeRef(Y, 0, size);
+   d_us.MakeRef(Y, size, size);
+
+   // LO solution of u, and HO solutions of u and us together; the halo of
+   // both fields was exchanged in one message. The LO solution of us is only
+   // needed around the new active elements, and is computed below.
+   WorkVector du_HO(work, 2*size), du_LO(work, 2*size);
+   Vector d_u_HO, d_u_LO, d_us_HO, d_us_LO;
+   d_u_HO.MakeRef(du_HO, 0, size);
+   d_u_LO.MakeRef(du_LO, 0, size);
+   d_us_HO.MakeRef(du_HO, size, size);
+   d_us_LO.MakeRef(du_LO, size, size);
+   CalcLO(u, d_u_LO, 1);
+   CalcHO(X, du_HO, 2);
+
+   x_gf.MakeRef(pfes, *xptr, 0);
+   x_gf.FaceNbrData() = asmbl.halo.FaceNbrData(u);
+   xs_gf.MakeRef(pfes, *xptr, size);
+   xs_gf.FaceNbrData() = asmbl.halo.FaceNbrData(us);
+
+   // Compute the ratio s = us_old / u_old, and old active dofs. s is only
+   // needed in the old active elements.
+   WorkVector s(work, size);
+   ComputeBoolIndicators(NE, u, s_bool_el, s_bool_dofs);
+   dofs.GetActiveElementList(s_bool_el, s_list);
+   ComputeRatio(NE, us, u, s, s_bool_el, s_bool_dofs, &s_list);
+#ifdef REMHOS_FCT_DEBUG
+   ComputeMinMaxS(s, s_bool_dofs, pfes->GetMyRank());
+#endif
+
+   // Bounds for u, and for s based on the old values (and old active dofs),
+   // with one communication. The bounds of s don't consider s values from the
+   // old inactive dofs, because there were no bounds restriction on them at
+   // the previous time step. The bounds of s are only filled in the elements
+   // that share a bounds dof with the old active elements, as all the other
+   // elements stay inactive.
+   perf_timers.Start(PerfPhase::Bounds);
+   WorkVector el_min(work, 2*NE), el_max(work, 2*NE),
+              dof_min(work, 2*size), dof_max(work, 2*size);
+   Vector el_min_f, el_max_f;
+   for (int f = 0; f < 2; f++)
+   {
+      el_min_f.MakeRef(el_min, f*NE, NE);
+      el_max_f.MakeRef(el_max, f*NE, NE);
+      if (f == 0)
+      {
+         dofs.ComputeElementsMinMax(u, el_min_f, el_max_f, NULL, NULL);
+      }
+      else
+      {
+         dofs.ComputeElementsMinMax(s, el_min_f, el_max_f,
+                                    &s_bool_el, &s_bool_dofs, &s_list);
+      }
+      el_min_f.SyncAliasMemory(el_min);
+      el_max_f.SyncAliasMemory(el_max);
+   }
+   bounds_active.SetSize(2*NE);
+   s_bool_el.HostRead();
+   for (int k = 0; k < NE; k++)
+   {
+      bounds_active[k] = true;
+      bounds_active[NE + k] = s_bool_el[k];
+   }
+   dofs.GetBoundsElementList(s_bool_el, s_list, s_bounds_list);
+   dofs.ComputeBounds(el_min, el_max, dof_min, dof_max, &bounds_active, 2,
+                      &s_bounds_list);
+   Vector u_min, u_max, s_min, s_max;
+   u_min.MakeRef(dof_min, 0, size);
+   u_max.MakeRef(dof_max, 0, size);
+   s_min.MakeRef(dof_min, size, size);
+   s_max.MakeRef(dof_max, size, size);
+   perf_timers.Stop(PerfPhase::Bounds);
+
+   // FCT for u.
+   perf_timers.Start(PerfPhase::FCT);
+   fct_solver->CalcFCTSolution(x_gf, lumpedM, d_u_HO, d_u_LO,
+                               u_min, u_max, d_u);
+   perf_timers.Stop(PerfPhase::FCT);
+
+   // Evolve u and get the new active dofs.
+   WorkVector u_new(work, size);
+   add(1.0, u, dt, d_u, u_new);
+   ComputeBoolIndicators(NE, u_new, s_bool_el_new, s_bool_dofs_new);
+   dofs.GetActiveElementList(s_bool_el_new, s_list_new);
+
+   CalcLOAt(us, d_us_LO, s_list_new);
+
+   perf_timers.Start(PerfPhase::FCT);
+   fct_solver->CalcFCTProduct(xs_gf, lumpedM, d_us_HO, d_us_LO,
+                              s_min, s_max, u_new,
+                              s_bool_el_new, s_bool_dofs_new, s_list_new,
+                              d_us);
+   perf_timers.Stop(PerfPhase::FCT);
+
+   // The product limiting is an extra pass over each active element.
+   if (element_costs.IsEnabled())
+   {
+      const bool *el_new = s_bool_el_new.HostRead();
+      const int *list = s_list_new.HostRead();
+      for (int e = 0; e < s_list_new.Size(); e++)
+      {
+         if (el_new[list[e]]) { element_costs.Add(list[e], 1.0); }
+      }
+   }
+
+#ifdef REMHOS_FCT_DEBUG
+   Vector us_new(size);
+   add(1.0, us, dt, d_us, us_new);
+   int myid = pfes->GetMyRank();
+   ComputeMinMaxS(NE, us_new, u_new, myid);
+   if (myid == 0) { std::cout << " --- " << std::endl; }
+#endif
+
+   d_u.SyncAliasMemory(Y);
+   d_us.SyncAliasMemory(Y);
+}
+
+void AdvectionOperator::CalcFieldsFCT(const Vector &X, Vector &Y) const
+{
+   MFEM_VERIFY(ho_solver && lo_solver, "FCT requires HO and LO solvers.");
+
+   ParFiniteElementSpace *pfes = Kbf.ParFESpace();
+   const int size = pfes->GetVSize(), NE = pfes->GetNE(),
+             nf = X.Size() / size;
+   Vector* xptr = const_cast<Vector*>(&X);
+
+   WorkVector du_HO(work, nf*size), du_LO(work, nf*size);
+   CalcLO(X, du_LO, nf);
+   CalcHO(X, du_HO, nf);
+
+   // Bounds of all fields, with one communication.
+   perf_timers.Start(PerfPhase::Bounds);
+   WorkVector el_min(work, nf*NE), el_max(work, nf*NE),
+              dof_min(work, nf*size), dof_max(work, nf*size);
+   Vector u_f, el_min_f, el_max_f;
+   for (int f = 0; f < nf; f++)
+   {
+      u_f.MakeRef(*xptr, f*size, size);
+      el_min_f.MakeRef(el_min, f*NE, NE);
+      el_max_f.MakeRef(el_max, f*NE, NE);
+      dofs.ComputeElementsMinMax(u_f, el_min_f, el_max_f, NULL, NULL);
+      el_min_f.SyncAliasMemory(el_min);
+      el_max_f.SyncAliasMemory(el_max);
+   }
+   dofs.ComputeBounds(el_min, el_max, dof_min, dof_max, NULL, nf);
+   perf_timers.Stop(PerfPhase::Bounds);
+
+   PerfRegion perf_fct(PerfPhase::FCT);
+   Vector d_u_HO, d_u_LO, u_min, u_max, d_u;
+   for (int f = 0; f < nf; f++)
+   {
+      x_gf.MakeRef(pfes, *xptr, f*size);
+      x_gf.FaceNbrData() = asmbl.halo.FaceNbrData(x_gf);
+      d_u_HO.MakeRef(du_HO, f*size, size);
+      d_u_LO.MakeRef(du_LO, f*size, size);
+      u_min.MakeRef(dof_min, f*size, size);
+      u_max.MakeRef(dof_max, f*size, size);
+      d_u.MakeRef(Y, f*size, size);
+      fct_solver->CalcFCTSolution(x_gf, lumpedM, d_u_HO, d_u_LO,
+                                  u_min, u_max, d_u);
+      d_u.SyncAliasMemory(Y);
+   }
+}
+
+void AdvectionOperator::StageMult(const Vector &x, const Vector *z,
+                                  double a, double b, double c,
+                                  Vector &y) const
+{
+   // The rate is a workspace temporary, so the integrator keeps no stage
+   // vectors. The solvers still write the full rate; the stage update and the
+   // scaling by the local time steps then form one pass, which reads x, the
+   // rate and z, and writes y.
+   WorkVector f(work, x.Size());
+   MultRate(x, f);
+
+   const int size = Kbf.ParFESpace()->GetVSize(),
+             nd = Kbf.ParFESpace()->GetFE(0)->GetDof(),
+             nfields = x.Size() / size, n = x.Size();
+   const bool use_z = (z != NULL), scale = (el_dt_scale != NULL),
+              soa = (layout == FieldLayout::SoA);
+   const double *X = x.Read(), *F = f.Read(), *Z = use_z ? z->Read() : NULL,
+                *d_sc = scale ? el_dt_scale->Read() : NULL;
+   double *Y = y.ReadWrite();
+   MFEM_FORALL(j, n,
+   {
+      const int i = soa ? j % size : j / nfields;
+      const double c_j = scale ? c * d_sc[i / nd] : c;
+      Y[j] = a * X[j] + c_j * F[j] + (use_z ? b * Z[j] : 0.0);
+   });
+}
+
+} // namespace mfem
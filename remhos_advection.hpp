@@ -0,0 +1,157 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#ifndef MFEM_REMHOS_ADVECTION
+#define MFEM_REMHOS_ADVECTION
+
+#include "mfem.hpp"
+#include "remhos_ho.hpp"
+#include "remhos_lo.hpp"
+#include "remhos_fct.hpp"
+#include "remhos_mono.hpp"
+#include "remhos_tools.hpp"
+#include "remhos_remap.hpp"
+#include "remhos_ode.hpp"
+#include "remhos_perf.hpp"
+
+namespace mfem
+{
+
+// The rate of the DG fields for transport or remap, computed by the chosen
+// HO, LO, FCT or monolithic solvers. Used by the driver and by the remapper.
+class AdvectionOperator : public StageOperator
+{
+private:
+   BilinearForm &Mbf, &ml;
+   ParBilinearForm &Kbf;
+   ParBilinearForm &M_HO, &K_HO;
+   Vector &lumpedM;
+
+   Vector start_mesh_pos, start_submesh_pos;
+   GridFunction &mesh_pos, *submesh_pos, &mesh_vel, &submesh_vel;
+
+   mutable ParGridFunction x_gf, xs_gf;
+
+   double dt;
+   Assembly &asmbl;
+
+   LowOrderMethod &lom;
+   DofInfo &dofs;
+
+   HOSolver *ho_solver;
+   LOSolver *lo_solver;
+   FCTSolver *fct_solver;
+   MonolithicSolver *mono_solver;
+
+   // Reassembles the operators on the moving mesh (remap mode).
+   RemapAssembler *remap_asmbl;
+   // 0 is transport, 1 is remap.
+   const int exec_mode;
+
+   // Ratios of the local time steps of the elements and dt, or NULL.
+   const Vector *el_dt_scale;
+
+   // Temporaries that are reused in every call of Mult().
+   mutable Workspace work;
+   mutable Array<bool> s_bool_el, s_bool_dofs, s_bool_el_new, s_bool_dofs_new;
+   mutable Array<bool> bounds_active;
+   // The old and the new active elements of the product remap with their
+   // face neighbors, and the elements whose bounds depend on the old ones.
+   mutable Array<int> s_list, s_list_new, s_bounds_list;
+
+   // The fields of the state are the product remap fields u and u_s, or
+   // independent fields, stored with the given layout.
+   bool product_fields;
+   FieldLayout layout;
+
+   // Timed solver calls for nfields fields, stored with layout l.
+   void CalcLO(const Vector &u, Vector &du, int nfields,
+               FieldLayout l = FieldLayout::SoA) const
+   {
+      PerfRegion perf(PerfPhase::LO);
+      lo_solver->CalcLOSolutions(u, du, nfields, l);
+   }
+   void CalcLOAt(const Vector &u, Vector &du, const Array<int> &elems) const
+   {
+      PerfRegion perf(PerfPhase::LO);
+      lo_solver->CalcLOSolutionAt(u, du, elems);
+   }
+   void CalcHO(const Vector &u, Vector &du, int nfields,
+               FieldLayout l = FieldLayout::SoA) const
+   {
+      PerfRegion perf(PerfPhase::HO);
+      ho_solver->CalcHOSolutions(u, du, nfields, l);
+   }
+   void CalcMono(const Vector &u, Vector &du) const
+   {
+      PerfRegion perf(PerfPhase::Mono);
+      mono_solver->CalcSolution(u, du);
+   }
+
+   // Mult() without the scaling by the local time steps, which the callers
+   // apply in their final pass over the rate.
+   void MultRate(const Vector &x, Vector &y) const;
+   // Mult() for the fields of x stored with layout l.
+   void MultFields(const Vector &x, Vector &y, FieldLayout l) const;
+
+   // FCT solution of the product remap, with u and u_s handled together.
+   void CalcProductFCT(const Vector &x, Vector &y) const;
+   // FCT solution of independent SoA fields; the LO and HO solutions and the
+   // bounds of all fields are computed together.
+   void CalcFieldsFCT(const Vector &x, Vector &y) const;
+
+public:
+   AdvectionOperator(int size, BilinearForm &Mbf_, BilinearForm &_ml,
+                     Vector &_lumpedM,
+                     ParBilinearForm &Kbf_,
+                     ParBilinearForm &M_HO_, ParBilinearForm &K_HO_,
+                     GridFunction &pos, GridFunction *sub_pos,
+                     GridFunction &vel, GridFunction &sub_vel,
+                     Assembly &_asmbl, LowOrderMethod &_lom, DofInfo &_dofs,
+                     HOSolver *hos, LOSolver *los, FCTSolver *fct,
+                     MonolithicSolver *mos, RemapAssembler *remap,
+                     int mode);
+
+   virtual void Mult(const Vector &x, Vector &y) const;
+
+   virtual void StageMult(const Vector &x, const Vector *z,
+                          double a, double b, double c, Vector &y) const;
+
+   virtual void SetDt(double _dt)
+   {
+      dt = _dt;
+      if (fct_solver) { fct_solver->UpdateTimeStep(dt); }
+   }
+   void SetFields(bool product, FieldLayout l)
+   {
+      product_fields = product;
+      layout = l;
+   }
+   // With local time steps, the rate of each element is multiplied by its
+   // scale, so that a step of size dt advances it by its own time step.
+   void SetLocalTimeSteps(const Vector *el_scale) { el_dt_scale = el_scale; }
+   void SetRemapStartPos(const Vector &m_pos, const Vector &sm_pos)
+   {
+      start_mesh_pos    = m_pos;
+      start_submesh_pos = sm_pos;
+   }
+
+   virtual ~AdvectionOperator() { }
+};
+
+} // namespace mfem
+
+#endif // MFEM_REMHOS_ADVECTION
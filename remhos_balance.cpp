@@ -0,0 +1,297 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+
+#include "remhos_balance.hpp"
+
+using namespace std;
+
+namespace mfem
+{
+
+ElementCosts element_costs;
+
+double ElementCosts::Imbalance(MPI_Comm comm) const
+{
+   int num_procs;
+   MPI_Comm_size(comm, &num_procs);
+   const double loc = cost.Sum();
+   double max_cost, sum_cost;
+   MPI_Allreduce(&loc, &max_cost, 1, MPI_DOUBLE, MPI_MAX, comm);
+   MPI_Allreduce(&loc, &sum_cost, 1, MPI_DOUBLE, MPI_SUM, comm);
+   const double avg_cost = sum_cost / num_procs;
+   return (avg_cost > 0.0) ? max_cost / avg_cost : 1.0;
+}
+
+void GetCurveOrder(Mesh &mesh, Array<int> &sfc_order)
+{
+   // The ordering gives the position of each element along the curve.
+   Array<int> ordering;
+   mesh.GetHilbertElementOrdering(ordering);
+   sfc_order.SetSize(ordering.Size());
+   for (int e = 0; e < ordering.Size(); e++) { sfc_order[ordering[e]] = e; }
+}
+
+void GetGlobalElements(const Array<int> &partitioning, int rank,
+                       Array<int> &glob_el)
+{
+   glob_el.SetSize(0);
+   for (int g = 0; g < partitioning.Size(); g++)
+   {
+      if (partitioning[g] == rank) { glob_el.Append(g); }
+   }
+}
+
+void GatherElementCosts(MPI_Comm comm, const Array<int> &partitioning,
+                        const Vector &local_cost, Vector &cost)
+{
+   int myid;
+   MPI_Comm_rank(comm, &myid);
+   Array<int> glob_el;
+   GetGlobalElements(partitioning, myid, glob_el);
+   MFEM_VERIFY(glob_el.Size() == local_cost.Size(),
+               "The local elements don't match the partitioning.");
+
+   cost.SetSize(partitioning.Size());
+   cost = 0.0;
+   const double *h_loc = local_cost.HostRead();
+   double *h_cost = cost.HostReadWrite();
+   for (int e = 0; e < glob_el.Size(); e++) { h_cost[glob_el[e]] = h_loc[e]; }
+   MPI_Allreduce(MPI_IN_PLACE, h_cost, cost.Size(), MPI_DOUBLE, MPI_SUM,
+                 comm);
+}
+
+void PartitionByCost(const Array<int> &sfc_order, const Vector &cost,
+                     int num_parts, Array<int> &partitioning)
+{
+   const int ne = sfc_order.Size();
+   MFEM_VERIFY(ne >= num_parts, "There are fewer elements than parts.");
+   const double total = cost.Sum();
+
+   partitioning.SetSize(ne);
+   double acc = 0.0;
+   for (int i = 0, part = -1; i < ne; i++)
+   {
+      const int e = sfc_order[i];
+      // The part that contains the middle of the element's cost. The parts
+      // advance at most by one per element, and the remaining elements must
+      // be enough for the remaining parts.
+      int p = (total > 0.0) ? (int) ((acc + 0.5 * cost(e)) * num_parts / total)
+              : (int) ((long long) i * num_parts / ne);
+      p = min(max(p, part), part + 1);
+      p = min(max(p, num_parts - (ne - i)), num_parts - 1);
+      partitioning[e] = part = p;
+      acc += cost(e);
+   }
+}
+
+void PartitionLocalByCost(MPI_Comm comm, const Vector &cost,
+                          Array<int> &partition)
+{
+   int myid, num_procs;
+   MPI_Comm_rank(comm, &myid);
+   MPI_Comm_size(comm, &num_procs);
+   const int ne = cost.Size();
+   const double loc = cost.Sum();
+   double acc = 0.0, total;
+   MPI_Exscan(&loc, &acc, 1, MPI_DOUBLE, MPI_SUM, comm);
+   if (myid == 0) { acc = 0.0; }
+   MPI_Allreduce(&loc, &total, 1, MPI_DOUBLE, MPI_SUM, comm);
+
+   partition.SetSize(ne);
+   const double *h_cost = cost.HostRead();
+   for (int e = 0; e < ne; e++)
+   {
+      // The part that contains the middle of the element's cost.
+      const int p = (total > 0.0) ?
+                    (int) ((acc + 0.5 * h_cost[e]) * num_procs / total) : myid;
+      partition[e] = min(max(p, 0), num_procs - 1);
+      acc += h_cost[e];
+   }
+}
+
+void RedistributeElementState(MPI_Comm comm, const Array<int> &glob_el,
+                              const Vector &el_vals, int el_size,
+                              const Array<int> &new_partitioning,
+                              Vector &new_el_vals)
+{
+   int myid, num_procs;
+   MPI_Comm_rank(comm, &myid);
+   MPI_Comm_size(comm, &num_procs);
+   const int ne = glob_el.Size();
+   MFEM_VERIFY(el_vals.Size() == ne * el_size,
+               "Wrong size of the element data.");
+
+   // The local elements, grouped by their new task.
+   Array<int> send_cnt(num_procs), send_off(num_procs + 1);
+   send_cnt = 0;
+   for (int e = 0; e < ne; e++) { send_cnt[new_partitioning[glob_el[e]]]++; }
+   send_off[0] = 0;
+   for (int p = 0; p < num_procs; p++)
+   {
+      send_off[p + 1] = send_off[p] + send_cnt[p];
+   }
+   Array<int> send_ids(ne), pos(num_procs);
+   Vector send_vals(ne * el_size);
+   const double *h_vals = el_vals.HostRead();
+   double *h_send = send_vals.HostWrite();
+   for (int p = 0; p < num_procs; p++) { pos[p] = send_off[p]; }
+   for (int e = 0; e < ne; e++)
+   {
+      const int i = pos[new_partitioning[glob_el[e]]]++;
+      send_ids[i] = glob_el[e];
+      for (int j = 0; j < el_size; j++)
+      {
+         h_send[i*el_size + j] = h_vals[e*el_size + j];
+      }
+   }
+
+   Array<int> recv_cnt(num_procs), recv_off(num_procs + 1);
+   MPI_Alltoall(send_cnt.GetData(), 1, MPI_INT, recv_cnt.GetData(), 1,
+                MPI_INT, comm);
+   recv_off[0] = 0;
+   for (int p = 0; p < num_procs; p++)
+   {
+      recv_off[p + 1] = recv_off[p] + recv_cnt[p];
+   }
+   const int nr = recv_off[num_procs];
+   Array<int> recv_ids(nr);
+   MPI_Alltoallv(send_ids.GetData(), send_cnt.GetData(), send_off.GetData(),
+                 MPI_INT, recv_ids.GetData(), recv_cnt.GetData(),
+                 recv_off.GetData(), MPI_INT, comm);
+
+   // The values are sent as el_size doubles per element.
+   Array<int> send_vcnt(num_procs), send_voff(num_procs),
+              recv_vcnt(num_procs), recv_voff(num_procs);
+   for (int p = 0; p < num_procs; p++)
+   {
+      send_vcnt[p] = send_cnt[p] * el_size;
+      send_voff[p] = send_off[p] * el_size;
+      recv_vcnt[p] = recv_cnt[p] * el_size;
+      recv_voff[p] = recv_off[p] * el_size;
+   }
+   Vector recv_vals(nr * el_size);
+   MPI_Alltoallv(h_send, send_vcnt.GetData(), send_voff.GetData(),
+                 MPI_DOUBLE, recv_vals.HostWrite(), recv_vcnt.GetData(),
+                 recv_voff.GetData(), MPI_DOUBLE, comm);
+
+   // The new local elements are in the order of their serial indices.
+   Array<int> new_glob_el;
+   GetGlobalElements(new_partitioning, myid, new_glob_el);
+   MFEM_VERIFY(new_glob_el.Size() == nr,
+               "The received elements don't match the partitioning.");
+   new_el_vals.SetSize(nr * el_size);
+   const double *h_recv = recv_vals.HostRead();
+   double *h_new = new_el_vals.HostWrite();
+   for (int r = 0; r < nr; r++)
+   {
+      const int e = new_glob_el.FindSorted(recv_ids[r]);
+      MFEM_VERIFY(e >= 0, "Unknown element " << recv_ids[r]);
+      for (int j = 0; j < el_size; j++)
+      {
+         h_new[e*el_size + j] = h_recv[r*el_size + j];
+      }
+   }
+}
+
+int ElementStateSize(const ParFiniteElementSpace &pfes, int num_fields,
+                     const ParFiniteElementSpace &x_fes,
+                     const ParFiniteElementSpace *x_sub_fes, int sub_per_el)
+{
+   int size = num_fields * pfes.GetFE(0)->GetDof() +
+              x_fes.GetVDim() * x_fes.GetFE(0)->GetDof();
+   if (x_sub_fes)
+   {
+      size += sub_per_el * x_sub_fes->GetVDim() * x_sub_fes->GetFE(0)->GetDof();
+   }
+   return size;
+}
+
+void PackElementState(const ParFiniteElementSpace &pfes, int num_fields,
+                      const Vector &S, const ParFiniteElementSpace &x_fes,
+                      const Vector &x_vals,
+                      const ParFiniteElementSpace *x_sub_fes,
+                      const Vector &x_sub_vals, int sub_per_el,
+                      Vector &el_vals)
+{
+   const int ne = pfes.GetNE(), nd = pfes.GetFE(0)->GetDof(),
+             vsize = pfes.GetVSize(),
+             size = ElementStateSize(pfes, num_fields, x_fes, x_sub_fes,
+                                     sub_per_el);
+   el_vals.SetSize(ne * size);
+   const double *h_S = S.HostRead();
+   double *h_vals = el_vals.HostWrite();
+   Array<int> vdofs;
+   Vector x_loc;
+   for (int e = 0; e < ne; e++)
+   {
+      double *v = h_vals + e * size;
+      for (int f = 0; f < num_fields; f++)
+      {
+         for (int i = 0; i < nd; i++) { *(v++) = h_S[f*vsize + e*nd + i]; }
+      }
+      x_fes.GetElementVDofs(e, vdofs);
+      x_vals.GetSubVector(vdofs, x_loc);
+      for (int i = 0; i < x_loc.Size(); i++) { *(v++) = x_loc(i); }
+      for (int j = 0; x_sub_fes && j < sub_per_el; j++)
+      {
+         x_sub_fes->GetElementVDofs(e * sub_per_el + j, vdofs);
+         x_sub_vals.GetSubVector(vdofs, x_loc);
+         for (int i = 0; i < x_loc.Size(); i++) { *(v++) = x_loc(i); }
+      }
+   }
+}
+
+void UnpackElementState(const ParFiniteElementSpace &pfes, int num_fields,
+                        const Vector &el_vals, Vector &S,
+                        const ParFiniteElementSpace &x_fes, Vector &x_vals,
+                        const ParFiniteElementSpace *x_sub_fes,
+                        Vector &x_sub_vals, int sub_per_el)
+{
+   const int ne = pfes.GetNE(), nd = pfes.GetFE(0)->GetDof(),
+             vsize = pfes.GetVSize(),
+             size = ElementStateSize(pfes, num_fields, x_fes, x_sub_fes,
+                                     sub_per_el);
+   MFEM_VERIFY(el_vals.Size() == ne * size, "Wrong size of the element data.");
+   const double *h_vals = el_vals.HostRead();
+   double *h_S = S.HostReadWrite();
+   x_vals.HostReadWrite();
+   if (x_sub_fes) { x_sub_vals.HostReadWrite(); }
+   Array<int> vdofs;
+   Vector x_loc;
+   for (int e = 0; e < ne; e++)
+   {
+      const double *v = h_vals + e * size;
+      for (int f = 0; f < num_fields; f++)
+      {
+         for (int i = 0; i < nd; i++) { h_S[f*vsize + e*nd + i] = *(v++); }
+      }
+      // Shared nodes get the same value from all their elements.
+      x_fes.GetElementVDofs(e, vdofs);
+      x_loc.SetSize(vdofs.Size());
+      for (int i = 0; i < x_loc.Size(); i++) { x_loc(i) = *(v++); }
+      x_vals.SetSubVector(vdofs, x_loc);
+      for (int j = 0; x_sub_fes && j < sub_per_el; j++)
+      {
+         x_sub_fes->GetElementVDofs(e * sub_per_el + j, vdofs);
+         x_loc.SetSize(vdofs.Size());
+         for (int i = 0; i < x_loc.Size(); i++) { x_loc(i) = *(v++); }
+         x_sub_vals.SetSubVector(vdofs, x_loc);
+      }
+   }
+}
+
+} // namespace mfem
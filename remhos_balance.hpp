@@ -0,0 +1,112 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#ifndef MFEM_REMHOS_BALANCE
+#define MFEM_REMHOS_BALANCE
+
+#include "mfem.hpp"
+
+namespace mfem
+{
+
+// Work of the local elements, accumulated between two checks of the load
+// balance. The driver adds a unit cost per element and time step, and the
+// solvers add the iterations that they spend on single elements. Disabled by
+// default, so that Add() costs nothing in regular runs.
+class ElementCosts
+{
+private:
+   bool enabled;
+   Vector cost;
+
+public:
+   ElementCosts() : enabled(false) { }
+
+   void Enable(int ne) { enabled = true; cost.SetSize(ne); cost = 0.0; }
+   bool IsEnabled() const { return enabled; }
+
+   void Add(int e, double w) { if (enabled) { cost(e) += w; } }
+   void AddAll(double w) { if (enabled) { cost += w; } }
+   void Reset() { cost = 0.0; }
+   const Vector &Costs() const { return cost; }
+
+   // Ratio of the maximum and the average total cost of the tasks.
+   double Imbalance(MPI_Comm comm) const;
+};
+
+// The element costs of the run, set up by the driver.
+extern ElementCosts element_costs;
+
+// Elements of the mesh in the order of a Hilbert curve through their centers.
+void GetCurveOrder(Mesh &mesh, Array<int> &sfc_order);
+
+// Local element i of a task is the i-th element of the serial mesh that is
+// assigned to the task by partitioning, as in the ParMesh constructor. Returns
+// the serial indices of the local elements.
+void GetGlobalElements(const Array<int> &partitioning, int rank,
+                       Array<int> &glob_el);
+
+// Sums the local costs of all tasks into cost, indexed by the elements of the
+// serial mesh.
+void GatherElementCosts(MPI_Comm comm, const Array<int> &partitioning,
+                        const Vector &local_cost, Vector &cost);
+
+// Splits the elements of the serial mesh, ordered along the space filling
+// curve sfc_order, into num_parts contiguous pieces of about equal cost. Every
+// part gets at least one element.
+void PartitionByCost(const Array<int> &sfc_order, const Vector &cost,
+                     int num_parts, Array<int> &partitioning);
+
+// Splits the local elements of a nonconforming mesh into parts of about equal
+// cost, like PartitionByCost(). The elements of such a mesh are ordered along
+// a space filling curve over all tasks, so the part of each local element is
+// given by the cost of the elements before it on the curve. Returns the new
+// task of each local element.
+void PartitionLocalByCost(MPI_Comm comm, const Vector &cost,
+                          Array<int> &partition);
+
+// Sends the values of the local elements, el_size values per element, stored
+// as by PackElementState() for the elements glob_el of the serial mesh, to
+// the tasks of new_partitioning. new_el_vals has the values of the elements
+// of the task in new_partitioning, in the order of GetGlobalElements().
+void RedistributeElementState(MPI_Comm comm, const Array<int> &glob_el,
+                              const Vector &el_vals, int el_size,
+                              const Array<int> &new_partitioning,
+                              Vector &new_el_vals);
+
+// Copies the values of the local elements to el_vals, which stores the values
+// of each element contiguously, and back. The values are those of the
+// num_fields blocks of the element-contiguous DG state S, of the mesh
+// positions x_vals on x_fes and, if x_sub_fes isn't NULL, of the subcell mesh
+// positions x_sub_vals, with sub_per_el consecutive subcells in each element.
+int ElementStateSize(const ParFiniteElementSpace &pfes, int num_fields,
+                     const ParFiniteElementSpace &x_fes,
+                     const ParFiniteElementSpace *x_sub_fes, int sub_per_el);
+void PackElementState(const ParFiniteElementSpace &pfes, int num_fields,
+                      const Vector &S, const ParFiniteElementSpace &x_fes,
+                      const Vector &x_vals,
+                      const ParFiniteElementSpace *x_sub_fes,
+                      const Vector &x_sub_vals, int sub_per_el,
+                      Vector &el_vals);
+void UnpackElementState(const ParFiniteElementSpace &pfes, int num_fields,
+                        const Vector &el_vals, Vector &S,
+                        const ParFiniteElementSpace &x_fes, Vector &x_vals,
+                        const ParFiniteElementSpace *x_sub_fes,
+                        Vector &x_sub_vals, int sub_per_el);
+
+} // namespace mfem
+
+#endif // MFEM_REMHOS_BALANCE
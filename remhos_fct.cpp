@@ -16,6 +16,7 @@
 
 #include "remhos_fct.hpp"
 #include "remhos_tools.hpp"
+#include "remhos_kernels.hpp"
 #include "remhos_sync.hpp"
 
 using namespace std;
@@ -23,6 +24,310 @@ using namespace std;
 namespace mfem
 {
 
+FluxBasedFCT::FluxBasedFCT(ParFiniteElementSpace &space,
+                           SmoothnessIndicator *si, double delta_t,
+                           ParBilinearForm &adv_form,
+                           ParBilinearForm &mass_form,
+                           const DofInfo &dof_info, int fct_iterations)
+   : FCTSolver(space, si, delta_t), K(adv_form), M(mass_form),
+     dofs(dof_info), iter_cnt(fct_iterations),
+     alpha_halo(space, dof_info),
+     stamp(0), restricted(false)
+{
+   // The face fluxes pair each face dof with a single neighbor dof.
+   MFEM_VERIFY(space.GetParMesh()->Nonconforming() == false,
+               "Flux-based FCT requires a conforming mesh.");
+   MFEM_VERIFY(M.GetDBFI()->Size() == 1,
+               "The mass form must have one integrator.");
+
+   const int NE = pfes.GetNE(), s = pfes.GetVSize();
+   nd = pfes.GetFE(0)->GetDof();
+   num_pairs = nd * (nd - 1) / 2;
+   pair_i.SetSize(num_pairs);
+   pair_j.SetSize(num_pairs);
+   for (int i = 0, p = 0; i < nd; i++)
+   {
+      for (int j = i + 1; j < nd; j++, p++)
+      {
+         pair_i[p] = i;
+         pair_j[p] = j;
+      }
+   }
+
+   // Pairs of the face dofs of neighboring elements. Each local face is taken
+   // from the element with the smaller index.
+   const int nbdr = dofs.numBdrs, nfd = dofs.numFaceDofs;
+   for (int k = 0; k < NE; k++)
+   {
+      for (int f = 0; f < nbdr; f++)
+      {
+         const int *f_dof = dofs.face_dof.HostRead() + (k*nbdr + f)*nfd,
+                    *f_nbr = dofs.face_nbr.HostRead() + (k*nbdr + f)*nfd;
+         const int src = dofs.face_src.HostRead()[(k*nbdr + f)*nfd];
+         if (src == DofInfo::INFLOW) { continue; }
+         if (src == DofInfo::LOCAL && f_nbr[0] / nd <= k) { continue; }
+         for (int i = 0; i < nfd; i++)
+         {
+            for (int j = 0; j < nfd; j++)
+            {
+               face_i.Append(f_dof[i]);
+               face_j.Append((src == DofInfo::LOCAL) ? f_nbr[j]
+                             : s + f_nbr[j]);
+            }
+         }
+      }
+   }
+
+   // Face pairs of each dof, ordered by the pair index.
+   const int nfp = face_i.Size();
+   dof_face_I.SetSize(s + 1);
+   dof_face_I = 0;
+   for (int p = 0; p < nfp; p++)
+   {
+      dof_face_I[face_i[p] + 1]++;
+      if (face_j[p] < s) { dof_face_I[face_j[p] + 1]++; }
+   }
+   dof_face_I.PartialSum();
+   dof_face_J.SetSize(dof_face_I[s]);
+   Array<int> pos(s);
+   for (int i = 0; i < s; i++) { pos[i] = dof_face_I[i]; }
+   for (int p = 0; p < nfp; p++)
+   {
+      dof_face_J[pos[face_i[p]]++] = 2*p;
+      if (face_j[p] < s) { dof_face_J[pos[face_j[p]]++] = 2*p + 1; }
+   }
+
+   pair_stamp.SetSize(nfp);
+   pair_stamp = -1;
+   el_stamp.SetSize(NE);
+   el_stamp = -1;
+
+   el_d.SetSize(NE * num_pairs);
+   el_m.SetSize(NE * num_pairs);
+   face_d.SetSize(face_i.Size());
+   flux_sums.SetSize(2 * s);
+   alpha.SetSize(2 * s);
+   if (K.GetAssemblyLevel() == AssemblyLevel::PARTIAL ||
+       M.GetAssemblyLevel() == AssemblyLevel::PARTIAL)
+   {
+      K_el.SetSize(nd, nd, NE);
+   }
+   else { ComputePositions(); }
+   UpdateOperators();
+}
+
+// Position of entry (i, j) in the CSR values of A, or -1 if it isn't stored.
+static int FindPosition(const SparseMatrix &A, int i, int j)
+{
+   if (i >= A.Height()) { return -1; }
+   const int *I = A.GetI(), *J = A.GetJ();
+   for (int q = I[i]; q < I[i+1]; q++)
+   {
+      if (J[q] == j) { return q; }
+   }
+   return -1;
+}
+
+void FluxBasedFCT::ComputePositions()
+{
+   // With the neighbor block kept, the rows and the columns of K past the
+   // local size are the face-neighbor dofs, as the j sides of the face pairs.
+   const SparseMatrix &K_mat = K.SpMat(), &M_mat = M.SpMat();
+   MFEM_VERIFY(K_mat.Finalized() && M_mat.Finalized(),
+               "The matrices must be finalized.");
+   const int NE = pfes.GetNE(), nfp = face_i.Size();
+   el_k_pos.SetSize(2 * NE * num_pairs);
+   el_m_pos.SetSize(NE * num_pairs);
+   face_k_pos.SetSize(2 * nfp);
+   for (int k = 0; k < NE; k++)
+   {
+      for (int p = 0; p < num_pairs; p++)
+      {
+         const int e = k*num_pairs + p,
+                   i = k*nd + pair_i[p], j = k*nd + pair_j[p];
+         el_k_pos[2*e]     = FindPosition(K_mat, i, j);
+         el_k_pos[2*e + 1] = FindPosition(K_mat, j, i);
+         el_m_pos[e]       = FindPosition(M_mat, i, j);
+      }
+   }
+   for (int p = 0; p < nfp; p++)
+   {
+      face_k_pos[2*p]     = FindPosition(K_mat, face_i[p], face_j[p]);
+      face_k_pos[2*p + 1] = FindPosition(K_mat, face_j[p], face_i[p]);
+   }
+}
+
+void FluxBasedFCT::UpdateOperators()
+{
+   if (el_m_pos.Size() > 0) { UpdateFromMatrices(); }
+   else                     { UpdateFromIntegrators(); }
+}
+
+void FluxBasedFCT::UpdateFromMatrices()
+{
+   const int n_el = el_m_pos.Size(), nfp = face_i.Size();
+   const int *KP = el_k_pos.Read(), *MP = el_m_pos.Read(),
+              *FP = face_k_pos.Read();
+   const double *K_data = K.SpMat().ReadData(),
+                *M_data = M.SpMat().ReadData();
+   double *d = el_d.Write(), *m_ij = el_m.Write();
+   MFEM_FORALL(e, n_el,
+   {
+      const double kij = (KP[2*e] >= 0) ? K_data[KP[2*e]] : 0.0,
+                   kji = (KP[2*e+1] >= 0) ? K_data[KP[2*e+1]] : 0.0;
+      d[e] = fmax(fmax(0.0, -kij), -kji);
+      m_ij[e] = (MP[e] >= 0) ? M_data[MP[e]] : 0.0;
+   });
+
+   double *fd = face_d.Write();
+   MFEM_FORALL(p, nfp,
+   {
+      const double kij = (FP[2*p] >= 0) ? K_data[FP[2*p]] : 0.0,
+                   kji = (FP[2*p+1] >= 0) ? K_data[FP[2*p+1]] : 0.0;
+      fd[p] = fmax(fmax(0.0, -kij), -kji);
+   });
+}
+
+void FluxBasedFCT::UpdateFromIntegrators()
+{
+   ParMesh *pmesh = pfes.GetParMesh();
+   const int NE = pfes.GetNE(), dim = pmesh->Dimension(), s = pfes.GetVSize();
+   BilinearFormIntegrator *mass_int = (*M.GetDBFI())[0];
+   Array<BilinearFormIntegrator*> &dbfi = *K.GetDBFI(),
+                                   &fbfi = *K.GetFBFI(),
+                                   &bfbfi = *K.GetBFBFI();
+   DenseMatrix elmat, face_mat, K_k;
+
+   // Mass pairs and the element blocks of K.
+   K_el = 0.0;
+   for (int k = 0; k < NE; k++)
+   {
+      const FiniteElement &fe = *pfes.GetFE(k);
+      ElementTransformation *T = pmesh->GetElementTransformation(k);
+      mass_int->AssembleElementMatrix(fe, *T, elmat);
+      for (int p = 0; p < num_pairs; p++)
+      {
+         el_m(k*num_pairs + p) = elmat(pair_i[p], pair_j[p]);
+      }
+      K_k.UseExternalData(K_el.GetData(k), nd, nd);
+      for (int i = 0; i < dbfi.Size(); i++)
+      {
+         dbfi[i]->AssembleElementMatrix(fe, *T, elmat);
+         K_k += elmat;
+      }
+   }
+   for (int b = 0; b < pmesh->GetNBE() && bfbfi.Size() > 0; b++)
+   {
+      FaceElementTransformations *T = pmesh->GetBdrFaceTransformations(b);
+      if (T == NULL) { continue; }
+      const FiniteElement &fe = *pfes.GetFE(T->Elem1No);
+      K_k.UseExternalData(K_el.GetData(T->Elem1No), nd, nd);
+      for (int i = 0; i < bfbfi.Size(); i++)
+      {
+         bfbfi[i]->AssembleFaceMatrix(fe, fe, *T, elmat);
+         K_k += elmat;
+      }
+   }
+
+   // Local number of each shared face.
+   Array<int> shared_face(pmesh->GetNumFaces());
+   shared_face = -1;
+   for (int sf = 0; sf < pmesh->GetNSharedFaces(); sf++)
+   {
+      shared_face[pmesh->GetSharedFace(sf)] = sf;
+   }
+
+   // Face terms, visited in the order of the face pairs. The terms between
+   // dofs of one element go to its block of K.
+   const int nbdr = dofs.numBdrs, nfd = dofs.numFaceDofs;
+   Array<int> bdrs, orientation, nbr_vdofs;
+   DenseMatrix K_n;
+   int fp = 0;
+   for (int k = 0; k < NE; k++)
+   {
+      if (dim == 1)      { pmesh->GetElementVertices(k, bdrs); }
+      else if (dim == 2) { pmesh->GetElementEdges(k, bdrs, orientation); }
+      else if (dim == 3) { pmesh->GetElementFaces(k, bdrs, orientation); }
+
+      for (int f = 0; f < nbdr; f++)
+      {
+         const int *f_nbr = dofs.face_nbr.HostRead() + (k*nbdr + f)*nfd;
+         const int src = dofs.face_src.HostRead()[(k*nbdr + f)*nfd];
+         if (src == DofInfo::INFLOW) { continue; }
+         if (src == DofInfo::LOCAL && f_nbr[0] / nd <= k) { continue; }
+
+         // Offsets of the rows of k and of its neighbor in the face matrix.
+         FaceElementTransformations *T;
+         int off_k = 0, off_n = nd, kn = -1;
+         face_mat.SetSize(2*nd);
+         face_mat = 0.0;
+         if (src == DofInfo::LOCAL)
+         {
+            kn = f_nbr[0] / nd;
+            T = pmesh->GetFaceElementTransformations(bdrs[f]);
+            if (T->Elem1No != k) { off_k = nd; off_n = 0; }
+            for (int i = 0; i < fbfi.Size(); i++)
+            {
+               fbfi[i]->AssembleFaceMatrix(*pfes.GetFE(T->Elem1No),
+                                           *pfes.GetFE(T->Elem2No),
+                                           *T, elmat);
+               face_mat += elmat;
+            }
+            K_n.UseExternalData(K_el.GetData(kn), nd, nd);
+         }
+         else
+         {
+            T = pmesh->GetSharedFaceTransformations(shared_face[bdrs[f]]);
+            const int nbr_el = T->Elem2No - NE;
+            pfes.GetFaceNbrElementVDofs(nbr_el, nbr_vdofs);
+            for (int i = 0; i < fbfi.Size(); i++)
+            {
+               fbfi[i]->AssembleFaceMatrix(*pfes.GetFE(k),
+                                           *pfes.GetFaceNbrFE(nbr_el),
+                                           *T, elmat);
+               face_mat += elmat;
+            }
+         }
+
+         K_k.UseExternalData(K_el.GetData(k), nd, nd);
+         for (int i = 0; i < nd; i++)
+         {
+            for (int j = 0; j < nd; j++)
+            {
+               K_k(i, j) += face_mat(off_k + i, off_k + j);
+               if (kn >= 0) { K_n(i, j) += face_mat(off_n + i, off_n + j); }
+            }
+         }
+
+         for (int p = 0; p < nfd * nfd; p++, fp++)
+         {
+            const int i = face_i[fp] - k*nd;
+            int j = -1;
+            if (kn >= 0) { j = face_j[fp] - kn*nd; }
+            else
+            {
+               j = nbr_vdofs.Find(face_j[fp] - s);
+               MFEM_VERIFY(j >= 0, "Face-neighbor dof not found.");
+            }
+            const double kij = face_mat(off_k + i, off_n + j),
+                         kji = face_mat(off_n + j, off_k + i);
+            face_d(fp) = fmax(fmax(0.0, -kij), -kji);
+         }
+      }
+   }
+
+   for (int k = 0; k < NE; k++)
+   {
+      K_k.UseExternalData(K_el.GetData(k), nd, nd);
+      for (int p = 0; p < num_pairs; p++)
+      {
+         const double kij = K_k(pair_i[p], pair_j[p]),
+                      kji = K_k(pair_j[p], pair_i[p]);
+         el_d(k*num_pairs + p) = fmax(fmax(0.0, -kij), -kji);
+      }
+   }
+}
+
 void FluxBasedFCT::CalcFCTSolution(const ParGridFunction &u, const Vector &m,
                                    const Vector &du_ho, const Vector &du_lo,
                                    const Vector &u_min, const Vector &u_max,
@@ -30,22 +335,22 @@ void FluxBasedFCT::CalcFCTSolution(const ParGridFunction &u, const Vector &m,
 {
    MFEM_VERIFY(smth_indicator == NULL, "TODO: update SI bounds.");
 
-   // Construct the flux matrix (it gets recomputed every time).
-   ComputeFluxMatrix(u, du_ho, flux_ij);
+   // Compute the fluxes (they get recomputed every time) and their sums at
+   // the dofs.
+   ComputeFluxes(u, du_ho, el_flux, face_flux, true);
 
    // Iterated FCT correction.
-   Vector du_lo_fct(du_lo);
+   WorkVector du_lo_fct(*work, du_lo.Size());
+   du_lo_fct = du_lo;
    for (int fct_iter = 0; fct_iter < iter_cnt; fct_iter++)
    {
-      // Compute sums of incoming/outgoing fluxes at each DOF.
-      AddFluxesAtDofs(flux_ij, gp, gm);
-
-      // Compute the flux coefficients (aka alphas) into gp and gm.
-      ComputeFluxCoefficients(u, du_lo_fct, m, u_min, u_max, gp, gm);
+      // Compute the flux coefficients (aka alphas).
+      ComputeFluxCoefficients(u, du_lo_fct, m, u_min, u_max);
 
       // Apply the alpha coefficients to get the final solution.
-      // Update the flux matrix for iterative FCT (when iter_cnt > 1).
-      UpdateSolutionAndFlux(du_lo_fct, m, gp, gm, flux_ij, du);
+      // Update the fluxes and their sums for iterative FCT (iter_cnt > 1).
+      UpdateSolutionAndFlux(du_lo_fct, m, el_flux, face_flux,
+                            fct_iter + 1 < iter_cnt, du);
 
       du_lo_fct = du;
    }
@@ -56,11 +361,18 @@ void FluxBasedFCT::CalcFCTProduct(const ParGridFunction &us, const Vector &m,
                                   Vector &s_min, Vector &s_max,
                                   const Vector &u_new,
                                   const Array<bool> &active_el,
-                                  const Array<bool> &active_dofs, Vector &d_us)
+                                  const Array<bool> &active_dofs,
+                                  const Array<int> &elem_list, Vector &d_us)
 {
-   // Construct the flux matrix (it gets recomputed every time).
-   ComputeFluxMatrix(us, d_us_HO, flux_ij);
+   // The passes below only visit the active elements and their neighbors.
+   // The other elements are empty, and their d_us is zero.
+   SetActiveSet(elem_list);
+   restricted = true;
 
+   // Compute the fluxes (they get recomputed every time).
+   ComputeFluxes(us, d_us_HO, el_flux, face_flux, false);
+
+   el_flux.HostReadWrite();
    us.HostRead();
    d_us_LO.HostRead();
    s_min.HostReadWrite();
@@ -72,31 +384,42 @@ void FluxBasedFCT::CalcFCTProduct(const ParGridFunction &us, const Vector &m,
    const double eps = 1e-12;
    int dof_id;
 
-   // Update the flux matrix to a product-compatible version.
+   // Update the fluxes to a product-compatible version.
    // Compute a compatible low-order solutions.
    const int NE = us.ParFESpace()->GetNE();
    const int ndofs = us.Size() / NE;
-   Vector us_new_LO_el(ndofs), flux_el(ndofs), beta(ndofs);
-   Vector dus_lo_fct(us.Size()), us_min(us.Size()), us_max(us.Size());
-   DenseMatrix fij_el(ndofs);
-   fij_el = 0.0;
+   WorkVector dus_lo_fct(*work, us.Size()), us_min(*work, us.Size()),
+              us_max(*work, us.Size()), el_work(*work, 3*ndofs);
+   double *us_new_LO_el = el_work.HostWrite(),
+           *flux_el = us_new_LO_el + ndofs, *beta = flux_el + ndofs;
 
    Vector s_min_loc, s_max_loc;
 
-   dus_lo_fct = 0.0;
+   dus_lo_fct.HostWrite();
+   us_min.HostWrite();
+   us_max.HostWrite();
+   m.HostRead();
 
-   for (int k = 0; k < NE; k++)
+   const int *list = active_list.HostRead();
+   for (int e = 0; e < active_list.Size(); e++)
    {
-      if (active_el[k] == false) { continue; }
-
-      Array<int> dofs;
-      us.ParFESpace()->GetElementDofs(k, dofs);
-
+      const int k = list[e];
+      if (active_el[k] == false)
+      {
+         // Empty neighbor, no fluxes to it.
+         for (int j = 0; j < ndofs; j++)
+         {
+            dus_lo_fct(k*ndofs + j) = 0.0;
+            us_min(k*ndofs + j) = 0.0;
+            us_max(k*ndofs + j) = 0.0;
+         }
+         continue;
+      }
       double mass_us = 0.0, mass_u = 0.0;
       for (int j = 0; j < ndofs; j++)
       {
-         us_new_LO_el(j) = us(k*ndofs + j) + dt * d_us_LO(k*ndofs + j);
-         mass_us += us_new_LO_el(j) * m(k*ndofs + j);
+         us_new_LO_el[j] = us(k*ndofs + j) + dt * d_us_LO(k*ndofs + j);
+         mass_us += us_new_LO_el[j] * m(k*ndofs + j);
          mass_u  += u_new(k*ndofs + j) * m(k*ndofs + j);
       }
       double s_avg = mass_us / mass_u;
@@ -141,7 +464,8 @@ void FluxBasedFCT::CalcFCTProduct(const ParGridFunction &us, const Vector &m,
             std::cout << "Element " << k << std::endl;
             std::cout << "Masses " << mass_us << " " << mass_u << std::endl;
             PrintCellValues(k, NE, u_new, "u_loc: ");
-            std::cout << "us_loc_LO: " << std::endl; us_new_LO_el.Print();
+            std::cout << "us_loc_LO: " << std::endl;
+            Vector(us_new_LO_el, ndofs).Print();
 
             MFEM_ABORT("s_avg is not in the full stencil bounds!");
          }
@@ -154,29 +478,29 @@ void FluxBasedFCT::CalcFCTProduct(const ParGridFunction &us, const Vector &m,
       }
 
       // Take into account the compatible low-order solution.
+      double beta_sum = 0.0;
       for (int j = 0; j < ndofs; j++)
       {
          // In inactive dofs we get u_new*s_avg ~ 0, which should be fine.
 
          dof_id = k*ndofs + j;
          double d_us_LO_j = (u_new(dof_id) * s_avg - us(dof_id)) / dt;
-         flux_el(j) = m(dof_id) * dt * (d_us_LO(dof_id) - d_us_LO_j);
+         flux_el[j] = m(dof_id) * dt * (d_us_LO(dof_id) - d_us_LO_j);
          // Change the LO solution.
          dus_lo_fct(dof_id) = d_us_LO_j;
 
-         beta(j) = m(dof_id) * u_new(dof_id);
+         beta[j] = m(dof_id) * u_new(dof_id);
+         beta_sum += beta[j];
       }
 
       // Make the betas sum to 1, add the new compatible fluxes.
-      beta /= beta.Sum();
-      for (int j = 1; j < ndofs; j++)
+      for (int j = 0; j < ndofs; j++) { beta[j] /= beta_sum; }
+      for (int p = 0; p < num_pairs; p++)
       {
-         for (int i = 0; i < j; i++)
-         {
-            fij_el(i, j) = beta(j) * flux_el(i) - beta(i) * flux_el(j);
-         }
+         const int i = pair_i[p], j = pair_j[p];
+         el_flux(k*num_pairs + p) += beta[j] * flux_el[i] -
+                                     beta[i] * flux_el[j];
       }
-      flux_ij.AddSubMatrix(dofs, dofs, fij_el);
 
       // Rescale the bounds (s_min, s_max) -> (u*s_min, u*s_max).
       for (int j = 0; j < ndofs; j++)
@@ -220,23 +544,25 @@ void FluxBasedFCT::CalcFCTProduct(const ParGridFunction &us, const Vector &m,
 
    // Iterated FCT correction.
    // To get the LO compatible product solution (with s_avg), just do
-   // d_us = dus_lo_fct instead of the loop below.
+   // d_us = dus_lo_fct instead of the loop below. d_us is only written at the
+   // dofs of the list below, and is zero elsewhere.
+   d_us = 0.0;
+   AddFluxesAtDofs(el_flux, face_flux);
    for (int fct_iter = 0; fct_iter < iter_cnt; fct_iter++)
    {
-      // Compute sums of incoming fluxes at each DOF.
-      AddFluxesAtDofs(flux_ij, gp, gm);
-
-      // Compute the flux coefficients (aka alphas) into gp and gm.
-      ComputeFluxCoefficients(us, dus_lo_fct, m, us_min, us_max, gp, gm);
+      // Compute the flux coefficients (aka alphas).
+      ComputeFluxCoefficients(us, dus_lo_fct, m, us_min, us_max);
 
       // Apply the alpha coefficients to get the final solution.
-      // Update the fluxes for iterative FCT (when iter_cnt > 1).
-      UpdateSolutionAndFlux(dus_lo_fct, m, gp, gm, flux_ij, d_us);
+      // Update the fluxes and their sums for iterative FCT (iter_cnt > 1).
+      UpdateSolutionAndFlux(dus_lo_fct, m, el_flux, face_flux,
+                            fct_iter + 1 < iter_cnt, d_us);
 
-      ZeroOutEmptyDofs(active_el, active_dofs, d_us);
+      ZeroOutEmptyDofs(active_el, active_dofs, d_us, &active_list);
 
-      dus_lo_fct = d_us;
+      if (fct_iter + 1 < iter_cnt) { CopyAtDofs(d_us, dus_lo_fct); }
    }
+   restricted = false;
 
 #ifdef REMHOS_FCT_DEBUG
    // Check the bounds of the final solution.
@@ -276,468 +602,564 @@ void FluxBasedFCT::CalcFCTProduct(const ParGridFunction &us, const Vector &m,
 #endif
 }
 
-void FluxBasedFCT::ComputeFluxMatrix(const ParGridFunction &u,
-                                     const Vector &du_ho,
-                                     SparseMatrix &flux_mat) const
+void FluxBasedFCT::SetActiveSet(const Array<int> &list)
 {
-   const int s = u.Size();
-   double *flux_data = flux_mat.GetData();
-   const int *K_I = K.GetI(), *K_J = K.GetJ();
-   const double *K_data = K.GetData();
-   const double *u_np = u.FaceNbrData().HostRead();
-   u.HostRead();
-   du_ho.HostRead();
-   for (int i = 0; i < s; i++)
+   active_list = list;
+   const int *L = active_list.HostRead();
+   stamp++;
+   for (int e = 0; e < active_list.Size(); e++) { el_stamp[L[e]] = stamp; }
+
+   // Each face pair is taken once, from the first dof of the list that is on
+   // one of its sides. The local sides outside of the list form the ring.
+   const int s = pfes.GetVSize();
+   const int *I = dof_face_I.HostRead(), *J = dof_face_J.HostRead(),
+              *F_i = face_i.HostRead(), *F_j = face_j.HostRead();
+   active_pairs.HostReadWrite();
+   active_ring.HostReadWrite();
+   active_pairs.SetSize(0);
+   active_ring.SetSize(0);
+   for (int e = 0; e < active_list.Size(); e++)
    {
-      for (int k = K_I[i]; k < K_I[i + 1]; k++)
+      for (int i = L[e]*nd; i < (L[e] + 1)*nd; i++)
       {
-         int j = K_J[k];
-         if (j <= i) { continue; }
+         for (int q = I[i]; q < I[i+1]; q++)
+         {
+            const int p = J[q] / 2;
+            if (pair_stamp[p] == stamp) { continue; }
+            pair_stamp[p] = stamp;
+            active_pairs.Append(p);
+
+            const int other = (J[q] % 2 == 0) ? F_j[p] : F_i[p];
+            if (other < s && el_stamp[other / nd] != stamp)
+            {
+               active_ring.Append(other);
+            }
+         }
+      }
+   }
+}
+
+void FluxBasedFCT::ZeroFluxSums() const
+{
+   if (restricted == false) { flux_sums = 0.0; return; }
 
-         double kij  = K_data[k], kji = K_data[K_smap[k]];
-         double dij  = max(max(0.0, -kij), -kji);
-         double u_ij = (j < s) ? u(i) - u(j)
-                       : u(i) - u_np[j - s];
+   const int s = pfes.GetVSize(), ND = nd, n = active_list.Size() * nd;
+   const int *L = active_list.Read();
+   double *sum_pos = flux_sums.ReadWrite(), *sum_neg = sum_pos + s;
+   MFEM_FORALL(t, n,
+   {
+      const int i = L[t / ND]*ND + t % ND;
+      sum_pos[i] = 0.0;
+      sum_neg[i] = 0.0;
+   });
+}
+
+void FluxBasedFCT::CopyAtDofs(const Vector &src, Vector &dst) const
+{
+   if (restricted == false) { dst = src; return; }
+
+   const int ND = nd, n = active_list.Size() * nd;
+   const int *L = active_list.Read();
+   const double *d_src = src.Read();
+   double *d_dst = dst.ReadWrite();
+   MFEM_FORALL(t, n,
+   {
+      const int i = L[t / ND]*ND + t % ND;
+      d_dst[i] = d_src[i];
+   });
+}
+
+// Adds f to the sum of the positive or the negative fluxes at dof i.
+MFEM_HOST_DEVICE inline
+void AddFluxAt(double f, int i, double *sum_pos, double *sum_neg)
+{
+   if (f >= 0.0) { sum_pos[i] += f; }
+   else          { sum_neg[i] += f; }
+}
 
-         flux_data[k] = dt * dij * u_ij;
+void FluxBasedFCT::ComputeFluxes(const ParGridFunction &u,
+                                 const Vector &du_ho,
+                                 Vector &el_f, Vector &face_f,
+                                 bool add_sums) const
+{
+   const int s = u.Size(), NE = pfes.GetNE();
+   const int ND = nd, NP = num_pairs;
+   const bool r = restricted;
+   const int n_el = r ? active_list.Size() : NE,
+             n_fp = r ? active_pairs.Size() : face_i.Size();
+   const int *L = r ? active_list.Read() : NULL,
+              *FP = r ? active_pairs.Read() : NULL;
+   const double dt_f = dt;
+   el_f.SetSize(NE * num_pairs);
+   face_f.SetSize(face_i.Size());
+   if (add_sums) { ZeroFluxSums(); }
+
+   // The element fluxes only touch the dofs of their element.
+   const int *P_i = pair_i.Read(), *P_j = pair_j.Read();
+   const double *d_u = u.Read(), *d_du = du_ho.Read();
+   const double *D = el_d.Read(), *M_ij = el_m.Read();
+   double *f = el_f.Write();
+   double *sum_pos = add_sums ? flux_sums.ReadWrite() : NULL,
+          *sum_neg = add_sums ? sum_pos + s : NULL;
+   MFEM_FORALL(e, n_el,
+   {
+      const int k = r ? L[e] : e;
+      for (int q = 0; q < NP; q++)
+      {
+         const int p = k*NP + q, i = k*ND + P_i[q], j = k*ND + P_j[q];
+         f[p] = dt_f * (D[p] * (d_u[i] - d_u[j]) +
+                        M_ij[p] * (d_du[i] - d_du[j]));
+         if (add_sums)
+         {
+            AddFluxAt(f[p], i, sum_pos, sum_neg);
+            AddFluxAt(-f[p], j, sum_pos, sum_neg);
+         }
       }
-   }
+   });
 
-   const int NE = pfes.GetMesh()->GetNE();
-   const int ndof = s / NE;
-   Array<int> dofs;
-   DenseMatrix Mz(ndof);
-   Vector du_z(ndof);
-   for (int k = 0; k < NE; k++)
+   const int *F_i = face_i.Read(), *F_j = face_j.Read();
+   const double *u_np = u.FaceNbrData().Read();
+   const double *fd = face_d.Read();
+   f = face_f.Write();
+   MFEM_FORALL(t, n_fp,
    {
-      pfes.GetElementDofs(k, dofs);
-      M.GetSubMatrix(dofs, dofs, Mz);
-      du_ho.GetSubVector(dofs, du_z);
-      for (int i = 0; i < ndof; i++)
+      const int p = r ? FP[t] : t;
+      const int i = F_i[p], j = F_j[p];
+      f[p] = dt_f * fd[p] * (d_u[i] - ((j < s) ? d_u[j] : u_np[j - s]));
+   });
+   if (add_sums) { AddFaceFluxSums(face_f); }
+}
+
+void FluxBasedFCT::AddFaceFluxSums(const Vector &face_f) const
+{
+   const int s = pfes.GetVSize(), ND = nd;
+   const bool r = restricted;
+   const int n = r ? active_list.Size() * nd : s;
+   const int *L = r ? active_list.Read() : NULL;
+   const int *I = dof_face_I.Read(), *J = dof_face_J.Read();
+   const double *f = face_f.Read();
+   double *sum_pos = flux_sums.ReadWrite(), *sum_neg = sum_pos + s;
+   MFEM_FORALL(t, n,
+   {
+      const int i = r ? L[t / ND]*ND + t % ND : t;
+      for (int e = I[i]; e < I[i+1]; e++)
       {
-         int j = 0;
-         for (; j <= i; j++) { Mz(i, j) = 0.0; }
-         for (; j < ndof; j++) { Mz(i, j) *= dt * (du_z(i) - du_z(j)); }
+         const int p = J[e] / 2;
+         AddFluxAt((J[e] % 2 == 0) ? f[p] : -f[p], i, sum_pos, sum_neg);
       }
-      flux_mat.AddSubMatrix(dofs, dofs, Mz, 0);
-   }
+   });
 }
 
 // Compute sums of incoming fluxes for every DOF.
-void FluxBasedFCT::AddFluxesAtDofs(const SparseMatrix &flux_mat,
-                                   Vector &flux_pos, Vector &flux_neg) const
+void FluxBasedFCT::AddFluxesAtDofs(const Vector &el_f,
+                                   const Vector &face_f) const
 {
-   const int s = flux_pos.Size();
-   const double *flux_data = flux_mat.GetData();
-   const int *flux_I = flux_mat.GetI(), *flux_J = flux_mat.GetJ();
-   flux_pos = 0.0;
-   flux_neg = 0.0;
-   flux_pos.HostReadWrite();
-   flux_neg.HostReadWrite();
-   for (int i = 0; i < s; i++)
+   const int s = pfes.GetVSize(), ND = nd, NP = num_pairs;
+   const bool r = restricted;
+   const int n = r ? active_list.Size() : pfes.GetNE();
+   const int *L = r ? active_list.Read() : NULL;
+   ZeroFluxSums();
+   const int *P_i = pair_i.Read(), *P_j = pair_j.Read();
+   const double *f = el_f.Read();
+   double *sum_pos = flux_sums.ReadWrite(), *sum_neg = sum_pos + s;
+   MFEM_FORALL(e, n,
    {
-      for (int k = flux_I[i]; k < flux_I[i + 1]; k++)
+      const int k = r ? L[e] : e;
+      for (int q = 0; q < NP; q++)
       {
-         int j = flux_J[k];
-
-         // The skipped fluxes will be added when the outer loop is at j as
-         // the flux matrix is always symmetric.
-         if (j <= i) { continue; }
-
-         const double f_ij = flux_data[k];
-
-         if (f_ij >= 0.0)
-         {
-            flux_pos(i) += f_ij;
-            // Modify j if it's on the same MPI task (prevents x2 counting).
-            if (j < s) { flux_neg(j) -= f_ij; }
-         }
-         else
-         {
-            flux_neg(i) += f_ij;
-            // Modify j if it's on the same MPI task (prevents x2 counting).
-            if (j < s) { flux_pos(j) -= f_ij; }
-         }
+         const int p = k*NP + q;
+         AddFluxAt(f[p], k*ND + P_i[q], sum_pos, sum_neg);
+         AddFluxAt(-f[p], k*ND + P_j[q], sum_pos, sum_neg);
       }
-   }
+   });
+   AddFaceFluxSums(face_f);
 }
 
-// Compute the so-called alpha coefficients that scale the fluxes into gp, gm.
+// Compute the so-called alpha coefficients that scale the fluxes.
 void FluxBasedFCT::
 ComputeFluxCoefficients(const Vector &u, const Vector &du_lo, const Vector &m,
-                        const Vector &u_min, const Vector &u_max,
-                        Vector &coeff_pos, Vector &coeff_neg) const
+                        const Vector &u_min, const Vector &u_max) const
 {
-   const int s = u.Size();
-   for (int i = 0; i < s; i++)
+   const int s = u.Size(), ND = nd;
+   const bool r = restricted;
+   const int n = r ? active_list.Size() * nd : s;
+   const int *L = r ? active_list.Read() : NULL;
+   const double dt_f = dt;
+   const double *sum_pos = flux_sums.Read(), *sum_neg = sum_pos + s;
+   const double *d_u = u.Read(), *d_du = du_lo.Read(), *d_m = m.Read(),
+                *d_u_min = u_min.Read(), *d_u_max = u_max.Read();
+   double *a_pos = r ? alpha.ReadWrite() : alpha.Write(), *a_neg = a_pos + s;
+
+   // No fluxes are applied at the dofs outside of the active set; of these,
+   // only the ring is read.
+   if (r)
    {
-      const double u_lo = u(i) + dt * du_lo(i);
-      const double max_pos_diff = max((u_max(i) - u_lo) * m(i), 0.0),
-                   min_neg_diff = min((u_min(i) - u_lo) * m(i), 0.0);
-      const double sum_pos = coeff_pos(i), sum_neg = coeff_neg(i);
-
-      coeff_pos(i) = (sum_pos > max_pos_diff) ? max_pos_diff / sum_pos : 1.0;
-      coeff_neg(i) = (sum_neg < min_neg_diff) ? min_neg_diff / sum_neg : 1.0;
+      const int *R = active_ring.Read();
+      MFEM_FORALL(t, active_ring.Size(),
+      {
+         a_pos[R[t]] = 0.0;
+         a_neg[R[t]] = 0.0;
+      });
    }
+   MFEM_FORALL(t, n,
+   {
+      const int i = r ? L[t / ND]*ND + t % ND : t;
+      const double u_lo = d_u[i] + dt_f * d_du[i];
+      const double max_pos_diff = fmax((d_u_max[i] - u_lo) * d_m[i], 0.0),
+                   min_neg_diff = fmin((d_u_min[i] - u_lo) * d_m[i], 0.0);
+
+      a_pos[i] = (sum_pos[i] > max_pos_diff) ? max_pos_diff / sum_pos[i] : 1.0;
+      a_neg[i] = (sum_neg[i] < min_neg_diff) ? min_neg_diff / sum_neg[i] : 1.0;
+   });
+
+   // Both coefficients are sent in one message.
+   alpha_halo.ExchangeBegin(alpha, 2);
 }
 
 void FluxBasedFCT::
 UpdateSolutionAndFlux(const Vector &du_lo, const Vector &m,
-                      ParGridFunction &coeff_pos, ParGridFunction &coeff_neg,
-                      SparseMatrix &flux_mat, Vector &du) const
+                      Vector &el_f, Vector &face_f, bool add_sums,
+                      Vector &du) const
 {
-   Vector &a_pos_n = coeff_pos.FaceNbrData(),
-          &a_neg_n = coeff_neg.FaceNbrData();
-   coeff_pos.ExchangeFaceNbrData();
-   coeff_neg.ExchangeFaceNbrData();
-
-   du = du_lo;
-
-   coeff_pos.HostReadWrite();
-   coeff_neg.HostReadWrite();
-   du.HostReadWrite();
-
-   double *flux_data = flux_mat.GetData();
-   const int *flux_I = flux_mat.GetI(), *flux_J = flux_mat.GetJ();
-   const int s = du.Size();
-   for (int i = 0; i < s; i++)
+   const int s = du.Size(), ND = nd, NP = num_pairs;
+   const bool r = restricted;
+   const int n_el = r ? active_list.Size() : pfes.GetNE(),
+             n_fp = r ? active_pairs.Size() : face_i.Size(),
+             n_dof = r ? active_list.Size() * nd : s;
+   const int *L = r ? active_list.Read() : NULL,
+              *FP = r ? active_pairs.Read() : NULL;
+   const double dt_f = dt;
+   CopyAtDofs(du_lo, du);
+   if (add_sums) { ZeroFluxSums(); }
+   const double *a_pos = alpha.Read(), *a_neg = a_pos + s;
+   const double *d_m = m.Read();
+   double *d_du = du.ReadWrite();
+   double *sum_pos = add_sums ? flux_sums.ReadWrite() : NULL,
+          *sum_neg = add_sums ? sum_pos + s : NULL;
+
+   // The element fluxes don't need the face-neighbor alphas.
+   const int *P_i = pair_i.Read(), *P_j = pair_j.Read();
+   double *f = el_f.ReadWrite();
+   MFEM_FORALL(e, n_el,
    {
-      for (int k = flux_I[i]; k < flux_I[i + 1]; k++)
+      const int k = r ? L[e] : e;
+      for (int q = 0; q < NP; q++)
       {
-         int j = flux_J[k];
-         if (j <= i) { continue; }
-
-         double fij = flux_data[k], a_ij;
-         if (fij >= 0.0)
+         const int p = k*NP + q, i = k*ND + P_i[q], j = k*ND + P_j[q];
+         const double a_ij = (f[p] >= 0.0) ? fmin(a_pos[i], a_neg[j])
+                             : fmin(a_neg[i], a_pos[j]);
+         const double fij = f[p] * a_ij;
+         d_du[i] += fij / d_m[i] / dt_f;
+         d_du[j] -= fij / d_m[j] / dt_f;
+         f[p] -= fij;
+         if (add_sums)
          {
-            a_ij = (j < s) ? min(coeff_pos(i), coeff_neg(j))
-                   : min(coeff_pos(i), a_neg_n(j - s));
+            AddFluxAt(f[p], i, sum_pos, sum_neg);
+            AddFluxAt(-f[p], j, sum_pos, sum_neg);
          }
-         else
-         {
-            a_ij = (j < s) ? min(coeff_neg(i), coeff_pos(j))
-                   : min(coeff_neg(i), a_pos_n(j - s));
-         }
-         fij *= a_ij;
-
-         du(i) += fij / m(i) / dt;
-         if (j < s) { du(j) -= fij / m(j) / dt; }
+      }
+   });
+
+   // The applied face fluxes are formed per face pair, then gathered by the
+   // dofs of both sides.
+   const Vector &a_nbr = alpha_halo.FaceNbrData(alpha, 2);
+   const int n_nbr = a_nbr.Size() / 2;
+   const double *a_pos_n = a_nbr.Read(), *a_neg_n = a_pos_n + n_nbr;
+   const int *F_i = face_i.Read(), *F_j = face_j.Read();
+   WorkVector face_fij(*work, face_i.Size());
+   double *fij = face_fij.Write();
+   f = face_f.ReadWrite();
+   MFEM_FORALL(t, n_fp,
+   {
+      const int p = r ? FP[t] : t;
+      const int i = F_i[p], j = F_j[p];
+      double a_ij;
+      if (f[p] >= 0.0)
+      {
+         a_ij = fmin(a_pos[i], (j < s) ? a_neg[j] : a_neg_n[j - s]);
+      }
+      else
+      {
+         a_ij = fmin(a_neg[i], (j < s) ? a_pos[j] : a_pos_n[j - s]);
+      }
+      fij[p] = f[p] * a_ij;
+      f[p] -= fij[p];
+   });
 
-         flux_data[k] -= fij;
+   const int *I = dof_face_I.Read(), *J = dof_face_J.Read();
+   MFEM_FORALL(t, n_dof,
+   {
+      const int i = r ? L[t / ND]*ND + t % ND : t;
+      for (int e = I[i]; e < I[i+1]; e++)
+      {
+         const int p = J[e] / 2;
+         if (J[e] % 2 == 0) { d_du[i] += fij[p] / d_m[i] / dt_f; }
+         else               { d_du[i] -= fij[p] / d_m[i] / dt_f; }
       }
-   }
+   });
+   if (add_sums) { AddFaceFluxSums(face_f); }
 }
 
-
-void ClipScaleSolver::CalcFCTSolution(const ParGridFunction &u, const Vector &m,
-                                      const Vector &du_ho, const Vector &du_lo,
-                                      const Vector &u_min, const Vector &u_max,
-                                      Vector &du) const
+template<int T_DIM, int T_ORDER>
+static void ClipScaleKernel(const int NE, const int nd_, const double dt_fct,
+                            const double *d_u, const double *d_m,
+                            const double *d_du_ho, const double *d_du_lo,
+                            const double *d_u_min, const double *d_u_max,
+                            double *d_du)
 {
-   const int NE = pfes.GetMesh()->GetNE();
-   const int nd = pfes.GetFE(0)->GetDof();
-   Vector f_clip(nd);
-
-   int dof_id;
-   double sumPos, sumNeg, u_new_ho, u_new_lo, new_mass, f_clip_min, f_clip_max;
-   double umin, umax;
+   const int nd = T_DIM ? KernelElemDofs(T_DIM, T_ORDER) : nd_;
    const double eps = 1.0e-15;
-
-   // Smoothness indicator.
-   ParGridFunction si_val;
-   if (smth_indicator)
+   MFEM_FORALL(k, NE,
    {
-      smth_indicator->ComputeSmoothnessIndicator(u, si_val);
-   }
+      double sumPos = 0.0, sumNeg = 0.0;
 
-   u.HostRead();
-   du.HostReadWrite();
-   du_lo.Read(); du_ho.Read();
-   for (int k = 0; k < NE; k++)
-   {
-      sumPos = sumNeg = 0.0;
-
-      // Clip.
+      // Clip. The clipped fluxes are temporarily stored in du.
       for (int j = 0; j < nd; j++)
       {
-         dof_id = k*nd+j;
-
-         u_new_ho   = u(dof_id) + dt * du_ho(dof_id);
-         u_new_lo   = u(dof_id) + dt * du_lo(dof_id);
+         const int dof_id = k*nd+j;
 
-         umin = u_min(dof_id);
-         umax = u_max(dof_id);
-         if (smth_indicator)
-         {
-            smth_indicator->UpdateBounds(dof_id, u_new_ho, si_val, umin, umax);
-         }
-
-         f_clip_min = m(dof_id) / dt * (umin - u_new_lo);
-         f_clip_max = m(dof_id) / dt * (umax - u_new_lo);
+         const double u_new_lo   = d_u[dof_id] + dt_fct * d_du_lo[dof_id];
+         const double f_clip_min = d_m[dof_id] / dt_fct *
+                                   (d_u_min[dof_id] - u_new_lo);
+         const double f_clip_max = d_m[dof_id] / dt_fct *
+                                   (d_u_max[dof_id] - u_new_lo);
 
-         f_clip(j) = m(dof_id) * (du_ho(dof_id) - du_lo(dof_id));
-         f_clip(j) = min(f_clip_max, max(f_clip_min, f_clip(j)));
+         double f_clip = d_m[dof_id] * (d_du_ho[dof_id] - d_du_lo[dof_id]);
+         f_clip = fmin(f_clip_max, fmax(f_clip_min, f_clip));
 
-         sumNeg += min(f_clip(j), 0.0);
-         sumPos += max(f_clip(j), 0.0);
+         sumNeg += fmin(f_clip, 0.0);
+         sumPos += fmax(f_clip, 0.0);
+         d_du[dof_id] = f_clip;
       }
 
-      new_mass = sumNeg + sumPos;
+      const double new_mass = sumNeg + sumPos;
 
       // Rescale.
       for (int j = 0; j < nd; j++)
       {
+         const int dof_id = k*nd+j;
+
+         double f_clip = d_du[dof_id];
          if (new_mass > eps)
          {
-            f_clip(j) = min(0.0, f_clip(j)) -
-                        max(0.0, f_clip(j)) * sumNeg / sumPos;
+            f_clip = fmin(0.0, f_clip) - fmax(0.0, f_clip) * sumNeg / sumPos;
          }
          if (new_mass < -eps)
          {
-            f_clip(j) = max(0.0, f_clip(j)) -
-                        min(0.0, f_clip(j)) * sumPos / sumNeg;
+            f_clip = fmax(0.0, f_clip) - fmin(0.0, f_clip) * sumPos / sumNeg;
          }
 
          // Set du to the discrete time derivative featuring the high order
          // anti-diffusive reconstruction that leads to an forward Euler
          // updated admissible solution.
-         dof_id = k*nd+j;
-         du(dof_id) = du_lo(dof_id) + f_clip(j) / m(dof_id);
+         d_du[dof_id] = d_du_lo[dof_id] + f_clip / d_m[dof_id];
       }
-   }
+   });
 }
 
-void NonlinearPenaltySolver::CalcFCTSolution(const ParGridFunction &u,
-                                             const Vector &m,
-                                             const Vector &du_ho,
-                                             const Vector &du_lo,
-                                             const Vector &u_min,
-                                             const Vector &u_max,
-                                             Vector &du) const
-{
-   const int size = u.Size();
-   Vector du_ho_star(size);
+typedef void (*ClipScaleKernelType)(const int, const int, const double,
+                                    const double *, const double *,
+                                    const double *, const double *,
+                                    const double *, const double *, double *);
 
-   double umin, umax;
+void ClipScaleSolver::CalcFCTSolution(const ParGridFunction &u, const Vector &m,
+                                      const Vector &du_ho, const Vector &du_lo,
+                                      const Vector &u_min, const Vector &u_max,
+                                      Vector &du) const
+{
+   const int NE = pfes.GetMesh()->GetNE();
+   const int nd = pfes.GetFE(0)->GetDof();
 
-   // Smoothness indicator.
-   ParGridFunction si_val;
+   // Smoothness indicator - adjusts the bounds on the host.
+   const Vector *umin_ptr = &u_min, *umax_ptr = &u_max;
+   WorkVector u_min_si(*work, u_min.Size()), u_max_si(*work, u_max.Size());
    if (smth_indicator)
    {
       smth_indicator->ComputeSmoothnessIndicator(u, si_val);
-   }
 
-   // Clipped flux.
-   for (int i = 0; i < size; i++)
-   {
-      umin = u_min(i);
-      umax = u_max(i);
-      if (smth_indicator)
+      u_min_si = u_min;
+      u_max_si = u_max;
+      u.HostRead();
+      du_ho.HostRead();
+      u_min_si.HostReadWrite();
+      u_max_si.HostReadWrite();
+      for (int i = 0; i < NE * nd; i++)
       {
-         smth_indicator->UpdateBounds(i, u(i) + dt * du_ho(i),
-                                      si_val, umin, umax);
+         const double u_new_ho = u(i) + dt * du_ho(i);
+         smth_indicator->UpdateBounds(i, u_new_ho, si_val,
+                                      u_min_si(i), u_max_si(i));
       }
-
-      // Note that this uses u(i) at the old time.
-      du_ho_star(i) = min( (umax - u(i)) / dt,
-                           max(du_ho(i), (umin - u(i)) / dt) );
-   }
-
-   // Non-conservative fluxes.
-   Vector fL(size), fH(size);
-   for (int i = 0; i < size; i++)
-   {
-      fL(i) = m(i) * (du_ho_star(i) - du_lo(i));
-      fH(i) = m(i) * (du_ho_star(i) - du_ho(i));
-   }
-
-   // Restore conservation.
-   Vector flux_correction(size);
-   CorrectFlux(fL, fH, flux_correction);
-
-   for (int i = 0; i < size; i++)
-   {
-      fL(i) += flux_correction(i);
-   }
-
-   for (int i = 0; i < size; i++)
-   {
-      du(i) = du_lo(i) + fL(i) / m(i);
-   }
-}
-
-void get_z(double lambda, const Vector &w, const Vector &flux, Vector &zz)
-{
-   for (int j=0; j<w.Size(); j++)
-   {
-      zz(j) = (abs(flux(j)) >= lambda*abs(w(j))) ? lambda * w(j) : flux(j);
+      umin_ptr = &u_min_si;
+      umax_ptr = &u_max_si;
    }
-}
 
-double get_lambda_times_sum_z(double lambda,
-                              const Vector &w, const Vector &fluxL)
-{
-   double lambda_times_z;
-   double lambda_times_sum_z = 0.0;
-   for (int j=0; j<w.Size(); j++)
+   ClipScaleKernelType kernel;
+   const int dim = pfes.GetMesh()->Dimension(), order = pfes.GetOrder(0);
+   switch (KernelKey(dim, order))
    {
-      // In the second case, lambda * w(j) is set to fluxL(j).
-      lambda_times_z = (abs(fluxL(j)) >= lambda*abs(w(j)))
-                       ? lambda * w(j) : fluxL(j);
-
-      lambda_times_sum_z += lambda_times_z;
+      REMHOS_KERNEL_CASES(kernel, ClipScaleKernel)
    }
-   return lambda_times_sum_z;
+   kernel(NE, nd, dt, u.Read(), m.Read(), du_ho.Read(), du_lo.Read(),
+          umin_ptr->Read(), umax_ptr->Read(), du.Write());
 }
 
-void get_lambda(double delta, const Vector &w,
-                const Vector &fluxL, Vector &zz)
+// The conservative correction of each element solves the nonlinear equation
+// sum_j z_j(lambda) = delta, for the penalized fluxes
+// z_j = lambda w_j if |fL_j| >= lambda |w_j|, and z_j = fL_j otherwise. The
+// sum is piecewise linear in lambda, with breakpoints |fL_j| / |w_j|, so the
+// root is found exactly on the first linear piece that reaches delta. The
+// generic kernel keeps fL, w and lam of element k in scratch[3*nd*k..].
+template<int T_DIM, int T_ORDER>
+static void NonlinearPenaltyKernel(const int NE, const int nd_,
+                                   const double dt_fct, const double eps_w,
+                                   const double *d_u, const double *d_m,
+                                   const double *d_du_ho,
+                                   const double *d_du_lo,
+                                   const double *d_u_min,
+                                   const double *d_u_max, double *scratch,
+                                   double *d_du)
 {
-   // solve nonlinearity F(lambda)=0
-   double tol=1e-15;
-   double lambdaLower=0., lambdaUpper = 0.;
-   double FLower=0., FUpper=0.;
-
-   // compute starting F and check F at the min (lambda = 0).
-   double lambda = 1.0;
-   double F = delta - get_lambda_times_sum_z(lambda, w, fluxL);
-   double F0 = delta-get_lambda_times_sum_z(0.0, w, fluxL);
-   if (abs(F) <= tol)
-   {
-      get_z(lambda, w, fluxL, zz);
-   }
-   else if (abs(F0)<=tol)
-   {
-      get_z(0.0, w, fluxL, zz);
-   }
-
-   // solve non-linearity
-   // Get lambda values that give Fs on both sides of the zero.
-   double factor = 1.0;
-   do
-   {
-      factor *= 2.0;
-      lambdaLower = lambda/factor;
-      lambdaUpper = factor*lambda;
-      FLower = delta - get_lambda_times_sum_z(lambdaLower,w,fluxL);
-      FUpper = delta - get_lambda_times_sum_z(lambdaUpper,w,fluxL);
-   }
-   while (F*FLower > 0 && F*FUpper > 0);
-
-   // check if either of lambdaLower or lambdaUpper hit the solution
-   if (FLower==0.0)
-   {
-      get_z(lambdaLower, w, fluxL, zz);
-   }
-   else if (FUpper==0.0)
-   {
-      get_z(lambdaUpper, w, fluxL, zz);
-   }
-
-   // get STARTING lower and upper bounds for lambda
-   if (F*FLower < 0)
-   {
-      lambdaUpper = lambda;
-   }
-   else
-   {
-      lambdaLower = lambda;
-   }
-
-   // get STARTING lower and upper bounds on F
-   FLower = delta - get_lambda_times_sum_z(lambdaLower,w,fluxL);
-   FUpper = delta - get_lambda_times_sum_z(lambdaUpper,w,fluxL);
-
-   do
+   const int nd = T_DIM ? KernelElemDofs(T_DIM, T_ORDER) : nd_;
+   const double inf = numeric_limits<double>::infinity();
+   MFEM_FORALL(k, NE,
    {
-      // compute new lambda and new F
-      lambda = 0.5*(lambdaLower+lambdaUpper);
-      F = delta - get_lambda_times_sum_z(lambda,w,fluxL);
-      if (F*FLower < 0)
-      {
-         lambdaUpper = lambda;
-         FUpper = F;
-      }
-      else
+      constexpr int max_nd = T_DIM ? KernelElemDofs(T_DIM, T_ORDER) : 1;
+      double el_loc[3*max_nd];
+      double *fL = T_DIM ? el_loc : scratch + 3*nd*k,
+              *w = fL + nd, *lam = w + nd;
+
+      // Non-conservative fluxes from the clipped HO solution. Note that this
+      // uses u at the old time.
+      double fp = 0.0, fn = 0.0, fH_max = -1.0;
+      for (int j = 0; j < nd; j++)
       {
-         lambdaLower = lambda;
-         FLower = F;
+         const int id = k*nd + j;
+         const double du_star =
+            fmin((d_u_max[id] - d_u[id]) / dt_fct,
+                 fmax(d_du_ho[id], (d_u_min[id] - d_u[id]) / dt_fct));
+         fL[j] = d_m[id] * (du_star - d_du_lo[id]);
+         fH_max = fmax(fH_max, fabs(d_m[id] * (du_star - d_du_ho[id])));
+         if (fL[j] >= 0.0) { fp += fL[j]; }
+         else              { fn += fL[j]; }
       }
-   }
-   while (abs(F)>tol);
-
-   lambda = 0.5*(lambdaLower+lambdaUpper);
-   get_z(lambda, w, fluxL, zz);
-}
-
-void NonlinearPenaltySolver::CorrectFlux(Vector &fluxL, Vector &fluxH,
-                                         Vector &flux_fix) const
-{
-   // This consider any definition of wi. If a violation on MPP is created,
-   // then wi is s.t. fi=0.
-   // The idea is to relax the penalization wi in favor of MPP
-   const int num_cells = pfes.GetNE();
-   const int xd = pfes.GetFE(0)->GetDof();
+      const double delta = fp + fn;
 
-   Array<int> ldofs;
-   Vector fluxL_z(xd), fluxH_z(xd), flux_correction_z(xd);
-   for (int i = 0; i < num_cells; i++)
-   {
-      pfes.GetElementDofs(i, ldofs);
-      fluxL.GetSubVector(ldofs, fluxL_z);
-      fluxH.GetSubVector(ldofs, fluxH_z);
-
-      double fp = 0.0, fn = 0.0;
-      for (int j = 0; j < xd; j++)
+      // Penalization terms, nonzero for the fluxes of the sign of delta.
+      for (int j = 0; j < nd; j++)
       {
-         if (fluxL_z(j) >= 0.0) { fp += fluxL_z(j); }
-         else                   { fn += fluxL_z(j); }
+         if (delta > 0.0)
+         {
+            w[j] = (fL[j] > 0.0) ? eps_w * fabs(fL[j]) + fH_max : 0.0;
+         }
+         else
+         {
+            w[j] = (fL[j] < 0.0) ? - eps_w * fabs(fL[j]) - fH_max : 0.0;
+         }
+         lam[j] = (w[j] != 0.0) ? fabs(fL[j]) / fabs(w[j]) : inf;
       }
 
-      double delta = fp + fn;
-
-      if (delta == 0.0)
+      // The sum has the sign of delta and grows in magnitude with lambda.
+      // Find the smallest breakpoint where it reaches delta.
+      double lam_hi = inf, lam_max = 0.0;
+      for (int i = 0; i < nd; i++)
       {
-         flux_correction_z = 0.0;
-         flux_fix.SetSubVector(ldofs, flux_correction_z);
-         continue;
+         if (w[i] == 0.0) { continue; }
+         lam_max = fmax(lam_max, lam[i]);
+         double sum_z = 0.0;
+         for (int j = 0; j < nd; j++)
+         {
+            if (w[j] == 0.0) { continue; }
+            sum_z += (lam[j] >= lam[i]) ? lam[i] * w[j] : fL[j];
+         }
+         if (fabs(sum_z) >= fabs(delta)) { lam_hi = fmin(lam_hi, lam[i]); }
       }
 
-      // compute penalization terms wi's as desired
-      Vector w(xd);
-      const double eps = pfes.GetMesh()->GetElementSize(0,0) / pfes.GetOrder(0);
-      for (int j = 0; j < xd; j++)
+      // On the piece that ends at lam_hi, the z_j of breakpoints below lam_hi
+      // are fL_j, the others lambda w_j. When delta is not reached, because
+      // of round-off, all fluxes are taken fully.
+      double lambda = lam_max;
+      if (lam_hi < inf)
       {
-         if (delta > 0.0)
+         double sum_w = 0.0, sum_f = 0.0;
+         for (int j = 0; j < nd; j++)
          {
-            w(j) = (fluxL_z(j) > 0.0)
-                   ? eps * abs(fluxL_z(j)) + abs(get_max_on_cellNi(fluxH_z))
-                   : 0.0;
+            if (w[j] == 0.0) { continue; }
+            if (lam[j] >= lam_hi) { sum_w += w[j]; }
+            else                  { sum_f += fL[j]; }
          }
-         else
+         lambda = (delta - sum_f) / sum_w;
+      }
+
+      // Restore conservation and apply the corrected fluxes.
+      for (int j = 0; j < nd; j++)
+      {
+         const int id = k*nd + j;
+         double f = fL[j];
+         if (delta != 0.0)
          {
-            w(j) = (fluxL_z(j) < 0.0)
-                   ? - eps * abs(fluxL_z(j)) - abs(get_max_on_cellNi(fluxH_z))
-                   : 0.0;
+            f -= (fabs(fL[j]) >= lambda * fabs(w[j])) ? lambda * w[j] : fL[j];
          }
+         d_du[id] = d_du_lo[id] + f / d_m[id];
       }
+   });
+}
+
+typedef void (*NonlinearPenaltyKernelType)(const int, const int, const double,
+                                           const double, const double *,
+                                           const double *, const double *,
+                                           const double *, const double *,
+                                           const double *, double *,
+                                           double *);
+
+void NonlinearPenaltySolver::CalcFCTSolution(const ParGridFunction &u,
+                                             const Vector &m,
+                                             const Vector &du_ho,
+                                             const Vector &du_lo,
+                                             const Vector &u_min,
+                                             const Vector &u_max,
+                                             Vector &du) const
+{
+   const int NE = pfes.GetMesh()->GetNE();
+   const int nd = pfes.GetFE(0)->GetDof();
 
-      // compute lambda and the flux correction.
-      get_lambda(delta, w, fluxL_z, flux_correction_z);
-      flux_correction_z.Neg();
+   // Smoothness indicator - adjusts the bounds on the host.
+   const Vector *umin_ptr = &u_min, *umax_ptr = &u_max;
+   WorkVector u_min_si(*work, u_min.Size()), u_max_si(*work, u_max.Size());
+   if (smth_indicator)
+   {
+      smth_indicator->ComputeSmoothnessIndicator(u, si_val);
 
-      flux_fix.SetSubVector(ldofs, flux_correction_z);
+      u_min_si = u_min;
+      u_max_si = u_max;
+      u.HostRead();
+      du_ho.HostRead();
+      u_min_si.HostReadWrite();
+      u_max_si.HostReadWrite();
+      for (int i = 0; i < NE * nd; i++)
+      {
+         const double u_new_ho = u(i) + dt * du_ho(i);
+         smth_indicator->UpdateBounds(i, u_new_ho, si_val,
+                                      u_min_si(i), u_max_si(i));
+      }
+      umin_ptr = &u_min_si;
+      umax_ptr = &u_max_si;
    }
-}
 
-double NonlinearPenaltySolver::get_max_on_cellNi(Vector &fluxH) const
-{
-   double MAX = -1.0;
-   for (int i = 0; i < fluxH.Size(); i++)
+   // The weight of the penalization terms.
+   const double eps_w = pfes.GetMesh()->GetElementSize(0, 0) /
+                        pfes.GetOrder(0);
+
+   NonlinearPenaltyKernelType kernel;
+   const int dim = pfes.GetMesh()->Dimension(), order = pfes.GetOrder(0);
+   const int key = KernelKey(dim, order);
+   switch (key)
    {
-      MAX = max(fabs(fluxH(i)), MAX);
+      REMHOS_KERNEL_CASES(kernel, NonlinearPenaltyKernel)
    }
-   return MAX;
+   WorkVector scratch(*work, key ? 0 : 3*nd*NE);
+   kernel(NE, nd, dt, eps_w, u.Read(), m.Read(), du_ho.Read(), du_lo.Read(),
+          umin_ptr->Read(), umax_ptr->Read(), key ? NULL : scratch.Write(),
+          du.Write());
 }
 
 } // namespace mfem
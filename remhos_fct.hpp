@@ -20,12 +20,11 @@
 //#define REMHOS_FCT_DEBUG
 
 #include "mfem.hpp"
+#include "remhos_tools.hpp"
 
 namespace mfem
 {
 
-class SmoothnessIndicator;
-
 // Monotone, High-order, Conservative Solver.
 class FCTSolver
 {
@@ -33,14 +32,21 @@ protected:
    ParFiniteElementSpace &pfes;
    SmoothnessIndicator *smth_indicator;
    double dt;
+   Workspace *work;
+
+   // Values of the smoothness indicator, kept between calls.
+   mutable ParGridFunction si_val;
 
 public:
    FCTSolver(ParFiniteElementSpace &space,
              SmoothnessIndicator *si, double dt_)
-      : pfes(space), smth_indicator(si), dt(dt_) { }
+      : pfes(space), smth_indicator(si), dt(dt_), work(NULL) { }
 
    virtual ~FCTSolver() { }
 
+   // Temporary vectors are borrowed from w. Must be set before solving.
+   void SetWorkspace(Workspace &w) { work = &w; }
+
    virtual void UpdateTimeStep(double dt_) { dt = dt_; }
 
    // Calculate du that satisfies the following:
@@ -52,49 +58,117 @@ public:
                                 const Vector &u_min, const Vector &u_max,
                                 Vector &du) const = 0;
 
+   // FCT solution of the product field us. The new active elements with
+   // their face neighbors are given in active_list, as computed by
+   // DofInfo::GetActiveElementList(); d_us_LO, s_min and s_max are only read
+   // in these elements, and d_us is zero outside of them.
    virtual void CalcFCTProduct(const ParGridFunction &us, const Vector &m,
                                const Vector &d_us_HO, const Vector &d_us_LO,
                                Vector &s_min, Vector &s_max,
                                const Vector &u_new,
                                const Array<bool> &active_el,
-                               const Array<bool> &active_dofs, Vector &d_us)
+                               const Array<bool> &active_dofs,
+                               const Array<int> &active_list, Vector &d_us)
    {
       MFEM_ABORT("Product remap is not implemented for the chosen solver");
    }
+
+   // Must be called after the underlying forms change, e.g., when the mesh
+   // moves in remap mode.
+   virtual void UpdateOperators() { }
 };
 
+// Flux-based FCT. The antidiffusive fluxes are kept in a compact store: the
+// fluxes between the dofs of each element, from the mass and the advection
+// matrices, and the fluxes between the face dofs of neighboring elements,
+// from the advection matrix. The d_ij and m_ij of the store are read from the
+// assembled HO matrices, or assembled from the integrators of the HO forms
+// when they use partial assembly. The flux sums at the dofs are formed in the
+// passes that compute and update the fluxes, and the iterations of the
+// correction reuse the store.
+// NOTE: Only the face dofs are assumed to be nonzero on a face, as for the
+//       positive basis.
 class FluxBasedFCT : public FCTSolver
 {
 protected:
-   const SparseMatrix &K, &M;
-   const Array<int> &K_smap;
-
-   // Temporary computation objects.
-   mutable SparseMatrix flux_ij;
-   mutable ParGridFunction gp, gm;
-
+   ParBilinearForm &K, &M;
+   const DofInfo &dofs;
    const int iter_cnt;
 
-   void ComputeFluxMatrix(const ParGridFunction &u, const Vector &du_ho,
-                          SparseMatrix &flux_mat) const;
-   void AddFluxesAtDofs(const SparseMatrix &flux_mat,
-                        Vector &flux_pos, Vector &flux_neg) const;
+   // Dof pairs (i < j) of an element, the same for all elements.
+   int nd, num_pairs;
+   Array<int> pair_i, pair_j;
+   // d_ij and m_ij of pair p of element k, at k*num_pairs + p.
+   Vector el_d, el_m;
+   // Face pairs: the local dof i, dof j on the other side of the face (local,
+   // or size + face-neighbor index), and d_ij.
+   Array<int> face_i, face_j;
+   Vector face_d;
+   // The face pairs of each local dof, in CSR format and increasing order.
+   // Entry 2p is the i side of pair p, entry 2p+1 its j side.
+   Array<int> dof_face_I, dof_face_J;
+   // Element blocks of K, only used during the assembly of the store from the
+   // integrators.
+   DenseTensor K_el;
+
+   // Positions of k_ij and k_ji of each element pair and each face pair, at
+   // 2p and 2p+1, and of m_ij of each element pair, in the CSR values of the
+   // assembled K and M, or -1 for entries that aren't stored. Found once, as
+   // the sparsity doesn't change when the mesh moves. Empty for partial
+   // assembly.
+   Array<int> el_k_pos, el_m_pos, face_k_pos;
+   void ComputePositions();
+   void UpdateFromMatrices();
+   void UpdateFromIntegrators();
+
+   // Fluxes in the layout of the store.
+   mutable Vector el_flux, face_flux;
+
+   // Sums of the positive and negative fluxes, and the alpha coefficients, at
+   // each dof, in one vector each, so that both alphas are sent together.
+   mutable Vector flux_sums, alpha;
+   mutable HaloExchange alpha_halo;
+
+   // Active set of the product field: the elements with one layer of face
+   // neighbors, the face pairs that touch their dofs, and the other sides of
+   // these pairs that are outside of the list (the ring). When restricted is
+   // true, the passes below visit only these, and the values of the other
+   // dofs are neither read nor written, except for the zero alphas of the
+   // ring.
+   Array<int> active_list, active_pairs, active_ring, pair_stamp, el_stamp;
+   int stamp;
+   mutable bool restricted;
+   void SetActiveSet(const Array<int> &list);
+
+   // Zeroes the flux sums, and copies src to dst, at the dofs of the active
+   // set when restricted is true.
+   void ZeroFluxSums() const;
+   void CopyAtDofs(const Vector &src, Vector &dst) const;
+
+   // Computes the fluxes of u in one pass over the store. The flux sums are
+   // formed in the same pass if add_sums is true.
+   void ComputeFluxes(const ParGridFunction &u, const Vector &du_ho,
+                      Vector &el_f, Vector &face_f, bool add_sums) const;
+   void AddFluxesAtDofs(const Vector &el_f, const Vector &face_f) const;
+   // Turns the flux sums into the alphas and exchanges them.
    void ComputeFluxCoefficients(const Vector &u, const Vector &du_lo,
-      const Vector &m, const Vector &u_min, const Vector &u_max,
-      Vector &coeff_pos, Vector &coeff_neg) const;
+      const Vector &m, const Vector &u_min, const Vector &u_max) const;
+   // Applies the alphas to du and removes the applied part from the fluxes.
+   // The sums of the remaining fluxes are formed if add_sums is true.
    void UpdateSolutionAndFlux(const Vector &du_lo, const Vector &m,
-      ParGridFunction &coeff_pos, ParGridFunction &coeff_neg,
-      SparseMatrix &flux_mat, Vector &du) const;
+                              Vector &el_f, Vector &face_f, bool add_sums,
+                              Vector &du) const;
+
+   // Adds the face fluxes to the flux sums of the local dofs. Each dof gathers
+   // its face pairs, so there are no write conflicts between threads, and the
+   // summation order doesn't depend on the number of threads.
+   void AddFaceFluxSums(const Vector &face_f) const;
 
 public:
    FluxBasedFCT(ParFiniteElementSpace &space,
                 SmoothnessIndicator *si, double delta_t,
-                const SparseMatrix &adv_mat, const Array<int> &adv_smap,
-                const SparseMatrix &mass_mat, int fct_iterations = 1)
-      : FCTSolver(space, si, delta_t),
-        K(adv_mat), M(mass_mat), K_smap(adv_smap), flux_ij(adv_mat),
-        gp(&pfes), gm(&pfes),
-        iter_cnt(fct_iterations) { }
+                ParBilinearForm &adv_form, ParBilinearForm &mass_form,
+                const DofInfo &dof_info, int fct_iterations = 1);
 
    virtual void CalcFCTSolution(const ParGridFunction &u, const Vector &m,
                                 const Vector &du_ho, const Vector &du_lo,
@@ -106,7 +180,11 @@ public:
                                Vector &s_min, Vector &s_max,
                                const Vector &u_new,
                                const Array<bool> &active_el,
-                               const Array<bool> &active_dofs, Vector &d_us);
+                               const Array<bool> &active_dofs,
+                               const Array<int> &elem_list, Vector &d_us);
+
+   // Reassembles d_ij and m_ij of the store.
+   virtual void UpdateOperators();
 };
 
 class ClipScaleSolver : public FCTSolver
@@ -123,12 +201,9 @@ public:
 };
 
 // TODO doesn't conserve mass exactly for some reason.
+// The flux correction of all elements is computed in one element kernel.
 class NonlinearPenaltySolver : public FCTSolver
 {
-protected:
-   void CorrectFlux(Vector &fluxL, Vector &fluxH, Vector &flux_fix) const;
-   double get_max_on_cellNi(Vector &fluxH) const;
-
 public:
    NonlinearPenaltySolver(ParFiniteElementSpace &space,
                           SmoothnessIndicator *si, double dt_)
@@ -22,90 +22,172 @@ using namespace std;
 namespace mfem
 {
 
+void HOSolver::CalcHOSolutions(const Vector &u, Vector &du, int nfields,
+                               FieldLayout layout) const
+{
+   if (layout == FieldLayout::AoS && nfields > 1)
+   {
+      WorkVector u_soa(*work, u.Size()), du_soa(*work, du.Size());
+      ConvertFieldLayout(u, layout, u_soa, FieldLayout::SoA, nfields);
+      CalcHOSolutions(u_soa, du_soa, nfields, FieldLayout::SoA);
+      ConvertFieldLayout(du_soa, FieldLayout::SoA, du, layout, nfields);
+      return;
+   }
+
+   const int s = u.Size() / nfields;
+   Vector u_f, du_f;
+   for (int f = 0; f < nfields; f++)
+   {
+      u_f.MakeRef(const_cast<Vector &>(u), f*s, s);
+      du_f.MakeRef(du, f*s, s);
+      CalcHOSolution(u_f, du_f);
+      du_f.SyncAliasMemory(du);
+   }
+}
+
 CGHOSolver::CGHOSolver(ParFiniteElementSpace &space,
                        ParBilinearForm &Mbf, ParBilinearForm &Kbf)
-   : HOSolver(space), M(Mbf), K(Kbf)
-{ }
+   : HOSolver(space), M(Mbf), K(Kbf),
+     M_mat(NULL), K_mat(NULL), M_prec(NULL), M_solver(space.GetComm()),
+     du_prev(space.GetVSize())
+{
+   M_solver.SetRelTol(1e-8);
+   M_solver.SetAbsTol(0.0);
+   M_solver.SetMaxIter(50);
+   M_solver.SetPrintLevel(0);
+   M_solver.iterative_mode = true;
 
-void CGHOSolver::CalcHOSolution(const Vector &u, Vector &du) const
+   du_prev = 0.0;
+   UpdateOperators();
+}
+
+CGHOSolver::~CGHOSolver()
 {
-   Vector rhs(u.Size());
-   du = 0.0;
+   delete M_prec;
+   delete M_mat;
+   delete K_mat;
+}
+
+void CGHOSolver::UpdateOperators()
+{
+   delete M_prec;
+   delete M_mat;
+   delete K_mat;
+   M_mat = K_mat = NULL;
 
    // Invert by preconditioned CG.
-   CGSolver M_solver(pfes.GetComm());
-   HypreParMatrix *M_mat = NULL, *K_mat = NULL;
-   Solver *M_prec;
    Array<int> ess_tdof_list;
    if (M.GetAssemblyLevel() == AssemblyLevel::PARTIAL)
    {
-      MFEM_ABORT("PA for DG is not yet implemented.");
-
-      K.Mult(u, rhs);
-
-      M_solver.SetOperator(M);
+      // K and M are applied matrix-free.
       M_prec = new OperatorJacobiSmoother(M, ess_tdof_list);
+      M_solver.SetPreconditioner(*M_prec);
+      M_solver.SetOperator(M);
    }
    else
    {
       K_mat = K.ParallelAssemble();
-      K_mat->Mult(u, rhs);
 
       M_mat = M.ParallelAssemble();
-      M_solver.SetOperator(*M_mat);
       M_prec = new HypreSmoother(*M_mat, HypreSmoother::Jacobi);
+      // The preconditioner is set first, as SetOperator() also updates it.
+      M_solver.SetPreconditioner(*M_prec);
+      M_solver.SetOperator(*M_mat);
    }
-   M_solver.SetPreconditioner(*M_prec);
-   M_solver.SetRelTol(1e-8);
-   M_solver.SetAbsTol(0.0);
-   M_solver.SetMaxIter(50);
-   M_solver.SetPrintLevel(0);
+}
 
+void CGHOSolver::CalcHOSolution(const Vector &u, Vector &du) const
+{
+   WorkVector rhs(*work, u.Size());
+
+   if (K_mat) { K_mat->Mult(u, rhs); }
+   else       { K.Mult(u, rhs); }
+
+   // Start from the previous solution.
+   du = du_prev;
    M_solver.Mult(rhs, du);
+   du_prev = du;
+}
 
-   delete M_prec;
-   delete M_mat;
-   delete K_mat;
+ElementMassInverse::ElementMassInverse(ParFiniteElementSpace &space,
+                                       ParBilinearForm &Mbf)
+   : Solver(space.GetVSize()), pfes(space), M(Mbf),
+     M_inv(pfes.GetFE(0)->GetDof(), pfes.GetFE(0)->GetDof(), pfes.GetNE())
+{
+   Update();
 }
 
-LocalInverseHOSolver::LocalInverseHOSolver(ParFiniteElementSpace &space,
-                                           ParBilinearForm &Mbf,
-                                           ParBilinearForm &Kbf)
-   : HOSolver(space), M(Mbf), K(Kbf) { }
+void ElementMassInverse::Update()
+{
+   const bool pa = (M.GetAssemblyLevel() == AssemblyLevel::PARTIAL);
+   const int ne = pfes.GetNE();
+   Array<int> dofs;
+   M_inv.HostWrite();
+   for (int k = 0; k < ne; k++)
+   {
+      if (pa)
+      {
+         // There is no sparse matrix, the blocks are integrated directly.
+         M.ComputeElementMatrix(k, M_inv(k));
+      }
+      else
+      {
+         pfes.GetElementDofs(k, dofs);
+         M.SpMat().GetSubMatrix(dofs, dofs, M_inv(k));
+      }
+      M_inv(k).Invert();
+   }
+}
 
-void LocalInverseHOSolver::CalcHOSolution(const Vector &u, Vector &du) const
+void ElementMassInverse::Mult(const Vector &b, Vector &x) const
 {
-   Vector rhs(u.Size());
+   const int ne = pfes.GetNE(), nd = pfes.GetFE(0)->GetDof();
 
-   HypreParMatrix *K_mat = NULL;
-   if (M.GetAssemblyLevel() == AssemblyLevel::PARTIAL)
+   // DG dofs are ordered element by element.
+   const auto Mi = Reshape(M_inv.Read(), nd, nd, ne);
+   const auto B  = Reshape(b.Read(), nd, ne);
+   auto X        = Reshape(x.Write(), nd, ne);
+   MFEM_FORALL(k, ne,
    {
-      MFEM_ABORT("PA for DG is not yet implemented.");
-      K.Mult(u, rhs);
-   }
-   else
+      for (int i = 0; i < nd; i++)
+      {
+         double sum = 0.0;
+         for (int j = 0; j < nd; j++) { sum += Mi(i, j, k) * B(j, k); }
+         X(i, k) = sum;
+      }
+   });
+}
+
+LocalInverseHOSolver::LocalInverseHOSolver(ParFiniteElementSpace &space,
+                                           ParBilinearForm &Mbf,
+                                           ParBilinearForm &Kbf)
+   : HOSolver(space), M(Mbf), K(Kbf), K_mat(NULL), M_inv(space, Mbf)
+{
+   if (K.GetAssemblyLevel() != AssemblyLevel::PARTIAL)
    {
       K_mat = K.ParallelAssemble();
-      K_mat->Mult(u, rhs);
    }
+}
 
-   const int ne = pfes.GetMesh()->GetNE();
-   const int nd = pfes.GetFE(0)->GetDof();
-   DenseMatrix M_loc(nd);
-   DenseMatrixInverse M_loc_inv(&M_loc);
-   Vector rhs_loc(nd), du_loc(nd);
-   Array<int> dofs;
-   for (int i = 0; i < ne; i++)
+void LocalInverseHOSolver::UpdateOperators()
+{
+   if (K_mat)
    {
-      pfes.GetElementDofs(i, dofs);
-      rhs.GetSubVector(dofs, rhs_loc);
-      M.SpMat().GetSubMatrix(dofs, dofs, M_loc);
-      M_loc_inv.Factor();
-      M_loc_inv.Mult(rhs_loc, du_loc);
-      du.SetSubVector(dofs, du_loc);
+      delete K_mat;
+      K_mat = K.ParallelAssemble();
    }
+   M_inv.Update();
+}
 
-   delete K_mat;
+void LocalInverseHOSolver::CalcHOSolution(const Vector &u, Vector &du) const
+{
+   WorkVector rhs(*work, u.Size());
+
+   // With PA, K multiplies a ldofs Vector, as we're always doing DG.
+   if (K_mat) { K_mat->Mult(u, rhs); }
+   else       { K.Mult(u, rhs); }
+
+   M_inv.Mult(rhs, du);
 }
 
 NeumannHOSolver::NeumannHOSolver(ParFiniteElementSpace &space,
@@ -115,52 +197,34 @@ NeumannHOSolver::NeumannHOSolver(ParFiniteElementSpace &space,
 
 void NeumannHOSolver::CalcHOSolution(const Vector &u, Vector &du) const
 {
-   const int n = u.Size(), ne = pfes.GetNE(), ndof = pfes.GetFE(0)->GetDof();
-   Vector rhs(n), res(n);
-   Vector alpha(ndof); alpha = 1.0;
+   const int n = u.Size();
+   WorkVector rhs(*work, n), res(*work, n);
 
    // K multiplies a ldofs Vector, as we're always doing DG.
    K.Mult(u, rhs);
 
    // Face contributions.
-   ParGridFunction u_gf(&pfes);
-   u_gf = u;
-   u_gf.ExchangeFaceNbrData();
-   Vector &u_nd = u_gf.FaceNbrData();
-   u.HostRead();
-   rhs.HostReadWrite();
-   u_nd.HostRead();
-   for (int k = 0; k < ne; k++)
-   {
-      for (int i = 0; i < assembly.dofs.numBdrs; i++)
-      {
-         assembly.LinearFluxLumping(k, ndof, i, u, rhs, u_nd, alpha);
-      }
-   }
+   assembly.LinearFluxLumping(u, rhs, 1.0);
 
    // Neumann iteration.
    du = 0.0;
    const double abs_tol = 1.e-4;
    const int max_iter = 20;
-   du.ReadWrite();
-   M_lumped.HostRead();
    for (int iter = 1; iter <= max_iter; iter++)
    {
       M.Mult(du, res);
       res -= rhs;
 
-      double resid_loc = res.Norml2(); resid_loc *= resid_loc;
+      // The residual is reproducible for any number of threads.
+      double resid_loc = DeterministicSquaredNorm(res, res_blocks);
       double resid;
       MPI_Allreduce(&resid_loc, &resid, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
       resid = std::sqrt(resid);
       if (resid <= abs_tol) { return; }
 
-      res.HostReadWrite();
-      du.HostReadWrite();
-      for (int i = 0; i < n; i++)
-      {
-         du(i) -= res(i) / M_lumped(i);
-      }
+      const double *d_res = res.Read(), *d_ml = M_lumped.Read();
+      double *d_du = du.ReadWrite();
+      MFEM_FORALL(i, n, d_du[i] -= d_res[i] / d_ml[i]; );
    }
 }
 
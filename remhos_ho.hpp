@@ -18,6 +18,7 @@
 #define MFEM_REMHOS_HO
 
 #include "mfem.hpp"
+#include "remhos_tools.hpp"
 
 namespace mfem
 {
@@ -28,13 +29,27 @@ class HOSolver
 {
 protected:
    ParFiniteElementSpace &pfes;
+   Workspace *work;
 
 public:
-   HOSolver(ParFiniteElementSpace &space) : pfes(space) { }
+   HOSolver(ParFiniteElementSpace &space) : pfes(space), work(NULL) { }
 
    virtual ~HOSolver() { }
 
+   // Temporary vectors are borrowed from w. Must be set before solving.
+   void SetWorkspace(Workspace &w) { work = &w; }
+
    virtual void CalcHOSolution(const Vector &u, Vector &du) const = 0;
+
+   // HO solutions of nfields fields, stored with the given layout in u and
+   // du. By default, the fields are solved one by one, AoS fields through
+   // SoA copies.
+   virtual void CalcHOSolutions(const Vector &u, Vector &du, int nfields,
+                                FieldLayout layout = FieldLayout::SoA) const;
+
+   // Must be called after the underlying forms are reassembled, e.g., when the
+   // mesh moves in remap mode.
+   virtual void UpdateOperators() { }
 };
 
 class CGHOSolver : public HOSolver
@@ -42,11 +57,45 @@ class CGHOSolver : public HOSolver
 protected:
    ParBilinearForm &M, &K;
 
+   // Assembled operators and the solver, kept until the forms change.
+   HypreParMatrix *M_mat, *K_mat;
+   Solver *M_prec;
+   CGSolver M_solver;
+
+   // Solution of the previous call, used as an initial guess.
+   mutable Vector du_prev;
+
 public:
    CGHOSolver(ParFiniteElementSpace &space,
               ParBilinearForm &Mbf, ParBilinearForm &Kbf);
 
+   virtual ~CGHOSolver();
+
    virtual void CalcHOSolution(const Vector &u, Vector &du) const;
+
+   virtual void UpdateOperators();
+};
+
+// Inverses of the element mass matrices of a DG space, stored contiguously
+// and applied by a batched element-wise matrix-vector kernel.
+class ElementMassInverse : public Solver
+{
+protected:
+   ParFiniteElementSpace &pfes;
+   ParBilinearForm &M;
+
+   // Size nd x nd x NE.
+   DenseTensor M_inv;
+
+public:
+   ElementMassInverse(ParFiniteElementSpace &space, ParBilinearForm &Mbf);
+
+   // Recomputes the inverses from the current state of M.
+   void Update();
+
+   virtual void Mult(const Vector &b, Vector &x) const;
+
+   virtual void SetOperator(const Operator &op) { }
 };
 
 class LocalInverseHOSolver : public HOSolver
@@ -54,14 +103,19 @@ class LocalInverseHOSolver : public HOSolver
 protected:
    ParBilinearForm &M, &K;
 
+   HypreParMatrix *K_mat;
+   ElementMassInverse M_inv;
+
 public:
    LocalInverseHOSolver(ParFiniteElementSpace &space,
                         ParBilinearForm &Mbf, ParBilinearForm &Kbf);
 
+   virtual ~LocalInverseHOSolver() { delete K_mat; }
+
    virtual void CalcHOSolution(const Vector &u, Vector &du) const;
-};
 
-class Assembly;
+   virtual void UpdateOperators();
+};
 
 class NeumannHOSolver : public HOSolver
 {
@@ -69,6 +123,8 @@ protected:
    const ParBilinearForm &M, &K;
    const Vector &M_lumped;
    Assembly &assembly;
+   // Block sums of the residual norm.
+   mutable Vector res_blocks;
 
 public:
    NeumannHOSolver(ParFiniteElementSpace &space,
@@ -0,0 +1,523 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#include "remhos_io.hpp"
+#include "remhos_sync.hpp"
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+namespace mfem
+{
+
+// Marks the files of WriteParallelBinary().
+static const long long remhos_io_magic = 0x52454d484f53LL;
+// Marks the files of SaveElementCheckpoint().
+static const long long remhos_el_magic = 0x52454d484f45LL;
+
+// Global sizes of the vectors and the offsets of the local parts.
+static void GetBlockOffsets(MPI_Comm comm, const Array<long long> &loc,
+                            Array<long long> &glob, Array<long long> &off)
+{
+   const int nv = loc.Size();
+   glob.SetSize(nv);
+   off.SetSize(nv);
+   off = 0;
+   if (nv == 0) { return; }
+   MPI_Allreduce(loc.GetData(), glob.GetData(), nv, MPI_LONG_LONG, MPI_SUM,
+                 comm);
+   MPI_Exscan(loc.GetData(), off.GetData(), nv, MPI_LONG_LONG, MPI_SUM, comm);
+   int myid;
+   MPI_Comm_rank(comm, &myid);
+   if (myid == 0) { off = 0; }
+}
+
+void WriteParallelBinary(MPI_Comm comm, const char *fname,
+                         const Vector &header,
+                         const Array<const Vector *> &vecs)
+{
+   int myid, num_procs;
+   MPI_Comm_rank(comm, &myid);
+   MPI_Comm_size(comm, &num_procs);
+   const int nv = vecs.Size(), nh = header.Size();
+
+   Array<long long> loc(nv), glob, off;
+   for (int v = 0; v < nv; v++) { loc[v] = vecs[v]->Size(); }
+   GetBlockOffsets(comm, loc, glob, off);
+
+   // Preamble: magic, number of tasks, header size, number of vectors and
+   // their global sizes.
+   Array<long long> pre(4 + nv);
+   pre[0] = remhos_io_magic;
+   pre[1] = num_procs;
+   pre[2] = nh;
+   pre[3] = nv;
+   for (int v = 0; v < nv; v++) { pre[4 + v] = glob[v]; }
+
+   MPI_File fh;
+   int err = MPI_File_open(comm, const_cast<char *>(fname),
+                           MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+                           &fh);
+   MFEM_VERIFY(err == MPI_SUCCESS, "Error opening file " << fname);
+   MPI_File_set_size(fh, 0);
+
+   MPI_Offset pos = 0;
+   if (myid == 0)
+   {
+      MPI_File_write_at(fh, pos, pre.GetData(), pre.Size(), MPI_LONG_LONG,
+                        MPI_STATUS_IGNORE);
+      MPI_File_write_at(fh, pos + pre.Size() * sizeof(long long),
+                        const_cast<double *>(header.HostRead()), nh,
+                        MPI_DOUBLE, MPI_STATUS_IGNORE);
+   }
+   pos += pre.Size() * sizeof(long long) + nh * sizeof(double);
+
+   for (int v = 0; v < nv; v++)
+   {
+      const MPI_Offset v_pos = pos + off[v] * sizeof(double);
+      err = MPI_File_write_at_all(fh, v_pos,
+                                  const_cast<double *>(vecs[v]->HostRead()),
+                                  (int) loc[v], MPI_DOUBLE, MPI_STATUS_IGNORE);
+      MFEM_VERIFY(err == MPI_SUCCESS, "Error writing file " << fname);
+      pos += glob[v] * sizeof(double);
+   }
+   MPI_File_close(&fh);
+}
+
+void ReadParallelBinary(MPI_Comm comm, const char *fname, Vector &header,
+                        const Array<Vector *> &vecs)
+{
+   int num_procs;
+   MPI_Comm_size(comm, &num_procs);
+   const int nv = vecs.Size(), nh = header.Size();
+
+   Array<long long> loc(nv), glob, off;
+   for (int v = 0; v < nv; v++) { loc[v] = vecs[v]->Size(); }
+   GetBlockOffsets(comm, loc, glob, off);
+
+   MPI_File fh;
+   int err = MPI_File_open(comm, const_cast<char *>(fname), MPI_MODE_RDONLY,
+                           MPI_INFO_NULL, &fh);
+   MFEM_VERIFY(err == MPI_SUCCESS, "Error opening file " << fname);
+
+   Array<long long> pre(4 + nv);
+   MPI_Offset pos = 0;
+   MPI_File_read_at_all(fh, pos, pre.GetData(), pre.Size(), MPI_LONG_LONG,
+                        MPI_STATUS_IGNORE);
+   MFEM_VERIFY(pre[0] == remhos_io_magic, "Unknown file format: " << fname);
+   MFEM_VERIFY(pre[1] == num_procs, "The file " << fname << " was written "
+               "by " << pre[1] << " tasks, not " << num_procs);
+   MFEM_VERIFY(pre[2] == nh && pre[3] == nv,
+               "Unexpected contents of file " << fname);
+   for (int v = 0; v < nv; v++)
+   {
+      MFEM_VERIFY(pre[4 + v] == glob[v], "Size mismatch of vector " << v
+                  << " in file " << fname);
+   }
+   pos += pre.Size() * sizeof(long long);
+
+   MPI_File_read_at_all(fh, pos, header.HostWrite(), nh, MPI_DOUBLE,
+                        MPI_STATUS_IGNORE);
+   pos += nh * sizeof(double);
+
+   for (int v = 0; v < nv; v++)
+   {
+      const MPI_Offset v_pos = pos + off[v] * sizeof(double);
+      err = MPI_File_read_at_all(fh, v_pos, vecs[v]->HostWrite(),
+                                 (int) loc[v], MPI_DOUBLE, MPI_STATUS_IGNORE);
+      MFEM_VERIFY(err == MPI_SUCCESS, "Error reading file " << fname);
+      pos += glob[v] * sizeof(double);
+   }
+   MPI_File_close(&fh);
+}
+
+void SaveParallelOutput(ParMesh &pmesh, const char *mesh_name,
+                        const ParGridFunction *u, const char *sol_name,
+                        int precision)
+{
+   if (mesh_name)
+   {
+      ostringstream name;
+      name << mesh_name << "." << setfill('0') << setw(6) << pmesh.GetMyRank();
+      ofstream mesh_ofs(name.str().c_str());
+      mesh_ofs.precision(precision);
+      pmesh.Print(mesh_ofs);
+   }
+   if (u && sol_name)
+   {
+      Vector header;
+      Array<const Vector *> vecs(1);
+      vecs[0] = u;
+      WriteParallelBinary(pmesh.GetComm(), sol_name, header, vecs);
+   }
+}
+
+void SaveCheckpoint(MPI_Comm comm, const char *fname, const Vector &S,
+                    double t, int ti, double dt, const Vector &masses0,
+                    const Vector &mesh_pos0, const Vector &submesh_pos0)
+{
+   const int nm = masses0.Size();
+   Vector header(3 + nm);
+   header(0) = t;
+   header(1) = ti;
+   header(2) = dt;
+   for (int i = 0; i < nm; i++) { header(3 + i) = masses0(i); }
+   Array<const Vector *> vecs(3);
+   vecs[0] = &S;
+   vecs[1] = &mesh_pos0;
+   vecs[2] = &submesh_pos0;
+   WriteParallelBinary(comm, fname, header, vecs);
+}
+
+void LoadCheckpoint(MPI_Comm comm, const char *fname, Vector &S,
+                    double &t, int &ti, double &dt, Vector &masses0,
+                    Vector &mesh_pos0, Vector &submesh_pos0)
+{
+   const int nm = masses0.Size();
+   Vector header(3 + nm);
+   Array<Vector *> vecs(3);
+   vecs[0] = &S;
+   vecs[1] = &mesh_pos0;
+   vecs[2] = &submesh_pos0;
+   ReadParallelBinary(comm, fname, header, vecs);
+   t  = header(0);
+   ti = (int) header(1);
+   dt = header(2);
+   for (int i = 0; i < nm; i++) { masses0(i) = header(3 + i); }
+}
+
+// Preamble of an element checkpoint: magic, number of elements, values per
+// element, number of tasks of the partitioning and number of initial masses.
+// It is followed by the header t, ti, dt and the initial masses, the
+// partitioning, and the element values.
+static const int el_chk_pre = 5, el_chk_header = 3;
+
+static MPI_Offset ElementCheckpointHeader()
+{
+   return el_chk_pre * sizeof(long long);
+}
+
+static MPI_Offset ElementCheckpointPartitioning(long long nm)
+{
+   return ElementCheckpointHeader() + (el_chk_header + nm) * sizeof(double);
+}
+
+static MPI_Offset ElementCheckpointValues(long long ne, long long nm)
+{
+   return ElementCheckpointPartitioning(nm) + ne * sizeof(int);
+}
+
+// File view that selects the records of the local elements.
+static void SetElementView(MPI_File fh, MPI_Offset pos,
+                           const Array<int> &glob_el, int size,
+                           MPI_Datatype &el_type, MPI_Datatype &view_type)
+{
+   MPI_Type_contiguous(size, MPI_DOUBLE, &el_type);
+   MPI_Type_commit(&el_type);
+   MPI_Type_create_indexed_block(glob_el.Size(), 1,
+                                 const_cast<int *>(glob_el.GetData()),
+                                 el_type, &view_type);
+   MPI_Type_commit(&view_type);
+   MPI_File_set_view(fh, pos, MPI_DOUBLE, view_type,
+                     const_cast<char *>("native"), MPI_INFO_NULL);
+}
+
+void SaveElementCheckpoint(MPI_Comm comm, const char *fname,
+                           const Array<int> &glob_el, const Vector &el_vals,
+                           const Array<int> &partitioning,
+                           double t, int ti, double dt,
+                           const Vector &masses0)
+{
+   int myid, num_procs;
+   MPI_Comm_rank(comm, &myid);
+   MPI_Comm_size(comm, &num_procs);
+   const int ne = partitioning.Size(), ne_loc = glob_el.Size();
+   const int size = (ne_loc > 0) ? el_vals.Size() / ne_loc : 0;
+   int size_glob;
+   MPI_Allreduce(&size, &size_glob, 1, MPI_INT, MPI_MAX, comm);
+   MFEM_VERIFY(el_vals.Size() == ne_loc * size_glob,
+               "The elements must have the same number of values.");
+
+   MPI_File fh;
+   int err = MPI_File_open(comm, const_cast<char *>(fname),
+                           MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL,
+                           &fh);
+   MFEM_VERIFY(err == MPI_SUCCESS, "Error opening file " << fname);
+   MPI_File_set_size(fh, 0);
+
+   const int nm = masses0.Size();
+   if (myid == 0)
+   {
+      long long pre[el_chk_pre] = { remhos_el_magic, ne, size_glob,
+                                    num_procs, nm
+                                  };
+      Vector header(el_chk_header + nm);
+      header(0) = t;
+      header(1) = ti;
+      header(2) = dt;
+      for (int i = 0; i < nm; i++) { header(el_chk_header + i) = masses0(i); }
+      MPI_File_write_at(fh, 0, pre, el_chk_pre, MPI_LONG_LONG,
+                        MPI_STATUS_IGNORE);
+      MPI_File_write_at(fh, ElementCheckpointHeader(), header.GetData(),
+                        header.Size(), MPI_DOUBLE, MPI_STATUS_IGNORE);
+      MPI_File_write_at(fh, ElementCheckpointPartitioning(nm),
+                        const_cast<int *>(partitioning.GetData()),
+                        ne, MPI_INT, MPI_STATUS_IGNORE);
+   }
+
+   MPI_Datatype el_type, view_type;
+   SetElementView(fh, ElementCheckpointValues(ne, nm), glob_el, size_glob,
+                  el_type, view_type);
+   err = MPI_File_write_all(fh, const_cast<double *>(el_vals.HostRead()),
+                            el_vals.Size(), MPI_DOUBLE, MPI_STATUS_IGNORE);
+   MFEM_VERIFY(err == MPI_SUCCESS, "Error writing file " << fname);
+   MPI_File_close(&fh);
+   MPI_Type_free(&view_type);
+   MPI_Type_free(&el_type);
+}
+
+// Reads and checks the preamble of an element checkpoint, and reads its header.
+static void ReadElementPreamble(MPI_File fh, const char *fname,
+                                long long *pre, Vector &header)
+{
+   MPI_File_read_at_all(fh, 0, pre, el_chk_pre, MPI_LONG_LONG,
+                        MPI_STATUS_IGNORE);
+   MFEM_VERIFY(pre[0] == remhos_el_magic, "Unknown file format: " << fname);
+   header.SetSize(el_chk_header + (int) pre[4]);
+   MPI_File_read_at_all(fh, ElementCheckpointHeader(), header.GetData(),
+                        header.Size(), MPI_DOUBLE, MPI_STATUS_IGNORE);
+}
+
+void LoadCheckpointPartitioning(MPI_Comm comm, const char *fname, int ne,
+                                Array<int> &partitioning)
+{
+   int num_procs;
+   MPI_Comm_size(comm, &num_procs);
+
+   MPI_File fh;
+   int err = MPI_File_open(comm, const_cast<char *>(fname), MPI_MODE_RDONLY,
+                           MPI_INFO_NULL, &fh);
+   MFEM_VERIFY(err == MPI_SUCCESS, "Error opening file " << fname);
+
+   long long pre[el_chk_pre];
+   Vector header;
+   ReadElementPreamble(fh, fname, pre, header);
+   MFEM_VERIFY(pre[1] == ne, "The file " << fname << " is for a mesh with "
+               << pre[1] << " elements, not " << ne);
+   MFEM_VERIFY(pre[3] == num_procs, "The file " << fname << " is for "
+               << pre[3] << " tasks, not " << num_procs);
+
+   partitioning.SetSize(ne);
+   MPI_File_read_at_all(fh, ElementCheckpointPartitioning(pre[4]),
+                        partitioning.GetData(), ne, MPI_INT,
+                        MPI_STATUS_IGNORE);
+   MPI_File_close(&fh);
+}
+
+void LoadElementCheckpoint(MPI_Comm comm, const char *fname,
+                           const Array<int> &glob_el, Vector &el_vals,
+                           double &t, int &ti, double &dt, Vector &masses0)
+{
+   const int ne_loc = glob_el.Size();
+
+   MPI_File fh;
+   int err = MPI_File_open(comm, const_cast<char *>(fname), MPI_MODE_RDONLY,
+                           MPI_INFO_NULL, &fh);
+   MFEM_VERIFY(err == MPI_SUCCESS, "Error opening file " << fname);
+
+   long long pre[el_chk_pre];
+   Vector header;
+   ReadElementPreamble(fh, fname, pre, header);
+   MFEM_VERIFY(el_vals.Size() == ne_loc * pre[2],
+               "Size mismatch of the element values in file " << fname);
+   MFEM_VERIFY(masses0.Size() == pre[4],
+               "Size mismatch of the initial masses in file " << fname);
+   t  = header(0);
+   ti = (int) header(1);
+   dt = header(2);
+   for (int i = 0; i < masses0.Size(); i++)
+   {
+      masses0(i) = header(el_chk_header + i);
+   }
+
+   MPI_Datatype el_type, view_type;
+   SetElementView(fh, ElementCheckpointValues(pre[1], pre[4]), glob_el,
+                  (int) pre[2], el_type, view_type);
+   err = MPI_File_read_all(fh, el_vals.HostWrite(), el_vals.Size(),
+                           MPI_DOUBLE, MPI_STATUS_IGNORE);
+   MFEM_VERIFY(err == MPI_SUCCESS, "Error reading file " << fname);
+   MPI_File_close(&fh);
+   MPI_Type_free(&view_type);
+   MPI_Type_free(&el_type);
+}
+
+AsyncFieldWriter::AsyncFieldWriter(const char *file_prefix, int myid,
+                                   bool single_precision)
+   : prefix(file_prefix), rank(myid), single(single_precision),
+     next(0), stop(false)
+{
+   full[0] = full[1] = false;
+   thread = std::thread(&AsyncFieldWriter::Run, this);
+}
+
+AsyncFieldWriter::~AsyncFieldWriter()
+{
+   {
+      std::lock_guard<std::mutex> lock(mtx);
+      stop = true;
+   }
+   cv.notify_all();
+   thread.join();
+}
+
+void AsyncFieldWriter::Write(int cycle, double time,
+                             const Array<const Vector *> &fields,
+                             const Array<const char *> &names,
+                             const Vector *us, const Vector *u, int nd)
+{
+   MFEM_VERIFY(fields.Size() == names.Size(), "Missing field names.");
+
+   // Wait until the writer is done with the buffer.
+   std::unique_lock<std::mutex> lock(mtx);
+   cv.wait(lock, [&] { return full[next] == false; });
+   lock.unlock();
+
+   Snapshot &snap = buf[next];
+   snap.cycle = cycle;
+   snap.time = time;
+   snap.names.assign(names.GetData(), names.GetData() + names.Size());
+   snap.sizes.resize(fields.Size());
+   int total = 0;
+   for (int f = 0; f < fields.Size(); f++)
+   {
+      snap.sizes[f] = fields[f]->Size();
+      total += snap.sizes[f];
+   }
+   snap.data.resize(total);
+   for (int f = 0, pos = 0; f < fields.Size(); f++)
+   {
+      const double *h_f = fields[f]->HostRead();
+      std::copy(h_f, h_f + snap.sizes[f], snap.data.begin() + pos);
+      pos += snap.sizes[f];
+   }
+   snap.ratio_nd = (us && u) ? nd : 0;
+   if (snap.ratio_nd > 0)
+   {
+      const double *h_us = us->HostRead(), *h_u = u->HostRead();
+      snap.ratio_us.assign(h_us, h_us + us->Size());
+      snap.ratio_u.assign(h_u, h_u + u->Size());
+   }
+
+   lock.lock();
+   full[next] = true;
+   next = 1 - next;
+   lock.unlock();
+   cv.notify_all();
+}
+
+void AsyncFieldWriter::Run()
+{
+   // The buffers are filled and written in alternating order.
+   for (int cur = 0; ; cur = 1 - cur)
+   {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [&] { return full[cur] || stop; });
+      if (full[cur] == false) { return; }
+      lock.unlock();
+
+      CompleteSnapshot(buf[cur]);
+      WriteSnapshot(buf[cur]);
+
+      lock.lock();
+      full[cur] = false;
+      lock.unlock();
+      cv.notify_all();
+   }
+}
+
+void AsyncFieldWriter::CompleteSnapshot(Snapshot &snap) const
+{
+   if (snap.ratio_nd > 0)
+   {
+      const int nd = snap.ratio_nd, size = (int) snap.ratio_u.size();
+      const size_t pos = snap.data.size();
+      snap.names.push_back("s");
+      snap.sizes.push_back(size);
+      snap.data.resize(pos + size);
+      const double *h_us = snap.ratio_us.data(), *h_u = snap.ratio_u.data();
+      double *h_s = snap.data.data() + pos;
+      for (int k = 0; k < size / nd; k++)
+      {
+         // Empty elements get s = 0, as in ComputeRatio().
+         bool empty = true;
+         for (int j = 0; j < nd; j++)
+         {
+            if (h_u[k*nd + j] > EMPTY_ZONE_TOL) { empty = false; }
+         }
+         if (empty)
+         {
+            for (int j = 0; j < nd; j++) { h_s[k*nd + j] = 0.0; }
+            continue;
+         }
+         ComputeElementRatio(nd, h_u + k*nd, h_us + k*nd, h_s + k*nd);
+      }
+   }
+
+   if (single)
+   {
+      snap.data_sp.resize(snap.data.size());
+      for (size_t i = 0; i < snap.data.size(); i++)
+      {
+         snap.data_sp[i] = (float) snap.data[i];
+      }
+   }
+}
+
+void AsyncFieldWriter::WriteSnapshot(const Snapshot &snap) const
+{
+   // Layout: number of fields, bytes per value, cycle, time, then the name
+   // length, name, size and values of each field.
+   ostringstream name;
+   name << prefix << "_" << setfill('0') << setw(6) << snap.cycle << "."
+        << setw(6) << rank;
+   ofstream ofs(name.str().c_str(), ios::binary);
+   if (!ofs)
+   {
+      cerr << "Error opening file " << name.str() << endl;
+      return;
+   }
+   const int nf = (int) snap.names.size(), bytes = single ? 4 : 8;
+   ofs.write((const char *) &nf, sizeof(int));
+   ofs.write((const char *) &bytes, sizeof(int));
+   ofs.write((const char *) &snap.cycle, sizeof(int));
+   ofs.write((const char *) &snap.time, sizeof(double));
+   size_t pos = 0;
+   for (int f = 0; f < nf; f++)
+   {
+      const int len = (int) snap.names[f].size();
+      ofs.write((const char *) &len, sizeof(int));
+      ofs.write(snap.names[f].c_str(), len);
+      ofs.write((const char *) &snap.sizes[f], sizeof(int));
+      const char *vals = single ? (const char *) (snap.data_sp.data() + pos)
+                         : (const char *) (snap.data.data() + pos);
+      ofs.write(vals, (size_t) snap.sizes[f] * bytes);
+      pos += snap.sizes[f];
+   }
+}
+
+} // namespace mfem
@@ -0,0 +1,137 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#ifndef MFEM_REMHOS_IO
+#define MFEM_REMHOS_IO
+
+#include "mfem.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mfem
+{
+
+// Writes the local parts of the vectors vecs of all tasks to one binary file,
+// with MPI-IO. Each vector is stored contiguously, in the order of the ranks,
+// after a preamble of sizes and the values of header, which are the same on
+// all tasks.
+void WriteParallelBinary(MPI_Comm comm, const char *fname,
+                         const Vector &header,
+                         const Array<const Vector *> &vecs);
+
+// Reads a file written by WriteParallelBinary() with the same number of tasks.
+// header and the vectors must have the sizes used for writing.
+void ReadParallelBinary(MPI_Comm comm, const char *fname, Vector &header,
+                        const Array<Vector *> &vecs);
+
+// Writes the local mesh of each task to mesh_name.<rank>, in the format that
+// GLVis reads with -np, and the solution of all tasks to the binary file
+// sol_name. Unlike PrintAsOne() and SaveAsOne(), nothing is gathered on one
+// task. Nothing is written for a NULL name.
+void SaveParallelOutput(ParMesh &pmesh, const char *mesh_name,
+                        const ParGridFunction *u, const char *sol_name,
+                        int precision);
+
+// State of a run that is needed to resume it: the solution blocks S, the time,
+// the time step count, the time step, the initial masses of the fields, which
+// the reported mass losses refer to, and the start positions of the meshes for
+// remap. The number of tasks must be the same when restarting, and masses0
+// must have the size used for writing.
+void SaveCheckpoint(MPI_Comm comm, const char *fname, const Vector &S,
+                    double t, int ti, double dt, const Vector &masses0,
+                    const Vector &mesh_pos0, const Vector &submesh_pos0);
+void LoadCheckpoint(MPI_Comm comm, const char *fname, Vector &S,
+                    double &t, int &ti, double &dt, Vector &masses0,
+                    Vector &mesh_pos0, Vector &submesh_pos0);
+
+// Checkpoint that is stored per element of the serial mesh, in the global
+// element order, together with the partitioning that the run resumes with.
+// This allows to resume with a different partitioning of the mesh. el_vals
+// has the values of the local elements, see PackElementState(), whose serial
+// indices are glob_el, see GetGlobalElements().
+void SaveElementCheckpoint(MPI_Comm comm, const char *fname,
+                           const Array<int> &glob_el, const Vector &el_vals,
+                           const Array<int> &partitioning,
+                           double t, int ti, double dt,
+                           const Vector &masses0);
+// Reads the partitioning of an element checkpoint, for a serial mesh with ne
+// elements. Must be done before the parallel mesh is built.
+void LoadCheckpointPartitioning(MPI_Comm comm, const char *fname, int ne,
+                                Array<int> &partitioning);
+// el_vals must have the size of the values of the local elements.
+void LoadElementCheckpoint(MPI_Comm comm, const char *fname,
+                           const Array<int> &glob_el, Vector &el_vals,
+                           double &t, int &ti, double &dt, Vector &masses0);
+
+// Writes snapshots of fields from a background thread, so that the time loop
+// doesn't wait for the file system. A snapshot is copied to one of two host
+// staging buffers, and the time loop only waits when both buffers are still
+// being written. The thread converts the values to single precision, if
+// requested, and computes the ratio field s = us / u. Each task writes its own
+// binary file, prefix_<cycle>.<rank>, so the thread makes no MPI calls.
+class AsyncFieldWriter
+{
+private:
+   struct Snapshot
+   {
+      int cycle;
+      double time;
+      std::vector<std::string> names;
+      std::vector<int> sizes;
+      std::vector<double> data;
+      std::vector<float> data_sp;
+      // us and u of the ratio field, with ratio_nd dofs per element.
+      int ratio_nd;
+      std::vector<double> ratio_us, ratio_u;
+   };
+
+   const std::string prefix;
+   const int rank;
+   const bool single;
+
+   Snapshot buf[2];
+   bool full[2];
+   int next;
+   bool stop;
+   std::mutex mtx;
+   std::condition_variable cv;
+   std::thread thread;
+
+   void Run();
+   // Appends s to the fields of the snapshot and fills data_sp.
+   void CompleteSnapshot(Snapshot &snap) const;
+   void WriteSnapshot(const Snapshot &snap) const;
+
+public:
+   AsyncFieldWriter(const char *file_prefix, int myid, bool single_precision);
+
+   // Waits for the queued snapshots to be written.
+   ~AsyncFieldWriter();
+
+   // Copies the fields and queues them for writing. If us and u are given,
+   // s = us / u of these DG fields, with nd dofs per element, is written after
+   // the other fields, as ComputeRatio() gives it.
+   void Write(int cycle, double time, const Array<const Vector *> &fields,
+              const Array<const char *> &names,
+              const Vector *us = NULL, const Vector *u = NULL, int nd = 0);
+};
+
+} // namespace mfem
+
+#endif // MFEM_REMHOS_IO
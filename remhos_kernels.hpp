@@ -0,0 +1,175 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#ifndef MFEM_REMHOS_KERNELS
+#define MFEM_REMHOS_KERNELS
+
+#include "mfem.hpp"
+
+namespace mfem
+{
+
+// The element kernels are specialized at compile time for T_DIM = 2, 3 and
+// T_ORDER = 1..4. T_DIM = T_ORDER = 0 gives the generic kernel, which uses the
+// runtime sizes and keeps its local arrays in scratch memory of the caller.
+// NOTE: The mesh is assumed to consist of segments, quads or hexes.
+
+constexpr int KernelPow(int b, int e)
+{ return e <= 0 ? 1 : b * KernelPow(b, e-1); }
+
+// Number of dofs of an element and of the subcells of an element.
+constexpr int KernelElemDofs(int dim, int order)
+{ return KernelPow(order + 1, dim); }
+constexpr int KernelNumSubcells(int dim, int order)
+{ return KernelPow(order, dim); }
+constexpr int KernelSubcellDofs(int dim) { return KernelPow(2, dim); }
+
+// Size of the scratch of the generic RDElementKernel(), for nd element dofs
+// and nsc subcells.
+constexpr int RDScratchSize(int nd, int nsc) { return 2*nd + 6*nsc; }
+
+// Returns 10*dim + order if there are specialized kernels for the given
+// dimension and order, and 0 otherwise.
+inline int KernelKey(int dim, int order)
+{
+   if (dim < 2 || dim > 3 || order < 1 || order > 4) { return 0; }
+   return 10*dim + order;
+}
+
+// Expands to the cases of a switch over KernelKey() that select a kernel
+// instantiation, for example: switch (key) { REMHOS_KERNEL_CASES(k, Foo) }
+// sets k = Foo<T_DIM, T_ORDER>.
+#define REMHOS_KERNEL_CASES(kernel, name) \
+   case 21: kernel = name<2,1>; break;    \
+   case 22: kernel = name<2,2>; break;    \
+   case 23: kernel = name<2,3>; break;    \
+   case 24: kernel = name<2,4>; break;    \
+   case 31: kernel = name<3,1>; break;    \
+   case 32: kernel = name<3,2>; break;    \
+   case 33: kernel = name<3,3>; break;    \
+   case 34: kernel = name<3,4>; break;    \
+   default: kernel = name<0,0>;
+
+// Residual distribution of the element fluctuation rho, summed from z, to the
+// element dofs, as in eq. (58) - (59) of the paper. u, z and rd point to the
+// nd values of the element, sc_weights and sub2ind to its nsc x nds subcell
+// weights and indices, stored column-major. On exit rd holds
+// weightP * rhoP + weightN * rhoN for each dof. The generic kernel uses the
+// RDScratchSize(nd, nsc) values of scratch, the others ignore it.
+template<int T_DIM, int T_ORDER>
+MFEM_HOST_DEVICE inline
+void RDElementKernel(const int nd_, const int nsc_, const int nds_,
+                     const bool subcell, const double gamma,
+                     const double *u, const double *z,
+                     const double x_min, const double x_max,
+                     const double *sc_weights, const int *sub2ind,
+                     double *scratch, double *rd)
+{
+   constexpr int ND  = KernelElemDofs(T_DIM, T_ORDER);
+   constexpr int NSC = KernelNumSubcells(T_DIM, T_ORDER);
+   constexpr int max_nd  = T_DIM ? ND  : 1;
+   constexpr int max_nsc = T_DIM ? NSC : 1;
+   const int nd  = T_DIM ? ND  : nd_;
+   const int nsc = T_DIM ? NSC : nsc_;
+   const int nds = T_DIM ? KernelSubcellDofs(T_DIM) : nds_;
+   const double eps = 1.E-15;
+
+   double rhoP = 0., rhoN = 0., xSum = 0.;
+   for (int j = 0; j < nd; j++)
+   {
+      xSum += u[j];
+      rhoP += fmax(0., z[j]);
+      rhoN += fmin(0., z[j]);
+   }
+   const double sumWeightsP = nd*x_max - xSum + eps;
+   const double sumWeightsN = nd*x_min - xSum - eps;
+
+   double sumFluctSubcellP = 0., sumFluctSubcellN = 0.;
+   double nw_loc[2*max_nd];
+   double *nodalWeightsP = T_DIM ? nw_loc : scratch,
+           *nodalWeightsN = nodalWeightsP + nd;
+   if (subcell)
+   {
+      double sc_loc[6*max_nsc];
+      double *xMaxSubcell = T_DIM ? sc_loc : scratch + 2*nd,
+              *xMinSubcell = xMaxSubcell + nsc,
+              *sumWeightsSubcellP = xMinSubcell + nsc,
+              *sumWeightsSubcellN = sumWeightsSubcellP + nsc,
+              *fluctSubcellP = sumWeightsSubcellN + nsc,
+              *fluctSubcellN = fluctSubcellP + nsc;
+      for (int i = 0; i < nd; i++) { nodalWeightsP[i] = nodalWeightsN[i] = 0.; }
+
+      // compute min-/max-values and the fluctuation for subcells
+      for (int m = 0; m < nsc; m++)
+      {
+         const double u0 = u[sub2ind[m]];
+         double fluct = 0., xSumSubcell = 0.;
+         xMinSubcell[m] = xMaxSubcell[m] = u0;
+         for (int i = 0; i < nds; i++)
+         {
+            const double u_i = u[sub2ind[m + i*nsc]];
+            fluct += sc_weights[m + i*nsc] * u_i;
+            xMaxSubcell[m] = fmax(xMaxSubcell[m], u_i);
+            xMinSubcell[m] = fmin(xMinSubcell[m], u_i);
+            xSumSubcell += u_i;
+         }
+         sumWeightsSubcellP[m] = nds * xMaxSubcell[m] - xSumSubcell + eps;
+         sumWeightsSubcellN[m] = nds * xMinSubcell[m] - xSumSubcell - eps;
+
+         fluctSubcellP[m] = fmax(0., fluct);
+         fluctSubcellN[m] = fmin(0., fluct);
+         sumFluctSubcellP += fluctSubcellP[m];
+         sumFluctSubcellN += fluctSubcellN[m];
+      }
+
+      for (int m = 0; m < nsc; m++)
+      {
+         for (int i = 0; i < nds; i++)
+         {
+            const int loc = sub2ind[m + i*nsc];
+            nodalWeightsP[loc] += fluctSubcellP[m]
+                                  * ((xMaxSubcell[m] - u[loc])
+                                     / sumWeightsSubcellP[m]); // eq. (58)
+            nodalWeightsN[loc] += fluctSubcellN[m]
+                                  * ((xMinSubcell[m] - u[loc])
+                                     / sumWeightsSubcellN[m]); // eq. (59)
+         }
+      }
+   }
+
+   for (int i = 0; i < nd; i++)
+   {
+      double weightP = (x_max - u[i]) / sumWeightsP;
+      double weightN = (x_min - u[i]) / sumWeightsN;
+
+      if (subcell)
+      {
+         double aux = gamma / (rhoP + eps);
+         weightP *= 1. - fmin(aux * sumFluctSubcellP, 1.);
+         weightP += fmin(aux, 1./(sumFluctSubcellP+eps))*nodalWeightsP[i];
+
+         aux = gamma / (rhoN - eps);
+         weightN *= 1. - fmin(aux * sumFluctSubcellN, 1.);
+         weightN += fmax(aux, 1./(sumFluctSubcellN-eps))*nodalWeightsN[i];
+      }
+
+      rd[i] = weightP * rhoP + weightN * rhoN;
+   }
+}
+
+} // namespace mfem
+
+#endif // MFEM_REMHOS_KERNELS
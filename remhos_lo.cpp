@@ -16,6 +16,7 @@
 
 #include "remhos_lo.hpp"
 #include "remhos_tools.hpp"
+#include "remhos_kernels.hpp"
 
 using namespace std;
 
@@ -34,37 +35,89 @@ DiscreteUpwind::DiscreteUpwind(ParFiniteElementSpace &space,
    ComputeDiscreteUpwindMatrix();
 }
 
-void DiscreteUpwind::CalcLOSolution(const Vector &u, Vector &du) const
+void LOSolver::CalcLOSolutions(const Vector &u, Vector &du, int nfields,
+                               FieldLayout layout) const
 {
-   const int ndof = pfes.GetFE(0)->GetDof();
-   Vector alpha(ndof); alpha = 0.0;
+   if (layout == FieldLayout::AoS && nfields > 1)
+   {
+      WorkVector u_soa(*work, u.Size()), du_soa(*work, du.Size());
+      ConvertFieldLayout(u, layout, u_soa, FieldLayout::SoA, nfields);
+      CalcLOSolutions(u_soa, du_soa, nfields, FieldLayout::SoA);
+      ConvertFieldLayout(du_soa, FieldLayout::SoA, du, layout, nfields);
+      return;
+   }
+
+   const int s = u.Size() / nfields;
+   Vector u_f, du_f;
+   for (int f = 0; f < nfields; f++)
+   {
+      u_f.MakeRef(const_cast<Vector &>(u), f*s, s);
+      du_f.MakeRef(du, f*s, s);
+      CalcLOSolution(u_f, du_f);
+      du_f.SyncAliasMemory(du);
+   }
+}
 
+void DiscreteUpwind::CalcLOSolutions(const Vector &u, Vector &du,
+                                     int nfields, FieldLayout layout) const
+{
    // Recompute D due to mesh changes (K changes) in remap mode.
    if (update_D) { ComputeDiscreteUpwindMatrix(); }
 
-   // Discretization and monotonicity terms.
-   D.Mult(u, du);
-
-   // Lump fluxes (for PDU).
-   ParGridFunction u_gf(&pfes);
-   u_gf = u;
-   u_gf.ExchangeFaceNbrData();
-   Vector &u_nd = u_gf.FaceNbrData();
-   const int ne = pfes.GetNE();
-   u.HostRead();
-   du.HostReadWrite();
-   M_lumped.HostRead();
-   for (int k = 0; k < ne; k++)
+   // Discretization and monotonicity terms, D u for all fields.
+   const int s = D.Height(), nf = nfields,
+             fs = FieldStride(layout, s), ds = DofStride(layout, nf);
+   const int *I = D.ReadI(), *J = D.ReadJ();
+   const double *A = D.ReadData(), *d_u = u.Read();
+   double *d_du = du.Write();
+   MFEM_FORALL(i, s,
    {
-      // Face contributions.
-      for (int f = 0; f < assembly.dofs.numBdrs; f++)
+      for (int f = 0; f < nf; f++)
       {
-         assembly.LinearFluxLumping(k, ndof, f, u, du, u_nd, alpha);
+         double sum = 0.0;
+         for (int k = I[i]; k < I[i+1]; k++)
+         {
+            sum += A[k] * d_u[f*fs + J[k]*ds];
+         }
+         d_du[f*fs + i*ds] = sum;
       }
-   }
+   });
+
+   // Lump fluxes (for PDU).
+   assembly.LinearFluxLumping(u, du, 0.0, nfields, layout);
+
+   const double *d_m = M_lumped.Read();
+   d_du = du.ReadWrite();
+   MFEM_FORALL(i, s,
+   {
+      for (int f = 0; f < nf; f++) { d_du[f*fs + i*ds] /= d_m[i]; }
+   });
+}
+
+void DiscreteUpwind::CalcLOSolutionAt(const Vector &u, Vector &du,
+                                      const Array<int> &elems) const
+{
+   const int ND = pfes.GetFE(0)->GetDof(), n = elems.Size() * ND;
+   const int *L = elems.Read(), *I = D.ReadI(), *J = D.ReadJ();
+   const double *A = D.ReadData(), *d_u = u.Read();
+   double *d_du = du.Write();
+   MFEM_FORALL(t, n,
+   {
+      const int i = L[t / ND]*ND + t % ND;
+      double sum = 0.0;
+      for (int k = I[i]; k < I[i+1]; k++) { sum += A[k] * d_u[J[k]]; }
+      d_du[i] = sum;
+   });
 
-   const int s = du.Size();
-   for (int i = 0; i < s; i++) { du(i) /= M_lumped(i); }
+   assembly.LinearFluxLumping(u, du, 0.0, 1, FieldLayout::SoA, &elems);
+
+   const double *d_m = M_lumped.Read();
+   d_du = du.ReadWrite();
+   MFEM_FORALL(t, n,
+   {
+      const int i = L[t / ND]*ND + t % ND;
+      d_du[i] /= d_m[i];
+   });
 }
 
 void DiscreteUpwind::ComputeDiscreteUpwindMatrix() const
@@ -102,140 +155,96 @@ ResidualDistribution::ResidualDistribution(ParFiniteElementSpace &space,
      M_lumped(Mlump), subcell_scheme(subcell), time_dep(timedep)
 { }
 
-void ResidualDistribution::CalcLOSolution(const Vector &u, Vector &du) const
+template<int T_DIM, int T_ORDER>
+static void RDKernel(const int NE, const int nd_, const int nsc, const int nds,
+                     const bool subcell, const double *u, const double *z,
+                     const double *sc_weights, const int *sub2ind,
+                     const double *m_lumped, double *xe_min, double *xe_max,
+                     double *scratch, double *du)
 {
-   const int ndof = pfes.GetFE(0)->GetDof();
-   const int ne = pfes.GetMesh()->GetNE();
-   Vector alpha(ndof); alpha = 0.0;
-   Vector z(u.Size());
-
+   const int nd = T_DIM ? KernelElemDofs(T_DIM, T_ORDER) : nd_;
+   const int sc_size = nd + RDScratchSize(nd, nsc);
    const double gamma = 1.0;
-   int dof_id;
-   double xSum, sumFluctSubcellP, sumFluctSubcellN, sumWeightsP,
-          sumWeightsN, weightP, weightN, rhoP, rhoN, aux, fluct, eps = 1.E-15;
-   Vector xMaxSubcell, xMinSubcell, sumWeightsSubcellP, sumWeightsSubcellN,
-          fluctSubcellP, fluctSubcellN, nodalWeightsP, nodalWeightsN;
-
-   // Discretization terms
-   du = 0.;
-   K.Mult(u, z);
-
-   ParGridFunction u_gf(&pfes);
-   u_gf = u;
-   u_gf.ExchangeFaceNbrData();
-   Vector &u_nd = u_gf.FaceNbrData();
-
-   z.HostReadWrite();
-   u.HostRead();
-   du.HostReadWrite();
-   M_lumped.HostRead();
-   // Monotonicity terms
-   for (int k = 0; k < ne; k++)
+   MFEM_FORALL(k, NE,
    {
-      // Boundary contributions
-      for (int f = 0; f < assembly.dofs.numBdrs; f++)
+      constexpr int max_nd = T_DIM ? KernelElemDofs(T_DIM, T_ORDER) : 1;
+      const double *u_k = u + k*nd;
+      double x_min = u_k[0], x_max = u_k[0];
+      for (int j = 1; j < nd; j++)
       {
-         assembly.LinearFluxLumping(k, ndof, f, u, du, u_nd, alpha);
+         x_min = fmin(x_min, u_k[j]);
+         x_max = fmax(x_max, u_k[j]);
       }
-
-      // Element contributions
-      rhoP = rhoN = xSum = 0.;
-      assembly.dofs.xe_min(k) =   numeric_limits<double>::infinity();
-      assembly.dofs.xe_max(k) = - numeric_limits<double>::infinity();
-      for (int j = 0; j < ndof; j++)
+      xe_min[k] = x_min;
+      xe_max[k] = x_max;
+
+      // The generic kernel keeps rd and the RDElementKernel() scratch in the
+      // slice of element k.
+      double rd_loc[max_nd];
+      double *sc_k = T_DIM ? NULL : scratch + k*sc_size;
+      double *rd = T_DIM ? rd_loc : sc_k;
+      RDElementKernel<T_DIM, T_ORDER>(nd, nsc, nds, subcell, gamma, u_k,
+                                      z + k*nd, x_min, x_max,
+                                      subcell ? sc_weights + k*nsc*nds : NULL,
+                                      sub2ind, T_DIM ? NULL : sc_k + nd, rd);
+      for (int i = 0; i < nd; i++)
       {
-         dof_id = k*ndof+j;
-         assembly.dofs.xe_max(k) = max(assembly.dofs.xe_max(k), u(dof_id));
-         assembly.dofs.xe_min(k) = min(assembly.dofs.xe_min(k), u(dof_id));
-         xSum += u(dof_id);
-         rhoP += max(0., z(dof_id));
-         rhoN += min(0., z(dof_id));
+         const int dof_id = k*nd+i;
+         du[dof_id] = (du[dof_id] + rd[i]) / m_lumped[dof_id];
       }
+   });
+}
 
-      sumWeightsP = ndof*assembly.dofs.xe_max(k) - xSum + eps;
-      sumWeightsN = ndof*assembly.dofs.xe_min(k) - xSum - eps;
+typedef void (*RDKernelType)(const int, const int, const int, const int,
+                             const bool, const double *, const double *,
+                             const double *, const int *, const double *,
+                             double *, double *, double *, double *);
 
-      if (subcell_scheme)
-      {
-         fluctSubcellP.SetSize(assembly.dofs.numSubcells);
-         fluctSubcellN.SetSize(assembly.dofs.numSubcells);
-         xMaxSubcell.SetSize(assembly.dofs.numSubcells);
-         xMinSubcell.SetSize(assembly.dofs.numSubcells);
-         sumWeightsSubcellP.SetSize(assembly.dofs.numSubcells);
-         sumWeightsSubcellN.SetSize(assembly.dofs.numSubcells);
-         nodalWeightsP.SetSize(ndof);
-         nodalWeightsN.SetSize(ndof);
-         sumFluctSubcellP = sumFluctSubcellN = 0.;
-         nodalWeightsP = 0.; nodalWeightsN = 0.;
-
-         // compute min-/max-values and the fluctuation for subcells
-         for (int m = 0; m < assembly.dofs.numSubcells; m++)
-         {
-            xMinSubcell(m) =   numeric_limits<double>::infinity();
-            xMaxSubcell(m) = - numeric_limits<double>::infinity();;
-            fluct = xSum = 0.;
-
-            if (time_dep)
-            {
-               assembly.ComputeSubcellWeights(k, m);
-            }
-
-            for (int i = 0; i < assembly.dofs.numDofsSubcell; i++)
-            {
-               dof_id = k*ndof + assembly.dofs.Sub2Ind(m, i);
-               fluct += assembly.SubcellWeights(k)(m,i) * u(dof_id);
-               xMaxSubcell(m) = max(xMaxSubcell(m), u(dof_id));
-               xMinSubcell(m) = min(xMinSubcell(m), u(dof_id));
-               xSum += u(dof_id);
-            }
-            sumWeightsSubcellP(m) = assembly.dofs.numDofsSubcell
-                                    * xMaxSubcell(m) - xSum + eps;
-            sumWeightsSubcellN(m) = assembly.dofs.numDofsSubcell
-                                    * xMinSubcell(m) - xSum - eps;
-
-            fluctSubcellP(m) = max(0., fluct);
-            fluctSubcellN(m) = min(0., fluct);
-            sumFluctSubcellP += fluctSubcellP(m);
-            sumFluctSubcellN += fluctSubcellN(m);
-         }
+void ResidualDistribution::CalcLOSolution(const Vector &u, Vector &du) const
+{
+   const int ndof = pfes.GetFE(0)->GetDof();
+   const int ne = pfes.GetMesh()->GetNE();
+   const int dim = pfes.GetMesh()->Dimension(), order = pfes.GetOrder(0);
+   DofInfo &dofs = assembly.dofs;
+   WorkVector z(*work, u.Size());
 
-         for (int m = 0; m < assembly.dofs.numSubcells; m++)
-         {
-            for (int i = 0; i < assembly.dofs.numDofsSubcell; i++)
-            {
-               const int loc_id = assembly.dofs.Sub2Ind(m, i);
-               dof_id = k*ndof + loc_id;
-               nodalWeightsP(loc_id) += fluctSubcellP(m)
-                                        * ((xMaxSubcell(m) - u(dof_id))
-                                           / sumWeightsSubcellP(m)); // eq. (58)
-               nodalWeightsN(loc_id) += fluctSubcellN(m)
-                                        * ((xMinSubcell(m) - u(dof_id))
-                                           / sumWeightsSubcellN(m)); // eq. (59)
-            }
-         }
-      }
+   // Discretization terms
+   du = 0.;
+   K.Mult(u, z);
 
-      for (int i = 0; i < ndof; i++)
-      {
-         dof_id = k*ndof+i;
-         weightP = (assembly.dofs.xe_max(k) - u(dof_id)) / sumWeightsP;
-         weightN = (assembly.dofs.xe_min(k) - u(dof_id)) / sumWeightsN;
+   // Boundary contributions
+   assembly.LinearFluxLumping(u, du, 0.0);
 
-         if (subcell_scheme)
+   if (subcell_scheme && time_dep)
+   {
+      assembly.SubcellWeights.HostReadWrite();
+      for (int k = 0; k < ne; k++)
+      {
+         for (int m = 0; m < dofs.numSubcells; m++)
          {
-            aux = gamma / (rhoP + eps);
-            weightP *= 1. - min(aux * sumFluctSubcellP, 1.);
-            weightP += min(aux, 1./(sumFluctSubcellP+eps))*nodalWeightsP(i);
-
-            aux = gamma / (rhoN - eps);
-            weightN *= 1. - min(aux * sumFluctSubcellN, 1.);
-            weightN += max(aux, 1./(sumFluctSubcellN-eps))*nodalWeightsN(i);
+            assembly.ComputeSubcellWeights(k, m);
          }
-
-         du(dof_id) = (du(dof_id) + weightP * rhoP + weightN * rhoN) /
-                      M_lumped(dof_id);
       }
    }
+
+   RDKernelType kernel;
+   const int key = KernelKey(dim, order);
+   switch (key)
+   {
+      REMHOS_KERNEL_CASES(kernel, RDKernel)
+   }
+   const int nsc = dofs.numSubcells;
+   WorkVector scratch(*work,
+                      key ? 0 : ne * (ndof + RDScratchSize(ndof, nsc)));
+
+   // Monotonicity terms and element contributions.
+   const double *d_sc_weights =
+      subcell_scheme ? assembly.SubcellWeights.Read() : NULL;
+   const int *d_sub2ind = subcell_scheme ? dofs.sub2ind.Read() : NULL;
+   kernel(ne, ndof, nsc, dofs.numDofsSubcell, subcell_scheme,
+          u.Read(), z.Read(), d_sc_weights, d_sub2ind, M_lumped.Read(),
+          dofs.xe_min.Write(), dofs.xe_max.Write(),
+          key ? NULL : scratch.Write(), du.ReadWrite());
 }
 
 } // namespace mfem
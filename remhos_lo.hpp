@@ -18,6 +18,7 @@
 #define MFEM_REMHOS_LO
 
 #include "mfem.hpp"
+#include "remhos_tools.hpp"
 
 namespace mfem
 {
@@ -27,16 +28,31 @@ class LOSolver
 {
 protected:
    ParFiniteElementSpace &pfes;
+   Workspace *work;
 
 public:
-   LOSolver(ParFiniteElementSpace &space) : pfes(space) { }
+   LOSolver(ParFiniteElementSpace &space) : pfes(space), work(NULL) { }
 
    virtual ~LOSolver() { }
 
+   // Temporary vectors are borrowed from w. Must be set before solving.
+   void SetWorkspace(Workspace &w) { work = &w; }
+
    virtual void CalcLOSolution(const Vector &u, Vector &du) const = 0;
-};
 
-class Assembly;
+   // LO solutions of nfields fields, stored with the given layout in u and
+   // du. By default, the fields are solved one by one, AoS fields through
+   // SoA copies.
+   virtual void CalcLOSolutions(const Vector &u, Vector &du, int nfields,
+                                FieldLayout layout = FieldLayout::SoA) const;
+
+   // LO solution of u, which is needed only at the dofs of the elements
+   // elems; the other values of du are undefined. By default, the solution is
+   // computed everywhere.
+   virtual void CalcLOSolutionAt(const Vector &u, Vector &du,
+                                 const Array<int> &elems) const
+   { CalcLOSolution(u, du); }
+};
 
 class DiscreteUpwind : public LOSolver
 {
@@ -55,7 +71,18 @@ public:
                   const Array<int> &adv_smap, const Vector &Mlump,
                   Assembly &asmbly, bool updateD);
 
-   virtual void CalcLOSolution(const Vector &u, Vector &du) const;
+   virtual void CalcLOSolution(const Vector &u, Vector &du) const
+   { CalcLOSolutions(u, du, 1); }
+
+   // All fields are processed in one pass over D and the face data, in both
+   // layouts.
+   virtual void CalcLOSolutions(const Vector &u, Vector &du, int nfields,
+                                FieldLayout layout = FieldLayout::SoA) const;
+
+   // Visits only the rows of D and the faces of the listed elements. Uses the
+   // D of the last CalcLOSolutions() call, which must be in the same stage.
+   virtual void CalcLOSolutionAt(const Vector &u, Vector &du,
+                                 const Array<int> &elems) const;
 };
 
 class ResidualDistribution : public LOSolver
@@ -16,6 +16,8 @@
 
 #include "remhos_mono.hpp"
 #include "remhos_tools.hpp"
+#include "remhos_kernels.hpp"
+#include "remhos_balance.hpp"
 
 using namespace std;
 
@@ -27,15 +29,22 @@ MonoRDSolver::MonoRDSolver(ParFiniteElementSpace &space,
                            const SparseMatrix &mass_mat, const Vector &Mlump,
                            Assembly &asmbly,
                            SmoothnessIndicator *si,
-                           VectorFunctionCoefficient &velocity,
+                           VectorCoefficient &velocity,
                            bool subcell, bool timedep, bool masslim)
    : MonolithicSolver(space),
      K_mat(adv_mat), M_mat(mass_mat), M_lumped(Mlump),
      assembly(asmbly), smth_indicator(si), scale(pfes.GetNE()),
      subcell_scheme(subcell), time_dep(timedep), mass_lim(masslim)
+{
+   UpdateVelocityScale(velocity);
+   UpdateOperators();
+}
+
+void MonoRDSolver::UpdateVelocityScale(VectorCoefficient &velocity)
 {
    const int ne = pfes.GetNE(), dim = pfes.GetMesh()->Dimension();
    const int order = pfes.GetOrder(0);
+   double *sc = scale.HostWrite();
    for (int e = 0; e < ne; e++)
    {
       const FiniteElement* el = pfes.GetFE(e);
@@ -53,56 +62,96 @@ MonoRDSolver::MonoRDSolver(ParFiniteElementSpace &space,
          vmax = max(vmax, vval.Norml2());
       }
       const double el_size = pfes.GetMesh()->GetElementSize(e);
-      scale(e) = vmax / (2. * (sqrt(dim) * el_size / order));
+      sc[e] = vmax / (2. * (sqrt(dim) * el_size / order));
    }
 }
 
 void MonoRDSolver::CalcSolution(const Vector &u, Vector &du) const
 {
-   const int ndof = pfes.GetFE(0)->GetDof();
-   int dof_id;
-   int loc, CtrIt, ctr = 0, max_iter = 100;
-   double xSum, sumFluctSubcellP, sumFluctSubcellN, sumWeightsP,
-          sumWeightsN, weightP, weightN, rhoP, rhoN, aux, fluct,
-          uDotMin, uDotMax, diff, MassP, MassN, alphaGlob, tmp, bndN, bndP,
-          gamma = 10., beta = 10., tol = 1.E-8, eps = 1.E-15;
-   Vector xMaxSubcell, xMinSubcell, sumWeightsSubcellP, sumWeightsSubcellN,
-          fluctSubcellP, fluctSubcellN, nodalWeightsP, nodalWeightsN, d,
-          m_it(ndof), uDot(ndof), res(ndof);
-   Vector alpha(ndof), alpha1(ndof);
-   alpha = 0.0; alpha1 = 1.0;
-   Vector z(u.Size());
-
-   const double *Mij = M_mat.GetData();
-
-   if (!mass_lim) { max_iter = -1; }
-   const int ne = pfes.GetMesh()->GetNE();
+   const int dim = pfes.GetMesh()->Dimension(), order = pfes.GetOrder(0);
+   switch (KernelKey(dim, order))
+   {
+      case 21: CalcSolutionKernel<2,1>(u, du); break;
+      case 22: CalcSolutionKernel<2,2>(u, du); break;
+      case 23: CalcSolutionKernel<2,3>(u, du); break;
+      case 24: CalcSolutionKernel<2,4>(u, du); break;
+      case 31: CalcSolutionKernel<3,1>(u, du); break;
+      case 32: CalcSolutionKernel<3,2>(u, du); break;
+      case 33: CalcSolutionKernel<3,3>(u, du); break;
+      case 34: CalcSolutionKernel<3,4>(u, du); break;
+      default: CalcSolutionKernel<0,0>(u, du);
+   }
+}
 
-   assembly.dofs.xe_max.HostReadWrite();
-   assembly.dofs.xe_min.HostReadWrite();
-   u.HostRead();
+void MonoRDSolver::UpdateOperators()
+{
+   // The mass matrix of DG is block diagonal, its element blocks are stored
+   // contiguously, row-major, in the element order.
+   const int ne = pfes.GetNE(), nd = pfes.GetFE(0)->GetDof();
+   M_blocks.SetSize(ne * nd * nd);
+   M_blocks = 0.0;
+   double *mb = M_blocks.HostReadWrite();
    for (int k = 0; k < ne; k++)
    {
-      assembly.dofs.xe_min(k) = numeric_limits<double>::infinity();
-      assembly.dofs.xe_max(k) = -numeric_limits<double>::infinity();
-
-      for (int i = 0; i < ndof; i++)
+      for (int i = 0; i < nd; i++)
       {
-         dof_id = k*ndof+i;
-         assembly.dofs.xe_max(k) = max(assembly.dofs.xe_max(k), u(dof_id));
-         assembly.dofs.xe_min(k) = min(assembly.dofs.xe_min(k), u(dof_id));
+         const int row = k*nd + i, row_size = M_mat.RowSize(row);
+         const int *cols = M_mat.GetRowColumns(row);
+         const double *vals = M_mat.GetRowEntries(row);
+         for (int c = 0; c < row_size; c++)
+         {
+            const int j = cols[c] - k*nd;
+            MFEM_ASSERT(j >= 0 && j < nd, "The mass matrix is not DG.");
+            mb[(k*nd + i)*nd + j] = vals[c];
+         }
       }
    }
-   assembly.dofs.ComputeElementsMinMax(u, assembly.dofs.xe_min,
-                                          assembly.dofs.xe_max, NULL, NULL);
-   assembly.dofs.ComputeBounds(assembly.dofs.xe_min, assembly.dofs.xe_max,
-                               assembly.dofs.xi_min, assembly.dofs.xi_max);
-
-   // Smoothness indicator.
-   ParGridFunction si_val;
-   if (smth_indicator)
+}
+
+template<int T_DIM, int T_ORDER>
+void MonoRDSolver::CalcSolutionKernel(const Vector &u, Vector &du) const
+{
+   constexpr int max_nd = T_DIM ? KernelElemDofs(T_DIM, T_ORDER) : 1;
+   const int ndof = T_DIM ? KernelElemDofs(T_DIM, T_ORDER)
+                    : pfes.GetFE(0)->GetDof();
+   DofInfo &dofs = assembly.dofs;
+   int dof_id;
+   const int max_iter = 100;
+   const double gamma = 10., beta = 10., tol = 1.E-8, eps = 1.E-15;
+   WorkVector z(*work, u.Size()), d(*work, u.Size()),
+              si_dof(*work, u.Size());
+
+   const int ne = pfes.GetMesh()->GetNE();
+   const int nsc = dofs.numSubcells, nds = dofs.numDofsSubcell;
+
+   // The generic kernel keeps the element arrays, the RDElementKernel()
+   // scratch, and uDot of the mass limiting of all elements in el_work.
+   WorkVector el_work(*work, T_DIM ? 0 : 3*ndof + RDScratchSize(ndof, nsc) +
+                      ne*ndof);
+   double rd_loc[max_nd], alpha_loc[max_nd], alpha1_loc[max_nd];
+   double *rd = T_DIM ? rd_loc : el_work.HostWrite(),
+           *alpha = T_DIM ? alpha_loc : rd + ndof,
+           *alpha1 = T_DIM ? alpha1_loc : alpha + ndof,
+           *rd_scratch = T_DIM ? NULL : alpha1 + ndof;
+   for (int i = 0; i < ndof; i++) { alpha1[i] = 1.0; }
+
+   dofs.ComputeElementsMinMax(u, dofs.xe_min, dofs.xe_max, NULL, NULL);
+   dofs.ComputeBounds(dofs.xe_min, dofs.xe_max, dofs.xi_min, dofs.xi_max);
+
+   // Smoothness indicator, evaluated at the DG dofs. The value 1 is used at
+   // the dofs that have no CG counterpart.
+   const bool smth = (smth_indicator != NULL);
+   si_dof = 0.0;
+   if (smth)
    {
       smth_indicator->ComputeSmoothnessIndicator(u, si_val);
+      si_val.HostRead();
+      double *h_si = si_dof.HostWrite();
+      for (int i = 0; i < u.Size(); i++)
+      {
+         const int cg_id = smth_indicator->DG2CG(i);
+         h_si[i] = (cg_id < 0) ? 1. : si_val(cg_id);
+      }
    }
 
    // Discretization terms.
@@ -110,249 +159,208 @@ void MonoRDSolver::CalcSolution(const Vector &u, Vector &du) const
    K_mat.Mult(u, z);
    d = z;
 
-   ParGridFunction u_gf(&pfes);
-   u_gf = u;
-   u_gf.ExchangeFaceNbrData();
-   Vector &u_nd = u_gf.FaceNbrData();
+   // Interior elements are processed first, while the face-neighbor values of
+   // u are in transit.
+   HaloExchange &halo = assembly.halo;
+   const Vector *u_nd = &halo.FaceNbrBuffer();
+   const Array<int> &el_order = halo.ElementOrder();
+
+   if (subcell_scheme && time_dep)
+   {
+      for (int k = 0; k < ne; k++)
+      {
+         for (int m = 0; m < nsc; m++) { assembly.ComputeSubcellWeights(k, m); }
+      }
+   }
+   const double *sc_weights = subcell_scheme ?
+                              assembly.SubcellWeights.HostRead() : NULL;
+   const int *sub2ind = subcell_scheme ? dofs.sub2ind.HostRead() : NULL;
 
    // Monotonicity terms
+   u.HostRead();
    du.HostReadWrite();
-   alpha.HostReadWrite();
    z.HostReadWrite();
-   M_lumped.HostRead();
-   for (int k = 0; k < ne; k++)
+   si_dof.HostRead();
+   dofs.xe_min.HostRead();
+   dofs.xe_max.HostRead();
+   dofs.xi_min.HostRead();
+   dofs.xi_max.HostRead();
+   for (int e = 0; e < ne; e++)
    {
+      if (e == halo.NumInteriorElements()) { u_nd = &halo.FaceNbrData(u); }
+      const int k = el_order[e];
+
       for (int j = 0; j < ndof; j++)
       {
          dof_id = k*ndof+j;
-         alpha(j) = min( 1., beta * min(assembly.dofs.xi_max(dof_id) - u(dof_id),
-                                        u(dof_id) - assembly.dofs.xi_min(dof_id))
-                         / (max(assembly.dofs.xi_max(dof_id) - u(dof_id),
-                                u(dof_id) - assembly.dofs.xi_min(dof_id)) + eps) );
+         alpha[j] = min( 1., beta * min(dofs.xi_max(dof_id) - u(dof_id),
+                                        u(dof_id) - dofs.xi_min(dof_id))
+                         / (max(dofs.xi_max(dof_id) - u(dof_id),
+                                u(dof_id) - dofs.xi_min(dof_id)) + eps) );
 
-         if (smth_indicator)
+         if (smth)
          {
-            tmp = smth_indicator->DG2CG(dof_id) < 0. ? 1. : si_val(smth_indicator->DG2CG(
-                                                                      dof_id));
-            bndN = max( 0., tmp * (2.*u(dof_id) - assembly.dofs.xi_max(dof_id)) +
-                        (1.-tmp) * assembly.dofs.xi_min(dof_id) );
-            bndP = min( 1., tmp * (2.*u(dof_id) - assembly.dofs.xi_min(dof_id)) +
-                        (1.-tmp) * assembly.dofs.xi_max(dof_id) );
-
-            if (assembly.dofs.xi_min(dof_id)+assembly.dofs.xi_max(dof_id) > 2.*u(
-                   dof_id) + eps)
+            const double tmp = si_dof(dof_id);
+            const double bndN = max( 0., tmp * (2.*u(dof_id) -
+                                                dofs.xi_max(dof_id)) +
+                                     (1.-tmp) * dofs.xi_min(dof_id) );
+            const double bndP = min( 1., tmp * (2.*u(dof_id) -
+                                                dofs.xi_min(dof_id)) +
+                                     (1.-tmp) * dofs.xi_max(dof_id) );
+
+            if (dofs.xi_min(dof_id)+dofs.xi_max(dof_id) > 2.*u(dof_id) + eps)
             {
-               alpha(j) = min(1., beta*(u(dof_id) - bndN) /
-                              (assembly.dofs.xi_max(dof_id) - u(dof_id) + eps));
+               alpha[j] = min(1., beta*(u(dof_id) - bndN) /
+                              (dofs.xi_max(dof_id) - u(dof_id) + eps));
             }
-            else if (assembly.dofs.xi_min(dof_id)+assembly.dofs.xi_max(dof_id) < 2.*u(
-                        dof_id) - eps)
+            else if (dofs.xi_min(dof_id)+dofs.xi_max(dof_id) <
+                     2.*u(dof_id) - eps)
             {
-               alpha(j) = min(1., beta*(bndP - u(dof_id)) /
-                              (u(dof_id) - assembly.dofs.xi_min(dof_id) + eps));
+               alpha[j] = min(1., beta*(bndP - u(dof_id)) /
+                              (u(dof_id) - dofs.xi_min(dof_id) + eps));
             }
          }
 
          // Splitting for volume term.
-         du(dof_id) += alpha(j) * z(dof_id);
-         z(dof_id) -= alpha(j) * z(dof_id);
+         du(dof_id) += alpha[j] * z(dof_id);
+         z(dof_id) -= alpha[j] * z(dof_id);
       }
 
       // Face contributions.
-      for (int i = 0; i < assembly.dofs.numBdrs; i++)
+      for (int i = 0; i < dofs.numBdrs; i++)
       {
-         assembly.NonlinFluxLumping(k, ndof, i, u, du, u_nd, alpha);
-         assembly.NonlinFluxLumping(k, ndof, i, u, d, u_nd, alpha1);
+         assembly.NonlinFluxLumping(k, ndof, i, u, du, *u_nd, alpha);
+         assembly.NonlinFluxLumping(k, ndof, i, u, d, *u_nd, alpha1);
       }
 
       // Element contributions
-      rhoP = rhoN = xSum = 0.;
-
-      for (int j = 0; j < ndof; j++)
-      {
-         dof_id = k*ndof+j;
-         xSum += u(dof_id);
-         rhoP += max(0., z(dof_id));
-         rhoN += min(0., z(dof_id));
-      }
-
-      sumWeightsP = ndof*assembly.dofs.xe_max(k) - xSum + eps;
-      sumWeightsN = ndof*assembly.dofs.xe_min(k) - xSum - eps;
-
-      if (subcell_scheme)
-      {
-         fluctSubcellP.SetSize(assembly.dofs.numSubcells);
-         fluctSubcellN.SetSize(assembly.dofs.numSubcells);
-         xMaxSubcell.SetSize(assembly.dofs.numSubcells);
-         xMinSubcell.SetSize(assembly.dofs.numSubcells);
-         sumWeightsSubcellP.SetSize(assembly.dofs.numSubcells);
-         sumWeightsSubcellN.SetSize(assembly.dofs.numSubcells);
-         nodalWeightsP.SetSize(ndof);
-         nodalWeightsN.SetSize(ndof);
-         sumFluctSubcellP = sumFluctSubcellN = 0.;
-         nodalWeightsP = 0.; nodalWeightsN = 0.;
-
-         // compute min-/max-values and the fluctuation for subcells
-         for (int m = 0; m < assembly.dofs.numSubcells; m++)
-         {
-            xMinSubcell(m) =   numeric_limits<double>::infinity();
-            xMaxSubcell(m) = - numeric_limits<double>::infinity();;
-            fluct = xSum = 0.;
-
-            if (time_dep)
-            {
-               assembly.ComputeSubcellWeights(k, m);
-            }
-
-            for (int i = 0; i < assembly.dofs.numDofsSubcell; i++)
-            {
-               dof_id = k*ndof + assembly.dofs.Sub2Ind(m, i);
-               fluct += assembly.SubcellWeights(k)(m,i) * u(dof_id);
-               xMaxSubcell(m) = max(xMaxSubcell(m), u(dof_id));
-               xMinSubcell(m) = min(xMinSubcell(m), u(dof_id));
-               xSum += u(dof_id);
-            }
-            sumWeightsSubcellP(m) = assembly.dofs.numDofsSubcell
-                                    * xMaxSubcell(m) - xSum + eps;
-            sumWeightsSubcellN(m) = assembly.dofs.numDofsSubcell
-                                    * xMinSubcell(m) - xSum - eps;
-
-            fluctSubcellP(m) = max(0., fluct);
-            fluctSubcellN(m) = min(0., fluct);
-            sumFluctSubcellP += fluctSubcellP(m);
-            sumFluctSubcellN += fluctSubcellN(m);
-         }
+      RDElementKernel<T_DIM, T_ORDER>(ndof, nsc, nds, subcell_scheme, gamma,
+                                      u.GetData() + k*ndof,
+                                      z.GetData() + k*ndof,
+                                      dofs.xe_min(k), dofs.xe_max(k),
+                                      subcell_scheme ?
+                                      sc_weights + k*nsc*nds : NULL,
+                                      sub2ind, rd_scratch, rd);
+      for (int i = 0; i < ndof; i++) { du(k*ndof+i) += rd[i]; }
+   }
 
-         for (int m = 0; m < assembly.dofs.numSubcells; m++)
-         {
-            for (int i = 0; i < assembly.dofs.numDofsSubcell; i++)
-            {
-               loc = assembly.dofs.Sub2Ind(m, i);
-               dof_id = k*ndof + loc;
-               nodalWeightsP(loc) += fluctSubcellP(m)
-                                     * ((xMaxSubcell(m) - u(dof_id))
-                                        / sumWeightsSubcellP(m)); // eq. (58)
-               nodalWeightsN(loc) += fluctSubcellN(m)
-                                     * ((xMinSubcell(m) - u(dof_id))
-                                        / sumWeightsSubcellN(m)); // eq. (59)
-            }
-         }
-      }
+   // Time derivative and mass matrix. Without mass limiting, the lumped mass
+   // matrix is used.
+   const double *d_ML = M_lumped.Read();
+   if (mass_lim == false)
+   {
+      double *d_du = du.ReadWrite();
+      MFEM_FORALL(i, du.Size(), d_du[i] /= d_ML[i]; );
+      return;
+   }
 
-      for (int i = 0; i < ndof; i++)
+   // The mass limiting iterations are done for all elements together. An
+   // element is skipped once its residual is below tol.
+   WorkVector m_it(*work, u.Size());
+   m_it = 0.0;
+   el_active.SetSize(ne);
+   el_active = 1;
+   const double *d_u = u.Read(), *d_du = du.Read(), *d_d = d.Read();
+   const double *d_Mb = M_blocks.Read(), *d_scale = scale.Read();
+   const double *d_xi_min = dofs.xi_min.Read(),
+                 *d_xi_max = dofs.xi_max.Read(), *d_si = si_dof.Read();
+   double *d_m_it = m_it.ReadWrite();
+   double *d_uDot = T_DIM ? NULL :
+                    el_work.ReadWrite() + 3*ndof + RDScratchSize(ndof, nsc);
+   int *d_active = el_active.ReadWrite();
+   for (int it = 0; it <= max_iter; it++)
+   {
+      MFEM_FORALL(k, ne,
       {
-         dof_id = k*ndof+i;
-         weightP = (assembly.dofs.xe_max(k) - u(dof_id)) / sumWeightsP;
-         weightN = (assembly.dofs.xe_min(k) - u(dof_id)) / sumWeightsN;
-
-         if (subcell_scheme)
-         {
-            aux = gamma / (rhoP + eps);
-            weightP *= 1. - min(aux * sumFluctSubcellP, 1.);
-            weightP += min(aux, 1./(sumFluctSubcellP+eps))*nodalWeightsP(i);
+         if (d_active[k] == 0) { return; }
 
-            aux = gamma / (rhoN - eps);
-            weightN *= 1. - min(aux * sumFluctSubcellN, 1.);
-            weightN += max(aux, 1./(sumFluctSubcellN-eps))*nodalWeightsN(i);
-         }
-
-         du(dof_id) += weightP * rhoP + weightN * rhoN;
-      }
-
-      // Time derivative and mass matrix, if mass_lim = false, max_iter has
-      // been set to -1, and the iteration loop is not entered.
-      m_it = uDot = 0.;
-      for (int it = 0; it <= max_iter; it++)
-      {
+         double uDot_loc[max_nd];
+         double *uDot = T_DIM ? uDot_loc : d_uDot + k*ndof;
          for (int i = 0; i < ndof; i++)
          {
-            dof_id = k*ndof+i;
-            uDot(i) = (du(dof_id) + m_it(i)) / M_lumped(dof_id);
+            const int id = k*ndof + i;
+            uDot[i] = (d_du[id] + d_m_it[id]) / d_ML[id];
          }
 
-         CtrIt = ctr;
-
-         uDotMin = numeric_limits<double>::infinity();
-         uDotMax = -uDotMin;
-
+         double uDotMin = uDot[0], uDotMax = uDot[0];
          for (int i = 0; i < ndof; i++) // eq. (28)
          {
-            uDotMin = min(uDotMin, uDot(i));
-            uDotMax = max(uDotMax, uDot(i));
-
-            dof_id = k*ndof+i;
-            m_it(i) = 0.;
-            // NOTE: This will only work in serial.
-            for (int j = ndof-1; j >= 0; j--) // run backwards through columns
-            {
-               // use knowledge of how M looks like
-               m_it(i) += Mij[ctr] * (uDot(i) - uDot(j));
-               ctr++;
-            }
-            diff = d(dof_id) - du(dof_id);
+            uDotMin = fmin(uDotMin, uDot[i]);
+            uDotMax = fmax(uDotMax, uDot[i]);
 
-            tmp = 0.;
-            if (smth_indicator)
+            const int id = k*ndof + i;
+            const double *M_row = d_Mb + id*ndof;
+            double m_i = 0.;
+            for (int j = 0; j < ndof; j++)
             {
-               tmp = smth_indicator->DG2CG(dof_id) < 0. ? 1. : si_val(smth_indicator->DG2CG(
-                                                                         dof_id));
+               m_i += M_row[j] * (uDot[i] - uDot[j]);
             }
-            m_it(i) += min( 1., max(tmp, abs(m_it(i)) / (abs(diff) + eps)) )
-                       * diff; // eq. (27) - (29)
+            const double diff = d_d[id] - d_du[id];
+            d_m_it[id] = m_i + fmin(1., fmax(d_si[id],
+                                              fabs(m_i) / (fabs(diff) + eps)))
+                         * diff; // eq. (27) - (29)
          }
 
-         ctr = CtrIt;
-         MassP = MassN = 0.;
-
+         double MassP = 0., MassN = 0.;
          for (int i = 0; i < ndof; i++)
          {
-            dof_id = k*ndof+i;
-            alpha(i) = min(1., beta * scale(k) * min(assembly.dofs.xi_max(dof_id) - u(
-                                                        dof_id),
-                                                     u(dof_id) - assembly.dofs.xi_min(dof_id))
-                           / (max(uDotMax - uDot(i), uDot(i) - uDotMin) + eps) );
-
-            if (smth_indicator)
+            const int id = k*ndof + i;
+            const double uDotDiff = fmax(uDotMax - uDot[i], uDot[i] - uDotMin);
+            double alpha_i = fmin(1., beta * d_scale[k] *
+                                  fmin(d_xi_max[id] - d_u[id],
+                                       d_u[id] - d_xi_min[id])
+                                  / (uDotDiff + eps) );
+
+            if (smth)
             {
-               alphaGlob = min( 1., beta * scale(k) * min(1. - u(dof_id), u(dof_id) - 0.)
-                                / (max(uDotMax - uDot(i), uDot(i) - uDotMin) + eps) );
-               tmp = smth_indicator->DG2CG(dof_id) < 0. ? 1. : si_val(smth_indicator->DG2CG(
-                                                                         dof_id));
-               alpha(i) = min(max(tmp, alpha(i)), alphaGlob);
+               const double alphaGlob =
+                  fmin( 1., beta * d_scale[k] * fmin(1. - d_u[id], d_u[id])
+                        / (uDotDiff + eps) );
+               alpha_i = fmin(fmax(d_si[id], alpha_i), alphaGlob);
             }
 
-            m_it(i) *= alpha(i);
-            MassP += max(0., m_it(i));
-            MassN += min(0., m_it(i));
+            d_m_it[id] *= alpha_i;
+            MassP += fmax(0., d_m_it[id]);
+            MassN += fmin(0., d_m_it[id]);
          }
 
+         double res_norm = 0.;
          for (int i = 0; i < ndof; i++)
          {
+            const int id = k*ndof + i;
+            const double m_i = d_m_it[id];
             if (MassP + MassN > eps)
             {
-               m_it(i) = min(0., m_it(i)) - max(0., m_it(i)) * MassN / MassP;
+               d_m_it[id] = fmin(0., m_i) - fmax(0., m_i) * MassN / MassP;
             }
             else if (MassP + MassN < -eps)
             {
-               m_it(i) = max(0., m_it(i)) - min(0., m_it(i)) * MassP / MassN;
+               d_m_it[id] = fmax(0., m_i) - fmin(0., m_i) * MassP / MassN;
             }
+            const double res = d_m_it[id] + d_du[id] - d_ML[id] * uDot[i];
+            res_norm += res * res;
          }
 
-         for (int i = 0; i < ndof; i++)
-         {
-            dof_id = k*ndof+i;
-            res(i) = m_it(i) + du(dof_id) - M_lumped(dof_id) * uDot(i);
-         }
-
-         if (res.Norml2() <= tol) { break; }
-      }
+         if (sqrt(res_norm) <= tol) { d_active[k] = 0; }
+      });
 
-      for (int i = 0; i < ndof; i++)
+      // Stop when all elements have converged. The iterations of each element
+      // are its cost for the load balancing.
+      const int *h_active = el_active.HostRead();
+      bool any_active = false;
+      const bool count = element_costs.IsEnabled();
+      for (int k = 0; k < ne && (count || any_active == false); k++)
       {
-         dof_id = k*ndof+i;
-         du(dof_id) = (du(dof_id) + m_it(i)) / M_lumped(dof_id);
+         if (h_active[k] != 0) { element_costs.Add(k, 1.0); }
+         any_active = any_active || (h_active[k] != 0);
       }
+      if (any_active == false) { break; }
+      d_active = el_active.ReadWrite();
    }
+
+   double *d_du_rw = du.ReadWrite();
+   MFEM_FORALL(i, du.Size(),
+               d_du_rw[i] = (d_du_rw[i] + d_m_it[i]) / d_ML[i]; );
 }
 
 } // namespace mfem
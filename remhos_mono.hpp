@@ -22,6 +22,8 @@
 namespace mfem
 {
 
+class Workspace;
+
 // Monolithic solvers - these solve the transport/remap problem directly,
 // without splitting into HO / LO / FCT phases.
 // The result should be a high-order, conservative, bound preserving solution.
@@ -29,12 +31,20 @@ class MonolithicSolver
 {
 protected:
    ParFiniteElementSpace &pfes;
+   Workspace *work;
 
 public:
-   MonolithicSolver(ParFiniteElementSpace &space) : pfes(space) { }
+   MonolithicSolver(ParFiniteElementSpace &space) : pfes(space), work(NULL) { }
 
    virtual ~MonolithicSolver() { }
 
+   // Temporary vectors are borrowed from w. Must be set before solving.
+   void SetWorkspace(Workspace &w) { work = &w; }
+
+   // Must be called after the underlying forms are reassembled, e.g., when the
+   // mesh moves in remap mode.
+   virtual void UpdateOperators() { }
+
    virtual void CalcSolution(const Vector &u, Vector &du) const = 0;
 };
 
@@ -53,14 +63,32 @@ protected:
    const bool time_dep;
    const bool mass_lim;
 
+   // Values of the smoothness indicator, kept between calls.
+   mutable ParGridFunction si_val;
+
+   // Element blocks of M_mat, each nd x nd and row-major.
+   Vector M_blocks;
+   // Elements that are still iterated by the mass limiting.
+   mutable Array<int> el_active;
+
+   // Specialized for the dimension and order, see remhos_kernels.hpp.
+   template<int T_DIM, int T_ORDER>
+   void CalcSolutionKernel(const Vector &u, Vector &du) const;
+
 public:
    MonoRDSolver(ParFiniteElementSpace &space,
                 const SparseMatrix &adv_mat, const SparseMatrix &mass_mat,
                 const Vector &Mlump,
                 Assembly &asmbly, SmoothnessIndicator *si,
-                VectorFunctionCoefficient &velocity,
+                VectorCoefficient &velocity,
                 bool subcell, bool timedep, bool masslim);
 
+   void UpdateOperators();
+
+   // Recomputes the element scales of the smoothness term from the maximum
+   // of the velocity in each element, e.g., when the remap velocity changes.
+   void UpdateVelocityScale(VectorCoefficient &velocity);
+
    void CalcSolution(const Vector &u, Vector &du) const;
 };
 
@@ -0,0 +1,86 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#include "remhos_ode.hpp"
+
+using namespace std;
+
+namespace mfem
+{
+
+static StageOperator *GetStageOperator(TimeDependentOperator &f)
+{
+   StageOperator *op = dynamic_cast<StageOperator *>(&f);
+   MFEM_VERIFY(op, "Low-storage RK methods require a StageOperator.");
+   return op;
+}
+
+void LowStorageSSPRK2Solver::Init(TimeDependentOperator &f)
+{
+   ODESolver::Init(f);
+   op = GetStageOperator(f);
+   q2.SetSize(f.Width(), mem_type);
+   q2.UseDevice(true);
+}
+
+void LowStorageSSPRK2Solver::Step(Vector &x, double &t, double &dt)
+{
+   // D. Ketcheson, Highly efficient strong stability-preserving Runge-Kutta
+   // methods with low-storage implementations, SISC 30(4), 2008.
+   const double h = dt / (s - 1);
+   q2 = x;
+   for (int i = 0; i < s - 1; i++)
+   {
+      op->SetTime(t + i * h);
+      op->StageMult(x, NULL, 1.0, 0.0, h, x);
+   }
+   op->SetTime(t + dt);
+   op->StageMult(x, &q2, (s - 1.0) / s, 1.0 / s, dt / s, x);
+   t += dt;
+}
+
+void LowStorageSSPRK104Solver::Init(TimeDependentOperator &f)
+{
+   ODESolver::Init(f);
+   op = GetStageOperator(f);
+   q2.SetSize(f.Width(), mem_type);
+   q2.UseDevice(true);
+}
+
+void LowStorageSSPRK104Solver::Step(Vector &x, double &t, double &dt)
+{
+   // Same reference as above, algorithm 4.
+   const double h = dt / 6.0;
+   q2 = x;
+   for (int i = 0; i < 5; i++)
+   {
+      op->SetTime(t + i * h);
+      op->StageMult(x, NULL, 1.0, 0.0, h, x);
+   }
+   // q2 = (q2 + 9 x) / 25, x = 15 q2 - 5 x.
+   add(1.0 / 25.0, q2, 9.0 / 25.0, x, q2);
+   add(15.0, q2, -5.0, x, x);
+   for (int i = 0; i < 4; i++)
+   {
+      op->SetTime(t + (i + 2) * h);
+      op->StageMult(x, NULL, 1.0, 0.0, h, x);
+   }
+   op->SetTime(t + dt);
+   op->StageMult(x, &q2, 0.6, 1.0, dt / 10.0, x);
+   t += dt;
+}
+
+} // namespace mfem
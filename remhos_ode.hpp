@@ -0,0 +1,74 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#ifndef MFEM_REMHOS_ODE
+#define MFEM_REMHOS_ODE
+
+#include "mfem.hpp"
+
+namespace mfem
+{
+
+// Time-dependent operator that applies the stage update of the low-storage
+// Runge-Kutta methods together with its action, so that the rate F(x) is only
+// a temporary of the operator. This saves the storage of the stage vectors;
+// the rate is still formed in full before the update.
+class StageOperator : public TimeDependentOperator
+{
+public:
+   StageOperator(int size) : TimeDependentOperator(size) { }
+
+   // Computes y = a x + b z + c F(x). z can be NULL, and x and y can be the
+   // same vector.
+   virtual void StageMult(const Vector &x, const Vector *z,
+                          double a, double b, double c, Vector &y) const = 0;
+};
+
+// Low-storage SSP-RK(s,2) of Ketcheson, with SSP coefficient s-1. Besides the
+// solution it stores one copy of the state.
+class LowStorageSSPRK2Solver : public ODESolver
+{
+private:
+   const int s;
+   StageOperator *op;
+   Vector q2;
+
+public:
+   LowStorageSSPRK2Solver(int stages) : s(stages), op(NULL)
+   { MFEM_VERIFY(s >= 2, "SSP-RK(s,2) needs at least two stages."); }
+
+   virtual void Init(TimeDependentOperator &f);
+   virtual void Step(Vector &x, double &t, double &dt);
+};
+
+// Low-storage SSP-RK(10,4) of Ketcheson, with SSP coefficient 6. Besides the
+// solution it stores one copy of the state.
+class LowStorageSSPRK104Solver : public ODESolver
+{
+private:
+   StageOperator *op;
+   Vector q2;
+
+public:
+   LowStorageSSPRK104Solver() : op(NULL) { }
+
+   virtual void Init(TimeDependentOperator &f);
+   virtual void Step(Vector &x, double &t, double &dt);
+};
+
+} // namespace mfem
+
+#endif // MFEM_REMHOS_ODE
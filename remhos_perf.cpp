@@ -0,0 +1,126 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#include "remhos_perf.hpp"
+#include <fstream>
+#include <iomanip>
+
+using namespace std;
+
+namespace mfem
+{
+
+PerfTimers perf_timers;
+
+static const char *phase_names[] =
+{
+   "step", "remap_assembly", "flux_terms", "lo", "ho", "bounds", "fct",
+   "mono", "halo"
+};
+
+PerfTimers::PerfTimers() : enabled(false)
+{
+   for (int i = 0; i < num_phases; i++)
+   {
+      timers[i].Clear();
+      calls[i] = 0;
+   }
+}
+
+void PerfTimers::Start(PerfPhase phase)
+{
+   if (enabled == false) { return; }
+   timers[(int) phase].Start();
+}
+
+void PerfTimers::Stop(PerfPhase phase)
+{
+   if (enabled == false) { return; }
+   MFEM_DEVICE_SYNC;
+   timers[(int) phase].Stop();
+   calls[(int) phase]++;
+}
+
+void PerfTimers::Print(MPI_Comm comm, HYPRE_Int global_dofs,
+                       const char *json_file) const
+{
+   if (enabled == false) { return; }
+
+   int myid, num_procs;
+   MPI_Comm_rank(comm, &myid);
+   MPI_Comm_size(comm, &num_procs);
+
+   double t_loc[num_phases], t_min[num_phases], t_max[num_phases],
+          t_sum[num_phases];
+   for (int i = 0; i < num_phases; i++) { t_loc[i] = timers[i].RealTime(); }
+   MPI_Reduce(t_loc, t_min, num_phases, MPI_DOUBLE, MPI_MIN, 0, comm);
+   MPI_Reduce(t_loc, t_max, num_phases, MPI_DOUBLE, MPI_MAX, 0, comm);
+   MPI_Reduce(t_loc, t_sum, num_phases, MPI_DOUBLE, MPI_SUM, 0, comm);
+   if (myid != 0) { return; }
+
+   const int step_id = (int) PerfPhase::Step, steps = calls[step_id];
+   const double t_step = t_sum[step_id] / num_procs;
+   const double t_dof = (steps > 0 && global_dofs > 0) ?
+                        t_step / ((double) global_dofs * steps) : 0.0;
+
+   cout << "\nPerformance (seconds, over " << num_procs << " MPI tasks):\n"
+        << setw(16) << left << "phase" << right
+        << setw(8) << "calls" << setw(13) << "min"
+        << setw(13) << "avg" << setw(13) << "max"
+        << setw(10) << "max/avg" << endl;
+   for (int i = 0; i < num_phases; i++)
+   {
+      if (calls[i] == 0) { continue; }
+      const double t_avg = t_sum[i] / num_procs;
+      cout << setw(16) << left << phase_names[i] << right
+           << setw(8) << calls[i] << scientific << setprecision(4)
+           << setw(13) << t_min[i] << setw(13) << t_avg
+           << setw(13) << t_max[i] << fixed << setprecision(2)
+           << setw(10) << ((t_avg > 0.0) ? t_max[i] / t_avg : 1.0) << endl;
+   }
+   cout << scientific << setprecision(4)
+        << "Time per dof and step: " << t_dof << endl
+        << "Global dofs: " << global_dofs << ", steps: " << steps << endl;
+   cout.unsetf(ios_base::floatfield);
+   cout << setprecision(8);
+
+   if (json_file == NULL || json_file[0] == '\0') { return; }
+
+   ofstream json(json_file);
+   if (!json) { MFEM_ABORT("Error opening file " << json_file); }
+   json << setprecision(10);
+   json << "{\n"
+        << "  \"mpi_tasks\": " << num_procs << ",\n"
+        << "  \"global_dofs\": " << global_dofs << ",\n"
+        << "  \"steps\": " << steps << ",\n"
+        << "  \"time_per_dof_step\": " << t_dof << ",\n"
+        << "  \"phases\": {";
+   bool first = true;
+   for (int i = 0; i < num_phases; i++)
+   {
+      if (calls[i] == 0) { continue; }
+      json << (first ? "\n" : ",\n")
+           << "    \"" << phase_names[i] << "\": {"
+           << "\"calls\": " << calls[i] << ", "
+           << "\"min\": " << t_min[i] << ", "
+           << "\"avg\": " << t_sum[i] / num_procs << ", "
+           << "\"max\": " << t_max[i] << "}";
+      first = false;
+   }
+   json << "\n  }\n}\n";
+}
+
+} // namespace mfem
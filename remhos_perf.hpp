@@ -0,0 +1,75 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#ifndef MFEM_REMHOS_PERF
+#define MFEM_REMHOS_PERF
+
+#include "mfem.hpp"
+
+namespace mfem
+{
+
+// Phases of the time stepping that are timed separately. The halo exchange
+// time is also contained in the phase that waits for the exchange.
+enum class PerfPhase
+{
+   Step, RemapAssembly, FluxTerms, LO, HO, Bounds, FCT, Mono, Halo, Count
+};
+
+// Accumulates the wall time spent in each phase. Timing is disabled by
+// default, so that the regions cost nothing in regular runs.
+class PerfTimers
+{
+private:
+   static const int num_phases = (int) PerfPhase::Count;
+
+   bool enabled;
+   StopWatch timers[num_phases];
+   int calls[num_phases];
+
+public:
+   PerfTimers();
+
+   void Enable(bool enable) { enabled = enable; }
+   bool IsEnabled() const { return enabled; }
+
+   void Start(PerfPhase phase);
+   // Device kernels are synchronized before the timer is stopped.
+   void Stop(PerfPhase phase);
+
+   // Prints the min/avg/max times over the MPI tasks, together with the time
+   // per dof and step. The same data is written to json_file, if it's given.
+   void Print(MPI_Comm comm, HYPRE_Int global_dofs,
+              const char *json_file) const;
+};
+
+// The timers of the run, set up by the driver.
+extern PerfTimers perf_timers;
+
+// Times a phase for the lifetime of the object.
+class PerfRegion
+{
+private:
+   const PerfPhase phase;
+
+public:
+   PerfRegion(PerfPhase p) : phase(p) { perf_timers.Start(phase); }
+   ~PerfRegion() { perf_timers.Stop(phase); }
+};
+
+} // namespace mfem
+
+#endif // MFEM_REMHOS_PERF
@@ -0,0 +1,531 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#include "remhos_remap.hpp"
+#include "remhos_perf.hpp"
+
+using namespace std;
+
+namespace mfem
+{
+
+RemapAssembler::RemapAssembler(ParFiniteElementSpace &space,
+                               ParBilinearForm &m_, ParBilinearForm &ml_,
+                               ParBilinearForm &k_, ParBilinearForm &M_HO_,
+                               ParBilinearForm &K_HO_, Vector &lumpedM_,
+                               Assembly &asmbl_, LowOrderMethod &lom_,
+                               DofInfo &dofs)
+   : pfes(space), m(m_), ml(ml_), k(k_), M_HO(M_HO_), K_HO(K_HO_),
+     pk(lom_.pk), lumpedM(lumpedM_), asmbl(asmbl_), lom(lom_), dofs(dofs),
+     ho_full(M_HO_.GetAssemblyLevel() != AssemblyLevel::PARTIAL),
+     poly_deg(-1)
+{
+   MFEM_VERIFY(m.GetDBFI()->Size() == 1 && k.GetDBFI()->Size() == 1,
+               "The mass and convection forms must have one integrator.");
+   MFEM_VERIFY(pk == NULL || pk->GetDBFI()->Size() == 1,
+               "The preconditioned convection form must have one integrator.");
+
+   ComputePositions(m.SpMat(), m_pos);
+   ComputePositions(k.SpMat(), k_pos);
+   if (pk) { ComputePositions(pk->SpMat(), pk_pos); }
+   if (ho_full)
+   {
+      ComputePositions(M_HO.SpMat(), M_HO_pos);
+      ComputePositions(K_HO.SpMat(), K_HO_pos);
+   }
+
+   // ml is diagonal.
+   const SparseMatrix &ml_mat = ml.SpMat();
+   const int *I = ml_mat.GetI(), *J = ml_mat.GetJ();
+   ml_pos.SetSize(ml_mat.Height());
+   for (int i = 0; i < ml_mat.Height(); i++)
+   {
+      ml_pos[i] = -1;
+      for (int p = I[i]; p < I[i+1]; p++)
+      {
+         if (J[p] == i) { ml_pos[i] = p; break; }
+      }
+      MFEM_VERIFY(ml_pos[i] >= 0, "Missing diagonal entry of ml.");
+   }
+
+   // Local indices of the faces in their adjacent elements.
+   Mesh *mesh = pfes.GetMesh();
+   const int dim = mesh->Dimension(), ne = mesh->GetNE();
+   face_loc1.SetSize(mesh->GetNumFaces());
+   face_loc2.SetSize(mesh->GetNumFaces());
+   face_loc1 = -1;
+   face_loc2 = -1;
+   Array<int> bdrs, orientation;
+   for (int e = 0; e < ne; e++)
+   {
+      if (dim == 1)      { mesh->GetElementVertices(e, bdrs); }
+      else if (dim == 2) { mesh->GetElementEdges(e, bdrs, orientation); }
+      else if (dim == 3) { mesh->GetElementFaces(e, bdrs, orientation); }
+
+      for (int i = 0; i < dofs.numBdrs; i++)
+      {
+         int e1, e2;
+         mesh->GetFaceElements(bdrs[i], &e1, &e2);
+         if (e1 == e && face_loc1[bdrs[i]] < 0) { face_loc1[bdrs[i]] = i; }
+         else if (e2 == e)                      { face_loc2[bdrs[i]] = i; }
+      }
+   }
+}
+
+void RemapAssembler::ComputePositions(const SparseMatrix &mat,
+                                      Array<int> &pos) const
+{
+   MFEM_VERIFY(mat.Finalized(), "The matrix must be finalized.");
+
+   const int ne = pfes.GetNE(), nd = pfes.GetFE(0)->GetDof();
+   const int *I = mat.GetI(), *J = mat.GetJ();
+   Array<int> vdofs;
+   pos.SetSize(ne*nd*nd);
+   for (int e = 0; e < ne; e++)
+   {
+      pfes.GetElementVDofs(e, vdofs);
+      for (int i = 0; i < nd; i++)
+      {
+         const int row = vdofs[i];
+         for (int j = 0; j < nd; j++)
+         {
+            // Entries skipped as zeros at the first assembly stay -1.
+            int &p = pos[(e*nd + i)*nd + j];
+            p = -1;
+            for (int q = I[row]; q < I[row+1]; q++)
+            {
+               if (J[q] == vdofs[j]) { p = q; break; }
+            }
+         }
+      }
+   }
+}
+
+// Host pointer to the values of A, for overwriting all of them, or for
+// updating them. Either marks the device copy of the values as out of date.
+static double *HostWriteValues(SparseMatrix &A)
+{
+   return mfem::HostWrite(A.GetMemoryData(), A.NumNonZeroElems());
+}
+static double *HostReadWriteValues(SparseMatrix &A)
+{
+   return mfem::HostReadWrite(A.GetMemoryData(), A.NumNonZeroElems());
+}
+
+// Writes the values at t of the polynomials with coefficients coef to y.
+static void EvalPolynomials(const Vector &coef, const int deg, const double t,
+                            double *y)
+{
+   const int n = coef.Size() / (deg + 1);
+   const double *c = coef.HostRead();
+   for (int i = 0; i < n; i++)
+   {
+      double val = c[deg*n + i];
+      for (int p = deg - 1; p >= 0; p--) { val = val * t + c[p*n + i]; }
+      y[i] = val;
+   }
+}
+
+// Replaces the values of the deg+1 samples in coef, stored like the
+// coefficients, by the coefficients of the interpolating polynomials.
+static void SamplesToCoefficients(const DenseMatrix &V_inv, Vector &coef)
+{
+   const int ns = V_inv.Height(), n = coef.Size() / ns;
+   double *c = coef.HostReadWrite();
+   Vector samples(ns);
+   for (int i = 0; i < n; i++)
+   {
+      for (int s = 0; s < ns; s++) { samples(s) = c[s*n + i]; }
+      for (int p = 0; p < ns; p++)
+      {
+         double val = 0.0;
+         for (int s = 0; s < ns; s++) { val += V_inv(p, s) * samples(s); }
+         c[p*n + i] = val;
+      }
+   }
+}
+
+void RemapAssembler::ComputePolynomials(GridFunction &pos, const Vector &pos0,
+                                        const GridFunction &vel)
+{
+   Mesh *mesh = pfes.GetMesh();
+   const int ns = mesh->Dimension() + 1;
+   const int nfq = mesh->GetNumFaces() * lom.irF->GetNPoints() * 2;
+   const int m_n = m.SpMat().NumNonZeroElems(),
+             k_n = k.SpMat().NumNonZeroElems(), ml_n = lumpedM.Size();
+   m_coef.SetSize(ns * m_n);
+   k_coef.SetSize(ns * k_n);
+   ml_coef.SetSize(ns * ml_n);
+   flux_coef.SetSize(ns * nfq);
+   face_flux.SetSize(nfq);
+   face_B.SetSize(dofs.numFaceDofs * dofs.numFaceDofs);
+   if (ho_full)
+   {
+      M_HO_coef.SetSize(ns * M_HO.SpMat().NumNonZeroElems());
+      K_HO_coef.SetSize(ns * K_HO.SpMat().NumNonZeroElems());
+   }
+
+   // Sample at t_s = s / dim, s = 0 .. dim.
+   DenseMatrix V(ns);
+   for (int s = 0; s < ns; s++)
+   {
+      const double t = s / (ns - 1.0);
+      for (int p = 0; p < ns; p++) { V(s, p) = pow(t, p); }
+
+      add(pos0, t, vel, pos);
+      mesh->DeleteGeometricFactors();
+
+      m.SpMat() = 0.0;
+      k.SpMat() = 0.0;
+      if (pk) { pk->SpMat() = 0.0; }
+      if (ho_full)
+      {
+         M_HO.SpMat() = 0.0;
+         K_HO.SpMat() = 0.0;
+      }
+      AssembleElements(true);
+
+      const Vector &lm = lumpedM;
+      lm.HostRead();
+      std::copy(m.SpMat().GetData(), m.SpMat().GetData() + m_n,
+                m_coef.HostReadWrite() + s*m_n);
+      std::copy(k.SpMat().GetData(), k.SpMat().GetData() + k_n,
+                k_coef.HostReadWrite() + s*k_n);
+      std::copy(lm.GetData(), lm.GetData() + ml_n,
+                ml_coef.HostReadWrite() + s*ml_n);
+      if (ho_full)
+      {
+         const int M_n = M_HO.SpMat().NumNonZeroElems(),
+                   K_n = K_HO.SpMat().NumNonZeroElems();
+         std::copy(M_HO.SpMat().GetData(), M_HO.SpMat().GetData() + M_n,
+                   M_HO_coef.HostReadWrite() + s*M_n);
+         std::copy(K_HO.SpMat().GetData(), K_HO.SpMat().GetData() + K_n,
+                   K_HO_coef.HostReadWrite() + s*K_n);
+      }
+      ComputeFaceFluxes(flux_coef.HostReadWrite() + s*nfq);
+   }
+   V.Invert();
+
+   SamplesToCoefficients(V, m_coef);
+   SamplesToCoefficients(V, k_coef);
+   SamplesToCoefficients(V, ml_coef);
+   SamplesToCoefficients(V, flux_coef);
+   if (ho_full)
+   {
+      SamplesToCoefficients(V, M_HO_coef);
+      SamplesToCoefficients(V, K_HO_coef);
+   }
+   ComputeFaceShapes();
+   poly_deg = ns - 1;
+
+   // Restore the operators of the initial mesh.
+   pos = pos0;
+   mesh->DeleteGeometricFactors();
+   Reassemble(0.0);
+}
+
+void RemapAssembler::Reassemble(double t)
+{
+   perf_timers.Start(PerfPhase::RemapAssembly);
+   const bool poly = (poly_deg >= 0);
+   if (pk) { pk->SpMat() = 0.0; }
+   if (poly)
+   {
+      EvalPolynomials(m_coef, poly_deg, t, HostWriteValues(m.SpMat()));
+      EvalPolynomials(k_coef, poly_deg, t, HostWriteValues(k.SpMat()));
+      double *lm = lumpedM.HostWrite(),
+             *ml_data = HostReadWriteValues(ml.SpMat());
+      EvalPolynomials(ml_coef, poly_deg, t, lm);
+      for (int i = 0; i < lumpedM.Size(); i++) { ml_data[ml_pos[i]] = lm[i]; }
+      if (ho_full)
+      {
+         EvalPolynomials(M_HO_coef, poly_deg, t,
+                         HostWriteValues(M_HO.SpMat()));
+         EvalPolynomials(K_HO_coef, poly_deg, t,
+                         HostWriteValues(K_HO.SpMat()));
+      }
+   }
+   else
+   {
+      m.SpMat() = 0.0;
+      ml.SpMat() = 0.0;
+      k.SpMat() = 0.0;
+      if (ho_full)
+      {
+         M_HO.SpMat() = 0.0;
+         K_HO.SpMat() = 0.0;
+      }
+   }
+   if (ho_full == false)
+   {
+      M_HO.BilinearForm::operator=(0.0);
+      M_HO.Assemble();
+      K_HO.BilinearForm::operator=(0.0);
+      K_HO.Assemble(0);
+   }
+   if (poly == false || pk) { AssembleElements(poly == false); }
+   perf_timers.Stop(PerfPhase::RemapAssembly);
+
+   PerfRegion perf(PerfPhase::FluxTerms);
+   if (poly) { AddPolynomialFluxTerms(t); }
+   AssembleFaces(poly == false);
+}
+
+void RemapAssembler::AssembleElements(bool all)
+{
+   Mesh *mesh = pfes.GetMesh();
+   const int ne = pfes.GetNE(), nd = pfes.GetFE(0)->GetDof();
+
+   BilinearFormIntegrator *mass_int = (*m.GetDBFI())[0],
+                           *conv_int = (*k.GetDBFI())[0],
+                           *pconv_int = pk ? (*pk->GetDBFI())[0] : NULL;
+
+   // Only pk is assembled if all is false.
+   double *m_data = all ? HostReadWriteValues(m.SpMat()) : NULL,
+          *ml_data = all ? HostReadWriteValues(ml.SpMat()) : NULL,
+          *k_data = all ? HostReadWriteValues(k.SpMat()) : NULL,
+          *pk_data = pk ? HostReadWriteValues(pk->SpMat()) : NULL,
+          *M_HO_data = (all && ho_full) ?
+                       HostReadWriteValues(M_HO.SpMat()) : NULL,
+          *K_HO_data = (all && ho_full) ?
+                       HostReadWriteValues(K_HO.SpMat()) : NULL;
+   double *lm = all ? lumpedM.HostWrite() : NULL;
+
+   DenseMatrix M_e, K_e, PK_e;
+   for (int e = 0; e < ne; e++)
+   {
+      const FiniteElement &fe = *pfes.GetFE(e);
+      ElementTransformation &T = *mesh->GetElementTransformation(e);
+      if (pk) { pconv_int->AssembleElementMatrix(fe, T, PK_e); }
+      if (all == false)
+      {
+         for (int i = 0; i < nd; i++)
+         {
+            for (int j = 0; j < nd; j++)
+            {
+               const int id = (e*nd + i)*nd + j;
+               if (pk_pos[id] >= 0) { pk_data[pk_pos[id]] += PK_e(i, j); }
+            }
+         }
+         continue;
+      }
+      mass_int->AssembleElementMatrix(fe, T, M_e);
+      conv_int->AssembleElementMatrix(fe, T, K_e);
+
+      for (int i = 0; i < nd; i++)
+      {
+         double row_sum = 0.0;
+         for (int j = 0; j < nd; j++)
+         {
+            const int id = (e*nd + i)*nd + j;
+            row_sum += M_e(i, j);
+            if (m_pos[id] >= 0) { m_data[m_pos[id]] += M_e(i, j); }
+            if (k_pos[id] >= 0) { k_data[k_pos[id]] += K_e(i, j); }
+            if (pk && pk_pos[id] >= 0) { pk_data[pk_pos[id]] += PK_e(i, j); }
+            if (ho_full)
+            {
+               if (M_HO_pos[id] >= 0) { M_HO_data[M_HO_pos[id]] += M_e(i, j); }
+               if (K_HO_pos[id] >= 0) { K_HO_data[K_HO_pos[id]] += K_e(i, j); }
+            }
+         }
+         ml_data[ml_pos[e*nd + i]] = row_sum;
+         lm[e*nd + i] = row_sum;
+      }
+   }
+}
+
+void RemapAssembler::AssembleFaces(bool flux_terms)
+{
+   Mesh *mesh = pfes.GetMesh();
+   Array<BilinearFormIntegrator*> &fbfi = *K_HO.GetFBFI(),
+                                   &bfbfi = *K_HO.GetBFBFI();
+   const bool ho_faces = ho_full && fbfi.Size() > 0;
+   SparseMatrix *K_mat = ho_full ? &K_HO.SpMat() : NULL;
+   Array<int> vdofs, vdofs2;
+   DenseMatrix elmat;
+
+   // Interior and boundary faces: flux terms of the adjacent local elements,
+   // and the interior face terms of K_HO on the same transformation.
+   if (flux_terms) { asmbl.ResetBdrBlocks(); }
+   FaceElementTransformations *T;
+   const int nf = (flux_terms || ho_faces) ? mesh->GetNumFaces() : 0;
+   for (int f = 0; f < nf; f++)
+   {
+      // On nonconforming meshes the slave faces couple the fine element to
+      // the coarse one, though the face is not a face of the coarse element.
+      int e1, e2;
+      mesh->GetFaceElements(f, &e1, &e2);
+      if (flux_terms == false && e2 < 0) { continue; }
+      T = mesh->GetFaceElementTransformations(f);
+      if (flux_terms)
+      {
+         asmbl.ComputeFaceFluxTerms(T, face_loc1[f], face_loc2[f], lom);
+      }
+
+      if (ho_faces == false || e2 < 0) { continue; }
+      const FiniteElement &fe1 = *pfes.GetFE(T->Elem1No),
+                          &fe2 = *pfes.GetFE(T->Elem2No);
+      pfes.GetElementVDofs(T->Elem1No, vdofs);
+      pfes.GetElementVDofs(T->Elem2No, vdofs2);
+      vdofs.Append(vdofs2);
+      for (int i = 0; i < fbfi.Size(); i++)
+      {
+         fbfi[i]->AssembleFaceMatrix(fe1, fe2, *T, elmat);
+         K_mat->AddSubMatrix(vdofs, vdofs, elmat, 0);
+      }
+   }
+   if (ho_full == false) { return; }
+
+   // Boundary face terms of K_HO.
+   for (int b = 0; b < mesh->GetNBE() && bfbfi.Size() > 0; b++)
+   {
+      T = mesh->GetBdrFaceTransformations(b);
+      if (T == NULL) { continue; }
+      const FiniteElement &fe1 = *pfes.GetFE(T->Elem1No);
+      pfes.GetElementVDofs(T->Elem1No, vdofs);
+      for (int i = 0; i < bfbfi.Size(); i++)
+      {
+         bfbfi[i]->AssembleFaceMatrix(fe1, fe1, *T, elmat);
+         K_mat->AddSubMatrix(vdofs, vdofs, elmat, 0);
+      }
+   }
+
+   // Shared face terms of K_HO, kept in the neighbor block of the matrix.
+   ParMesh *pmesh = pfes.GetParMesh();
+   const int height = pfes.GetVSize();
+   for (int f = 0; f < pmesh->GetNSharedFaces() && ho_faces; f++)
+   {
+      T = pmesh->GetSharedFaceTransformations(f);
+      const int nbr_el = T->Elem2No - pmesh->GetNE();
+      pfes.GetElementVDofs(T->Elem1No, vdofs);
+      pfes.GetFaceNbrElementVDofs(nbr_el, vdofs2);
+      for (int j = 0; j < vdofs2.Size(); j++) { vdofs2[j] += height; }
+      vdofs.Append(vdofs2);
+      for (int i = 0; i < fbfi.Size(); i++)
+      {
+         fbfi[i]->AssembleFaceMatrix(*pfes.GetFE(T->Elem1No),
+                                     *pfes.GetFaceNbrFE(nbr_el), *T, elmat);
+         K_mat->AddSubMatrix(vdofs, vdofs, elmat, 0);
+      }
+   }
+}
+
+void RemapAssembler::ComputeFaceFluxes(double *flux) const
+{
+   Mesh *mesh = pfes.GetMesh();
+   const int dim = mesh->Dimension(), nq = lom.irF->GetNPoints();
+   Vector nor(dim);
+
+   for (int f = 0; f < mesh->GetNumFaces(); f++)
+   {
+      FaceElementTransformations *T = mesh->GetFaceElementTransformations(f);
+      for (int q = 0; q < nq; q++)
+      {
+         const IntegrationPoint &ip = lom.irF->IntPoint(q);
+         IntegrationPoint eip;
+         T->Face->SetIntPoint(&ip);
+         T->Loc1.Transform(ip, eip);
+
+         // The unit normal times the face weight.
+         if (dim == 1) { nor(0) = 2.*eip.x - 1.0; }
+         else          { CalcOrtho(T->Face->Jacobian(), nor); }
+         nor *= ip.weight * T->Face->Weight() / nor.Norml2();
+
+         // The velocity is the same on both sides of the face.
+         double *fq = flux + 2*(f*nq + q);
+         const double *v = lom.coef->FaceValue(f, q);
+         fq[0] = 0.0;
+         for (int d = 0; d < dim; d++) { fq[0] += v[d] * nor(d); }
+         fq[1] = (face_loc2[f] >= 0) ? -fq[0] : 0.0;
+      }
+   }
+}
+
+void RemapAssembler::ComputeFaceShapes()
+{
+   Mesh *mesh = pfes.GetMesh();
+   const int nq = lom.irF->GetNPoints(), nfd = dofs.numFaceDofs;
+   face_shape.SetSize(mesh->GetNumFaces() * nq * 2 * nfd);
+   face_shape = 0.0;
+   double *fs = face_shape.HostReadWrite();
+   Vector shape;
+
+   for (int f = 0; f < mesh->GetNumFaces(); f++)
+   {
+      // Only the reference mappings are used, so any face transformation works.
+      FaceElementTransformations *T = mesh->GetFaceElementTransformations(f);
+      for (int q = 0; q < nq; q++)
+      {
+         const IntegrationPoint &ip = lom.irF->IntPoint(q);
+         IntegrationPoint eip;
+         for (int side = 0; side < 2; side++)
+         {
+            const int loc = side ? face_loc2[f] : face_loc1[f];
+            if (loc < 0) { continue; }
+            const int el = side ? T->Elem2No : T->Elem1No;
+            const FiniteElement &fe = *pfes.GetFE(el);
+            shape.SetSize(fe.GetDof());
+            if (side == 0) { T->Loc1.Transform(ip, eip); }
+            else           { T->Loc2.Transform(ip, eip); }
+            fe.CalcShape(eip, shape);
+            double *s = fs + (2*(f*nq + q) + side) * nfd;
+            for (int i = 0; i < nfd; i++)
+            {
+               s[i] = shape(dofs.BdrDofs(i, loc));
+            }
+         }
+      }
+   }
+}
+
+void RemapAssembler::AddPolynomialFluxTerms(double t)
+{
+   Mesh *mesh = pfes.GetMesh();
+   const int nq = lom.irF->GetNPoints(), nfd = dofs.numFaceDofs;
+   const double *fs = face_shape.HostRead();
+
+   double *flux = face_flux.HostWrite();
+   EvalPolynomials(flux_coef, poly_deg, t, flux);
+
+   double *B = face_B.HostWrite();
+   asmbl.ResetBdrBlocks();
+   for (int f = 0; f < mesh->GetNumFaces(); f++)
+   {
+      int e[2];
+      mesh->GetFaceElements(f, &e[0], &e[1]);
+      for (int side = 0; side < 2; side++)
+      {
+         const int loc = side ? face_loc2[f] : face_loc1[f];
+         if (loc < 0) { continue; }
+         for (int i = 0; i < nfd*nfd; i++) { B[i] = 0.; }
+         for (int q = 0; q < nq; q++)
+         {
+            const int id = 2*(f*nq + q) + side;
+            // Remap upwinding, as in Assembly::AddFluxTerm().
+            const double vn = -std::max(0., flux[id]);
+            const double *s = fs + id * nfd;
+            for (int i = 0; i < nfd; i++)
+            {
+               const double aux = s[i] * vn;
+               for (int j = 0; j < nfd; j++) { B[i*nfd + j] -= aux * s[j]; }
+            }
+         }
+         asmbl.StoreBdrBlock(e[side], loc, B);
+      }
+   }
+}
+
+} // namespace mfem
@@ -0,0 +1,104 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#ifndef MFEM_REMHOS_REMAP
+#define MFEM_REMHOS_REMAP
+
+#include "mfem.hpp"
+#include "remhos_tools.hpp"
+
+namespace mfem
+{
+
+// Reassembles the operators of the remap on the moved mesh. The sparsity of
+// the matrices doesn't change when the mesh moves, so the element matrices are
+// written directly into the existing CSR values, at positions found once in
+// the constructor. All element matrices are computed in one pass that shares
+// the element transformation, and the face flux terms of both elements of a
+// face are computed together with the face terms of K_HO.
+//
+// The mesh moves affinely in the pseudo-time t, so the entries of the mass
+// and convection matrices are polynomials of degree <= dim in t. In the
+// optional polynomial mode the coefficients of these polynomials are computed
+// once from dim+1 samples, and each reassembly only evaluates them. The same
+// is done for the normal velocities at the quadrature points of the faces,
+// which give the flux terms after the upwind clipping. The preconditioned
+// convection matrix and the face terms of K_HO are not polynomial in t and
+// are reassembled as usual.
+// NOTE: m, k and M_HO, K_HO are expected to have the same single domain
+//       integrator, and ml to be the lumped version of the mass matrix.
+class RemapAssembler
+{
+private:
+   ParFiniteElementSpace &pfes;
+   ParBilinearForm &m, &ml, &k, &M_HO, &K_HO, *pk;
+   Vector &lumpedM;
+   Assembly &asmbl;
+   LowOrderMethod &lom;
+   DofInfo &dofs;
+   const bool ho_full;
+
+   // Position in the CSR values of entry (i, j) of the element block e,
+   // stored at (e*nd + i)*nd + j. The diagonal positions of ml are per dof.
+   Array<int> m_pos, k_pos, M_HO_pos, K_HO_pos, pk_pos, ml_pos;
+
+   // Local index of each face in its first and second element, or -1 if the
+   // second element isn't local.
+   Array<int> face_loc1, face_loc2;
+
+   // Polynomial mode data. The coefficient p of entry i is stored at
+   // p*n + i, where n is the number of entries.
+   int poly_deg;
+   Vector m_coef, ml_coef, k_coef, M_HO_coef, K_HO_coef;
+   // Weighted normal velocity of the two sides of the face quadrature points,
+   // and the shapes of the face dofs at these points, per (face, point, side).
+   // face_flux and face_B are the fluxes at a time and a face block, the
+   // scratch of AddPolynomialFluxTerms().
+   Vector flux_coef, face_shape, face_flux, face_B;
+
+   void ComputePositions(const SparseMatrix &mat, Array<int> &pos) const;
+   // The preconditioned convection matrix is always assembled; the other
+   // matrices only if all is true.
+   void AssembleElements(bool all);
+   // K_HO face terms, and the flux terms of asmbl if flux_terms is true.
+   void AssembleFaces(bool flux_terms);
+
+   // Face quadrature data for the polynomial mode.
+   void ComputeFaceShapes();
+   void ComputeFaceFluxes(double *flux) const;
+   void AddPolynomialFluxTerms(double t);
+
+public:
+   RemapAssembler(ParFiniteElementSpace &space,
+                  ParBilinearForm &m_, ParBilinearForm &ml_,
+                  ParBilinearForm &k_, ParBilinearForm &M_HO_,
+                  ParBilinearForm &K_HO_, Vector &lumpedM_,
+                  Assembly &asmbl_, LowOrderMethod &lom_, DofInfo &dofs);
+
+   // Switches to the polynomial mode. The mesh is moved to pos0 + t vel at
+   // the sample times, and is returned to pos0 at the end.
+   void ComputePolynomials(GridFunction &pos, const Vector &pos0,
+                           const GridFunction &vel);
+
+   // Recomputes all matrices, lumpedM and the face flux terms of asmbl on the
+   // mesh at pseudo-time t. The mesh must be at time t and its geometric
+   // factors must be up to date.
+   void Reassemble(double t);
+};
+
+} // namespace mfem
+
+#endif // MFEM_REMHOS_REMAP
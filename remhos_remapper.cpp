@@ -0,0 +1,368 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#include "remhos_remapper.hpp"
+
+using namespace std;
+
+namespace mfem
+{
+
+RemhosRemapOptions::RemhosRemapOptions()
+   : order(2), ho_type(3), lo_type(2), fct_type(2), mono_type(0),
+     smth_ind_type(0), ode_solver_type(3), dt(0.01), cfl(-1.0),
+     remap_poly(false) { }
+
+static ParGridFunction &MeshNodes(ParMesh &pmesh)
+{
+   ParGridFunction *nodes = dynamic_cast<ParGridFunction *>(pmesh.GetNodes());
+   MFEM_VERIFY(nodes, "The remapper requires a mesh with parallel nodes.");
+   return *nodes;
+}
+
+static ODESolver *CreateODESolver(int type)
+{
+   switch (type)
+   {
+      case 1: return new ForwardEulerSolver;
+      case 2: return new RK2Solver(1.0);
+      case 3: return new RK3SSPSolver;
+      case 4: return new RK4Solver;
+      case 6: return new RK6Solver;
+      case 7: return new LowStorageSSPRK104Solver;
+      case 8: return new LowStorageSSPRK2Solver(5);
+      default: MFEM_ABORT("Unknown ODE solver type: " << type);
+   }
+   return NULL;
+}
+
+RemhosRemapper::RemhosRemapper(ParMesh &pmesh_,
+                               const RemhosRemapOptions &options,
+                               int nfields)
+   : pmesh(pmesh_), opt(options), num_fields(nfields),
+     x(MeshNodes(pmesh_)), x0(x.Size()), v_gf(x.FESpace()), v_coef(&v_gf),
+     velocity_q(v_coef, pmesh_),
+     fec(options.order, pmesh_.Dimension(), BasisType::Positive),
+     fec0(0, pmesh_.Dimension(), BasisType::Positive),
+     fec1(1, pmesh_.Dimension(), BasisType::Positive),
+     pfes(&pmesh_, &fec), inflow_gf(&pfes), u_si(&pfes),
+     m(&pfes), ml(&pfes), k(&pfes), M_HO(&pfes), K_HO(&pfes),
+     dofs(pfes),
+     subcell_mesh(&pmesh_), fec_sub(NULL), pfes_sub(NULL), xsub(NULL),
+     velocity_sub_q(NULL), sub_transfer(NULL),
+     asmbl(NULL), smth_indicator(NULL), ho_solver(NULL), lo_solver(NULL),
+     fct_solver(NULL), mono_solver(NULL), remap_asmbl(NULL), adv(NULL),
+     ode_solver(NULL)
+{
+   const bool forced_bounds = opt.lo_type != 0 || opt.mono_type != 0;
+   const bool use_subcell_RD = opt.lo_type == 4 || opt.mono_type == 2;
+   MFEM_VERIFY(forced_bounds == false || opt.order > 0,
+               "Monotonicity treatment requires order > 0.");
+   MFEM_VERIFY(use_subcell_RD == false || opt.order > 1,
+               "Subcell schemes are not applicable to linear FE.");
+   MFEM_VERIFY(pmesh.Nonconforming() == false ||
+               (use_subcell_RD == false && opt.smth_ind_type == 0),
+               "Subcell schemes and the smoothness indicator require a "
+               "conforming mesh.");
+
+   v_gf = 0.0;
+   inflow_gf = 0.0;
+
+   // The forms of remap mode, assembled on the setup mesh; they are
+   // reassembled in every stage.
+   m.AddDomainIntegrator(new MassIntegrator);
+   M_HO.AddDomainIntegrator(new MassIntegrator);
+   ml.AddDomainIntegrator(new LumpedIntegrator(new MassIntegrator));
+   k.AddDomainIntegrator(new ConvectionIntegrator(velocity_q));
+   K_HO.AddDomainIntegrator(new ConvectionIntegrator(velocity_q));
+   if (opt.ho_type == 2 || opt.ho_type == 3 || opt.fct_type == 1)
+   {
+      DGTraceIntegrator *dgt_i = new DGTraceIntegrator(v_coef, -1.0, -0.5);
+      DGTraceIntegrator *dgt_b = new DGTraceIntegrator(v_coef, -1.0, -0.5);
+      K_HO.AddInteriorFaceIntegrator(new TransposeIntegrator(dgt_i));
+      K_HO.AddBdrFaceIntegrator(new TransposeIntegrator(dgt_b));
+      K_HO.KeepNbrBlock(true);
+   }
+   const int skip_zeros = 0;
+   m.Assemble();
+   m.Finalize();
+   M_HO.Assemble();
+   M_HO.Finalize();
+   ml.Assemble();
+   ml.Finalize();
+   ml.SpMat().GetDiag(lumpedM);
+   k.Assemble(skip_zeros);
+   k.Finalize(skip_zeros);
+   K_HO.Assemble(skip_zeros);
+   K_HO.Finalize(skip_zeros);
+
+   lom.subcell_scheme = use_subcell_RD;
+   lom.pk = NULL;
+   lom.VolumeTerms = NULL;
+   lom.SubFes0 = NULL;
+   lom.SubFes1 = NULL;
+   if (opt.lo_type == 1)
+   {
+      lom.smap = SparseMatrix_Build_smap(k.SpMat());
+      lom.D = k.SpMat();
+   }
+   else if (opt.lo_type == 2)
+   {
+      lom.pk = new ParBilinearForm(&pfes);
+      lom.pk->AddDomainIntegrator(new PrecondConvectionIntegrator(velocity_q));
+      lom.pk->Assemble(skip_zeros);
+      lom.pk->Finalize(skip_zeros);
+      lom.smap = SparseMatrix_Build_smap(lom.pk->SpMat());
+      lom.D = lom.pk->SpMat();
+   }
+   lom.coef = &velocity_q;
+
+   // Face integration rule.
+   const FaceElementTransformations *ft =
+      pmesh.GetFaceElementTransformations(0);
+   const int el_order = pfes.GetFE(0)->GetOrder();
+   int ft_order = ft->Elem1->OrderW() + 2 * el_order;
+   if (pfes.GetFE(0)->Space() == FunctionSpace::Pk) { ft_order++; }
+   lom.irF = &IntRules.Get(ft->FaceGeom, ft_order);
+   velocity_q.SetFaceRule(*lom.irF);
+
+   if (opt.order > 1 && pmesh.Nonconforming() == false) { SetupSubcellMesh(); }
+
+   SetupSolvers();
+}
+
+void RemhosRemapper::SetupSubcellMesh()
+{
+   // The mesh of the Bezier subcells of order p. Its positions follow the
+   // positions of the mesh by interpolation; the fine mesh is always linear.
+   const int dim = pmesh.Dimension();
+   subcell_mesh = new ParMesh(&pmesh, opt.order, BasisType::ClosedUniform);
+   const bool periodic = dynamic_cast<const L2_FECollection *>
+                         (x.FESpace()->FEColl()) != NULL;
+   if (periodic)
+   {
+      const bool disc_nodes = true;
+      subcell_mesh->SetCurvature(1, disc_nodes);
+      fec_sub = new L2_FECollection(1, dim, BasisType::ClosedUniform);
+   }
+   else
+   {
+      subcell_mesh->SetCurvature(1);
+      fec_sub = new H1_FECollection(1, dim, BasisType::ClosedUniform);
+   }
+   pfes_sub = new ParFiniteElementSpace(subcell_mesh, fec_sub, dim);
+   xsub = new ParGridFunction(pfes_sub);
+   subcell_mesh->SetNodalGridFunction(xsub);
+   sub_transfer = new InterpolationGridTransfer(*x.FESpace(), *pfes_sub);
+   sub_transfer->ForwardOperator().Mult(x, *xsub);
+   x0_sub = *xsub;
+
+   lom.SubFes0 = new FiniteElementSpace(subcell_mesh, &fec0);
+   lom.SubFes1 = new FiniteElementSpace(subcell_mesh, &fec1);
+
+   v_sub_gf.SetSpace(pfes_sub);
+   v_sub_gf = 0.0;
+   v_sub_coef.SetGridFunction(&v_sub_gf);
+   velocity_sub_q = new QuadratureVelocity(v_sub_coef, *subcell_mesh);
+   lom.VolumeTerms = new MixedConvectionIntegrator(*velocity_sub_q);
+}
+
+void RemhosRemapper::SetupSolvers()
+{
+   const int remap_mode = 1;
+   const bool time_dep = true, mass_lim = true;
+   asmbl = new Assembly(dofs, lom, inflow_gf, pfes, subcell_mesh, remap_mode);
+
+   if (opt.lo_type == 1)
+   {
+      lo_solver = new DiscreteUpwind(pfes, k.SpMat(), lom.smap,
+                                     lumpedM, *asmbl, time_dep);
+   }
+   else if (opt.lo_type == 2)
+   {
+      lo_solver = new DiscreteUpwind(pfes, lom.pk->SpMat(), lom.smap,
+                                     lumpedM, *asmbl, time_dep);
+   }
+   else if (opt.lo_type == 3 || opt.lo_type == 4)
+   {
+      const bool subcell_scheme = (opt.lo_type == 4);
+      lo_solver = new ResidualDistribution(pfes, k, *asmbl, lumpedM,
+                                           subcell_scheme, time_dep);
+   }
+
+   // The matrices of the smoothness indicator are refreshed by Remap().
+   if (opt.smth_ind_type)
+   {
+      smth_indicator = new SmoothnessIndicator(opt.smth_ind_type,
+                                               *subcell_mesh, pfes, u_si,
+                                               dofs);
+   }
+
+   if (opt.ho_type == 1)
+   {
+      ho_solver = new NeumannHOSolver(pfes, m, k, lumpedM, *asmbl);
+   }
+   else if (opt.ho_type == 2)
+   {
+      ho_solver = new CGHOSolver(pfes, M_HO, K_HO);
+   }
+   else if (opt.ho_type == 3)
+   {
+      ho_solver = new LocalInverseHOSolver(pfes, M_HO, K_HO);
+   }
+
+   // The smoothness scaling uses the mesh velocity.
+   if (opt.mono_type == 1 || opt.mono_type == 2)
+   {
+      const bool subcell_scheme = (opt.mono_type == 2);
+      mono_solver = new MonoRDSolver(pfes, k.SpMat(), m.SpMat(), lumpedM,
+                                     *asmbl, smth_indicator, v_coef,
+                                     subcell_scheme, time_dep, mass_lim);
+   }
+
+   if (opt.fct_type == 1)
+   {
+      const int fct_iterations = 1;
+      fct_solver = new FluxBasedFCT(pfes, smth_indicator, opt.dt, K_HO, M_HO,
+                                    dofs, fct_iterations);
+   }
+   else if (opt.fct_type == 2)
+   {
+      fct_solver = new ClipScaleSolver(pfes, smth_indicator, opt.dt);
+   }
+   else if (opt.fct_type == 3)
+   {
+      fct_solver = new NonlinearPenaltySolver(pfes, smth_indicator, opt.dt);
+   }
+
+   remap_asmbl = new RemapAssembler(pfes, m, ml, k, M_HO, K_HO, lumpedM,
+                                    *asmbl, lom, dofs);
+
+   S.SetSize(num_fields * pfes.GetVSize(), Device::GetMemoryType());
+   S.UseDevice(true);
+   adv = new AdvectionOperator(S.Size(), m, ml, lumpedM, k, M_HO, K_HO,
+                               x, xsub, v_gf, v_sub_gf, *asmbl, lom, dofs,
+                               ho_solver, lo_solver, fct_solver, mono_solver,
+                               remap_asmbl, remap_mode);
+   ode_solver = CreateODESolver(opt.ode_solver_type);
+
+   // The adaptive time step is based on the matrix of the LO solution.
+   if (opt.cfl > 0.0)
+   {
+      cfl_smap = SparseMatrix_Build_smap(lom.pk ? lom.pk->SpMat()
+                                         : k.SpMat());
+   }
+}
+
+void RemhosRemapper::Remap(const Vector &x_old, const Vector &x_new,
+                           Array<ParGridFunction *> &fields)
+{
+   MFEM_VERIFY(x_old.Size() == x.Size() && x_new.Size() == x.Size(),
+               "The positions don't match the mesh nodes.");
+   MFEM_VERIFY(fields.Size() == num_fields,
+               "Wrong number of fields: " << fields.Size());
+
+   // Geometric data of the new motion: the velocity at the quadrature points
+   // and the positions of the subcell mesh.
+   subtract(x_new, x_old, v_gf);
+   x0 = x_old;
+   x = x0;
+   velocity_q.Refresh();
+   if (subcell_mesh != &pmesh)
+   {
+      sub_transfer->ForwardOperator().Mult(x, x0_sub);
+      sub_transfer->ForwardOperator().Mult(v_gf, v_sub_gf);
+      *xsub = x0_sub;
+      velocity_sub_q->Refresh();
+   }
+   pmesh.DeleteGeometricFactors();
+   if (smth_indicator) { smth_indicator->UpdateGeometry(dofs); }
+   if (mono_solver) { mono_solver->UpdateVelocityScale(v_coef); }
+   if (opt.remap_poly) { remap_asmbl->ComputePolynomials(x, x0, v_gf); }
+   adv->SetRemapStartPos(x0, x0_sub);
+
+   const int vsize = pfes.GetVSize();
+   Vector S_f;
+   for (int f = 0; f < num_fields; f++)
+   {
+      MFEM_VERIFY(fields[f]->Size() == vsize, "Wrong size of field " << f);
+      S_f.MakeRef(S, f*vsize, vsize);
+      S_f = *fields[f];
+      S_f.SyncAliasMemory(S);
+   }
+
+   // The CFL time step needs the matrices at the start positions.
+   const SparseMatrix &K_cfl = lom.pk ? lom.pk->SpMat() : k.SpMat();
+   if (opt.cfl > 0.0) { remap_asmbl->Reassemble(0.0); }
+
+   // The pseudo-time evolves from 0 to 1.
+   double t = 0.0;
+   adv->SetTime(t);
+   ode_solver->Init(*adv);
+   bool done = false;
+   while (done == false)
+   {
+      double dt = opt.dt;
+      if (opt.cfl > 0.0)
+      {
+         dt = ComputeCFLTimeStep(K_cfl, cfl_smap, *asmbl, lumpedM, opt.cfl,
+                                 pmesh.GetComm(), el_dt, cfl_diag);
+      }
+      const double dt_real = min(dt, 1.0 - t);
+      adv->SetDt(dt_real);
+      perf_timers.Start(PerfPhase::Step);
+      ode_solver->Step(S, t, dt_real);
+      perf_timers.Stop(PerfPhase::Step);
+      done = (t >= 1.0 - 1.e-8*dt);
+   }
+
+   add(x0, 1.0, v_gf, x);
+   if (subcell_mesh != &pmesh) { add(x0_sub, 1.0, v_sub_gf, *xsub); }
+   pmesh.DeleteGeometricFactors();
+   for (int f = 0; f < num_fields; f++)
+   {
+      S_f.MakeRef(S, f*vsize, vsize);
+      *fields[f] = S_f;
+   }
+}
+
+RemhosRemapper::~RemhosRemapper()
+{
+   delete ode_solver;
+   delete adv;
+   delete remap_asmbl;
+   delete fct_solver;
+   delete mono_solver;
+   delete ho_solver;
+   delete smth_indicator;
+   delete lo_solver;
+   delete asmbl;
+   delete lom.pk;
+   if (subcell_mesh != &pmesh)
+   {
+      delete lom.VolumeTerms;
+      delete lom.SubFes0;
+      delete lom.SubFes1;
+      delete velocity_sub_q;
+      delete sub_transfer;
+      delete subcell_mesh;
+      delete xsub;
+      delete pfes_sub;
+      delete fec_sub;
+   }
+}
+
+} // namespace mfem
@@ -0,0 +1,119 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#ifndef MFEM_REMHOS_REMAPPER
+#define MFEM_REMHOS_REMAPPER
+
+#include "mfem.hpp"
+#include "remhos_advection.hpp"
+
+namespace mfem
+{
+
+// Options of the remapper. The solver ids are those of the driver options
+// -ho, -lo, -fct, -mono, -sis and -s, where 0 disables the solver.
+struct RemhosRemapOptions
+{
+   int order;
+   int ho_type, lo_type, fct_type, mono_type, smth_ind_type;
+   int ode_solver_type;
+   // Pseudo-time step, or the CFL number of an adaptive step if cfl > 0.
+   double dt, cfl;
+   // Polynomial reassembly of the matrices, see -rpm.
+   bool remap_poly;
+
+   RemhosRemapOptions();
+};
+
+// Remaps DG fields between two positions of the nodes of a mesh, e.g., in the
+// Eulerian phase of an ALE code. The spaces, forms, dof tables, subcell mesh
+// and solvers depend only on the mesh topology and are set up once. Each call
+// of Remap() only refreshes the velocity and the geometric data.
+class RemhosRemapper
+{
+private:
+   ParMesh &pmesh;
+   const RemhosRemapOptions opt;
+   const int num_fields;
+
+   // Mesh positions, the start positions of a remap and the pseudo-time
+   // velocity x_new - x_old.
+   ParGridFunction &x;
+   Vector x0;
+   GridFunction v_gf;
+   VectorGridFunctionCoefficient v_coef;
+   QuadratureVelocity velocity_q;
+
+   DG_FECollection fec, fec0, fec1;
+   ParFiniteElementSpace pfes;
+   // There's no inflow, as the boundary doesn't move. u_si is the field
+   // argument of the smoothness indicator.
+   ParGridFunction inflow_gf, u_si;
+
+   ParBilinearForm m, ml, k, M_HO, K_HO;
+   Vector lumpedM;
+   DofInfo dofs;
+   LowOrderMethod lom;
+
+   // The subcell mesh, its positions and velocity, and the interpolation of
+   // the mesh positions to it. subcell_mesh is &pmesh for order 1.
+   ParMesh *subcell_mesh;
+   FiniteElementCollection *fec_sub;
+   ParFiniteElementSpace *pfes_sub;
+   ParGridFunction *xsub, v_sub_gf;
+   VectorGridFunctionCoefficient v_sub_coef;
+   QuadratureVelocity *velocity_sub_q;
+   InterpolationGridTransfer *sub_transfer;
+   Vector x0_sub;
+
+   Assembly *asmbl;
+   SmoothnessIndicator *smth_indicator;
+   HOSolver *ho_solver;
+   LOSolver *lo_solver;
+   FCTSolver *fct_solver;
+   MonoRDSolver *mono_solver;
+   Array<int> cfl_smap;
+   // Scratch of the CFL time steps.
+   Vector el_dt, cfl_diag;
+   RemapAssembler *remap_asmbl;
+   AdvectionOperator *adv;
+   ODESolver *ode_solver;
+
+   // The fields, stored one after the other.
+   Vector S;
+
+   void SetupSubcellMesh();
+   void SetupSolvers();
+
+public:
+   // The mesh must have nodes, which are moved by Remap().
+   RemhosRemapper(ParMesh &pmesh_, const RemhosRemapOptions &options,
+                  int nfields = 1);
+   ~RemhosRemapper();
+
+   // The space of the remapped fields.
+   ParFiniteElementSpace &GetFESpace() { return pfes; }
+
+   // Remaps the fields, which are functions of GetFESpace(), from the node
+   // positions x_old to x_new. Either can be the mesh nodes, which are left
+   // at x_new.
+   void Remap(const Vector &x_old, const Vector &x_new,
+              Array<ParGridFunction *> &fields);
+};
+
+} // namespace mfem
+
+#endif // MFEM_REMHOS_REMAPPER
@@ -0,0 +1,162 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#include "remhos_steady.hpp"
+#include "remhos_tools.hpp"
+
+using namespace std;
+
+namespace mfem
+{
+
+double ComputeLocalTimeStepScales(const Vector &el_dt, MPI_Comm comm,
+                                  Vector &scale)
+{
+   const int ne = el_dt.Size();
+   const double inf = numeric_limits<double>::infinity();
+   double dt_loc = inf, dt;
+   for (int k = 0; k < ne; k++) { dt_loc = fmin(dt_loc, el_dt(k)); }
+   MPI_Allreduce(&dt_loc, &dt, 1, MPI_DOUBLE, MPI_MIN, comm);
+   MFEM_VERIFY(dt < inf, "There is no flow in the domain.");
+
+   scale.SetSize(ne);
+   scale.UseDevice(true);
+   double *h_scale = scale.HostWrite();
+   for (int k = 0; k < ne; k++)
+   {
+      h_scale[k] = (el_dt(k) < inf) ? el_dt(k) / dt : 1.0;
+   }
+   return dt;
+}
+
+void ComputeResidualScales(const Vector &lumpedM, double dt,
+                           const Vector *el_scale, Vector &s)
+{
+   const int n = lumpedM.Size();
+   const int nd = el_scale ? n / el_scale->Size() : 1;
+   const bool use_scale = (el_scale != NULL);
+   s.SetSize(n);
+   s.UseDevice(true);
+   const double *d_m = lumpedM.Read(),
+                *d_sc = use_scale ? el_scale->Read() : NULL;
+   double *d_s = s.Write();
+   MFEM_FORALL(i, n,
+   {
+      d_s[i] = d_m[i] / (dt * (use_scale ? d_sc[i / nd] : 1.0));
+   });
+}
+
+AndersonAcceleration::AndersonAcceleration(int m, MPI_Comm comm_)
+   : depth(m), comm(comm_), dF(m), dG(m), num_cols(0), next(0),
+     have_old(false)
+{
+   MFEM_VERIFY(depth > 0, "The depth of the acceleration must be positive.");
+   for (int j = 0; j < depth; j++)
+   {
+      dF[j] = new Vector;
+      dG[j] = new Vector;
+      dF[j]->UseDevice(true);
+      dG[j]->UseDevice(true);
+   }
+   sf.UseDevice(true);
+   sf_old.UseDevice(true);
+   g_old.UseDevice(true);
+   g_acc.UseDevice(true);
+}
+
+AndersonAcceleration::~AndersonAcceleration()
+{
+   for (int j = 0; j < depth; j++)
+   {
+      delete dF[j];
+      delete dG[j];
+   }
+}
+
+double AndersonAcceleration::Apply(const Vector &u, Vector &g,
+                                   const Vector &s,
+                                   double u_min, double u_max)
+{
+   const int n = g.Size();
+   sf.SetSize(n);
+   const double *d_u = u.Read(), *d_g = g.Read(), *d_s = s.Read();
+   double *d_sf = sf.Write();
+   MFEM_FORALL(i, n, d_sf[i] = d_s[i] * (d_g[i] - d_u[i]); );
+
+   if (have_old)
+   {
+      dF[next]->SetSize(n);
+      dG[next]->SetSize(n);
+      subtract(sf, sf_old, *dF[next]);
+      subtract(g, g_old, *dG[next]);
+      next = (next + 1) % depth;
+      num_cols = min(num_cols + 1, depth);
+   }
+   sf_old = sf;
+   g_old = g;
+   have_old = true;
+
+   // The squared residual, the products of the differences with the residual,
+   // and their Gram matrix are summed in one reduction.
+   const int nc = num_cols, nv = 1 + nc + nc*nc;
+   loc.SetSize(nv);
+   glob.SetSize(nv);
+   loc(0) = DeterministicSquaredNorm(sf, block_sums);
+   for (int i = 0; i < nc; i++)
+   {
+      loc(1 + i) = DeterministicDot(*dF[i], sf, block_sums);
+      for (int j = 0; j <= i; j++)
+      {
+         loc(1 + nc + i*nc + j) = loc(1 + nc + j*nc + i) =
+                                     DeterministicDot(*dF[i], *dF[j],
+                                                      block_sums);
+      }
+   }
+   MPI_Allreduce(loc.GetData(), glob.GetData(), nv, MPI_DOUBLE, MPI_SUM,
+                 comm);
+   const double residual = sqrt(glob(0));
+   if (nc == 0) { return residual; }
+
+   A.SetSize(nc);
+   b.SetSize(nc);
+   gamma.SetSize(nc);
+   double trace = 0.0;
+   for (int i = 0; i < nc; i++)
+   {
+      b(i) = glob(1 + i);
+      for (int j = 0; j < nc; j++) { A(i, j) = glob(1 + nc + i*nc + j); }
+      trace += A(i, i);
+   }
+   if (trace == 0.0) { return residual; }
+   // The differences become almost linearly dependent near convergence.
+   for (int i = 0; i < nc; i++) { A(i, i) += 1e-12 * trace; }
+   A_inv.Factor(A);
+   A_inv.Mult(b, gamma);
+
+   g_acc = g;
+   for (int j = 0; j < nc; j++) { g_acc.Add(-gamma(j), *dG[j]); }
+
+   // The acceleration is not monotone, so it's dropped when it leaves the
+   // bounds.
+   int out_loc = (g_acc.Min() < u_min - 1e-12 || g_acc.Max() > u_max + 1e-12),
+       out;
+   MPI_Allreduce(&out_loc, &out, 1, MPI_INT, MPI_MAX, comm);
+   if (out) { Reset(); }
+   else     { g = g_acc; }
+   return residual;
+}
+
+} // namespace mfem
@@ -0,0 +1,81 @@
+// Copyright (c) 2017, Lawrence Livermore National Security, LLC. Produced at
+// the Lawrence Livermore National Laboratory. LLNL-CODE-734707. All Rights
+// reserved. See files LICENSE and NOTICE for details.
+//
+// This file is part of CEED, a collection of benchmarks, miniapps, software
+// libraries and APIs for efficient high-order finite element and spectral
+// element discretizations for exascale applications. For more information and
+// source code availability see http://github.com/ceed.
+//
+// The CEED research is supported by the Exascale Computing Project 17-SC-20-SC,
+// a collaborative effort of two U.S. Department of Energy organizations (Office
+// of Science and the National Nuclear Security Administration) responsible for
+// the planning and preparation of a capable exascale ecosystem, including
+// software, applications, hardware, advanced system engineering and early
+// testbed platforms, in support of the nation's exascale computing imperative.
+
+#ifndef MFEM_REMHOS_STEADY
+#define MFEM_REMHOS_STEADY
+
+#include "mfem.hpp"
+
+namespace mfem
+{
+
+// Local pseudo-time stepping to a steady state: element k advances with the
+// time step scale(k) * dt, where dt is the smallest of the element time steps
+// el_dt over all MPI tasks, which is returned. Elements without flow keep dt.
+double ComputeLocalTimeStepScales(const Vector &el_dt, MPI_Comm comm,
+                                  Vector &scale);
+
+// Scales s_i = m_i / dt_i of the steady residual |s (u_new - u_old)|, where
+// the time step dt_i of dof i is dt, times the scale of its element when
+// el_scale is given.
+void ComputeResidualScales(const Vector &lumpedM, double dt,
+                           const Vector *el_scale, Vector &s);
+
+// Anderson acceleration of the fixed point iteration u_{k+1} = G(u_k) that is
+// formed by the pseudo-time steps. With f_k = G(u_k) - u_k and the differences
+// dF_j, dG_j of the last depth values of f and G, the next iterate is
+// G(u_k) - sum_j gamma_j dG_j, where gamma minimizes |s (f_k - sum_j gamma_j
+// dF_j)| in the scaled residual norm.
+class AndersonAcceleration
+{
+private:
+   const int depth;
+   MPI_Comm comm;
+
+   // The differences s dF_j of the scaled residuals and dG_j of the images,
+   // stored cyclically.
+   Array<Vector *> dF, dG;
+   int num_cols, next;
+
+   // Scaled residual and image of the last iterate, and the accelerated one.
+   Vector sf, sf_old, g_old, g_acc;
+   bool have_old;
+
+   // Scratch of the deterministic dot products, and the local and global
+   // sums, the least squares system, its factorization and its solution, all
+   // reused by Apply().
+   Vector block_sums, loc, glob, b, gamma;
+   DenseMatrix A;
+   DenseMatrixInverse A_inv;
+
+public:
+   AndersonAcceleration(int m, MPI_Comm comm_);
+   ~AndersonAcceleration();
+
+   // Drops the stored differences.
+   void Reset() { num_cols = next = 0; }
+
+   // Replaces g = G(u) by the accelerated iterate. If that is outside of
+   // [u_min, u_max] on any MPI task, g is kept and the differences are
+   // dropped. Returns |s (g - u)| for the given g, which is summed in the same
+   // reduction as the least squares system.
+   double Apply(const Vector &u, Vector &g, const Vector &s,
+                double u_min, double u_max);
+};
+
+} // namespace mfem
+
+#endif // MFEM_REMHOS_STEADY
@@ -27,106 +27,72 @@ void ComputeBoolIndicators(int NE, const Vector &u,
    ind_elem.SetSize(NE);
    ind_dofs.SetSize(u.Size());
 
-   ind_elem.HostWrite();
-   ind_dofs.HostWrite();
-   u.HostRead();
-
    const int ndof = u.Size() / NE;
-   int dof_id;
-   for (int i = 0; i < NE; i++)
+   const double *d_u = u.Read();
+   bool *d_ind_elem = ind_elem.Write(), *d_ind_dofs = ind_dofs.Write();
+   MFEM_FORALL(i, NE,
    {
-      ind_elem[i] = false;
+      d_ind_elem[i] = false;
       for (int j = 0; j < ndof; j++)
       {
-         dof_id = i*ndof + j;
-         ind_dofs[dof_id] = (u(dof_id) > EMPTY_ZONE_TOL) ? true : false;
+         const int dof_id = i*ndof + j;
+         d_ind_dofs[dof_id] = (d_u[dof_id] > EMPTY_ZONE_TOL) ? true : false;
 
-         if (u(dof_id) > EMPTY_ZONE_TOL) { ind_elem[i] = true; }
+         if (d_u[dof_id] > EMPTY_ZONE_TOL) { d_ind_elem[i] = true; }
       }
-   }
+   });
 }
 
 // This function assumes a DG space.
 void ComputeRatio(int NE, const Vector &us, const Vector &u, Vector &s,
-                  Array<bool> &bool_el, Array<bool> &bool_dof)
+                  Array<bool> &bool_el, Array<bool> &bool_dof,
+                  const Array<int> *elems)
 {
-   ComputeBoolIndicators(NE, u, bool_el, bool_dof);
-
-   us.HostRead();
-   u.HostRead();
-   s.HostWrite();
-   bool_el.HostRead();
-   bool_dof.HostRead();
-
-   const int ndof = u.Size() / NE;
-   for (int i = 0; i < NE; i++)
+   const bool r = (elems != NULL);
+   if (r == false) { ComputeBoolIndicators(NE, u, bool_el, bool_dof); }
+
+   const int ndof = u.Size() / NE, n = r ? elems->Size() : NE;
+   const int *L = r ? elems->Read() : NULL;
+   const double *d_us = us.Read(), *d_u = u.Read();
+   const bool *d_bool_el = bool_el.Read();
+   double *d_s = s.Write();
+   MFEM_FORALL(e, n,
    {
-      if (bool_el[i] == false)
-      {
-         for (int j = 0; j < ndof; j++) { s(i*ndof + j) = 0.0; }
-         continue;
-      }
-
-      const double *u_el = &u(i*ndof), *us_el = &us(i*ndof);
-      double *s_el = &s(i*ndof);
+      const int i = r ? L[e] : e;
+      const double *u_el = d_u + i*ndof, *us_el = d_us + i*ndof;
+      double *s_el = d_s + i*ndof;
 
-      // Average of the existing values.
-      int n = 0;
-      double sum = 0.0;
-      for (int j = 0; j < ndof; j++)
+      if (d_bool_el[i] == false)
       {
-         if (u_el[j] > EMPTY_ZONE_TOL)
-         {
-            sum += us_el[j] / u_el[j];
-            n++;
-         }
+         for (int j = 0; j < ndof; j++) { s_el[j] = 0.0; }
+         return;
       }
-      MFEM_VERIFY(n > 0, "Major error that makes no sense");
-      const double s_avg = sum / n;
 
-      for (int j = 0; j < ndof; j++)
-      {
-         if (u_el[j] <= 0.0)
-         {
-            s_el[j] = s_avg;
-         }
-         else
-         {
-            const double s_j = us_el[j] / u_el[j];
-            if (u_el[j] > EMPTY_ZONE_TOL) { s_el[j] = s_j; }
-            else
-            {
-               // Continuous transition between s_avg and s for u in [0, tol].
-               s_el[j] = u_el[j] * (s_j - s_avg) / EMPTY_ZONE_TOL + s_avg;
-            }
-
-            // NOTE: the above transition alters slightly the values of
-            // s = us / u, near u = EMPTY_ZONE_TOL. This might break the theorem
-            // stating that s_min <= us_LO / u_LO <= s_max, as s_min and s_max
-            // are different, due to s not being exactly us / u.
-         }
-      }
-   }
+      ComputeElementRatio(ndof, u_el, us_el, s_el);
+   });
 }
 
 void ZeroOutEmptyDofs(const Array<bool> &ind_elem,
-                      const Array<bool> &ind_dofs, Vector &u)
+                      const Array<bool> &ind_dofs, Vector &u,
+                      const Array<int> *elems)
 {
-   ind_elem.HostRead();
-   ind_dofs.HostRead();
-   u.HostReadWrite();
-
    const int NE = ind_elem.Size();
    const int ndofs = u.Size() / NE;
-   for (int k = 0; k < NE; k++)
+   const bool r = (elems != NULL);
+   const int n = r ? elems->Size() : NE;
+   const int *L = r ? elems->Read() : NULL;
+   const bool *d_ind_elem = ind_elem.Read(), *d_ind_dofs = ind_dofs.Read();
+   double *d_u = u.ReadWrite();
+   MFEM_FORALL(e, n,
    {
-      if (ind_elem[k] == true) { continue; }
+      const int k = r ? L[e] : e;
+      if (d_ind_elem[k] == true) { return; }
 
       for (int i = 0; i < ndofs; i++)
       {
-         if (ind_dofs[k*ndofs + i] == false) { u(k*ndofs + i) = 0.0; }
+         if (d_ind_dofs[k*ndofs + i] == false) { d_u[k*ndofs + i] = 0.0; }
       }
-   }
+   });
 }
 
 void ComputeMinMaxS(int NE, const Vector &u_s, const Vector &u, int myid)
@@ -137,6 +103,7 @@ void ComputeMinMaxS(int NE, const Vector &u_s, const Vector &u, int myid)
    ComputeBoolIndicators(NE, u, bool_el, bool_dofs);
    ComputeRatio(NE, u_s, u, s, bool_el, bool_dofs);
 
+   s.HostRead();
    bool_dofs.HostRead();
 
    double min_s = numeric_limits<double>::infinity();
@@ -197,6 +164,12 @@ void VerifyLOProduct(int NE, const Vector &us_LO, const Vector &u_LO,
    const double eps = 1.0e-12;
    const int ndofs = u_LO.Size() / NE;
    Vector s_min_loc, s_max_loc;
+   us_LO.HostRead();
+   u_LO.HostRead();
+   s_min.HostRead();
+   s_max.HostRead();
+   active_el.HostRead();
+   active_dofs.HostRead();
 
    for (int k = 0; k < NE; k++)
    {
@@ -27,11 +27,60 @@ namespace mfem
 void ComputeBoolIndicators(int NE, const Vector &u,
                            Array<bool> &ind_elem, Array<bool> &ind_dofs);
 
+// s = u_s / u for the ndof dofs of an element that is not empty, i.e., that
+// has a dof with u > EMPTY_ZONE_TOL. Used by ComputeRatio().
+MFEM_HOST_DEVICE inline
+void ComputeElementRatio(const int ndof, const double *u_el,
+                         const double *us_el, double *s_el)
+{
+   // Average of the existing values. There is at least one, as the
+   // element is not empty.
+   int n = 0;
+   double sum = 0.0;
+   for (int j = 0; j < ndof; j++)
+   {
+      if (u_el[j] > EMPTY_ZONE_TOL)
+      {
+         sum += us_el[j] / u_el[j];
+         n++;
+      }
+   }
+   const double s_avg = sum / n;
+
+   for (int j = 0; j < ndof; j++)
+   {
+      if (u_el[j] <= 0.0)
+      {
+         s_el[j] = s_avg;
+      }
+      else
+      {
+         const double s_j = us_el[j] / u_el[j];
+         if (u_el[j] > EMPTY_ZONE_TOL) { s_el[j] = s_j; }
+         else
+         {
+            // Continuous transition between s_avg and s for u in [0, tol].
+            s_el[j] = u_el[j] * (s_j - s_avg) / EMPTY_ZONE_TOL + s_avg;
+         }
+
+         // NOTE: the above transition alters slightly the values of
+         // s = us / u, near u = EMPTY_ZONE_TOL. This might break the theorem
+         // stating that s_min <= us_LO / u_LO <= s_max, as s_min and s_max
+         // are different, due to s not being exactly us / u.
+      }
+   }
+}
+
+// If elems isn't NULL, bool_el and bool_dof must already hold the indicators
+// of u, and s is only computed in the elements elems.
 void ComputeRatio(int NE, const Vector &u_s, const Vector &u, Vector &s,
-                  Array<bool> &bool_el, Array<bool> &bool_dof);
+                  Array<bool> &bool_el, Array<bool> &bool_dof,
+                  const Array<int> *elems = NULL);
 
+// If elems isn't NULL, only the elements elems are visited.
 void ZeroOutEmptyDofs(const Array<bool> &ind_elem,
-                      const Array<bool> &ind_dofs, Vector &u);
+                      const Array<bool> &ind_dofs, Vector &u,
+                      const Array<int> *elems = NULL);
 
 // Set of functions that are used for debug calls.
 void ComputeMinMaxS(int NE, const Vector &u_s, const Vector &u, int myid);
@@ -15,6 +15,7 @@
 // testbed platforms, in support of the nation's exascale computing imperative.
 
 #include "remhos_tools.hpp"
+#include "remhos_perf.hpp"
 
 using namespace std;
 
@@ -29,38 +30,13 @@ SmoothnessIndicator::SmoothnessIndicator(int type_id,
    : type(type_id), param(type == 1 ? 5.0 : 3.0),
      fec_sub(1, pfes_DG_.GetMesh()->Dimension(), BasisType::Positive),
      pfes_CG_sub(&subcell_mesh, &fec_sub),
-     pfes_DG(pfes_DG_)
+     pfes_DG(pfes_DG_), MassMixed(NULL), MassInt(new MassIntegrator)
 {
    // TODO assemble SI matrices every RK stage for remap.
 
    MFEM_VERIFY(type_id == 1 || type_id == 2, "Bad smoothness indicator id!");
 
-   BilinearForm massH1(&pfes_CG_sub);
-   massH1.AddDomainIntegrator(new MassIntegrator);
-   massH1.Assemble();
-   massH1.Finalize();
-   Mmat = massH1.SpMat();
-
-   ConstantCoefficient neg_one(-1.0);
-   BilinearForm lap(&pfes_CG_sub);
-   lap.AddDomainIntegrator(new DiffusionIntegrator(neg_one));
-   lap.AddBdrFaceIntegrator(new DGDiffusionIntegrator(neg_one, 0., 0.));
-   lap.Assemble();
-   lap.Finalize();
-   LaplaceOp = lap.SpMat();
-
-   MassMixed = new SparseMatrix(pfes_CG_sub.GetVSize(), pfes_DG.GetVSize());
-   MassInt = new MassIntegrator;
-
-   BilinearForm mlH1(&pfes_CG_sub);
-   mlH1.AddDomainIntegrator(new LumpedIntegrator(new MassIntegrator));
-   mlH1.Assemble();
-   mlH1.Finalize();
-   mlH1.SpMat().GetDiag(lumpedMH1);
-
-   Vector lumped_hv(pfes_CG_sub.GetTrueVSize());
-   pfes_CG_sub.Dof_TrueDof_Matrix()->MultTranspose(lumpedMH1, lumped_hv);
-   pfes_CG_sub.GetProlongationMatrix()->Mult(lumped_hv, lumpedMH1);
+   AssembleMatrices();
 
    // Stores the index for the dof of H1-conforming for each node.
    // If the node is on the boundary, the entry is -1.
@@ -100,7 +76,8 @@ SmoothnessIndicator::SmoothnessIndicator(int type_id,
       {
          for (j = 0; j < dof_info.numFaceDofs; j++)
          {
-            if (dof_info.NbrDof(e,i,j) < 0)
+            const int id = (e*dof_info.numBdrs + i)*dof_info.numFaceDofs + j;
+            if (dof_info.face_src[id] == DofInfo::INFLOW)
             {
                DG2CG(e*nd+dof_info.BdrDofs(j,i)) = -1;
             }
@@ -147,6 +124,39 @@ SmoothnessIndicator::~SmoothnessIndicator()
    delete MassMixed;
 }
 
+void SmoothnessIndicator::UpdateGeometry(DofInfo &dof_info)
+{
+   AssembleMatrices();
+   ComputeVariationalMatrix(dof_info);
+}
+
+void SmoothnessIndicator::AssembleMatrices()
+{
+   BilinearForm massH1(&pfes_CG_sub);
+   massH1.AddDomainIntegrator(new MassIntegrator);
+   massH1.Assemble();
+   massH1.Finalize();
+   Mmat = massH1.SpMat();
+
+   ConstantCoefficient neg_one(-1.0);
+   BilinearForm lap(&pfes_CG_sub);
+   lap.AddDomainIntegrator(new DiffusionIntegrator(neg_one));
+   lap.AddBdrFaceIntegrator(new DGDiffusionIntegrator(neg_one, 0., 0.));
+   lap.Assemble();
+   lap.Finalize();
+   LaplaceOp = lap.SpMat();
+
+   BilinearForm mlH1(&pfes_CG_sub);
+   mlH1.AddDomainIntegrator(new LumpedIntegrator(new MassIntegrator));
+   mlH1.Assemble();
+   mlH1.Finalize();
+   mlH1.SpMat().GetDiag(lumpedMH1);
+
+   Vector lumped_hv(pfes_CG_sub.GetTrueVSize());
+   pfes_CG_sub.Dof_TrueDof_Matrix()->MultTranspose(lumpedMH1, lumped_hv);
+   pfes_CG_sub.GetProlongationMatrix()->Mult(lumped_hv, lumpedMH1);
+}
+
 void SmoothnessIndicator::ComputeSmoothnessIndicator(const Vector &u,
                                                      ParGridFunction &si_vals_u)
 {
@@ -202,6 +212,8 @@ void SmoothnessIndicator::ComputeVariationalMatrix(DofInfo &dof_info)
    Array <int> te_vdofs, tr_vdofs;
 
    tr_vdofs.SetSize(dof_info.numDofsSubcell);
+   delete MassMixed;
+   MassMixed = new SparseMatrix(pfes_CG_sub.GetVSize(), pfes_DG.GetVSize());
 
    for (k = 0; k < ne; k++)
    {
@@ -353,8 +365,10 @@ void SmoothnessIndicator::ComputeFromSparsity(const SparseMatrix &K,
 DofInfo::DofInfo(ParFiniteElementSpace &pfes_sltn)
    : pmesh(pfes_sltn.GetParMesh()), pfes(pfes_sltn),
      fec_bounds(pfes.GetOrder(0), pmesh->Dimension(), BasisType::GaussLobatto),
-     pfes_bounds(pmesh, &fec_bounds),
-     x_min(&pfes_bounds), x_max(&pfes_bounds)
+     pfes_bounds(pmesh, &fec_bounds, 2, Ordering::byNODES),
+     x_bounds(pfes_bounds.GetVSize()), pfes_bounds_nf(NULL),
+     fec_el(0, pmesh->Dimension()), pfes_el(NULL), el_bounds(NULL),
+     el_mark(0)
 {
    int n = pfes.GetVSize();
    int ne = pmesh->GetNE();
@@ -364,59 +378,187 @@ DofInfo::DofInfo(ParFiniteElementSpace &pfes_sltn)
    xe_min.SetSize(ne);
    xe_max.SetSize(ne);
 
-   ExtractBdrDofs(pfes.GetOrder(0),
-                  pfes.GetFE(0)->GetGeomType(), BdrDofs);
-   numFaceDofs = BdrDofs.Height();
-   numBdrs = BdrDofs.Width();
+   numBdrs = ExtractBdrDofs(pfes.GetOrder(0), pfes.GetFE(0)->GetGeomType(),
+                            bdr_dofs, numFaceDofs);
 
-   FillNeighborDofs();    // Fill NbrDof.
-   FillSubcell2CellDof(); // Fill Sub2Ind.
+   FillNeighborDofs();    // Fill face_nbr with the neighbor dofs.
+   if (pmesh->Nonconforming()) { FillNonconformingNeighborDofs(); }
+   FillSubcell2CellDof(); // Fill sub2ind.
+   FillCGDofTables();     // Fill el_dof_cg, cg_el_I, cg_el_J.
+   FillFaceDofTables();   // Fill face_dof, face_nbr, face_src.
+   FillSharedElements();  // Fill face_shared_el, vert_shared_el.
 }
 
 void DofInfo::ComputeBounds(const Vector &el_min, const Vector &el_max,
                             Vector &dof_min, Vector &dof_max,
-                            Array<bool> *active_el)
+                            Array<bool> *active_el, int nfields,
+                            const Array<int> *elems)
 {
-   GroupCommunicator &gcomm = pfes_bounds.GroupComm();
-   Array<int> dofsCG;
-   const int NE = pfes.GetNE();
+   if (pmesh->Nonconforming())
+   {
+      ComputeFaceBounds(el_min, el_max, dof_min, dof_max, active_el, nfields,
+                        elems);
+      return;
+   }
 
-   // Form min/max at each CG dof, considering element overlaps.
-   x_min =   std::numeric_limits<double>::infinity();
-   x_max = - std::numeric_limits<double>::infinity();
-   for (int i = 0; i < NE; i++)
+   if (nfields > 1 && (pfes_bounds_nf == NULL ||
+                       pfes_bounds_nf->GetVDim() != 2 * nfields))
    {
-      // Inactive elements don't affect the bounds.
-      if (active_el && (*active_el)[i] == false) { continue; }
+      delete pfes_bounds_nf;
+      pfes_bounds_nf = new ParFiniteElementSpace(pmesh, &fec_bounds,
+                                                 2 * nfields,
+                                                 Ordering::byNODES);
+   }
+   ParFiniteElementSpace &pfes_b = (nfields > 1) ? *pfes_bounds_nf
+                                   : pfes_bounds;
+   GroupCommunicator &gcomm = pfes_b.GroupComm();
+   const int NE = pfes.GetNE(), ndofs = pfes.GetFE(0)->GetDof(),
+             ncg = pfes_bounds.GetNDofs(), nf = nfields;
+   const double inf = std::numeric_limits<double>::infinity();
+   x_bounds.SetSize(pfes_b.GetVSize());
+
+   // Form min/max at each CG dof, considering element overlaps. The min and
+   // the negated max of field f are the components 2f and 2f+1.
+   const int *I = cg_el_I.Read(), *J = cg_el_J.Read();
+   const bool *d_active_el = (active_el) ? active_el->Read() : NULL;
+   const double *d_el_min = el_min.Read(), *d_el_max = el_max.Read();
+   double *d_x = x_bounds.Write();
+   MFEM_FORALL(i, ncg,
+   {
+      for (int f = 0; f < nf; f++)
+      {
+         double x_min = inf, x_max_neg = inf;
+         for (int e = I[i]; e < I[i+1]; e++)
+         {
+            const int k = f*NE + J[e];
+            // Inactive elements don't affect the bounds.
+            if (d_active_el && d_active_el[k] == false) { continue; }
 
-      x_min.HostReadWrite();
-      x_max.HostReadWrite();
-      pfes_bounds.GetElementDofs(i, dofsCG);
-      for (int j = 0; j < dofsCG.Size(); j++)
+            x_min     = fmin(x_min, d_el_min[k]);
+            x_max_neg = fmin(x_max_neg, -d_el_max[k]);
+         }
+         d_x[2*f*ncg + i]       = x_min;
+         d_x[(2*f + 1)*ncg + i] = x_max_neg;
+      }
+   });
+
+   // One exchange for the min and the (negated) max values of all fields.
+   Array<double> vals(x_bounds.HostReadWrite(), x_bounds.Size());
+   gcomm.Reduce<double>(vals, GroupCommunicator::Min);
+   gcomm.Bcast(vals);
+
+   // Use the CG values to fill (dof_min, dof_max) for each DG dof. The
+   // fields after the first are filled in a second pass, which visits only
+   // the listed elements when elems is given.
+   const bool r = (elems != NULL);
+   const int *d_el_dof = el_dof_cg.Read(), *L = r ? elems->Read() : NULL;
+   const double *d_xb = x_bounds.Read();
+   double *d_dof_min = dof_min.Write(), *d_dof_max = dof_max.Write();
+   MFEM_FORALL(i, NE * ndofs,
+   {
+      const int dof_cg = d_el_dof[i];
+      d_dof_min[i] =   d_xb[dof_cg];
+      d_dof_max[i] = - d_xb[ncg + dof_cg];
+   });
+   if (nf == 1) { return; }
+
+   const int n = (r ? elems->Size() : NE) * ndofs;
+   MFEM_FORALL(t, n,
+   {
+      const int i = r ? L[t / ndofs]*ndofs + t % ndofs : t;
+      const int dof_cg = d_el_dof[i];
+      for (int f = 1; f < nf; f++)
       {
-         x_min(dofsCG[j]) = std::min(x_min(dofsCG[j]), el_min(i));
-         x_max(dofsCG[j]) = std::max(x_max(dofsCG[j]), el_max(i));
+         d_dof_min[f*NE*ndofs + i] =   d_xb[2*f*ncg + dof_cg];
+         d_dof_max[f*NE*ndofs + i] = - d_xb[(2*f + 1)*ncg + dof_cg];
+      }
+   });
+}
+
+void DofInfo::ComputeFaceBounds(const Vector &el_min, const Vector &el_max,
+                                Vector &dof_min, Vector &dof_max,
+                                Array<bool> *active_el, int nfields,
+                                const Array<int> *elems)
+{
+   const int NE = pfes.GetNE(), nd = pfes.GetFE(0)->GetDof(), nf = nfields,
+             nfd_el = numBdrs * numFaceDofs;
+   const double inf = std::numeric_limits<double>::infinity();
+   if (pfes_el == NULL || pfes_el->GetVDim() != 2 * nf)
+   {
+      delete el_bounds;
+      delete pfes_el;
+      pfes_el = new ParFiniteElementSpace(pmesh, &fec_el, 2 * nf,
+                                          Ordering::byNODES);
+      el_bounds = new ParGridFunction(pfes_el);
+
+      // The face-neighbor data is ordered by the sent elements, so the
+      // components are found through the face-neighbor vdofs.
+      pfes_el->ExchangeFaceNbrData();
+      const int n_nbr_el = pfes_el->GetParMesh()->GetNFaceNeighborElements();
+      Array<int> vdofs;
+      el_nbr_vdofs.SetSize(n_nbr_el * 2 * nf);
+      for (int e = 0; e < n_nbr_el; e++)
+      {
+         pfes_el->GetFaceNbrElementVDofs(e, vdofs);
+         for (int c = 0; c < 2 * nf; c++)
+         {
+            el_nbr_vdofs[e*2*nf + c] = vdofs[c];
+         }
       }
    }
-   Array<double> minvals(x_min.GetData(), x_min.Size()),
-                 maxvals(x_max.GetData(), x_max.Size());
-   gcomm.Reduce<double>(minvals, GroupCommunicator::Min);
-   gcomm.Bcast(minvals);
-   gcomm.Reduce<double>(maxvals, GroupCommunicator::Max);
-   gcomm.Bcast(maxvals);
 
-   // Use (x_min, x_max) to fill (dof_min, dof_max) for each DG dof.
-   const TensorBasisElement *fe_cg =
-      dynamic_cast<const TensorBasisElement *>(pfes_bounds.GetFE(0));
-   const Array<int> &dof_map = fe_cg->GetDofMap();
-   const int ndofs = dof_map.Size();
-   for (int i = 0; i < NE; i++)
+   // The min and max of field f over each element are the components 2f and
+   // 2f+1. Inactive elements don't affect the bounds.
+   const bool *h_active = (active_el) ? active_el->HostRead() : NULL;
+   const double *h_el_min = el_min.HostRead(), *h_el_max = el_max.HostRead();
+   double *h_b = el_bounds->HostWrite();
+   for (int f = 0; f < nf; f++)
    {
-      pfes_bounds.GetElementDofs(i, dofsCG);
-      for (int j = 0; j < dofsCG.Size(); j++)
+      for (int k = 0; k < NE; k++)
       {
-         dof_min(i*ndofs + j) = x_min(dofsCG[dof_map[j]]);
-         dof_max(i*ndofs + j) = x_max(dofsCG[dof_map[j]]);
+         const bool act = (h_active == NULL || h_active[f*NE + k]);
+         h_b[2*f*NE + k]       = act ? h_el_min[f*NE + k] : inf;
+         h_b[(2*f + 1)*NE + k] = act ? h_el_max[f*NE + k] : -inf;
+      }
+   }
+   el_bounds->ExchangeFaceNbrData();
+   const double *h_nbr = el_bounds->FaceNbrData().HostRead();
+   const int *h_nbr_vdofs = el_nbr_vdofs.HostRead();
+
+   const int *f_dof = face_dof.HostRead(), *f_nbr = face_nbr.HostRead(),
+             *f_src = face_src.HostRead(),
+             *h_list = (elems) ? elems->HostRead() : NULL;
+   double *h_dof_min = dof_min.HostWrite(), *h_dof_max = dof_max.HostWrite();
+   for (int f = 0; f < nf; f++)
+   {
+      const double *b_min = h_b + 2*f*NE, *b_max = h_b + (2*f + 1)*NE;
+      double *d_min = h_dof_min + f*NE*nd, *d_max = h_dof_max + f*NE*nd;
+      const bool r = (f > 0 && h_list);
+      const int n = r ? elems->Size() : NE;
+      for (int t = 0; t < n; t++)
+      {
+         const int k = r ? h_list[t] : t;
+         for (int i = 0; i < nd; i++)
+         {
+            d_min[k*nd + i] = b_min[k];
+            d_max[k*nd + i] = b_max[k];
+         }
+         for (int id = k*nfd_el; id < (k + 1)*nfd_el; id++)
+         {
+            if (f_src[id] == INFLOW) { continue; }
+
+            const int dof = f_dof[id], e = f_nbr[id] / nd;
+            double e_min, e_max;
+            if (f_src[id] == LOCAL) { e_min = b_min[e]; e_max = b_max[e]; }
+            else
+            {
+               const int *v = h_nbr_vdofs + e*2*nf + 2*f;
+               e_min = h_nbr[v[0]];
+               e_max = h_nbr[v[1]];
+            }
+            d_min[dof] = fmin(d_min[dof], e_min);
+            d_max[dof] = fmax(d_max[dof], e_max);
+         }
       }
    }
 }
@@ -424,28 +566,39 @@ void DofInfo::ComputeBounds(const Vector &el_min, const Vector &el_max,
 void DofInfo::ComputeElementsMinMax(const Vector &u,
                                     Vector &u_min, Vector &u_max,
                                     Array<bool> *active_el,
-                                    Array<bool> *active_dof) const
+                                    Array<bool> *active_dof,
+                                    const Array<int> *elems) const
 {
-   const int NE = pfes.GetNE(), ndof = pfes.GetFE(0)->GetDof();
-   int dof_id;
-   for (int k = 0; k < NE; k++)
+   const int ndof = pfes.GetFE(0)->GetDof();
+   const bool r = (elems != NULL);
+   const int n = r ? elems->Size() : pfes.GetNE();
+   const int *L = r ? elems->Read() : NULL;
+   const double inf = numeric_limits<double>::infinity();
+   const bool *d_active_el  = (active_el)  ? active_el->Read()  : NULL;
+   const bool *d_active_dof = (active_dof) ? active_dof->Read() : NULL;
+   const double *d_u = u.Read();
+   double *d_u_min = u_min.Write(), *d_u_max = u_max.Write();
+   MFEM_FORALL(e, n,
    {
-      u_min(k) = numeric_limits<double>::infinity();
-      u_max(k) = -numeric_limits<double>::infinity();
+      const int k = r ? L[e] : e;
+      double el_min = inf, el_max = -inf;
 
       // Inactive elements don't affect the bounds.
-      if (active_el && (*active_el)[k] == false) { continue; }
-
-      for (int i = 0; i < ndof; i++)
+      if (d_active_el == NULL || d_active_el[k])
       {
-         dof_id = k*ndof + i;
-         // Inactive dofs don't affect the bounds.
-         if (active_dof && (*active_dof)[dof_id] == false) { continue; }
+         for (int i = 0; i < ndof; i++)
+         {
+            const int dof_id = k*ndof + i;
+            // Inactive dofs don't affect the bounds.
+            if (d_active_dof && d_active_dof[dof_id] == false) { continue; }
 
-         u_min(k) = min(u_min(k), u(dof_id));
-         u_max(k) = max(u_max(k), u(dof_id));
+            el_min = fmin(el_min, d_u[dof_id]);
+            el_max = fmax(el_max, d_u[dof_id]);
+         }
       }
-   }
+      d_u_min[k] = el_min;
+      d_u_max[k] = el_max;
+   });
 }
 
 void DofInfo::FillNeighborDofs()
@@ -460,7 +613,10 @@ void DofInfo::FillNeighborDofs()
    pmesh->ExchangeFaceNbrData();
    Table *face_to_el = pmesh->GetFaceToAllElementTable();
 
-   NbrDof.SetSize(ne, numBdrs, numFaceDofs);
+   // The neighbor dof of face dof j of face f of element k goes to
+   // face_nbr[(k*numBdrs + f)*numFaceDofs + j].
+   face_nbr.SetSize(ne * numBdrs * numFaceDofs);
+   int *nbr_dof = face_nbr.HostWrite();
 
    // Permutations of BdrDofs, taking into account all possible orientations.
    // Assumes BdrDofs are ordered in xyz order, which is true for 3D hexes,
@@ -493,11 +649,12 @@ void DofInfo::FillNeighborDofs()
 
          for (i = 0; i < numBdrs; i++)
          {
+            int *nbr = nbr_dof + (k*numBdrs + i)*numFaceDofs;
             const int nbr_cnt = face_to_el->RowSize(bdrs[i]);
             if (nbr_cnt == 1)
             {
                // No neighbor element.
-               NbrDof(k, i, 0) = -1;
+               nbr[0] = -1;
                continue;
             }
 
@@ -510,7 +667,7 @@ void DofInfo::FillNeighborDofs()
             }
             nbr_id = (el1_id == k) ? el2_id : el1_id;
 
-            NbrDof(k,i,0) = nbr_id*nd + BdrDofs(0, (i+1) % 2);
+            nbr[0] = nbr_id*nd + BdrDofs(0, (i+1) % 2);
          }
       }
       else if (dim==2)
@@ -519,11 +676,12 @@ void DofInfo::FillNeighborDofs()
 
          for (i = 0; i < numBdrs; i++)
          {
+            int *nbr = nbr_dof + (k*numBdrs + i)*numFaceDofs;
             const int nbr_cnt = face_to_el->RowSize(bdrs[i]);
             if (nbr_cnt == 1)
             {
                // No neighbor element.
-               for (j = 0; j < numFaceDofs; j++) { NbrDof(k, i, j) = -1; }
+               for (j = 0; j < numFaceDofs; j++) { nbr[j] = -1; }
                continue;
             }
 
@@ -544,8 +702,7 @@ void DofInfo::FillNeighborDofs()
             {
                // Here it is utilized that the orientations of the face for
                // the two elements are opposite of each other.
-               NbrDof(k,i,j) = nbr_id*nd + BdrDofs(numFaceDofs - 1 - j,
-                                                   face_id_nbr);
+               nbr[j] = nbr_id*nd + BdrDofs(numFaceDofs - 1 - j, face_id_nbr);
             }
          }
       }
@@ -555,11 +712,12 @@ void DofInfo::FillNeighborDofs()
 
          for (int f = 0; f < numBdrs; f++)
          {
+            int *nbr = nbr_dof + (k*numBdrs + f)*numFaceDofs;
             const int nbr_cnt = face_to_el->RowSize(bdrs[f]);
             if (nbr_cnt == 1)
             {
                // No neighbor element.
-               for (j = 0; j < numFaceDofs; j++) { NbrDof(k, f, j) = -1; }
+               for (j = 0; j < numFaceDofs; j++) { nbr[j] = -1; }
                continue;
             }
 
@@ -592,13 +750,297 @@ void DofInfo::FillNeighborDofs()
                const int nbr_dof_id =
                   fdof_ids(face_or_nbr)(loc_face_dof_id, face_id_nbr);
 
-               NbrDof(k, f, j) = nbr_id*nd + nbr_dof_id;
+               nbr[j] = nbr_id*nd + nbr_dof_id;
             }
          }
       }
    }
 }
 
+// Measure of the face in the reference coordinates of the element of loc. It
+// is 1 for a full face and smaller for a part of a coarse face.
+static double LocalFaceMeasure(IntegrationPointTransformation &loc,
+                               const IntegrationPoint &center)
+{
+   loc.Transf.SetIntPoint(&center);
+   return loc.Transf.Jacobian().Weight();
+}
+
+// Face coordinates xi of the point ip of the element of loc, which must lie on
+// the face. The maps from the faces to the elements are affine.
+static void LocalFaceCoordinates(IntegrationPointTransformation &loc,
+                                 int dim, const IntegrationPoint &ip,
+                                 IntegrationPoint &xi)
+{
+   IntegrationPoint origin, ip0;
+   origin.Set3(0.0, 0.0, 0.0);
+   loc.Transform(origin, ip0);
+   loc.Transf.SetIntPoint(&origin);
+   const DenseMatrix &J = loc.Transf.Jacobian();
+
+   double x[3], x0[3];
+   ip.Get(x, dim);
+   ip0.Get(x0, dim);
+   Vector diff(dim), rhs(dim - 1), c(dim - 1);
+   for (int d = 0; d < dim; d++) { diff(d) = x[d] - x0[d]; }
+   J.MultTranspose(diff, rhs);
+   DenseMatrix JtJ(dim - 1);
+   MultAtB(J, J, JtJ);
+   JtJ.Invert();
+   JtJ.Mult(rhs, c);
+   xi.Set(c.GetData(), dim - 1);
+}
+
+static bool InsideFace(const IntegrationPoint &xi, int fdim)
+{
+   const double tol = 1e-12;
+   double c[2];
+   xi.Get(c, fdim);
+   for (int d = 0; d < fdim; d++)
+   {
+      if (c[d] < -tol || c[d] > 1.0 + tol) { return false; }
+   }
+   return true;
+}
+
+// Local face of an element of the given geometry that contains ip.
+static int LocalFaceOf(Geometry::Type geom, const IntegrationPoint &ip)
+{
+   const int dim = Geometry::Dimension[geom];
+   const IntegrationRule *verts = Geometries.GetVertices(geom);
+   const int nfaces = (dim == 2) ? 4 : 6, nfv = (dim == 2) ? 2 : 4;
+   double x[3], v[3];
+   ip.Get(x, dim);
+   for (int f = 0; f < nfaces; f++)
+   {
+      const int *fv = (dim == 2) ?
+                      Geometry::Constants<Geometry::SQUARE>::Edges[f] :
+                      Geometry::Constants<Geometry::CUBE>::FaceVert[f];
+      // The face is the plane where all its vertices have the same coordinate.
+      for (int d = 0; d < dim; d++)
+      {
+         verts->IntPoint(fv[0]).Get(v, dim);
+         const double c = v[d];
+         bool on_face = fabs(x[d] - c) < 1e-12;
+         for (int i = 1; i < nfv && on_face; i++)
+         {
+            verts->IntPoint(fv[i]).Get(v, dim);
+            on_face = (v[d] == c);
+         }
+         if (on_face) { return f; }
+      }
+   }
+   MFEM_ABORT("The point is not on a face of the element.");
+   return -1;
+}
+
+// The dof of local face lf whose node is the closest to ip.
+static int NearestFaceDof(const IntegrationRule &nodes,
+                          const Array<int> &bdr_dofs, int nfd, int lf,
+                          int dim, const IntegrationPoint &ip)
+{
+   double x[3], y[3];
+   ip.Get(x, dim);
+   int best = bdr_dofs[lf*nfd];
+   double best_dist = numeric_limits<double>::infinity();
+   for (int j = 0; j < nfd; j++)
+   {
+      const int dof = bdr_dofs[j + lf*nfd];
+      nodes.IntPoint(dof).Get(y, dim);
+      double dist = 0.0;
+      for (int d = 0; d < dim; d++) { dist += (x[d]-y[d]) * (x[d]-y[d]); }
+      if (dist < best_dist) { best_dist = dist; best = dof; }
+   }
+   return best;
+}
+
+void DofInfo::FillNonconformingNeighborDofs()
+{
+   const FiniteElement &fe = *pfes.GetFE(0);
+   const IntegrationRule &nodes = fe.GetNodes();
+   const Geometry::Type geom = fe.GetGeomType();
+   const int dim = pmesh->Dimension(), ne = pmesh->GetNE(),
+             nd = fe.GetDof();
+   const IntegrationPoint &center =
+      Geometries.GetCenter((dim == 2) ? Geometry::SEGMENT : Geometry::SQUARE);
+   int *nbr_dof = face_nbr.HostReadWrite();
+
+   // A coarse dof at the corner of several fine faces is paired once.
+   Array<bool> coarse_done(face_nbr.Size());
+   coarse_done = false;
+
+   // Local faces with two elements, followed by the shared faces, where the
+   // second element is a face neighbor with index ne + its face-nbr index.
+   pmesh->ExchangeFaceNbrData();
+   const int nfaces = pmesh->GetNumFaces(), nsf = pmesh->GetNSharedFaces();
+   IntegrationPoint ip_f, ip_c, xi, ip;
+   for (int i = 0; i < nfaces + nsf; i++)
+   {
+      FaceElementTransformations *T;
+      if (i < nfaces)
+      {
+         int e1, e2;
+         pmesh->GetFaceElements(i, &e1, &e2);
+         if (e2 < 0) { continue; }
+         T = pmesh->GetFaceElementTransformations(i);
+      }
+      else { T = pmesh->GetSharedFaceTransformations(i - nfaces); }
+
+      const double w1 = LocalFaceMeasure(T->Loc1, center),
+                   w2 = LocalFaceMeasure(T->Loc2, center);
+      if (fabs(w1 - w2) < 1e-12) { continue; }
+
+      // The whole face of the fine element is a part of the coarse face.
+      const bool fine1 = (w1 > w2);
+      IntegrationPointTransformation &loc_f = fine1 ? T->Loc1 : T->Loc2,
+                                      &loc_c = fine1 ? T->Loc2 : T->Loc1;
+      const int el_f = fine1 ? T->Elem1No : T->Elem2No,
+                el_c = fine1 ? T->Elem2No : T->Elem1No;
+      loc_f.Transform(center, ip_f);
+      loc_c.Transform(center, ip_c);
+      const int lf_f = LocalFaceOf(geom, ip_f), lf_c = LocalFaceOf(geom, ip_c);
+
+      if (el_f < ne)
+      {
+         int *nbr = nbr_dof + (el_f*numBdrs + lf_f)*numFaceDofs;
+         for (int j = 0; j < numFaceDofs; j++)
+         {
+            LocalFaceCoordinates(loc_f, dim,
+                                 nodes.IntPoint(BdrDofs(j, lf_f)), xi);
+            loc_c.Transform(xi, ip);
+            nbr[j] = el_c*nd + NearestFaceDof(nodes, bdr_dofs, numFaceDofs,
+                                              lf_c, dim, ip);
+         }
+      }
+      if (el_c < ne)
+      {
+         const int id0 = (el_c*numBdrs + lf_c)*numFaceDofs;
+         for (int j = 0; j < numFaceDofs; j++)
+         {
+            if (coarse_done[id0 + j]) { continue; }
+
+            // Only the coarse dofs on this fine face.
+            LocalFaceCoordinates(loc_c, dim,
+                                 nodes.IntPoint(BdrDofs(j, lf_c)), xi);
+            if (InsideFace(xi, dim - 1) == false) { continue; }
+
+            loc_f.Transform(xi, ip);
+            nbr_dof[id0 + j] = el_f*nd +
+                               NearestFaceDof(nodes, bdr_dofs, numFaceDofs,
+                                              lf_f, dim, ip);
+            coarse_done[id0 + j] = true;
+         }
+      }
+   }
+}
+
+void DofInfo::GetActiveElementList(const Array<bool> &active_el,
+                                   Array<int> &list) const
+{
+   const int ne = pmesh->GetNE(), nd = pfes.GetFE(0)->GetDof();
+   const int *f_nbr = face_nbr.HostRead(), *f_src = face_src.HostRead();
+   const bool *act = active_el.HostRead();
+   list.HostReadWrite();
+   list.SetSize(0);
+   el_mark++;
+   for (int i = 0; i < face_shared_el.Size(); i++)
+   {
+      AddToList(face_shared_el[i], list);
+   }
+   for (int k = 0; k < ne; k++)
+   {
+      if (act[k] == false) { continue; }
+
+      AddToList(k, list);
+      for (int f = 0; f < numBdrs; f++)
+      {
+         const int id = (k*numBdrs + f)*numFaceDofs;
+         if (f_src[id] == LOCAL) { AddToList(f_nbr[id] / nd, list); }
+      }
+   }
+   list.Sort();
+}
+
+void DofInfo::GetBoundsElementList(const Array<bool> &active_el,
+                                   const Array<int> &elems,
+                                   Array<int> &list) const
+{
+   const int ne = pmesh->GetNE(), nd = pfes.GetFE(0)->GetDof();
+   list.HostReadWrite();
+   if (pmesh->Nonconforming())
+   {
+      list.SetSize(ne);
+      for (int k = 0; k < ne; k++) { list[k] = k; }
+      return;
+   }
+
+   const int *I = cg_el_I.HostRead(), *J = cg_el_J.HostRead(),
+              *el_dof = el_dof_cg.HostRead(), *L = elems.HostRead();
+   const bool *act = active_el.HostRead();
+   list.SetSize(0);
+   el_mark++;
+   for (int i = 0; i < vert_shared_el.Size(); i++)
+   {
+      AddToList(vert_shared_el[i], list);
+   }
+   for (int e = 0; e < elems.Size(); e++)
+   {
+      const int k = L[e];
+      if (act[k] == false) { continue; }
+
+      for (int i = k*nd; i < (k + 1)*nd; i++)
+      {
+         const int dof_cg = el_dof[i];
+         for (int q = I[dof_cg]; q < I[dof_cg + 1]; q++)
+         {
+            AddToList(J[q], list);
+         }
+      }
+   }
+   list.Sort();
+}
+
+void DofInfo::FillSharedElements()
+{
+   const int ne = pmesh->GetNE();
+   el_stamp.SetSize(ne);
+   el_stamp = 0;
+
+   for (int k = 0; k < ne; k++)
+   {
+      for (int f = 0; f < numBdrs; f++)
+      {
+         if (face_src[(k*numBdrs + f)*numFaceDofs] == FACE_NBR)
+         {
+            face_shared_el.Append(k);
+            break;
+         }
+      }
+   }
+
+   // The CG bounds dofs shared with other tasks are on shared vertices, or on
+   // shared edges and faces, whose vertices are shared as well.
+   if (pmesh->Nonconforming()) { return; }
+   Array<bool> shared_vert(pmesh->GetNV());
+   shared_vert = false;
+   for (int g = 1; g < pmesh->GetNGroups(); g++)
+   {
+      for (int i = 0; i < pmesh->GroupNVertices(g); i++)
+      {
+         shared_vert[pmesh->GroupVertex(g, i)] = true;
+      }
+   }
+   Array<int> verts;
+   for (int k = 0; k < ne; k++)
+   {
+      pmesh->GetElementVertices(k, verts);
+      for (int i = 0; i < verts.Size(); i++)
+      {
+         if (shared_vert[verts[i]]) { vert_shared_el.Append(k); break; }
+      }
+   }
+}
+
 void DofInfo::FillSubcell2CellDof()
 {
    const int dim = pmesh->Dimension(), p = pfes.GetFE(0)->GetOrder();
@@ -619,23 +1061,25 @@ void DofInfo::FillSubcell2CellDof()
       numDofsSubcell = 8;
    }
 
-   Sub2Ind.SetSize(numSubcells, numDofsSubcell);
+   sub2ind.SetSize(numSubcells * numDofsSubcell);
+   int *s2i = sub2ind.HostWrite();
 
    int aux;
    for (int m = 0; m < numSubcells; m++)
    {
       for (int j = 0; j < numDofsSubcell; j++)
       {
-         if (dim == 1) { Sub2Ind(m,j) = m + j; }
+         int &ind = s2i[m + j*numSubcells];
+         if (dim == 1) { ind = m + j; }
          else if (dim == 2)
          {
             aux = m + m/p;
             switch (j)
             {
-               case 0: Sub2Ind(m,j) =  aux; break;
-               case 1: Sub2Ind(m,j) =  aux + 1; break;
-               case 2: Sub2Ind(m,j) =  aux + p+1; break;
-               case 3: Sub2Ind(m,j) =  aux + p+2; break;
+               case 0: ind = aux; break;
+               case 1: ind = aux + 1; break;
+               case 2: ind = aux + p+1; break;
+               case 3: ind = aux + p+2; break;
             }
          }
          else if (dim == 3)
@@ -643,27 +1087,395 @@ void DofInfo::FillSubcell2CellDof()
             aux = m + m/p + (p+1)*(m/(p*p));
             switch (j)
             {
-               case 0: Sub2Ind(m,j) = aux; break;
-               case 1: Sub2Ind(m,j) = aux + 1; break;
-               case 2: Sub2Ind(m,j) = aux + p+1; break;
-               case 3: Sub2Ind(m,j) = aux + p+2; break;
-               case 4: Sub2Ind(m,j) = aux + (p+1)*(p+1); break;
-               case 5: Sub2Ind(m,j) = aux + (p+1)*(p+1)+1; break;
-               case 6: Sub2Ind(m,j) = aux + (p+1)*(p+1)+p+1; break;
-               case 7: Sub2Ind(m,j) = aux + (p+1)*(p+1)+p+2; break;
+               case 0: ind = aux; break;
+               case 1: ind = aux + 1; break;
+               case 2: ind = aux + p+1; break;
+               case 3: ind = aux + p+2; break;
+               case 4: ind = aux + (p+1)*(p+1); break;
+               case 5: ind = aux + (p+1)*(p+1)+1; break;
+               case 6: ind = aux + (p+1)*(p+1)+p+1; break;
+               case 7: ind = aux + (p+1)*(p+1)+p+2; break;
+            }
+         }
+      }
+   }
+}
+
+void DofInfo::FillCGDofTables()
+{
+   const int NE = pfes.GetNE();
+   const TensorBasisElement *fe_cg =
+      dynamic_cast<const TensorBasisElement *>(pfes_bounds.GetFE(0));
+   const Array<int> &dof_map = fe_cg->GetDofMap();
+   const int ndofs = dof_map.Size();
+
+   // The dof_map is applied here, so the table follows the DG ordering.
+   Array<int> dofsCG;
+   Table el_to_cg(NE, ndofs);
+   el_dof_cg.SetSize(NE * ndofs);
+   for (int i = 0; i < NE; i++)
+   {
+      pfes_bounds.GetElementDofs(i, dofsCG);
+      for (int j = 0; j < ndofs; j++)
+      {
+         el_dof_cg[i*ndofs + j] = dofsCG[dof_map[j]];
+         el_to_cg.GetRow(i)[j]  = dofsCG[dof_map[j]];
+      }
+   }
+
+   Table cg_to_el;
+   Transpose(el_to_cg, cg_to_el, pfes_bounds.GetNDofs());
+   cg_el_I.SetSize(cg_to_el.Size() + 1);
+   cg_el_J.SetSize(cg_to_el.Size_of_connections());
+   const int *I = cg_to_el.GetI(), *J = cg_to_el.GetJ();
+   for (int i = 0; i < cg_el_I.Size(); i++) { cg_el_I[i] = I[i]; }
+   for (int i = 0; i < cg_el_J.Size(); i++) { cg_el_J[i] = J[i]; }
+}
+
+void DofInfo::FillFaceDofTables()
+{
+   const int ne = pmesh->GetNE(), nd = pfes.GetFE(0)->GetDof(),
+             size = pfes.GetVSize();
+   const int n = ne * numBdrs * numFaceDofs;
+   MFEM_VERIFY(face_nbr.Size() == n, "The neighbor dofs are not filled.");
+   face_dof.SetSize(n);
+   face_src.SetSize(n);
+   face_nbr.HostReadWrite();
+   for (int k = 0; k < ne; k++)
+   {
+      for (int f = 0; f < numBdrs; f++)
+      {
+         for (int i = 0; i < numFaceDofs; i++)
+         {
+            const int id = (k*numBdrs + f)*numFaceDofs + i;
+            const int dof = k*nd + BdrDofs(i, f);
+            const int nbr = face_nbr[id];
+            face_dof[id] = dof;
+            if (nbr < 0)
+            {
+               face_nbr[id] = dof;
+               face_src[id] = INFLOW;
+            }
+            else if (nbr < size)
+            {
+               face_nbr[id] = nbr;
+               face_src[id] = LOCAL;
+            }
+            else
+            {
+               face_nbr[id] = nbr - size;
+               face_src[id] = FACE_NBR;
             }
          }
       }
    }
 }
 
+void ComputeFaceJumps(ParGridFunction &u, const DofInfo &dofs, Vector &jumps)
+{
+   const int ne = u.ParFESpace()->GetNE(),
+             nfd_el = dofs.numBdrs * dofs.numFaceDofs;
+   u.ExchangeFaceNbrData();
+   const double *h_u = u.HostRead(), *h_nbr = u.FaceNbrData().HostRead();
+   const int *f_dof = dofs.face_dof.HostRead(),
+             *f_nbr = dofs.face_nbr.HostRead(),
+             *f_src = dofs.face_src.HostRead();
+   jumps.SetSize(ne);
+   for (int k = 0; k < ne; k++)
+   {
+      double jump = 0.0;
+      for (int id = k*nfd_el; id < (k + 1)*nfd_el; id++)
+      {
+         if (f_src[id] == DofInfo::INFLOW) { continue; }
+
+         const double u_nbr = (f_src[id] == DofInfo::LOCAL) ? h_u[f_nbr[id]]
+                              : h_nbr[f_nbr[id]];
+         jump = fmax(jump, fabs(u_nbr - h_u[f_dof[id]]));
+      }
+      jumps(k) = jump;
+   }
+}
+
+// Face jumps of the projection of u on the current mesh.
+static void ProjectedFaceJumps(ParMesh &pmesh, FiniteElementCollection &fec,
+                               Coefficient &u, Vector &jumps)
+{
+   ParFiniteElementSpace pfes(&pmesh, &fec);
+   ParGridFunction u_gf(&pfes);
+   u_gf.ProjectCoefficient(u);
+   DofInfo dofs(pfes);
+   ComputeFaceJumps(u_gf, dofs, jumps);
+}
+
+void AdaptMeshToFaceJumps(ParMesh &pmesh, Coefficient &u, int order,
+                          int btype, int cycles,
+                          double ref_tol, double deref_tol)
+{
+   MFEM_VERIFY(pmesh.Nonconforming(), "The mesh must be nonconforming.");
+   DG_FECollection fec(order, pmesh.Dimension(), btype);
+   Vector jumps;
+   for (int c = 0; c < cycles; c++)
+   {
+      ProjectedFaceJumps(pmesh, fec, u, jumps);
+      const bool refined = pmesh.RefineByError(jumps, ref_tol, 1, 1);
+
+      ProjectedFaceJumps(pmesh, fec, u, jumps);
+      // The children are merged when the max of their jumps is small.
+      const bool derefined = pmesh.DerefineByError(jumps, deref_tol, 1, 2);
+
+      if (refined == false && derefined == false) { break; }
+      pmesh.Rebalance();
+   }
+}
+
+void UpdateFESpaces(Array<FiniteElementSpace *> &fes,
+                    Array<GridFunction *> &gf)
+{
+   for (int i = 0; i < fes.Size(); i++) { fes[i]->Update(); }
+   for (int i = 0; i < gf.Size(); i++) { gf[i]->Update(); }
+}
+
+bool AdaptMeshToSolution(ParMesh &pmesh, ParGridFunction &u,
+                         Array<FiniteElementSpace *> &fes,
+                         Array<GridFunction *> &gf,
+                         double ref_tol, double deref_tol)
+{
+   MFEM_VERIFY(pmesh.Nonconforming(), "The mesh must be nonconforming.");
+   Vector jumps;
+   {
+      DofInfo dofs(*u.ParFESpace());
+      ComputeFaceJumps(u, dofs, jumps);
+   }
+   const bool refined = pmesh.RefineByError(jumps, ref_tol, 1, 1);
+   if (refined) { UpdateFESpaces(fes, gf); }
+
+   {
+      DofInfo dofs(*u.ParFESpace());
+      ComputeFaceJumps(u, dofs, jumps);
+   }
+   // The children are merged when the max of their jumps is small.
+   const bool derefined = pmesh.DerefineByError(jumps, deref_tol, 1, 2);
+   if (derefined) { UpdateFESpaces(fes, gf); }
+
+   if (refined == false && derefined == false) { return false; }
+   pmesh.Rebalance();
+   UpdateFESpaces(fes, gf);
+   return true;
+}
+
+int Workspace::num_allocs = 0;
+
+Workspace::~Workspace()
+{
+   for (int i = 0; i < vectors.Size(); i++) { delete vectors[i]; }
+}
+
+int Workspace::Acquire(int size)
+{
+   // The smallest free vector that is large enough.
+   int id = -1;
+   for (int i = 0; i < vectors.Size(); i++)
+   {
+      if (in_use[i] || vectors[i]->Size() < size) { continue; }
+      if (id < 0 || vectors[i]->Size() < vectors[id]->Size()) { id = i; }
+   }
+
+   // Otherwise grow a free vector, or add a new one.
+   if (id < 0)
+   {
+      for (int i = 0; i < vectors.Size(); i++)
+      {
+         if (in_use[i] == false) { id = i; break; }
+      }
+      if (id < 0)
+      {
+         id = vectors.Append(new Vector) - 1;
+         in_use.Append(false);
+      }
+      vectors[id]->SetSize(size);
+      vectors[id]->UseDevice(true);
+      num_allocs++;
+   }
+
+   in_use[id] = true;
+   return id;
+}
+
+HaloExchange::HaloExchange(ParFiniteElementSpace &space, const DofInfo &dofs)
+   : pfes(space), src(NULL), num_fields(0), layout(FieldLayout::SoA),
+     in_flight(false),
+     num_int_elems(0)
+{
+   pfes.ExchangeFaceNbrData();
+   send_buf.SetSize(pfes.send_face_nbr_ldof.Size_of_connections());
+   face_nbr_data.SetSize(pfes.GetFaceNbrVSize());
+   const int num_face_nbrs = pfes.GetParMesh()->GetNFaceNeighbors();
+   requests.SetSize(2 * num_face_nbrs);
+
+   const int *send_offset = pfes.send_face_nbr_ldof.GetI(),
+              *recv_offset = pfes.face_nbr_ldof.GetI();
+   send_nbr.SetSize(send_buf.Size());
+   recv_nbr.SetSize(face_nbr_data.Size());
+   for (int fn = 0; fn < num_face_nbrs; fn++)
+   {
+      for (int i = send_offset[fn]; i < send_offset[fn+1]; i++)
+      {
+         send_nbr[i] = fn;
+      }
+      for (int i = recv_offset[fn]; i < recv_offset[fn+1]; i++)
+      {
+         recv_nbr[i] = fn;
+      }
+   }
+
+   // An element is shared when one of its face neighbors is not local.
+   const int ne = pfes.GetNE(), size = pfes.GetVSize();
+   Array<int> shared_elems;
+   for (int k = 0; k < ne; k++)
+   {
+      bool shared = false;
+      for (int f = 0; f < dofs.numBdrs; f++)
+      {
+         for (int j = 0; j < dofs.numFaceDofs; j++)
+         {
+            const int id = (k*dofs.numBdrs + f)*dofs.numFaceDofs + j;
+            if (dofs.face_src[id] == DofInfo::FACE_NBR) { shared = true; }
+         }
+      }
+      if (shared) { shared_elems.Append(k); }
+      else        { el_order.Append(k); }
+   }
+   num_int_elems = el_order.Size();
+   el_order.Append(shared_elems);
+}
+
+void HaloExchange::ExchangeBegin(const Vector &u, int nfields, FieldLayout l)
+{
+   if (in_flight) { ExchangeEnd(); }
+   src = u.GetData();
+   num_fields = nfields;
+   layout = l;
+   PerfRegion perf(PerfPhase::Halo);
+
+   ParMesh *pmesh = pfes.GetParMesh();
+   const int num_face_nbrs = pmesh->GetNFaceNeighbors();
+   const int nf = nfields, size = pfes.GetVSize(),
+             fs = FieldStride(l, size), ds = DofStride(l, nf),
+             n_send = pfes.send_face_nbr_ldof.Size_of_connections(),
+             n_recv = pfes.GetFaceNbrVSize();
+   send_buf.SetSize(nf * n_send);
+   face_nbr_data.SetSize(nf * n_recv);
+   if (num_face_nbrs == 0) { return; }
+
+   // The message to each neighbor holds its values of all fields, field by
+   // field: entry i of field fld is at nf*offset(fn) + fld*count(fn) + i.
+   const int *send_offset = pfes.send_face_nbr_ldof.GetI();
+   const int *recv_offset = pfes.face_nbr_ldof.GetI();
+   const int *d_send_ldof = mfem::Read(pfes.send_face_nbr_ldof.GetJMemory(),
+                                       n_send);
+   const int *d_send_off = mfem::Read(pfes.send_face_nbr_ldof.GetIMemory(),
+                                      num_face_nbrs + 1);
+   const int *d_send_nbr = send_nbr.Read();
+   const double *d_u = u.Read();
+   double *d_send = send_buf.Write();
+   MFEM_FORALL(i, n_send,
+   {
+      const int ldof = d_send_ldof[i];
+      const int fn = d_send_nbr[i], off = d_send_off[fn],
+                cnt = d_send_off[fn+1] - off;
+      for (int fld = 0; fld < nf; fld++)
+      {
+         d_send[nf*off + fld*cnt + i - off] =
+            d_u[fld*fs + (ldof >= 0 ? ldof : -1-ldof)*ds];
+      }
+   });
+
+   // A tag that differs from the one of ParGridFunction::ExchangeFaceNbrData().
+   const int tag = 271;
+   MPI_Comm comm = pfes.GetComm();
+   const double *h_send = send_buf.HostRead();
+   // With one field the message layout is the one of face_nbr_data.
+   if (nf > 1) { recv_buf.SetSize(nf * n_recv); }
+   double *h_recv = (nf > 1) ? recv_buf.HostWrite()
+                    : face_nbr_data.HostWrite();
+   for (int fn = 0; fn < num_face_nbrs; fn++)
+   {
+      const int nbr_rank = pmesh->GetFaceNbrRank(fn);
+      MPI_Isend(h_send + nf*send_offset[fn],
+                nf*(send_offset[fn+1] - send_offset[fn]),
+                MPI_DOUBLE, nbr_rank, tag, comm, &requests[fn]);
+      MPI_Irecv(h_recv + nf*recv_offset[fn],
+                nf*(recv_offset[fn+1] - recv_offset[fn]),
+                MPI_DOUBLE, nbr_rank, tag, comm, &requests[num_face_nbrs + fn]);
+   }
+   in_flight = true;
+}
+
+void HaloExchange::ExchangeEnd()
+{
+   if (in_flight == false) { return; }
+   PerfRegion perf(PerfPhase::Halo);
+   MPI_Waitall(requests.Size(), requests.GetData(), MPI_STATUSES_IGNORE);
+   in_flight = false;
+   if (num_fields == 1) { return; }
+
+   // Reorder to one field after the other.
+   const int nf = num_fields, n_recv = pfes.GetFaceNbrVSize();
+   const int *recv_offset = pfes.face_nbr_ldof.GetI();
+   const double *h_recv = recv_buf.HostRead();
+   double *h_data = face_nbr_data.HostWrite();
+   for (int i = 0; i < n_recv; i++)
+   {
+      const int fn = recv_nbr[i], off = recv_offset[fn],
+                cnt = recv_offset[fn+1] - off;
+      for (int fld = 0; fld < nf; fld++)
+      {
+         h_data[fld*n_recv + i] = h_recv[nf*off + fld*cnt + i - off];
+      }
+   }
+}
+
+int HaloExchange::FindField(const Vector &u, int nfields,
+                            FieldLayout l) const
+{
+   // The fields of an AoS vector can only be found all together.
+   if (l != layout || l == FieldLayout::AoS)
+   {
+      return (l == layout && u.GetData() == src &&
+              nfields == num_fields) ? 0 : -1;
+   }
+   const int size = pfes.GetVSize();
+   for (int fld = 0; src && fld + nfields <= num_fields; fld++)
+   {
+      if (u.GetData() == src + fld*size) { return fld; }
+   }
+   return -1;
+}
+
+const Vector &HaloExchange::FaceNbrData(const Vector &u, int nfields,
+                                        FieldLayout l)
+{
+   int fld = FindField(u, nfields, l);
+   if (fld < 0)
+   {
+      ExchangeBegin(u, nfields, l);
+      fld = 0;
+   }
+   ExchangeEnd();
+   if (fld == 0 && nfields == num_fields) { return face_nbr_data; }
+
+   const int n_recv = pfes.GetFaceNbrVSize();
+   field_nbr_data.MakeRef(face_nbr_data, fld * n_recv, nfields * n_recv);
+   return field_nbr_data;
+}
+
 Assembly::Assembly(DofInfo &_dofs, LowOrderMethod &lom,
                    const GridFunction &inflow,
                    ParFiniteElementSpace &pfes, ParMesh *submesh, int mode)
    : exec_mode(mode), inflow_gf(inflow), x_gf(&pfes),
      VolumeTerms(NULL),
      fes(&pfes), SubFes0(NULL), SubFes1(NULL),
-     subcell_mesh(submesh), dofs(_dofs)
+     subcell_mesh(submesh), dofs(_dofs), halo(pfes, _dofs)
 {
    Mesh *mesh = fes->GetMesh();
    int k, i, m, dim = mesh->Dimension(), ne = fes->GetNE();
@@ -671,8 +1483,13 @@ Assembly::Assembly(DofInfo &_dofs, LowOrderMethod &lom,
    Array <int> bdrs, orientation;
    FaceElementTransformations *Trans;
 
-   bdrInt.SetSize(ne, dofs.numBdrs, dofs.numFaceDofs*dofs.numFaceDofs);
-   bdrInt = 0.;
+   const int nfd = dofs.numFaceDofs;
+   face_B1.SetSize(nfd*nfd);
+   face_B2.SetSize(nfd*nfd);
+   face_diff.SetSize(nfd);
+   face_corr.SetSize(nfd);
+
+   ResetBdrBlocks();
 
    if (lom.subcell_scheme)
    {
@@ -719,8 +1536,11 @@ void Assembly::ComputeFluxTerms(const int e_id, const int BdrID,
    double aux, vn;
 
    const FiniteElement &el = *fes->GetFE(e_id);
+   const int face = Trans->ElementNo;
 
-   Vector vval, nor(dim), shape(el.GetDof());
+   Vector nor(dim), shape(el.GetDof());
+   face_B1 = 0.0;
+   double *B = face_B1.HostReadWrite();
 
    for (l = 0; l < lom.irF->GetNPoints(); l++)
    {
@@ -742,45 +1562,110 @@ void Assembly::ComputeFluxTerms(const int e_id, const int BdrID,
       {
          Trans->Loc2.Transform(ip, eip1);
          el.CalcShape(eip1, shape);
-         Trans->Elem2->SetIntPoint(&eip1);
-         lom.coef->Eval(vval, *Trans->Elem2, eip1);
          nor *= -1.;
       }
       else
       {
          Trans->Loc1.Transform(ip, eip1);
          el.CalcShape(eip1, shape);
-         Trans->Elem1->SetIntPoint(&eip1);
-         lom.coef->Eval(vval, *Trans->Elem1, eip1);
       }
 
       nor /= nor.Norml2();
 
-      if (exec_mode == 0)
-      {
-         // Transport.
-         vn = std::min(0., vval * nor);
-      }
-      else
+      const double *v = lom.coef->FaceValue(face, l);
+      vn = 0.;
+      for (j = 0; j < dim; j++) { vn += v[j] * nor(j); }
+      AddFluxTerm(B, BdrID, shape, ip.weight * Trans->Face->Weight(), vn);
+   }
+   StoreBdrBlock(e_id, BdrID, B);
+}
+
+void Assembly::ComputeFaceFluxTerms(FaceElementTransformations *Trans,
+                                    const int BdrID1, const int BdrID2,
+                                    LowOrderMethod &lom)
+{
+   const int dim = fes->GetMesh()->Dimension();
+   const FiniteElement &el1 = *fes->GetFE(Trans->Elem1No);
+   const int face = Trans->ElementNo;
+   Vector nor(dim), shape(el1.GetDof());
+   face_B1 = 0.0;
+   face_B2 = 0.0;
+   double *B1 = face_B1.HostReadWrite(), *B2 = face_B2.HostReadWrite();
+
+   for (int l = 0; l < lom.irF->GetNPoints(); l++)
+   {
+      const IntegrationPoint &ip = lom.irF->IntPoint(l);
+      IntegrationPoint eip1, eip2;
+      Trans->Face->SetIntPoint(&ip);
+      Trans->Loc1.Transform(ip, eip1);
+
+      // Normal pointing out of Elem1.
+      if (dim == 1) { nor(0) = 2.*eip1.x - 1.0; }
+      else          { CalcOrtho(Trans->Face->Jacobian(), nor); }
+      nor /= nor.Norml2();
+
+      const double w = ip.weight * Trans->Face->Weight();
+
+      // The velocity is the same on both sides of the face.
+      const double *v = lom.coef->FaceValue(face, l);
+      double vn = 0.;
+      for (int d = 0; d < dim; d++) { vn += v[d] * nor(d); }
+
+      el1.CalcShape(eip1, shape);
+      AddFluxTerm(B1, BdrID1, shape, w, vn);
+
+      if (BdrID2 >= 0)
       {
-         // Remap.
-         vn = std::max(0., vval * nor);
-         vn *= -1.0;
+         Trans->Loc2.Transform(ip, eip2);
+         fes->GetFE(Trans->Elem2No)->CalcShape(eip2, shape);
+         AddFluxTerm(B2, BdrID2, shape, w, -vn);
       }
+   }
+   StoreBdrBlock(Trans->Elem1No, BdrID1, B1);
+   if (BdrID2 >= 0) { StoreBdrBlock(Trans->Elem2No, BdrID2, B2); }
+}
 
-      const double w = ip.weight * Trans->Face->Weight();
-      for (i = 0; i < dofs.numFaceDofs; i++)
+void Assembly::AddFluxTerm(double *B, const int BdrID,
+                           const Vector &shape, const double w,
+                           const double vn) const
+{
+   // Transport uses the inflow part of the normal velocity, remap the
+   // outflow part.
+   const double vn_up = (exec_mode == 0) ? std::min(0., vn)
+                        : -std::max(0., vn);
+   if (vn_up == 0.) { return; }
+   const int nfd = dofs.numFaceDofs;
+   for (int i = 0; i < nfd; i++)
+   {
+      const double aux = w * shape(dofs.BdrDofs(i,BdrID)) * vn_up;
+      for (int j = 0; j < nfd; j++)
       {
-         aux = w * shape(dofs.BdrDofs(i,BdrID)) * vn;
-         for (j = 0; j < dofs.numFaceDofs; j++)
-         {
-            bdrInt(e_id, BdrID, i*dofs.numFaceDofs+j) -=
-               aux * shape(dofs.BdrDofs(j,BdrID));
-         }
+         B[i*nfd + j] -= aux * shape(dofs.BdrDofs(j,BdrID));
       }
    }
 }
 
+void Assembly::ResetBdrBlocks()
+{
+   const int n = fes->GetNE() * dofs.numBdrs;
+   bdr_block.SetSize(n);
+   int *b = bdr_block.HostWrite();
+   for (int i = 0; i < n; i++) { b[i] = -1; }
+   bdrInt.HostReadWrite();
+   bdrInt.SetSize(0);
+}
+
+void Assembly::StoreBdrBlock(const int k, const int f, const double *B)
+{
+   const int nfd2 = dofs.numFaceDofs * dofs.numFaceDofs;
+   bool zero = true;
+   for (int i = 0; i < nfd2; i++) { if (B[i] != 0.) { zero = false; } }
+   if (zero) { return; }
+
+   bdr_block[k*dofs.numBdrs + f] = bdrInt.Size() / nfd2;
+   for (int i = 0; i < nfd2; i++) { bdrInt.Append(B[i]); }
+}
+
 void Assembly::ComputeSubcellWeights(const int k, const int m)
 {
    DenseMatrix elmat; // These are essentially the same.
@@ -797,105 +1682,285 @@ void Assembly::ComputeSubcellWeights(const int k, const int m)
    }
 }
 
-void Assembly::LinearFluxLumping(const int k, const int nd, const int BdrID,
-                                 const Vector &x, Vector &y, const Vector &x_nd,
-                                 const Vector &alpha) const
+// Lumped face fluxes of the elements el_list[0..n_el-1]. Each element writes
+// only its own dofs, so the elements are processed in parallel. The nf fields
+// of x and y are at strides fs and ds (see FieldLayout), those of x_nd one
+// after the other with size nbr_size; all fields are processed in one visit
+// of the face data. The generic kernel, T_NFD = 0, keeps the differences of
+// element e in scratch[e*nfd..], as the number of face dofs is unbounded.
+template<int T_NFD = 0>
+static void FluxLumpingKernel(const int nf, const int fs, const int ds,
+                              const int nbr_size,
+                              const int n_el, const int *el_list,
+                              const int nbdr, const int nfd_,
+                              const int *face_dof, const int *face_nbr,
+                              const int *face_src, const int *bdr_block,
+                              const double *bdrInt,
+                              const double *x, const double *x_nd,
+                              const double *inflow, const double a2,
+                              double *scratch, double *y)
 {
-   int i, j, dofInd;
-   double xNeighbor;
-   Vector xDiff(dofs.numFaceDofs);
-   const int size_x = x.Size();
-
-   for (j = 0; j < dofs.numFaceDofs; j++)
+   const int nfd = T_NFD ? T_NFD : nfd_;
+   MFEM_FORALL(e, n_el,
    {
-      dofInd = k*nd+dofs.BdrDofs(j,BdrID);
-      const int nbr_dof_id = dofs.NbrDof(k, BdrID, j);
-      // Note that if the boundary is outflow, we have bdrInt = 0 by definition,
-      // s.t. this value will not matter.
-      if (nbr_dof_id < 0) { xNeighbor = inflow_gf(dofInd); }
-      else
+      constexpr int max_nfd = T_NFD ? T_NFD : 1;
+      const int NFD = T_NFD ? T_NFD : nfd;
+      const int k = el_list[e];
+      double xDiff_loc[max_nfd];
+      double *xDiff = T_NFD ? xDiff_loc : scratch + e*NFD;
+      for (int f = 0; f < nbdr; f++)
       {
-         xNeighbor = (nbr_dof_id < size_x) ? x(nbr_dof_id)
-                     : x_nd(nbr_dof_id - size_x);
+         // Zero blocks, e.g., of outflow faces, give no flux.
+         const int blk = bdr_block[k*nbdr + f];
+         if (blk < 0) { continue; }
+         const int offset = (k*nbdr + f) * NFD;
+         const double *B = bdrInt + blk * NFD*NFD;
+         for (int fld = 0; fld < nf; fld++)
+         {
+            const double *xf = x + fld*fs;
+            for (int j = 0; j < NFD; j++)
+            {
+               const int src = face_src[offset + j],
+                         nbr = face_nbr[offset + j];
+               const double xNeighbor =
+                  (src == DofInfo::LOCAL) ? xf[nbr*ds] :
+                  (src == DofInfo::FACE_NBR) ? x_nd[fld*nbr_size + nbr] :
+                  inflow[nbr];
+               xDiff[j] = xNeighbor - xf[face_dof[offset + j]*ds];
+            }
+            double *yf = y + fld*fs;
+            for (int i = 0; i < NFD; i++)
+            {
+               double flux = 0.0;
+               for (int j = 0; j < NFD; j++)
+               {
+                  flux += B[i*NFD + j] *
+                          (xDiff[i] + (xDiff[j] - xDiff[i]) * a2);
+               }
+               yf[face_dof[offset + i]*ds] += flux;
+            }
+         }
       }
-      xDiff(j) = xNeighbor - x(dofInd);
+   });
+}
+
+typedef void (*FluxLumpingKernelType)(const int, const int, const int,
+                                      const int, const int, const int *,
+                                      const int, const int, const int *,
+                                      const int *, const int *, const int *,
+                                      const double *, const double *,
+                                      const double *, const double *,
+                                      const double, double *, double *);
+
+void Assembly::LinearFluxLumping(const Vector &x, Vector &y,
+                                 const double alpha, const int nfields,
+                                 FieldLayout layout, const Array<int> *elems)
+{
+   FluxLumpingKernelType kernel;
+   switch (dofs.numFaceDofs)
+   {
+      case 1:  kernel = FluxLumpingKernel<1>;  break;
+      case 2:  kernel = FluxLumpingKernel<2>;  break;
+      case 3:  kernel = FluxLumpingKernel<3>;  break;
+      case 4:  kernel = FluxLumpingKernel<4>;  break;
+      case 5:  kernel = FluxLumpingKernel<5>;  break;
+      case 9:  kernel = FluxLumpingKernel<9>;  break;
+      case 16: kernel = FluxLumpingKernel<16>; break;
+      case 25: kernel = FluxLumpingKernel<25>; break;
+      default: kernel = FluxLumpingKernel<0>;
    }
 
-   for (i = 0; i < dofs.numFaceDofs; i++)
+   const int nbdr = dofs.numBdrs, nfd = dofs.numFaceDofs;
+   const int n_int = halo.NumInteriorElements(),
+             n_shared = halo.ElementOrder().Size() - n_int;
+   const int *el_list = halo.ElementOrder().Read();
+   const int *f_dof = dofs.face_dof.Read(), *f_nbr = dofs.face_nbr.Read(),
+              *f_src = dofs.face_src.Read();
+   const int *blk = bdr_block.Read();
+   const double *B = bdrInt.Read(), *d_x = x.Read(),
+                 *d_inflow = inflow_gf.Read();
+   double *d_y = y.ReadWrite();
+   double *d_diff = NULL;
+   if (kernel == FluxLumpingKernel<0>)
    {
-      dofInd = k*nd+dofs.BdrDofs(i,BdrID);
-      for (j = 0; j < dofs.numFaceDofs; j++)
+      const int n_el = elems ? elems->Size() : halo.ElementOrder().Size();
+      if (lump_diff.Size() < n_el*nfd)
       {
-         // alpha=0 is the low order solution, alpha=1, the Galerkin solution.
-         // 0 < alpha < 1 can be used for limiting within the low order method.
-         y(dofInd) += bdrInt(k, BdrID, i*dofs.numFaceDofs + j) *
-                      (xDiff(i) + (xDiff(j)-xDiff(i)) *
-                       alpha(dofs.BdrDofs(i,BdrID)) *
-                       alpha(dofs.BdrDofs(j,BdrID)));
+         lump_diff.SetSize(n_el*nfd);
+         lump_diff.UseDevice(true);
       }
+      d_diff = lump_diff.Write();
+   }
+
+   // alpha=0 is the low order solution, alpha=1, the Galerkin solution.
+   // 0 < alpha < 1 can be used for limiting within the low order method.
+   const double a2 = alpha * alpha;
+
+   // The interior elements don't access the face-neighbor values.
+   const int size = x.Size() / nfields,
+             fs = FieldStride(layout, size), ds = DofStride(layout, nfields),
+             nbr_size = x_gf.ParFESpace()->GetFaceNbrVSize();
+   if (elems)
+   {
+      const double *d_x_nd = halo.FaceNbrData(x, nfields, layout).Read();
+      kernel(nfields, fs, ds, nbr_size, elems->Size(), elems->Read(), nbdr,
+             nfd, f_dof, f_nbr, f_src, blk, B, d_x, d_x_nd, d_inflow, a2,
+             d_diff, d_y);
+      return;
    }
+   kernel(nfields, fs, ds, nbr_size, n_int, el_list, nbdr, nfd,
+          f_dof, f_nbr, f_src, blk, B, d_x, NULL, d_inflow, a2, d_diff, d_y);
+
+   const double *d_x_nd = halo.FaceNbrData(x, nfields, layout).Read();
+   kernel(nfields, fs, ds, nbr_size, n_shared, el_list + n_int, nbdr, nfd,
+          f_dof, f_nbr, f_src, blk, B, d_x, d_x_nd, d_inflow, a2, d_diff,
+          d_y);
 }
 
 void Assembly::NonlinFluxLumping(const int k, const int nd,
                                  const int BdrID, const Vector &x,
                                  Vector &y, const Vector &x_nd,
-                                 const Vector &alpha) const
+                                 const double *alpha) const
 {
-   int i, j, dofInd;
-   double xNeighbor, SumCorrP = 0., SumCorrN = 0., eps = 1.E-15;
-   const int size_x = x.Size();
-   Vector xDiff(dofs.numFaceDofs), BdrTermCorr(dofs.numFaceDofs);
-   BdrTermCorr = 0.;
-
-   for (j = 0; j < dofs.numFaceDofs; j++)
+   const double *B = BdrBlock(k, BdrID);
+   if (B == NULL) { return; }
+
+   const int nfd = dofs.numFaceDofs, offset = (k*dofs.numBdrs + BdrID) * nfd;
+   const int *f_dof = dofs.face_dof.HostRead() + offset,
+              *f_nbr = dofs.face_nbr.HostRead() + offset,
+              *f_src = dofs.face_src.HostRead() + offset;
+   const double *h_inflow = inflow_gf.HostRead();
+   double SumCorrP = 0., SumCorrN = 0., eps = 1.E-15;
+   double *xDiff = face_diff.HostWrite(),
+          *BdrTermCorr = face_corr.HostWrite();
+
+   for (int j = 0; j < nfd; j++)
    {
-      dofInd = k*nd+dofs.BdrDofs(j,BdrID);
-      const int nbr_dof_id = dofs.NbrDof(k, BdrID, j);
-      // Note that if the boundary is outflow, we have bdrInt = 0 by definition,
-      // s.t. this value will not matter.
-      if (nbr_dof_id < 0) { xNeighbor = inflow_gf(dofInd); }
-      else
-      {
-         xNeighbor = (nbr_dof_id < size_x) ? x(nbr_dof_id)
-                     : x_nd(nbr_dof_id - size_x);
-      }
-      xDiff(j) = xNeighbor - x(dofInd);
+      const int src = f_src[j], nbr = f_nbr[j];
+      const double xNeighbor = (src == DofInfo::LOCAL) ? x(nbr) :
+                               (src == DofInfo::FACE_NBR) ? x_nd(nbr) :
+                               h_inflow[nbr];
+      xDiff[j] = xNeighbor - x(f_dof[j]);
    }
 
    y.HostReadWrite();
-   bdrInt.HostRead();
-   xDiff.HostReadWrite();
-   for (i = 0; i < dofs.numFaceDofs; i++)
+   for (int i = 0; i < nfd; i++)
    {
-      dofInd = k*nd+dofs.BdrDofs(i,BdrID);
-      for (j = 0; j < dofs.numFaceDofs; j++)
+      BdrTermCorr[i] = 0.;
+      for (int j = 0; j < nfd; j++)
       {
-         y(dofInd) += bdrInt(k, BdrID, i*dofs.numFaceDofs + j) * xDiff(i);
-         BdrTermCorr(i) += bdrInt(k, BdrID,
-                                  i*dofs.numFaceDofs + j) * (xDiff(j)-xDiff(i));
+         y(f_dof[i]) += B[i*nfd + j] * xDiff[i];
+         BdrTermCorr[i] += B[i*nfd + j] * (xDiff[j]-xDiff[i]);
       }
-      BdrTermCorr(i) *= alpha(dofs.BdrDofs(i,BdrID));
-      SumCorrP += max(0., BdrTermCorr(i));
-      SumCorrN += min(0., BdrTermCorr(i));
+      BdrTermCorr[i] *= alpha[f_dof[i] - k*nd];
+      SumCorrP += max(0., BdrTermCorr[i]);
+      SumCorrN += min(0., BdrTermCorr[i]);
    }
 
-   for (i = 0; i < dofs.numFaceDofs; i++)
+   for (int i = 0; i < nfd; i++)
    {
-      dofInd = k*nd+dofs.BdrDofs(i,BdrID);
       if (SumCorrP + SumCorrN > eps)
       {
-         BdrTermCorr(i) = min(0., BdrTermCorr(i)) -
-                          max(0., BdrTermCorr(i)) * SumCorrN / SumCorrP;
+         BdrTermCorr[i] = min(0., BdrTermCorr[i]) -
+                          max(0., BdrTermCorr[i]) * SumCorrN / SumCorrP;
       }
       else if (SumCorrP + SumCorrN < -eps)
       {
-         BdrTermCorr(i) = max(0., BdrTermCorr(i)) -
-                          min(0., BdrTermCorr(i)) * SumCorrP / SumCorrN;
+         BdrTermCorr[i] = max(0., BdrTermCorr[i]) -
+                          min(0., BdrTermCorr[i]) * SumCorrP / SumCorrN;
+      }
+      y(f_dof[i]) += BdrTermCorr[i];
+   }
+}
+
+QuadratureVelocity::QuadratureVelocity(VectorCoefficient &q, Mesh &m)
+   : VectorCoefficient(q.GetVDim()), Q(q), mesh(m), face_rule(NULL)
+{ }
+
+QuadratureVelocity::~QuadratureVelocity()
+{
+   for (int r = 0; r < el_values.Size(); r++) { delete el_values[r]; }
+}
+
+void QuadratureVelocity::ComputeElementValues(int r)
+{
+   const IntegrationRule &ir = *el_rules[r];
+   const int ne = mesh.GetNE(), np = ir.GetNPoints();
+   Vector &vals = *el_values[r];
+   vals.SetSize(ne * np * vdim);
+   double *v = vals.HostWrite();
+   // A separate transformation, as the one of the mesh can be in use by the
+   // caller of Eval().
+   IsoparametricTransformation T;
+   DenseMatrix M;
+   for (int e = 0; e < ne; e++)
+   {
+      mesh.GetElementTransformation(e, &T);
+      Q.Eval(M, T, ir);
+      const double *m = M.GetData();
+      for (int i = 0; i < np * vdim; i++) { v[e*np*vdim + i] = m[i]; }
+   }
+}
+
+void QuadratureVelocity::ComputeFaceValues()
+{
+   const int nf = mesh.GetNumFaces(), nq = face_rule->GetNPoints();
+   face_values.SetSize(nf * nq * vdim);
+   double *v = face_values.HostWrite();
+   Vector vval;
+   for (int f = 0; f < nf; f++)
+   {
+      FaceElementTransformations *T = mesh.GetFaceElementTransformations(f);
+      for (int q = 0; q < nq; q++)
+      {
+         const IntegrationPoint &ip = face_rule->IntPoint(q);
+         IntegrationPoint eip;
+         T->Face->SetIntPoint(&ip);
+         T->Loc1.Transform(ip, eip);
+         T->Elem1->SetIntPoint(&eip);
+         Q.Eval(vval, *T->Elem1, eip);
+         for (int d = 0; d < vdim; d++) { v[(f*nq + q)*vdim + d] = vval(d); }
       }
-      y(dofInd) += BdrTermCorr(i);
    }
 }
 
+void QuadratureVelocity::SetFaceRule(const IntegrationRule &irF)
+{
+   face_rule = &irF;
+   ComputeFaceValues();
+}
+
+void QuadratureVelocity::Refresh()
+{
+   for (int r = 0; r < el_rules.Size(); r++) { ComputeElementValues(r); }
+   if (face_rule) { ComputeFaceValues(); }
+}
+
+void QuadratureVelocity::Eval(DenseMatrix &M, ElementTransformation &T,
+                              const IntegrationRule &ir)
+{
+   if (T.ElementType != ElementTransformation::ELEMENT ||
+       T.ElementNo >= mesh.GetNE())
+   {
+      Q.Eval(M, T, ir);
+      return;
+   }
+
+   int r = el_rules.Find(&ir);
+   if (r < 0)
+   {
+      r = el_rules.Append(&ir) - 1;
+      el_values.Append(new Vector);
+      ComputeElementValues(r);
+   }
+
+   const int np = ir.GetNPoints();
+   M.SetSize(vdim, np);
+   const double *v = el_values[r]->HostRead() + T.ElementNo * np*vdim;
+   double *m = M.GetData();
+   for (int i = 0; i < np * vdim; i++) { m[i] = v[i]; }
+}
+
 void PrecondConvectionIntegrator::AssembleElementMatrix(
    const FiniteElement &el, ElementTransformation &Trans, DenseMatrix &elmat)
 {
@@ -1277,73 +2342,80 @@ int GetLocalFaceDofIndex(int dim, int loc_face_id, int face_orient,
 
 
 // Assuming L2 elements.
-void ExtractBdrDofs(int p, Geometry::Type gtype, DenseMatrix &dofs)
+int ExtractBdrDofs(int p, Geometry::Type gtype, Array<int> &dofs, int &nfd)
 {
+   int nbdr = 0;
    switch (gtype)
    {
       case Geometry::SEGMENT:
       {
-         dofs.SetSize(1, 2);
-         dofs(0, 0) = 0;
-         dofs(0, 1) = p;
+         nfd = 1;
+         nbdr = 2;
+         dofs.SetSize(nfd * nbdr);
+         dofs[0] = 0;
+         dofs[1] = p;
          break;
       }
       case Geometry::SQUARE:
       {
-         dofs.SetSize(p+1, 4);
+         nfd = p+1;
+         nbdr = 4;
+         dofs.SetSize(nfd * nbdr);
          for (int i = 0; i <= p; i++)
          {
-            dofs(i,0) = i;
-            dofs(i,1) = i*(p+1) + p;
-            dofs(i,2) = (p+1)*(p+1) - 1 - i;
-            dofs(i,3) = (p-i)*(p+1);
+            dofs[i]         = i;
+            dofs[i + nfd]   = i*(p+1) + p;
+            dofs[i + 2*nfd] = (p+1)*(p+1) - 1 - i;
+            dofs[i + 3*nfd] = (p-i)*(p+1);
          }
          break;
       }
       case Geometry::CUBE:
       {
-         dofs.SetSize((p+1)*(p+1), 6);
+         nfd = (p+1)*(p+1);
+         nbdr = 6;
+         dofs.SetSize(nfd * nbdr);
          for (int bdrID = 0; bdrID < 6; bdrID++)
          {
-            int o(0);
+            int o = bdrID * nfd;
             switch (bdrID)
             {
                case 0:
                   for (int i = 0; i < (p+1)*(p+1); i++)
                   {
-                     dofs(o++,bdrID) = i;
+                     dofs[o++] = i;
                   }
                   break;
                case 1:
                   for (int i = 0; i <= p*(p+1)*(p+1); i+=(p+1)*(p+1))
                      for (int j = 0; j < p+1; j++)
                      {
-                        dofs(o++,bdrID) = i+j;
+                        dofs[o++] = i+j;
                      }
                   break;
                case 2:
                   for (int i = p; i < (p+1)*(p+1)*(p+1); i+=p+1)
                   {
-                     dofs(o++,bdrID) = i;
+                     dofs[o++] = i;
                   }
                   break;
                case 3:
                   for (int i = 0; i <= p*(p+1)*(p+1); i+=(p+1)*(p+1))
                      for (int j = p*(p+1); j < (p+1)*(p+1); j++)
                      {
-                        dofs(o++,bdrID) = i+j;
+                        dofs[o++] = i+j;
                      }
                   break;
                case 4:
                   for (int i = 0; i <= (p+1)*((p+1)*(p+1)-1); i+=p+1)
                   {
-                     dofs(o++,bdrID) = i;
+                     dofs[o++] = i;
                   }
                   break;
                case 5:
                   for (int i = p*(p+1)*(p+1); i < (p+1)*(p+1)*(p+1); i++)
                   {
-                     dofs(o++,bdrID) = i;
+                     dofs[o++] = i;
                   }
                   break;
             }
@@ -1352,6 +2424,7 @@ void ExtractBdrDofs(int p, Geometry::Type gtype, DenseMatrix &dofs)
       }
       default: MFEM_ABORT("Geometry not implemented.");
    }
+   return nbdr;
 }
 
 void GetMinMax(const ParGridFunction &g, double &min, double &max)
@@ -1362,6 +2435,49 @@ void GetMinMax(const ParGridFunction &g, double &min, double &max)
    MPI_Allreduce(&max_loc, &max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
 }
 
+void ConvertFieldLayout(const Vector &x, FieldLayout from,
+                        Vector &y, FieldLayout to, int nfields)
+{
+   const int nf = nfields, size = x.Size() / nf,
+             fs_x = FieldStride(from, size), ds_x = DofStride(from, nf),
+             fs_y = FieldStride(to, size), ds_y = DofStride(to, nf);
+   const double *d_x = x.Read();
+   double *d_y = y.Write();
+   MFEM_FORALL(i, size,
+   {
+      for (int f = 0; f < nf; f++)
+      {
+         d_y[f*fs_y + i*ds_y] = d_x[f*fs_x + i*ds_x];
+      }
+   });
+}
+
+double DeterministicSquaredNorm(const Vector &x, Vector &block_sums)
+{
+   return DeterministicDot(x, x, block_sums);
+}
+
+double DeterministicDot(const Vector &x, const Vector &y, Vector &block_sums)
+{
+   const int n = x.Size(), bs = 1024, nb = (n + bs - 1) / bs;
+   block_sums.SetSize(nb);
+   block_sums.UseDevice(true);
+   const double *d_x = x.Read(), *d_y = y.Read();
+   double *d_b = block_sums.Write();
+   MFEM_FORALL(b, nb,
+   {
+      const int end = (b + 1)*bs < n ? (b + 1)*bs : n;
+      double sum = 0.0;
+      for (int i = b*bs; i < end; i++) { sum += d_x[i] * d_y[i]; }
+      d_b[b] = sum;
+   });
+
+   const double *h_b = block_sums.HostRead();
+   double sum = 0.0;
+   for (int b = 0; b < nb; b++) { sum += h_b[b]; }
+   return sum;
+}
+
 Array<int> SparseMatrix_Build_smap(const SparseMatrix &A)
 {
    // Assuming that A is finalized
@@ -1410,6 +2526,72 @@ void ComputeDiscreteUpwindingMatrix(const SparseMatrix &K,
    }
 }
 
+void ComputeElementTimeSteps(const SparseMatrix &K, const Array<int> &smap,
+                             const Assembly &asmbl, const Vector &lumpedM,
+                             double cfl, Vector &el_dt, Vector &diag)
+{
+   const int *Ip = K.GetI(), *Jp = K.GetJ(), n = K.Size();
+   const double *Kp = K.GetData();
+   const DofInfo &dofs = asmbl.dofs;
+   const int ne = asmbl.bdr_block.Size() / dofs.numBdrs,
+             nfd = dofs.numFaceDofs,
+             nd = (ne > 0) ? n / ne : 0;
+
+   // Diagonal of the discrete upwinding matrix, as computed in
+   // ComputeDiscreteUpwindingMatrix().
+   diag.SetSize(n);
+   for (int i = 0; i < n; i++)
+   {
+      double kii = 0., rowsum = 0.;
+      for (int k = Ip[i]; k < Ip[i+1]; k++)
+      {
+         if (Jp[k] == i) { kii = Kp[k]; continue; }
+         rowsum += fmax(fmax(0.0, -Kp[k]), -Kp[smap[k]]);
+      }
+      diag(i) = fabs(kii - rowsum);
+   }
+
+   // Face fluxes, lumped as in Assembly::LinearFluxLumping() with alpha = 0.
+   for (int k = 0; k < ne; k++)
+   {
+      for (int f = 0; f < dofs.numBdrs; f++)
+      {
+         const double *B = asmbl.BdrBlock(k, f);
+         if (B == NULL) { continue; }
+         for (int i = 0; i < nfd; i++)
+         {
+            double row = 0.;
+            for (int j = 0; j < nfd; j++) { row += B[i*nfd + j]; }
+            diag(k*nd + dofs.BdrDofs(i, f)) += fabs(row);
+         }
+      }
+   }
+
+   const double *m = lumpedM.HostRead();
+   el_dt.SetSize(ne);
+   for (int k = 0; k < ne; k++)
+   {
+      double dt = numeric_limits<double>::infinity();
+      for (int i = k*nd; i < (k + 1)*nd; i++)
+      {
+         if (diag(i) > 0.) { dt = fmin(dt, m[i] / diag(i)); }
+      }
+      el_dt(k) = cfl * dt;
+   }
+}
+
+double ComputeCFLTimeStep(const SparseMatrix &K, const Array<int> &smap,
+                          const Assembly &asmbl, const Vector &lumpedM,
+                          double cfl, MPI_Comm comm,
+                          Vector &el_dt, Vector &diag)
+{
+   ComputeElementTimeSteps(K, smap, asmbl, lumpedM, cfl, el_dt, diag);
+   double dt_loc = numeric_limits<double>::infinity(), dt;
+   for (int k = 0; k < el_dt.Size(); k++) { dt_loc = fmin(dt_loc, el_dt(k)); }
+   MPI_Allreduce(&dt_loc, &dt, 1, MPI_DOUBLE, MPI_MIN, comm);
+   return dt;
+}
+
 void VisualizeField(socketstream &sock, const char *vishost, int visport,
                     ParGridFunction &gf, const char *title,
                     int x, int y, int w, int h, const char *keys, bool vec)
@@ -25,7 +25,9 @@ namespace mfem
 int GetLocalFaceDofIndex(int dim, int loc_face_id, int face_orient,
                          int face_dof_id, int face_dof1D_cnt);
 
-void ExtractBdrDofs(int p, Geometry::Type gtype, DenseMatrix &dofs);
+// Fills the local dofs of the faces of an element of the given geometry, with
+// dof i of face f at dofs[i + f*nfd]. Returns the number of faces.
+int ExtractBdrDofs(int p, Geometry::Type gtype, Array<int> &dofs, int &nfd);
 
 void GetMinMax(const ParGridFunction &g, double &min, double &max);
 
@@ -33,11 +35,51 @@ void GetMinMax(const ParGridFunction &g, double &min, double &max);
 // sparse matrix.
 Array<int> SparseMatrix_Build_smap(const SparseMatrix &A);
 
+// Storage of several fields of the same space in one vector. SoA stores one
+// field after the other, AoS stores the values of all fields at a dof next to
+// each other. Entry i of field f is at f*FieldStride() + i*DofStride().
+enum class FieldLayout { SoA, AoS };
+
+inline int FieldStride(FieldLayout layout, int size)
+{ return (layout == FieldLayout::SoA) ? size : 1; }
+inline int DofStride(FieldLayout layout, int nfields)
+{ return (layout == FieldLayout::SoA) ? 1 : nfields; }
+
+// Copies the nfields fields stored in x with layout from to y with layout to.
+void ConvertFieldLayout(const Vector &x, FieldLayout from,
+                        Vector &y, FieldLayout to, int nfields);
+
+// Local sum of x_i^2. The entries are summed in blocks of fixed size and the
+// block sums in order, so that the result doesn't depend on the number of
+// threads of the device. The block sums are stored in block_sums, which is
+// resized only when it's too small, so the caller keeps it between calls.
+double DeterministicSquaredNorm(const Vector &x, Vector &block_sums);
+// Local sum of x_i y_i, summed in the same way.
+double DeterministicDot(const Vector &x, const Vector &y, Vector &block_sums);
+
 // Given a matrix K, matrix D (initialized with same sparsity as K) is computed,
 // such that (K+D)_ij >= 0 for i != j.
 void ComputeDiscreteUpwindingMatrix(const SparseMatrix &K,
                                     Array<int> smap, SparseMatrix& D);
 
+class Assembly;
+
+// Returns cfl * min_i m_i / (|d_ii| + f_i) over all MPI tasks, where d_ii is
+// the diagonal of the discrete upwinding matrix of K and f_i is the lumped
+// face flux coefficient of dof i from asmbl.bdrInt. With cfl <= 1 this is the
+// time step that keeps the discrete upwind solution within the local bounds.
+// el_dt and diag are scratch that the caller keeps between the time steps.
+double ComputeCFLTimeStep(const SparseMatrix &K, const Array<int> &smap,
+                          const Assembly &asmbl, const Vector &lumpedM,
+                          double cfl, MPI_Comm comm,
+                          Vector &el_dt, Vector &diag);
+
+// The same time step limit over the dofs of each local element. Elements
+// without flow get an infinite time step. diag is scratch of the size of K.
+void ComputeElementTimeSteps(const SparseMatrix &K, const Array<int> &smap,
+                             const Assembly &asmbl, const Vector &lumpedM,
+                             double cfl, Vector &el_dt, Vector &diag);
+
 void VisualizeField(socketstream &sock, const char *vishost, int visport,
                     ParGridFunction &gf, const char *title,
                     int x, int y, int w, int h,
@@ -58,6 +100,8 @@ private:
    Vector lumpedMH1;
    DenseMatrix ShapeEval;
 
+   // The matrices of the subcell mesh at its current positions.
+   void AssembleMatrices();
    void ComputeVariationalMatrix(DofInfo &dof_info);
    void ApproximateLaplacian(const Vector &x, ParGridFunction &y);
    void ComputeFromSparsity(const SparseMatrix &K, const ParGridFunction &x,
@@ -71,6 +115,9 @@ public:
                        DofInfo &dof_info);
    ~SmoothnessIndicator();
 
+   // Reassembles the matrices after the subcell mesh has moved.
+   void UpdateGeometry(DofInfo &dof_info);
+
    void ComputeSmoothnessIndicator(const Vector &u, ParGridFunction &si_vals_u);
    void UpdateBounds(int dof_id, double u_HO,
                      const ParGridFunction &si_vals,
@@ -79,6 +126,56 @@ public:
    Vector DG2CG;
 };
 
+// Velocity at the quadrature points of the elements and faces of a mesh. The
+// element values of each integration rule are computed from Q in one pass over
+// the elements, at the first evaluation with the rule, and copied from the
+// cache afterwards. Evaluations that aren't on the elements of the mesh go to
+// Q directly. The face values are stored for the points of the rule given to
+// SetFaceRule(), evaluated in the first element of each face; the velocity is
+// assumed to be continuous across the faces.
+// NOTE: Q is evaluated at reference points, so the values stay valid when the
+//       mesh moves if Q is a grid function coefficient. Otherwise Refresh()
+//       must be called after the mesh has moved.
+class QuadratureVelocity : public VectorCoefficient
+{
+private:
+   VectorCoefficient &Q;
+   Mesh &mesh;
+
+   // Element values of rule r, stored for point q of element e at
+   // (e*np + q)*vdim.
+   Array<const IntegrationRule *> el_rules;
+   Array<Vector *> el_values;
+
+   // Face values, stored for point q of face f at (f*nq + q)*vdim.
+   const IntegrationRule *face_rule;
+   Vector face_values;
+
+   void ComputeElementValues(int r);
+   void ComputeFaceValues();
+
+public:
+   QuadratureVelocity(VectorCoefficient &q, Mesh &m);
+   ~QuadratureVelocity();
+
+   void SetFaceRule(const IntegrationRule &irF);
+
+   // Velocity at point q of the face rule on face f.
+   const double *FaceValue(int f, int q) const
+   {
+      const int nq = face_rule->GetNPoints();
+      return face_values.HostRead() + (f*nq + q)*vdim;
+   }
+
+   // Recomputes all stored values.
+   void Refresh();
+
+   virtual void Eval(Vector &V, ElementTransformation &T,
+                     const IntegrationPoint &ip) { Q.Eval(V, T, ip); }
+   virtual void Eval(DenseMatrix &M, ElementTransformation &T,
+                     const IntegrationRule &ir);
+};
+
 struct LowOrderMethod
 {
    bool subcell_scheme;
@@ -86,7 +183,7 @@ struct LowOrderMethod
    Array <int> smap;
    SparseMatrix D;
    ParBilinearForm* pk;
-   VectorCoefficient* coef;
+   QuadratureVelocity* coef;
    const IntegrationRule* irF;
    BilinearFormIntegrator* VolumeTerms;
 };
@@ -100,18 +197,64 @@ private:
 
    // The min and max bounds are represented as CG functions of the same order
    // as the solution, thus having 1:1 dof correspondence inside each element.
+   // The space has two components, the min and the negated max, so that both
+   // are communicated by a single Min reduction.
    H1_FECollection fec_bounds;
    ParFiniteElementSpace pfes_bounds;
-   ParGridFunction x_min, x_max;
+   Vector x_bounds;
+   // The same for several fields at once, with 2 components per field.
+   ParFiniteElementSpace *pfes_bounds_nf;
+
+   // Flat element-to-CG-dof table, ordered as the DG dofs of each element, and
+   // its transpose in CSR format (CG dof to elements).
+   Array<int> el_dof_cg, cg_el_I, cg_el_J;
+   void FillCGDofTables();
+
+   // Fills face_dof, and face_nbr and face_src from the neighbor dofs that
+   // FillNeighborDofs() stored in face_nbr.
+   void FillFaceDofTables();
 
    // For each DOF on an element boundary, the global index of the DOF on the
-   // opposite site is computed and stored in a list. This is needed for lumping
-   // the flux contributions, as in the paper. Right now it works on 1D meshes,
-   // quad meshes in 2D and 3D meshes of ordered cubes.
+   // opposite site is computed and stored in face_nbr (-1 if there's none).
+   // This is needed for lumping the flux contributions, as in the paper. Right
+   // now it works on 1D meshes, quad meshes in 2D and 3D meshes of ordered
+   // cubes.
    // NOTE: The mesh is assumed to consist of segments, quads or hexes.
-   // NOTE: This approach will not work for meshes with hanging nodes.
+   // NOTE: Nonconforming faces are handled by FillNonconformingNeighborDofs().
    void FillNeighborDofs();
 
+   // Overwrites the face_nbr entries of the faces with hanging nodes. A dof on
+   // the fine side gets the closest dof of the coarse face, a dof on the coarse
+   // side the closest dof of the fine face that contains it.
+   void FillNonconformingNeighborDofs();
+
+   // On nonconforming meshes the CG bounds space can't be used, as its dofs
+   // are only shared by elements with matching faces. The bounds of each dof
+   // are taken instead over its element and the neighbors across its faces,
+   // whose min and max are exchanged through a DG0 space with 2 components
+   // per field. el_nbr_vdofs holds the 2 nfields entries of each face-neighbor
+   // element in the face-neighbor data of el_bounds.
+   L2_FECollection fec_el;
+   ParFiniteElementSpace *pfes_el;
+   ParGridFunction *el_bounds;
+   Array<int> el_nbr_vdofs;
+   void ComputeFaceBounds(const Vector &el_min, const Vector &el_max,
+                          Vector &dof_min, Vector &dof_max,
+                          Array<bool> *active_el, int nfields,
+                          const Array<int> *elems);
+
+   // Elements with faces to other MPI tasks, and elements with vertices
+   // shared with other MPI tasks. The element lists below are collected with
+   // the stamps el_stamp, which are compared to el_mark.
+   Array<int> face_shared_el, vert_shared_el;
+   mutable Array<int> el_stamp;
+   mutable int el_mark;
+   void FillSharedElements();
+   void AddToList(int k, Array<int> &list) const
+   {
+      if (el_stamp[k] != el_mark) { el_stamp[k] = el_mark; list.Append(k); }
+   }
+
    // A list is filled to later access the correct element-global indices given
    // the subcell number and subcell index.
    // NOTE: The mesh is assumed to consist of segments, quads or hexes.
@@ -121,24 +264,193 @@ public:
    Vector xi_min, xi_max; // min/max values for each dof
    Vector xe_min, xe_max; // min/max values for each element
 
-   DenseMatrix BdrDofs, Sub2Ind;
-   DenseTensor NbrDof;
+   // Local dof i of face f, the same for all elements, at i + f*numFaceDofs.
+   Array<int> bdr_dofs;
+   // Local dof j of subcell m, at m + j*numSubcells.
+   Array<int> sub2ind;
+
+   int BdrDofs(int i, int f) const { return bdr_dofs[i + f*numFaceDofs]; }
+   int Sub2Ind(int m, int j) const { return sub2ind[m + j*numSubcells]; }
+
+   // Flat face data, stored for the face dof i of face f of element k at
+   // (k*numBdrs + f)*numFaceDofs + i.
+   // face_dof - the DG dof of element k at the face dof.
+   // face_nbr - index of the value on the other side of the face, into the
+   //            array given by face_src.
+   // face_src - INFLOW (inflow values), LOCAL (local dofs) or FACE_NBR
+   //            (face-neighbor dofs).
+   enum FaceNbrSource { INFLOW = 0, LOCAL = 1, FACE_NBR = 2 };
+   Array<int> face_dof, face_nbr, face_src;
 
    int numBdrs, numFaceDofs, numSubcells, numDofsSubcell;
 
    DofInfo(ParFiniteElementSpace &pfes_sltn);
 
+   ~DofInfo()
+   {
+      delete pfes_bounds_nf;
+      delete el_bounds;
+      delete pfes_el;
+   }
+
    // Computes the admissible interval of values for each DG dof from the values
-   // of all elements that feature the dof at its physical location.
+   // of all elements that feature the dof at its physical location. All inputs
+   // and outputs can hold nfields fields, one after the other; their bounds are
+   // communicated together. If elems isn't NULL, the bounds of the fields
+   // after the first are only filled at the dofs of these elements.
    void ComputeBounds(const Vector &el_min, const Vector &el_max,
                       Vector &dof_min, Vector &dof_max,
-                      Array<bool> *active_el = NULL);
-
-   // Computes the min and max values of u over each element.
+                      Array<bool> *active_el = NULL, int nfields = 1,
+                      const Array<int> *elems = NULL);
+
+   // Fills list with the active elements and their face neighbors, in
+   // increasing order. Elements with faces to other MPI tasks are always
+   // included, as the activity of their neighbors there is not known. Only
+   // the indicators are read for the inactive elements.
+   void GetActiveElementList(const Array<bool> &active_el,
+                             Array<int> &list) const;
+
+   // Fills list with the elements that share a bounds dof with the active
+   // elements among elems, i.e., whose bounds can depend on them, in
+   // increasing order. Elements with vertices shared with other MPI tasks are
+   // always included. On nonconforming meshes, all elements are listed.
+   void GetBoundsElementList(const Array<bool> &active_el,
+                             const Array<int> &elems,
+                             Array<int> &list) const;
+
+   // Computes the min and max values of u over each element, or only over the
+   // elements elems if it isn't NULL.
    void ComputeElementsMinMax(const Vector &u,
                               Vector &u_min, Vector &u_max,
                               Array<bool> *active_el,
-                              Array<bool> *active_dof) const;
+                              Array<bool> *active_dof,
+                              const Array<int> *elems = NULL) const;
+};
+
+// Computes the largest jump of u at the face dofs of each element, between the
+// values at the dof and at its neighbor. Boundary faces have no jumps.
+void ComputeFaceJumps(ParGridFunction &u, const DofInfo &dofs, Vector &jumps);
+
+// Adapts the nonconforming mesh to the coefficient u, projected on a DG space
+// of the given order and basis. In each cycle the elements with face jumps
+// above ref_tol are refined, and then the elements whose children all have
+// jumps below deref_tol are derefined. The mesh is rebalanced after each
+// cycle. The refinements stop when the mesh doesn't change.
+void AdaptMeshToFaceJumps(ParMesh &pmesh, Coefficient &u, int order,
+                          int btype, int cycles,
+                          double ref_tol, double deref_tol);
+
+// Updates the spaces fes, and then the functions gf on them, after the mesh
+// has changed.
+void UpdateFESpaces(Array<FiniteElementSpace *> &fes,
+                    Array<GridFunction *> &gf);
+
+// Adapts the nonconforming mesh to the DG function u with one cycle of
+// AdaptMeshToFaceJumps(), using the face jumps of u itself. The spaces fes and
+// the functions gf, which include u and its space, are updated after each
+// change of the mesh. Returns true if the mesh has changed.
+bool AdaptMeshToSolution(ParMesh &pmesh, ParGridFunction &u,
+                         Array<FiniteElementSpace *> &fes,
+                         Array<GridFunction *> &gf,
+                         double ref_tol, double deref_tol);
+
+// A pool of vectors that are reused by the solvers in every time step, so that
+// the solver temporaries are allocated only in the first step. The vectors are
+// borrowed through WorkVector objects and use device memory when available.
+class Workspace
+{
+private:
+   Array<Vector *> vectors;
+   Array<bool> in_use;
+
+   // Number of vector allocations by all workspaces. Vectors that are not
+   // borrowed from a workspace aren't counted.
+   static int num_allocs;
+
+public:
+   Workspace() { }
+   ~Workspace();
+
+   // Returns the id of a free vector of at least the given size.
+   int Acquire(int size);
+   void Release(int id) { in_use[id] = false; }
+   Vector &GetVector(int id) { return *vectors[id]; }
+
+   static int NumAllocations() { return num_allocs; }
+};
+
+// A vector borrowed from a Workspace for the lifetime of the object.
+class WorkVector : public Vector
+{
+private:
+   Workspace &work;
+   const int id;
+
+   WorkVector(const WorkVector &);
+
+public:
+   WorkVector(Workspace &w, int size) : work(w), id(w.Acquire(size))
+   {
+      MakeRef(w.GetVector(id), 0, size);
+      UseDevice(true);
+   }
+   ~WorkVector() { work.Release(id); }
+
+   using Vector::operator=;
+};
+
+// Exchanges the face-neighbor values of a DG field through nonblocking MPI
+// calls, so that work on the interior elements can overlap the communication.
+// One exchange per field and stage is shared by all solvers.
+class HaloExchange
+{
+private:
+   ParFiniteElementSpace &pfes;
+   Vector send_buf, recv_buf, face_nbr_data, field_nbr_data;
+   Array<MPI_Request> requests;
+   // Face neighbor of each entry of the send and the receive buffers.
+   Array<int> send_nbr, recv_nbr;
+
+   // Data, number of fields and layout of the last exchanged vector.
+   const double *src;
+   int num_fields;
+   FieldLayout layout;
+   bool in_flight;
+
+   // Index of the field of the last exchange that starts at u, or -1.
+   int FindField(const Vector &u, int nfields, FieldLayout l) const;
+
+   // Elements without faces shared with other MPI tasks come first.
+   Array<int> el_order;
+   int num_int_elems;
+
+public:
+   HaloExchange(ParFiniteElementSpace &space, const DofInfo &dofs);
+
+   // Posts the exchange of the face-neighbor values of u, which contains
+   // nfields fields of the size of the space, stored with layout l. All fields
+   // are sent in one message per face neighbor.
+   void ExchangeBegin(const Vector &u, int nfields = 1,
+                      FieldLayout l = FieldLayout::SoA);
+   // Waits for the posted exchange to finish.
+   void ExchangeEnd();
+
+   // Returns the face-neighbor values of the nfields fields in u, one field
+   // after the other for both layouts of u. The exchange is performed here,
+   // unless these fields are part of the last posted exchange. The returned
+   // vector may change in the next call, but its data stays valid until the
+   // next exchange.
+   const Vector &FaceNbrData(const Vector &u, int nfields = 1,
+                             FieldLayout l = FieldLayout::SoA);
+
+   // The receive buffer. Its values are valid only after the exchange is
+   // completed, but it can be passed to code that processes interior elements.
+   const Vector &FaceNbrBuffer() const { return face_nbr_data; }
+
+   // All local elements, the first NumInteriorElements() of which don't need
+   // face-neighbor data.
+   const Array<int> &ElementOrder() const { return el_order; }
+   int NumInteriorElements() const { return num_int_elems; }
 };
 
 class Assembly
@@ -151,33 +463,78 @@ private:
    FiniteElementSpace *fes, *SubFes0, *SubFes1;
    Mesh *subcell_mesh;
 
+   // Scratch of the face computations: the face blocks of the assembly, the
+   // differences and corrections of NonlinFluxLumping(), and the differences
+   // of the lumping kernel without a fixed number of face dofs, one slice of
+   // numFaceDofs entries per element.
+   Vector face_B1, face_B2;
+   mutable Vector face_diff, face_corr;
+   Vector lump_diff;
+
+   // Adds the upwind flux term of one quadrature point to the block B of face
+   // BdrID. vn is the normal velocity w.r.t. the element.
+   void AddFluxTerm(double *B, const int BdrID, const Vector &shape,
+                    const double w, const double vn) const;
+
 public:
    Assembly(DofInfo &_dofs, LowOrderMethod &lom, const GridFunction &inflow,
             ParFiniteElementSpace &pfes, ParMesh *submesh, int mode);
 
    // Auxiliary member variables that need to be accessed during time-stepping.
    DofInfo &dofs;
+   HaloExchange halo;
 
    // Data structures storing Galerkin contributions. These are updated for
    // remap but remain constant for transport.
-   // bdrInt - eq (32).
+   // bdrInt - eq (32), numFaceDofs x numFaceDofs blocks of the element faces.
+   //          Only the nonzero blocks are stored; the outflow faces have zero
+   //          blocks by definition.
+   // bdr_block - index of the block of face f of element k in bdrInt, stored
+   //             at k*numBdrs + f, or -1 if the block is zero.
    // SubcellWeights - above eq (49).
-   DenseTensor bdrInt, SubcellWeights;
+   Array<double> bdrInt;
+   Array<int> bdr_block;
+   DenseTensor SubcellWeights;
+
+   // Sets all face blocks to zero, before they're assembled again.
+   void ResetBdrBlocks();
+   // Stores the block B of face f of element k, if it's nonzero. Each block is
+   // stored at most once between calls of ResetBdrBlocks().
+   void StoreBdrBlock(const int k, const int f, const double *B);
+   // The block of face f of element k on the host, or NULL if it's zero.
+   const double *BdrBlock(const int k, const int f) const
+   {
+      const int b = bdr_block[k*dofs.numBdrs + f];
+      const int nfd = dofs.numFaceDofs;
+      return (b < 0) ? NULL : bdrInt.HostRead() + b * nfd*nfd;
+   }
 
    void ComputeFluxTerms(const int e_id, const int BdrID,
                          FaceElementTransformations *Trans,
                          LowOrderMethod &lom);
+   // Computes the flux terms of both elements adjacent to a face in one pass.
+   // BdrID1 and BdrID2 are the local indices of the face in Trans->Elem1 and
+   // Trans->Elem2; BdrID2 < 0 skips Elem2, e.g., when it's not local.
+   void ComputeFaceFluxTerms(FaceElementTransformations *Trans,
+                             const int BdrID1, const int BdrID2,
+                             LowOrderMethod &lom);
 
    void ComputeSubcellWeights(const int k, const int m);
 
-   void LinearFluxLumping(const int k, const int nd,
-                          const int BdrID, const Vector &x,
-                          Vector &y, const Vector &x_nd,
-                          const Vector &alpha) const;
+   // Adds the lumped face fluxes of all elements to y. alpha = 0 gives the low
+   // order fluxes, alpha = 1 the Galerkin ones. The interior elements are
+   // processed while the face-neighbor values of x are in transit. x and y
+   // can hold nfields fields, stored with the given layout. If elems isn't
+   // NULL, only the faces of these elements are lumped, with the face-neighbor
+   // values of the last exchange.
+   void LinearFluxLumping(const Vector &x, Vector &y, const double alpha,
+                          const int nfields = 1,
+                          FieldLayout layout = FieldLayout::SoA,
+                          const Array<int> *elems = NULL);
    void NonlinFluxLumping(const int k, const int nd,
                           const int BdrID, const Vector &x,
                           Vector &y, const Vector &x_nd,
-                          const Vector &alpha) const;
+                          const double *alpha) const;
 };
 
 // Class for local assembly of M_L M_C^-1 K, where M_L and M_C are the lumped